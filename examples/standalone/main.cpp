@@ -79,13 +79,18 @@ void setup() {
     dispatcher.registerCommand("led", ledCommandHandler);
     
     // Optional: handle non-ESPMole messages
-    mole->setUserCallback([](const char* topic, const uint8_t* payload, size_t len) {
-        Serial.printf("User topic: %s = %.*s\n", topic, (int)len, payload);
-    });
+    // Field diagnostics go to espmole/<device-id>/log ("$log debug" for more)
+    // The callback is a plain function pointer: no captures, state goes in ctx
+    mole->setUserCallback([](const char* topic, const uint8_t* payload, size_t len, void* ctx) {
+        espmole::MqttTransport& self = *static_cast<espmole::MqttTransport*>(ctx);
+        ESPMOLE_LOGI(self, "user topic %s = %.*s", topic, (int)len, payload);
+    }, mole);
     
     // Connect to MQTT broker
     mole->begin();
     
+    ESPMOLE_LOGI(*mole, "boot ip=%s", WiFi.localIP().toString().c_str());
+    
     Serial.println("ESPMole MQTT ready!");
     Serial.printf("Command topic: %s\n", mole->getCommandTopic());
     Serial.printf("Response topic: %s\n", mole->getResponseTopic());
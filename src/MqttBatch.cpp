@@ -0,0 +1,134 @@
+#include "MqttBatch.h"
+
+#include <string.h>
+
+namespace espmole {
+
+OutboundBatch::OutboundBatch() {
+    memset(buf_, 0, sizeof(buf_));
+}
+
+void OutboundBatch::begin(uint32_t intervalMs, Clock clock, void* ctx) {
+    clock_ = clock;
+    clockCtx_ = ctx;
+    interval_ = intervalMs;
+    start_ = now();
+    next_ = start_ + interval_;
+    connected_ = false;
+    connectedSince_ = start_;
+}
+
+bool OutboundBatch::add(uint8_t topic, const uint8_t* data, size_t len, bool urgent) {
+    if (!fits(len)) {
+        return false;
+    }
+
+    uint32_t t = now();
+    if (pending_ == 0 && interval_ > 0 && static_cast<int32_t>(t - next_) >= 0) {
+        // Slots passed with nothing to send - first message waits for the next one
+        uint32_t missed = (t - next_) / interval_ + 1;
+        next_ += missed * interval_;
+    }
+
+    size_t need = RECORD_HEADER + len;
+    if (tail_ + need > CAPACITY && head_ > 0) {
+        memmove(buf_, buf_ + head_, tail_ - head_);
+        tail_ -= head_;
+        head_ = 0;
+    }
+    if (tail_ + need > CAPACITY) {
+        full_ = true;
+        return false;
+    }
+
+    buf_[tail_] = topic;
+    buf_[tail_ + 1] = static_cast<uint8_t>(len >> 8);
+    buf_[tail_ + 2] = static_cast<uint8_t>(len);
+    memcpy(buf_ + tail_ + RECORD_HEADER, data, len);
+    tail_ += need;
+    pending_++;
+
+    if (urgent) urgent_ = true;
+    if (used() >= HIGH_WATER) full_ = true;
+    return true;
+}
+
+bool OutboundBatch::flushDue() const {
+    return pending_ > 0
+        && (urgent_ || full_ || static_cast<int32_t>(now() - next_) >= 0);
+}
+
+uint32_t OutboundBatch::nextFlush() const {
+    uint32_t t = now();
+    if (flushDue()) return t;
+    if (interval_ > 0 && static_cast<int32_t>(t - next_) >= 0) {
+        // Nothing buffered at the last slot - report the upcoming one
+        return next_ + ((t - next_) / interval_ + 1) * interval_;
+    }
+    return next_;
+}
+
+uint32_t OutboundBatch::msUntilFlush() const {
+    return nextFlush() - now();
+}
+
+bool OutboundBatch::peek(uint8_t& topic, const uint8_t*& data, size_t& len) const {
+    if (pending_ == 0) return false;
+    topic = buf_[head_];
+    len = (static_cast<size_t>(buf_[head_ + 1]) << 8) | buf_[head_ + 2];
+    data = buf_ + head_ + RECORD_HEADER;
+    return true;
+}
+
+void OutboundBatch::pop() {
+    if (pending_ == 0) return;
+
+    size_t len = (static_cast<size_t>(buf_[head_ + 1]) << 8) | buf_[head_ + 2];
+    head_ += RECORD_HEADER + len;
+    pending_--;
+    stats_.messages++;
+    stats_.bytes += len;
+
+    if (pending_ > 0) return;
+
+    // Burst complete
+    head_ = 0;
+    tail_ = 0;
+    stats_.bursts++;
+    if (full_) {
+        stats_.fullFlushes++;
+    } else if (urgent_) {
+        stats_.urgentFlushes++;
+    }
+    full_ = false;
+    urgent_ = false;
+    next_ = now() + interval_;
+}
+
+void OutboundBatch::noteConnected(bool connected) {
+    if (connected == connected_) return;
+
+    uint32_t t = now();
+    if (connected_) {
+        stats_.connectedMs += t - connectedSince_;
+    } else {
+        connectedSince_ = t;
+    }
+    connected_ = connected;
+}
+
+BatchStats OutboundBatch::stats() const {
+    BatchStats s = stats_;
+    uint32_t t = now();
+    if (connected_) s.connectedMs += t - connectedSince_;
+    s.elapsedMs = t - start_;
+    return s;
+}
+
+uint32_t OutboundBatch::burstsPerHour() const {
+    uint32_t elapsed = now() - start_;
+    if (elapsed == 0) return 0;
+    return static_cast<uint32_t>(static_cast<uint64_t>(stats_.bursts) * 3600000ULL / elapsed);
+}
+
+} // namespace espmole
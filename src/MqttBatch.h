@@ -0,0 +1,143 @@
+#ifndef ESPMOLE_MQTT_BATCH_H
+#define ESPMOLE_MQTT_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Bytes of outbound traffic held between bursts in duty-cycle mode
+#ifndef ESPMOLE_MQTT_BATCH_BYTES
+#define ESPMOLE_MQTT_BATCH_BYTES 1024
+#endif
+
+namespace espmole {
+
+/// Destination of a batched message
+enum BatchTopic : uint8_t {
+    BATCH_RESPONSE = 0,
+    BATCH_EVENT = 1
+};
+
+/**
+ * Duty-cycle counters. Connected time and bursts per hour are the energy
+ * proxies: the radio is on while connected and wakes once per burst.
+ */
+struct BatchStats {
+    uint32_t bursts = 0;        ///< Times the buffer was emptied
+    uint32_t messages = 0;      ///< Messages sent in bursts
+    uint32_t bytes = 0;         ///< Payload bytes sent in bursts
+    uint32_t fullFlushes = 0;   ///< Bursts forced by a full buffer
+    uint32_t urgentFlushes = 0; ///< Bursts forced by an urgent message
+    uint32_t dropped = 0;       ///< Messages that could not be buffered
+    uint32_t connectedMs = 0;   ///< Time spent connected
+    uint32_t elapsedMs = 0;     ///< Time since begin()
+};
+
+/**
+ * Outbound buffer for duty-cycle mode.
+ *
+ * Messages accumulate in a fixed buffer and go out in one burst when the
+ * flush interval elapses, the buffer is three quarters full, or an urgent
+ * message is added. Between bursts the application can sleep until
+ * nextFlush().
+ *
+ * Time comes from an injectable clock so the schedule and the energy
+ * counters can be tested off-device.
+ */
+class OutboundBatch {
+public:
+    /// Millisecond clock
+    using Clock = uint32_t (*)(void* ctx);
+
+    static constexpr size_t CAPACITY = ESPMOLE_MQTT_BATCH_BYTES;
+    static constexpr size_t RECORD_HEADER = 3;          ///< Topic + 16-bit length
+    static constexpr size_t HIGH_WATER = CAPACITY * 3 / 4;
+
+    OutboundBatch();
+
+    /**
+     * Start the flush schedule.
+     *
+     * @param intervalMs  Time between scheduled bursts
+     * @param clock       Millisecond clock
+     * @param ctx         Context passed to the clock
+     */
+    void begin(uint32_t intervalMs, Clock clock, void* ctx = nullptr);
+
+    /// Current time from the injected clock
+    uint32_t now() const { return clock_ ? clock_(clockCtx_) : 0; }
+
+    /**
+     * Buffer a message.
+     *
+     * @param topic   BatchTopic
+     * @param data    Payload
+     * @param len     Payload length
+     * @param urgent  Flush as soon as possible
+     * @return        false if there is no room (flush, then retry)
+     */
+    bool add(uint8_t topic, const uint8_t* data, size_t len, bool urgent = false);
+
+    /// Count a message that was given up on
+    void noteDropped() { stats_.dropped++; }
+
+    /// true if a message of `len` bytes could ever be buffered
+    static bool fits(size_t len) { return len + RECORD_HEADER <= CAPACITY; }
+
+    /// true if buffered messages should go out now
+    bool flushDue() const;
+
+    /// Time of the next burst (the scheduled time, or now if one is due)
+    uint32_t nextFlush() const;
+
+    /// Milliseconds until nextFlush() (0 if due)
+    uint32_t msUntilFlush() const;
+
+    /**
+     * Oldest buffered message.
+     *
+     * @return  false if the buffer is empty
+     */
+    bool peek(uint8_t& topic, const uint8_t*& data, size_t& len) const;
+
+    /// Drop the message returned by peek() after it was sent
+    void pop();
+
+    /**
+     * Track connection state for the connected-time counter. Call it from
+     * the client's connect and disconnect events; begin() starts out
+     * disconnected.
+     */
+    void noteConnected(bool connected);
+
+    size_t used() const { return tail_ - head_; }
+    size_t pending() const { return pending_; }
+
+    /// Counters up to now()
+    BatchStats stats() const;
+
+    /// Average bursts per hour since begin()
+    uint32_t burstsPerHour() const;
+
+private:
+    uint8_t buf_[CAPACITY];
+    size_t head_ = 0;
+    size_t tail_ = 0;
+    size_t pending_ = 0;
+
+    Clock clock_ = nullptr;
+    void* clockCtx_ = nullptr;
+    uint32_t interval_ = 0;
+    uint32_t start_ = 0;
+    uint32_t next_ = 0;
+    bool urgent_ = false;
+    bool full_ = false;
+
+    bool connected_ = false;
+    uint32_t connectedSince_ = 0;
+
+    BatchStats stats_;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_BATCH_H
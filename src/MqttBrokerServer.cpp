@@ -0,0 +1,147 @@
+#if defined(ESP32) && !defined(NATIVE_BUILD)
+
+#include "MqttBrokerServer.h"
+
+namespace espmole {
+
+MqttBrokerServer::MqttBrokerServer(MicroBroker& broker)
+    : broker_(broker)
+{
+}
+
+MqttBrokerServer::~MqttBrokerServer() {
+    end();
+    if (lock_ != nullptr) {
+        broker_.setLock(nullptr, nullptr);
+        vSemaphoreDelete(lock_);
+    }
+}
+
+bool MqttBrokerServer::begin(uint16_t port) {
+    end();
+
+    if (lock_ == nullptr) {
+        lock_ = xSemaphoreCreateRecursiveMutex();
+        if (lock_ == nullptr) return false;
+    }
+    broker_.setLock(onLock, this);
+    broker_.begin(onSend, onClose, this);
+
+    server_ = new AsyncServer(port);
+    server_->setNoDelay(true);
+    server_->onClient(onClient, this);
+    server_->begin();
+    return true;
+}
+
+void MqttBrokerServer::end() {
+    if (server_ == nullptr) return;
+
+    server_->end();
+    delete server_;
+    server_ = nullptr;
+
+    onLock(true, this);
+    for (size_t i = 0; i < MicroBroker::MAX_CLIENTS; i++) {
+        AsyncClient* c = conns_[i];
+        if (c == nullptr) continue;
+        conns_[i] = nullptr;
+        broker_.closed(static_cast<int>(i));
+        c->close(true);
+    }
+    onLock(false, this);
+}
+
+int MqttBrokerServer::find(AsyncClient* client) const {
+    for (size_t i = 0; i < MicroBroker::MAX_CLIENTS; i++) {
+        if (conns_[i] == client) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// =============================================================================
+// AsyncTCP callbacks (AsyncTCP task)
+// =============================================================================
+
+void MqttBrokerServer::onClient(void* ctx, AsyncClient* client) {
+    MqttBrokerServer* self = static_cast<MqttBrokerServer*>(ctx);
+
+    // Registered first so a refused client is freed as well
+    client->onDisconnect(onDisconnect, self);
+
+    onLock(true, self);
+    int handle = self->broker_.open(millis());
+    if (handle >= 0) {
+        self->conns_[handle] = client;
+        client->setNoDelay(true);
+        client->onData(onData, self);
+    }
+    onLock(false, self);
+
+    if (handle < 0) {
+        client->close(true);
+    }
+}
+
+void MqttBrokerServer::onData(void* ctx, AsyncClient* client, void* data, size_t len) {
+    MqttBrokerServer* self = static_cast<MqttBrokerServer*>(ctx);
+
+    onLock(true, self);
+    int handle = self->find(client);
+    if (handle >= 0) {
+        self->broker_.receive(handle, static_cast<const uint8_t*>(data), len, millis());
+    }
+    onLock(false, self);
+}
+
+void MqttBrokerServer::onDisconnect(void* ctx, AsyncClient* client) {
+    MqttBrokerServer* self = static_cast<MqttBrokerServer*>(ctx);
+
+    onLock(true, self);
+    int handle = self->find(client);
+    if (handle >= 0) {
+        // Lost without DISCONNECT - the broker publishes the will
+        self->conns_[handle] = nullptr;
+        self->broker_.closed(handle);
+    }
+    onLock(false, self);
+
+    delete client;
+}
+
+// =============================================================================
+// MicroBroker callbacks (lock held)
+// =============================================================================
+
+bool MqttBrokerServer::onSend(int client, const uint8_t* data, size_t len, void* ctx) {
+    MqttBrokerServer* self = static_cast<MqttBrokerServer*>(ctx);
+    AsyncClient* c = self->conns_[client];
+
+    // Never queue part of a packet
+    if (c == nullptr || c->space() < len) return false;
+    if (c->add(reinterpret_cast<const char*>(data), len) != len) return false;
+    return c->send();
+}
+
+void MqttBrokerServer::onClose(int client, void* ctx) {
+    MqttBrokerServer* self = static_cast<MqttBrokerServer*>(ctx);
+    AsyncClient* c = self->conns_[client];
+    if (c == nullptr) return;
+
+    // onDisconnect no longer finds it and only frees the object
+    self->conns_[client] = nullptr;
+    c->close(true);
+}
+
+void MqttBrokerServer::onLock(bool lock, void* ctx) {
+    MqttBrokerServer* self = static_cast<MqttBrokerServer*>(ctx);
+    if (lock) {
+        xSemaphoreTakeRecursive(self->lock_, portMAX_DELAY);
+    } else {
+        xSemaphoreGiveRecursive(self->lock_);
+    }
+}
+
+} // namespace espmole
+
+#endif // ESP32 && !NATIVE_BUILD
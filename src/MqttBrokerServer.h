@@ -0,0 +1,70 @@
+#ifndef ESPMOLE_MQTT_BROKER_SERVER_H
+#define ESPMOLE_MQTT_BROKER_SERVER_H
+
+#if defined(ESP32) && !defined(NATIVE_BUILD)
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "MqttMicroBroker.h"
+
+namespace espmole {
+
+/**
+ * AsyncTCP listener that feeds a MicroBroker.
+ *
+ * Connections are accepted and read on the AsyncTCP task while the
+ * transport publishes from loop(); a recursive mutex installed with
+ * MicroBroker::setLock() keeps the two apart.
+ *
+ * @code
+ *   espmole::MicroBroker broker;
+ *   espmole::MqttBrokerServer server(broker);
+ *
+ *   config.broker = nullptr;        // LAN only
+ *   MqttTransport mqtt(&dispatcher, config);
+ *   mqtt.begin();
+ *   mqtt.serveLocal(&broker);
+ *   server.begin(1883);
+ * @endcode
+ */
+class MqttBrokerServer {
+public:
+    explicit MqttBrokerServer(MicroBroker& broker);
+    ~MqttBrokerServer();
+
+    MqttBrokerServer(const MqttBrokerServer&) = delete;
+    MqttBrokerServer& operator=(const MqttBrokerServer&) = delete;
+
+    /**
+     * Start listening.
+     *
+     * @param port  TCP port (1883 = standard MQTT)
+     * @return      false if the mutex could not be created
+     */
+    bool begin(uint16_t port = 1883);
+
+    /// Stop listening and close every client
+    void end();
+
+private:
+    MicroBroker& broker_;
+    AsyncServer* server_ = nullptr;
+    AsyncClient* conns_[MicroBroker::MAX_CLIENTS] = {};
+    SemaphoreHandle_t lock_ = nullptr;
+
+    int find(AsyncClient* client) const;
+
+    static void onClient(void* ctx, AsyncClient* client);
+    static void onData(void* ctx, AsyncClient* client, void* data, size_t len);
+    static void onDisconnect(void* ctx, AsyncClient* client);
+    static bool onSend(int client, const uint8_t* data, size_t len, void* ctx);
+    static void onClose(int client, void* ctx);
+    static void onLock(bool lock, void* ctx);
+};
+
+} // namespace espmole
+
+#endif // ESP32 && !NATIVE_BUILD
+#endif // ESPMOLE_MQTT_BROKER_SERVER_H
@@ -0,0 +1,210 @@
+#ifndef ESPMOLE_MQTT_BUILD_CONFIG_H
+#define ESPMOLE_MQTT_BUILD_CONFIG_H
+
+/**
+ * Compile-time configuration of MqttTransport.
+ *
+ * Set these with build flags, e.g. in platformio.ini:
+ *
+ *   build_flags =
+ *       -D ESPMOLE_MQTT_DEVICE_ID='"kitchen-1"'
+ *       -D ESPMOLE_MQTT_RESPONSE_BUFFER=128
+ *       -D ESPMOLE_MQTT_FEATURE_MAILBOX=0
+ *
+ * Features switched off here are compiled out with their buffers; the
+ * matching MqttConfig fields are then ignored. Runtime MqttConfig stays
+ * the way to turn compiled-in features on and off.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+// -----------------------------------------------------------------------------
+// Buffer sizes
+// -----------------------------------------------------------------------------
+
+/// Topic buffer length (runtime-built topics)
+#ifndef ESPMOLE_MQTT_TOPIC_MAX
+#define ESPMOLE_MQTT_TOPIC_MAX 80
+#endif
+
+/// Device ID buffer length (runtime-built device ID)
+#ifndef ESPMOLE_MQTT_DEVICE_ID_MAX
+#define ESPMOLE_MQTT_DEVICE_ID_MAX 32
+#endif
+
+/// Response / event buffer, also the largest journaled event
+#ifndef ESPMOLE_MQTT_RESPONSE_BUFFER
+#define ESPMOLE_MQTT_RESPONSE_BUFFER 256
+#endif
+
+// -----------------------------------------------------------------------------
+// Feature switches (1 = compiled in)
+// -----------------------------------------------------------------------------
+
+/// Event sequencing, journal and $replay
+#ifndef ESPMOLE_MQTT_FEATURE_JOURNAL
+#define ESPMOLE_MQTT_FEATURE_JOURNAL 1
+#endif
+
+/// Consumer event filter (filter topic)
+#ifndef ESPMOLE_MQTT_FEATURE_FILTER
+#define ESPMOLE_MQTT_FEATURE_FILTER 1
+#endif
+
+/// $sched scheduled and watch queries
+#ifndef ESPMOLE_MQTT_FEATURE_SCHED
+#define ESPMOLE_MQTT_FEATURE_SCHED 1
+#endif
+
+/// Retained command mailbox
+#ifndef ESPMOLE_MQTT_FEATURE_MAILBOX
+#define ESPMOLE_MQTT_FEATURE_MAILBOX 1
+#endif
+
+/// Duty-cycle batching
+#ifndef ESPMOLE_MQTT_FEATURE_BATCH
+#define ESPMOLE_MQTT_FEATURE_BATCH 1
+#endif
+
+/// In-process event bus (subscribeLocal)
+#ifndef ESPMOLE_MQTT_FEATURE_BUS
+#define ESPMOLE_MQTT_FEATURE_BUS 1
+#endif
+
+/// Serving topics from an embedded MicroBroker (serveLocal)
+#ifndef ESPMOLE_MQTT_FEATURE_BROKER
+#define ESPMOLE_MQTT_FEATURE_BROKER 1
+#endif
+
+/// Log stream (log topic, ESPMOLE_LOGx macros, $log)
+#ifndef ESPMOLE_MQTT_FEATURE_LOG
+#define ESPMOLE_MQTT_FEATURE_LOG 1
+#endif
+
+/// Traffic capture hook (setTrace)
+#ifndef ESPMOLE_MQTT_FEATURE_TRACE
+#define ESPMOLE_MQTT_FEATURE_TRACE 1
+#endif
+
+/// Memory accounting and heap sampling ($mem, stats topic)
+#ifndef ESPMOLE_MQTT_FEATURE_MEM
+#define ESPMOLE_MQTT_FEATURE_MEM 1
+#endif
+
+/// $probe round-trip probes
+#ifndef ESPMOLE_MQTT_FEATURE_PROBE
+#define ESPMOLE_MQTT_FEATURE_PROBE 1
+#endif
+
+/// Interactive terminal sessions (term/<session>/in, term/<session>/out)
+#ifndef ESPMOLE_MQTT_FEATURE_TERM
+#define ESPMOLE_MQTT_FEATURE_TERM 1
+#endif
+
+/// Clock sync with a controller ("time?" / "$time") and message timestamps
+#ifndef ESPMOLE_MQTT_FEATURE_TIME
+#define ESPMOLE_MQTT_FEATURE_TIME 1
+#endif
+
+/// Loopback throughput self-test ($selftest, selftest topic)
+#ifndef ESPMOLE_MQTT_FEATURE_SELFTEST
+#define ESPMOLE_MQTT_FEATURE_SELFTEST 1
+#endif
+
+// -----------------------------------------------------------------------------
+// Static topics
+// -----------------------------------------------------------------------------
+
+/// Base topic used when the device ID is fixed at build time
+#ifndef ESPMOLE_MQTT_BASE_TOPIC
+#define ESPMOLE_MQTT_BASE_TOPIC "espmole"
+#endif
+
+/// Defining ESPMOLE_MQTT_DEVICE_ID (a string literal) builds topics at compile time
+#ifdef ESPMOLE_MQTT_DEVICE_ID
+#define ESPMOLE_MQTT_STATIC_TOPICS 1
+#else
+#define ESPMOLE_MQTT_STATIC_TOPICS 0
+#endif
+
+namespace espmole {
+
+/**
+ * NUL-terminated string built at compile time.
+ */
+template <size_t N>
+struct TopicString {
+    char str[N];
+
+    constexpr const char* c_str() const { return str; }
+    static constexpr size_t length() { return N - 1; }
+};
+
+namespace detail {
+
+template <size_t... I> struct Indices {};
+template <size_t N, size_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+/// Character `i` of "<a>/<b>/<c>" (C++11 constexpr: a single expression)
+constexpr char topicChar(const char* a, size_t aLen, const char* b, size_t bLen,
+                         const char* c, size_t cLen, size_t i) {
+    return i < aLen ? a[i]
+         : i == aLen ? '/'
+         : i < aLen + 1 + bLen ? b[i - aLen - 1]
+         : i == aLen + 1 + bLen ? '/'
+         : i < aLen + 2 + bLen + cLen ? c[i - aLen - 2 - bLen]
+         : '\0';
+}
+
+template <size_t A, size_t B, size_t C, size_t... I>
+constexpr TopicString<A + B + C> makeTopic(const char (&a)[A], const char (&b)[B],
+                                           const char (&c)[C], Indices<I...>) {
+    return TopicString<A + B + C>{{topicChar(a, A - 1, b, B - 1, c, C - 1, I)...}};
+}
+
+} // namespace detail
+
+/**
+ * Concatenate "<base>/<device>/<leaf>" at compile time.
+ *
+ * @code
+ *   constexpr auto cmd = makeTopic("espmole", "kitchen-1", "cmd");
+ *   static_assert(cmd.length() == 21, "");
+ * @endcode
+ */
+template <size_t A, size_t B, size_t C>
+constexpr TopicString<A + B + C> makeTopic(const char (&base)[A],
+                                           const char (&device)[B],
+                                           const char (&leaf)[C]) {
+    return detail::makeTopic(base, device, leaf,
+                             typename detail::MakeIndices<A + B + C>::type());
+}
+
+#if ESPMOLE_MQTT_STATIC_TOPICS
+
+/**
+ * Topics for ESPMOLE_MQTT_BASE_TOPIC / ESPMOLE_MQTT_DEVICE_ID, placed in
+ * flash instead of per-instance RAM buffers.
+ */
+struct StaticTopics {
+    static constexpr auto cmd = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "cmd");
+    static constexpr auto resp = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "resp");
+    static constexpr auto status = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "status");
+    static constexpr auto event = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "event");
+    static constexpr auto stats = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "stats");
+    static constexpr auto replay = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "replay");
+    static constexpr auto filter = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "filter");
+    static constexpr auto mailbox = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "mailbox/+");
+    static constexpr auto rtt = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "rtt");
+    static constexpr auto log = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "log");
+    static constexpr auto term = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "term/+/in");
+    static constexpr auto selftest = makeTopic(ESPMOLE_MQTT_BASE_TOPIC, ESPMOLE_MQTT_DEVICE_ID, "selftest");
+};
+
+#endif // ESPMOLE_MQTT_STATIC_TOPICS
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_BUILD_CONFIG_H
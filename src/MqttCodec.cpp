@@ -0,0 +1,375 @@
+#include "MqttCodec.h"
+
+#include <string.h>
+
+namespace espmole {
+namespace mqtt {
+
+// =============================================================================
+// Helpers
+// =============================================================================
+
+namespace {
+
+/// Bounded writer - any overflow makes finish() return 0
+struct Writer {
+    uint8_t* out;
+    size_t cap;
+    size_t pos = 0;
+    bool overflow = false;
+
+    Writer(uint8_t* o, size_t c) : out(o), cap(c) {}
+
+    void byte(uint8_t b) {
+        if (pos >= cap) { overflow = true; return; }
+        out[pos++] = b;
+    }
+    void u16(uint16_t v) {
+        byte(static_cast<uint8_t>(v >> 8));
+        byte(static_cast<uint8_t>(v & 0xFF));
+    }
+    void bytes(const void* data, size_t len) {
+        if (len == 0) return;
+        if (cap - pos < len || pos > cap) { overflow = true; return; }
+        memcpy(out + pos, data, len);
+        pos += len;
+    }
+    void str(const char* s, size_t len) {
+        u16(static_cast<uint16_t>(len));
+        bytes(s, len);
+    }
+    void str(const char* s) { str(s, s ? strlen(s) : 0); }
+
+    /// Fixed header: type/flags byte plus variable-length remaining length
+    void header(uint8_t type, uint8_t flags, size_t remaining) {
+        byte(static_cast<uint8_t>((type << 4) | (flags & 0x0F)));
+        do {
+            uint8_t digit = remaining % 128;
+            remaining /= 128;
+            if (remaining > 0) digit |= 0x80;
+            byte(digit);
+        } while (remaining > 0);
+    }
+
+    size_t finish() const { return overflow ? 0 : pos; }
+};
+
+/// Bounded reader over a packet body
+struct Reader {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool error = false;
+
+    Reader(const uint8_t* p, size_t len) : pos(p), end(p + len) {}
+
+    size_t left() const { return static_cast<size_t>(end - pos); }
+
+    uint8_t byte() {
+        if (pos >= end) { error = true; return 0; }
+        return *pos++;
+    }
+    uint16_t u16() {
+        uint16_t hi = byte();
+        uint16_t lo = byte();
+        return static_cast<uint16_t>((hi << 8) | lo);
+    }
+    StringView str() {
+        StringView v;
+        size_t len = u16();
+        if (error || left() < len) { error = true; return v; }
+        v.data = reinterpret_cast<const char*>(pos);
+        v.len = len;
+        pos += len;
+        return v;
+    }
+};
+
+} // namespace
+
+bool StringView::equals(const char* s) const {
+    size_t n = strlen(s);
+    return n == len && (len == 0 || memcmp(data, s, len) == 0);
+}
+
+// =============================================================================
+// Framing
+// =============================================================================
+
+int parse(const uint8_t* data, size_t len, Packet& packet) {
+    if (len < 2) return 0;
+
+    size_t remaining = 0;
+    size_t multiplier = 1;
+    size_t i = 1;
+    for (;;) {
+        if (i >= len) return 0;
+        if (i > 4) return -1;  // Remaining length uses at most 4 bytes
+        uint8_t digit = data[i++];
+        remaining += (digit & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((digit & 0x80) == 0) break;
+    }
+
+    if (remaining > MAX_REMAINING_LENGTH) return -1;
+    if (len - i < remaining) return 0;
+
+    packet.type = data[0] >> 4;
+    packet.flags = data[0] & 0x0F;
+    packet.body = data + i;
+    packet.len = remaining;
+
+    if (packet.type < CONNECT || packet.type > DISCONNECT) return -1;
+    return static_cast<int>(i + remaining);
+}
+
+// =============================================================================
+// Encoders
+// =============================================================================
+
+size_t encodeConnect(uint8_t* out, size_t cap, const ConnectOptions& o) {
+    bool hasWill = o.willTopic != nullptr;
+    size_t remaining = 10 + 2 + strlen(o.clientId);
+    if (hasWill) remaining += 2 + strlen(o.willTopic) + 2 + o.willLen;
+    if (o.username) remaining += 2 + strlen(o.username);
+    if (o.password) remaining += 2 + strlen(o.password);
+
+    uint8_t flags = 0;
+    if (o.cleanSession) flags |= 0x02;
+    if (hasWill) {
+        flags |= 0x04;
+        flags |= static_cast<uint8_t>((o.willQos & 0x03) << 3);
+        if (o.willRetain) flags |= 0x20;
+    }
+    if (o.password) flags |= 0x40;
+    if (o.username) flags |= 0x80;
+
+    Writer w(out, cap);
+    w.header(CONNECT, 0, remaining);
+    w.str("MQTT");
+    w.byte(4);  // Protocol level 3.1.1
+    w.byte(flags);
+    w.u16(o.keepAlive);
+    w.str(o.clientId);
+    if (hasWill) {
+        w.str(o.willTopic);
+        w.u16(static_cast<uint16_t>(o.willLen));
+        w.bytes(o.willPayload, o.willLen);
+    }
+    if (o.username) w.str(o.username);
+    if (o.password) w.str(o.password);
+    return w.finish();
+}
+
+size_t encodeConnack(uint8_t* out, size_t cap, bool sessionPresent, uint8_t code) {
+    Writer w(out, cap);
+    w.header(CONNACK, 0, 2);
+    w.byte(sessionPresent ? 1 : 0);
+    w.byte(code);
+    return w.finish();
+}
+
+size_t encodePublish(uint8_t* out, size_t cap, const char* topic, size_t topicLen,
+                     const uint8_t* payload, size_t len,
+                     uint8_t qos, bool retain, uint16_t packetId, bool dup) {
+    size_t remaining = 2 + topicLen + len + (qos > 0 ? 2 : 0);
+    uint8_t flags = static_cast<uint8_t>((qos & 0x03) << 1);
+    if (retain) flags |= 0x01;
+    if (dup) flags |= 0x08;
+
+    Writer w(out, cap);
+    w.header(PUBLISH, flags, remaining);
+    w.str(topic, topicLen);
+    if (qos > 0) w.u16(packetId);
+    w.bytes(payload, len);
+    return w.finish();
+}
+
+size_t encodeSubscribe(uint8_t* out, size_t cap, uint16_t packetId,
+                       const char* filter, uint8_t qos) {
+    size_t remaining = 2 + 2 + strlen(filter) + 1;
+    Writer w(out, cap);
+    w.header(SUBSCRIBE, 0x02, remaining);
+    w.u16(packetId);
+    w.str(filter);
+    w.byte(qos & 0x03);
+    return w.finish();
+}
+
+size_t encodeSuback(uint8_t* out, size_t cap, uint16_t packetId,
+                    const uint8_t* codes, size_t count) {
+    Writer w(out, cap);
+    w.header(SUBACK, 0, 2 + count);
+    w.u16(packetId);
+    w.bytes(codes, count);
+    return w.finish();
+}
+
+size_t encodeUnsubscribe(uint8_t* out, size_t cap, uint16_t packetId, const char* filter) {
+    Writer w(out, cap);
+    w.header(UNSUBSCRIBE, 0x02, 2 + 2 + strlen(filter));
+    w.u16(packetId);
+    w.str(filter);
+    return w.finish();
+}
+
+size_t encodeAck(uint8_t* out, size_t cap, PacketType type, uint16_t packetId) {
+    Writer w(out, cap);
+    w.header(type, type == PUBREL ? 0x02 : 0, 2);
+    w.u16(packetId);
+    return w.finish();
+}
+
+size_t encodeEmpty(uint8_t* out, size_t cap, PacketType type) {
+    Writer w(out, cap);
+    w.header(type, 0, 0);
+    return w.finish();
+}
+
+// =============================================================================
+// Decoders
+// =============================================================================
+
+bool decodeConnect(const Packet& packet, ConnectView& view) {
+    if (packet.type != CONNECT) return false;
+
+    Reader r(packet.body, packet.len);
+    StringView protocol = r.str();
+    view.protocolLevel = r.byte();
+    uint8_t flags = r.byte();
+    view.keepAlive = r.u16();
+    if (r.error) return false;
+    if (!protocol.equals("MQTT") && !protocol.equals("MQIsdp")) return false;
+    if (flags & 0x01) return false;  // Reserved bit must be 0
+
+    view.cleanSession = (flags & 0x02) != 0;
+    view.clientId = r.str();
+
+    view.hasWill = (flags & 0x04) != 0;
+    if (view.hasWill) {
+        view.willQos = (flags >> 3) & 0x03;
+        view.willRetain = (flags & 0x20) != 0;
+        view.willTopic = r.str();
+        view.willPayload = r.str();
+    }
+    if (flags & 0x80) view.username = r.str();
+    if (flags & 0x40) view.password = r.str();
+    return !r.error;
+}
+
+bool decodeConnack(const Packet& packet, bool& sessionPresent, uint8_t& code) {
+    if (packet.type != CONNACK || packet.len != 2) return false;
+    sessionPresent = (packet.body[0] & 0x01) != 0;
+    code = packet.body[1];
+    return true;
+}
+
+bool decodePublish(const Packet& packet, PublishView& view) {
+    if (packet.type != PUBLISH) return false;
+
+    view.qos = (packet.flags >> 1) & 0x03;
+    view.retain = (packet.flags & 0x01) != 0;
+    view.dup = (packet.flags & 0x08) != 0;
+    if (view.qos > 2) return false;
+
+    Reader r(packet.body, packet.len);
+    view.topic = r.str();
+    view.packetId = view.qos > 0 ? r.u16() : 0;
+    if (r.error || view.topic.len == 0) return false;
+
+    view.payload = r.pos;
+    view.len = r.left();
+    return true;
+}
+
+static bool decodeTopicList(const Packet& packet, uint8_t type, TopicListView& view) {
+    if (packet.type != type || packet.flags != 0x02 || packet.len < 2) return false;
+    view.packetId = static_cast<uint16_t>((packet.body[0] << 8) | packet.body[1]);
+    view.pos = packet.body + 2;
+    view.end = packet.body + packet.len;
+    view.withQos = type == SUBSCRIBE;
+    return view.pos < view.end;  // At least one filter is required
+}
+
+bool decodeSubscribe(const Packet& packet, TopicListView& view) {
+    return decodeTopicList(packet, SUBSCRIBE, view);
+}
+
+bool decodeUnsubscribe(const Packet& packet, TopicListView& view) {
+    return decodeTopicList(packet, UNSUBSCRIBE, view);
+}
+
+bool TopicListView::next(StringView& filter, uint8_t& qos) {
+    if (pos >= end) return false;
+
+    Reader r(pos, static_cast<size_t>(end - pos));
+    filter = r.str();
+    qos = withQos ? r.byte() : 0;
+    if (r.error || filter.len == 0 || qos > 2) {
+        pos = end;
+        return false;
+    }
+    pos = r.pos;
+    return true;
+}
+
+bool decodePacketId(const Packet& packet, uint16_t& packetId) {
+    switch (packet.type) {
+        case PUBACK: case PUBREC: case PUBREL: case PUBCOMP:
+        case UNSUBACK:
+            if (packet.len != 2) return false;
+            break;
+        case SUBACK:
+            if (packet.len < 3) return false;
+            break;
+        default:
+            return false;
+    }
+    packetId = static_cast<uint16_t>((packet.body[0] << 8) | packet.body[1]);
+    return true;
+}
+
+// =============================================================================
+// Topic Matching
+// =============================================================================
+
+bool topicMatches(const char* filter, size_t filterLen, const char* topic, size_t topicLen) {
+    if (topicLen > 0 && topic[0] == '$' && filterLen > 0
+        && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+
+    size_t f = 0;
+    size_t t = 0;
+    while (f < filterLen) {
+        if (filter[f] == '#') {
+            // Matches the parent level too ("a/#" matches "a")
+            return true;
+        }
+        if (filter[f] == '+') {
+            while (t < topicLen && topic[t] != '/') t++;
+            f++;
+        } else {
+            // Literal level - compare up to the next separator
+            while (f < filterLen && filter[f] != '/') {
+                if (t >= topicLen || topic[t] != filter[f]) return false;
+                f++;
+                t++;
+            }
+            if (t < topicLen && topic[t] != '/') return false;
+        }
+
+        if (f == filterLen) return t == topicLen;
+
+        // filter[f] == '/'
+        f++;
+        if (t == topicLen) {
+            // Topic ended - only a trailing "#" can still match
+            return f + 1 == filterLen && filter[f] == '#';
+        }
+        t++;  // Skip topic '/'
+    }
+    return t == topicLen;
+}
+
+} // namespace mqtt
+} // namespace espmole
@@ -0,0 +1,159 @@
+#ifndef ESPMOLE_MQTT_CODEC_H
+#define ESPMOLE_MQTT_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+namespace mqtt {
+
+/**
+ * Minimal MQTT 3.1.1 packet codec.
+ *
+ * Encoders write a complete packet into a caller buffer and return its
+ * length, or 0 if it does not fit. Decoders return views into the packet
+ * buffer - strings are NOT NUL-terminated.
+ *
+ * Used by the host-side tools and the embedded broker; the device's
+ * MQTT client is still AsyncMqttClient / PubSubClient.
+ *
+ * Platform independent.
+ */
+
+enum PacketType : uint8_t {
+    CONNECT = 1,
+    CONNACK = 2,
+    PUBLISH = 3,
+    PUBACK = 4,
+    PUBREC = 5,
+    PUBREL = 6,
+    PUBCOMP = 7,
+    SUBSCRIBE = 8,
+    SUBACK = 9,
+    UNSUBSCRIBE = 10,
+    UNSUBACK = 11,
+    PINGREQ = 12,
+    PINGRESP = 13,
+    DISCONNECT = 14
+};
+
+/// CONNACK return codes
+enum ConnackCode : uint8_t {
+    CONNACK_ACCEPTED = 0,
+    CONNACK_BAD_PROTOCOL = 1,
+    CONNACK_ID_REJECTED = 2,
+    CONNACK_UNAVAILABLE = 3,
+    CONNACK_BAD_CREDENTIALS = 4,
+    CONNACK_NOT_AUTHORIZED = 5
+};
+
+/// Length-delimited string inside a packet
+struct StringView {
+    const char* data = nullptr;
+    size_t len = 0;
+
+    bool equals(const char* s) const;
+};
+
+/// One complete packet as framed by parse()
+struct Packet {
+    uint8_t type = 0;
+    uint8_t flags = 0;              ///< Low nibble of the fixed header
+    const uint8_t* body = nullptr;  ///< Variable header + payload
+    size_t len = 0;
+};
+
+struct ConnectOptions {
+    const char* clientId = "";
+    const char* username = nullptr;
+    const char* password = nullptr;
+    const char* willTopic = nullptr;
+    const uint8_t* willPayload = nullptr;
+    size_t willLen = 0;
+    uint8_t willQos = 0;
+    bool willRetain = false;
+    uint16_t keepAlive = 15;        ///< Seconds
+    bool cleanSession = true;
+};
+
+struct ConnectView {
+    uint8_t protocolLevel = 0;
+    bool cleanSession = true;
+    uint16_t keepAlive = 0;
+    StringView clientId;
+    StringView username;
+    StringView password;
+    bool hasWill = false;
+    StringView willTopic;
+    StringView willPayload;
+    uint8_t willQos = 0;
+    bool willRetain = false;
+};
+
+struct PublishView {
+    StringView topic;
+    const uint8_t* payload = nullptr;
+    size_t len = 0;
+    uint8_t qos = 0;
+    bool retain = false;
+    bool dup = false;
+    uint16_t packetId = 0;          ///< 0 for QoS 0
+};
+
+/// Iterates topic filters of a SUBSCRIBE or UNSUBSCRIBE packet
+struct TopicListView {
+    uint16_t packetId = 0;
+    const uint8_t* pos = nullptr;
+    const uint8_t* end = nullptr;
+    bool withQos = true;            ///< SUBSCRIBE carries a QoS byte per filter
+
+    /// Fetch the next filter; false when done or malformed
+    bool next(StringView& filter, uint8_t& qos);
+};
+
+/// Largest remaining length the codec accepts (keeps packets in small buffers)
+constexpr size_t MAX_REMAINING_LENGTH = 64 * 1024;
+
+/**
+ * Frame one packet from the start of `data`.
+ *
+ * @return  Bytes the packet occupies (> 0), 0 if more data is needed,
+ *          or -1 if the data is malformed
+ */
+int parse(const uint8_t* data, size_t len, Packet& packet);
+
+// Encoders - return packet length, 0 if `cap` is too small
+size_t encodeConnect(uint8_t* out, size_t cap, const ConnectOptions& options);
+size_t encodeConnack(uint8_t* out, size_t cap, bool sessionPresent, uint8_t code);
+size_t encodePublish(uint8_t* out, size_t cap, const char* topic, size_t topicLen,
+                     const uint8_t* payload, size_t len,
+                     uint8_t qos, bool retain, uint16_t packetId, bool dup = false);
+size_t encodeSubscribe(uint8_t* out, size_t cap, uint16_t packetId,
+                       const char* filter, uint8_t qos);
+size_t encodeSuback(uint8_t* out, size_t cap, uint16_t packetId,
+                    const uint8_t* codes, size_t count);
+size_t encodeUnsubscribe(uint8_t* out, size_t cap, uint16_t packetId, const char* filter);
+/// PUBACK, PUBREC, PUBREL, PUBCOMP, UNSUBACK
+size_t encodeAck(uint8_t* out, size_t cap, PacketType type, uint16_t packetId);
+/// PINGREQ, PINGRESP, DISCONNECT
+size_t encodeEmpty(uint8_t* out, size_t cap, PacketType type);
+
+// Decoders - return false if the packet is malformed or of another type
+bool decodeConnect(const Packet& packet, ConnectView& view);
+bool decodeConnack(const Packet& packet, bool& sessionPresent, uint8_t& code);
+bool decodePublish(const Packet& packet, PublishView& view);
+bool decodeSubscribe(const Packet& packet, TopicListView& view);
+bool decodeUnsubscribe(const Packet& packet, TopicListView& view);
+/// Packet ID of PUBACK/PUBREC/PUBREL/PUBCOMP/SUBACK/UNSUBACK
+bool decodePacketId(const Packet& packet, uint16_t& packetId);
+
+/**
+ * Match a topic against a subscription filter with `+` and `#` wildcards.
+ * Topics starting with `$` never match a filter starting with a wildcard.
+ */
+bool topicMatches(const char* filter, size_t filterLen, const char* topic, size_t topicLen);
+
+} // namespace mqtt
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_CODEC_H
@@ -0,0 +1,88 @@
+#include "MqttEventBus.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+/// Same type word rule as EventFilter
+bool isTypeEnd(uint8_t c) {
+    return c == ' ' || c == ':' || c == '\t' || c == '\r' || c == '\n';
+}
+
+} // namespace
+
+LocalEventBus::LocalEventBus() {
+    memset(subs_, 0, sizeof(subs_));
+}
+
+int LocalEventBus::subscribe(LocalEventHandler handler, void* ctx, const char* type,
+                             uint8_t minSeverity, BusPolicy policy) {
+    if (handler == nullptr) return -1;
+
+    size_t typeLen = type ? strlen(type) : 0;
+    if (typeLen > TYPE_MAX) return -1;
+
+    for (size_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber& s = subs_[i];
+        if (s.handler != nullptr) continue;
+
+        s.handler = handler;
+        s.ctx = ctx;
+        memcpy(s.type, type ? type : "", typeLen);
+        s.type[typeLen] = '\0';
+        s.typeLen = static_cast<uint8_t>(typeLen);
+        s.minSeverity = minSeverity;
+        s.policy = policy;
+        count_++;
+        return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void LocalEventBus::unsubscribe(int id) {
+    if (id < 0 || static_cast<size_t>(id) >= MAX_SUBSCRIBERS) return;
+    if (subs_[id].handler == nullptr) return;
+    subs_[id].handler = nullptr;
+    count_--;
+}
+
+bool LocalEventBus::publish(const uint8_t* data, size_t len, uint8_t severity) {
+    // Nested broadcasts from a handler go to the network only
+    if (count_ == 0 || dispatching_) return false;
+
+    stats_.events++;
+    dispatching_ = true;
+
+    bool consumed = false;
+    for (size_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+        const Subscriber& s = subs_[i];
+        if (s.handler == nullptr || !matches(s, data, len, severity)) continue;
+
+        // Copy what is needed after the call - the handler may unsubscribe
+        BusPolicy policy = s.policy;
+        bool keep = s.handler(data, len, severity, s.ctx);
+        stats_.deliveries++;
+
+        if (policy == BUS_CONSUME || (policy == BUS_HANDLER && keep)) {
+            consumed = true;
+        }
+    }
+
+    dispatching_ = false;
+    if (consumed) stats_.consumed++;
+    return consumed;
+}
+
+bool LocalEventBus::matches(const Subscriber& s, const uint8_t* data, size_t len,
+                            uint8_t severity) {
+    if (severity < s.minSeverity) return false;
+    if (s.typeLen == 0) return true;
+
+    // Whole type word must match
+    if (len < s.typeLen || memcmp(data, s.type, s.typeLen) != 0) return false;
+    return len == s.typeLen || isTypeEnd(data[s.typeLen]);
+}
+
+} // namespace espmole
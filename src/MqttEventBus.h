@@ -0,0 +1,110 @@
+#ifndef ESPMOLE_MQTT_EVENT_BUS_H
+#define ESPMOLE_MQTT_EVENT_BUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Local event subscribers (display, rule engine, logger, ...)
+#ifndef ESPMOLE_MQTT_BUS_SUBSCRIBERS
+#define ESPMOLE_MQTT_BUS_SUBSCRIBERS 4
+#endif
+
+namespace espmole {
+
+/**
+ * Local event handler.
+ *
+ * `data` is the buffer passed to broadcast() - valid during the call only,
+ * never copied.
+ *
+ * @return  true to keep the event off the network (BUS_HANDLER policy)
+ */
+using LocalEventHandler = bool (*)(const uint8_t* data, size_t len,
+                                   uint8_t severity, void* ctx);
+
+/// What a matching subscriber means for the MQTT publish
+enum BusPolicy : uint8_t {
+    BUS_OBSERVE = 0,    ///< Publish to the network as well
+    BUS_CONSUME = 1,    ///< Keep the event on the device
+    BUS_HANDLER = 2     ///< The handler's return value decides
+};
+
+/**
+ * Counters for local delivery.
+ */
+struct BusStats {
+    uint32_t events = 0;        ///< Events offered to the bus
+    uint32_t deliveries = 0;    ///< Handler calls
+    uint32_t consumed = 0;      ///< Events kept off the network
+};
+
+/**
+ * In-process fan-out of device events.
+ *
+ * Subscribers register with an optional event type (the first word of the
+ * payload, as in EventFilter) and a minimum severity. publish() hands every
+ * matching subscriber a reference to the caller's buffer, in registration
+ * order, before the event goes to the broker - on-device consumers neither
+ * wait for nor depend on the network.
+ *
+ * Events broadcast from inside a handler skip the bus, so subscribers
+ * cannot loop.
+ *
+ * Platform independent.
+ */
+class LocalEventBus {
+public:
+    static constexpr size_t MAX_SUBSCRIBERS = ESPMOLE_MQTT_BUS_SUBSCRIBERS;
+    static constexpr size_t TYPE_MAX = 24;
+
+    LocalEventBus();
+
+    /**
+     * Register a subscriber.
+     *
+     * @param handler      Called for every matching event
+     * @param ctx          Passed to the handler
+     * @param type         Event type to match (nullptr = all types)
+     * @param minSeverity  Lowest severity delivered
+     * @param policy       Effect on the network publish
+     * @return             Subscriber ID, -1 if the table is full or the type too long
+     */
+    int subscribe(LocalEventHandler handler, void* ctx, const char* type = nullptr,
+                  uint8_t minSeverity = 0, BusPolicy policy = BUS_OBSERVE);
+
+    /// Remove a subscriber (safe from inside a handler)
+    void unsubscribe(int id);
+
+    /**
+     * Deliver an event to matching subscribers.
+     *
+     * @return  true if a subscriber kept the event off the network
+     */
+    bool publish(const uint8_t* data, size_t len, uint8_t severity);
+
+    /// Number of registered subscribers
+    size_t subscribers() const { return count_; }
+
+    const BusStats& stats() const { return stats_; }
+
+private:
+    struct Subscriber {
+        LocalEventHandler handler;  ///< nullptr = free slot
+        void* ctx;
+        char type[TYPE_MAX + 1];    ///< Empty = all types
+        uint8_t typeLen;
+        uint8_t minSeverity;
+        BusPolicy policy;
+    };
+
+    Subscriber subs_[MAX_SUBSCRIBERS];
+    size_t count_ = 0;
+    bool dispatching_ = false;
+    BusStats stats_;
+
+    static bool matches(const Subscriber& s, const uint8_t* data, size_t len, uint8_t severity);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_EVENT_BUS_H
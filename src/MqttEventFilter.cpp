@@ -0,0 +1,181 @@
+#include "MqttEventFilter.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool isTypeEnd(uint8_t c) {
+    return c == ' ' || c == ':' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// Parse an unsigned decimal at p, advancing it; returns false if no digits
+bool parseNumber(const char*& p, const char* end, unsigned& value) {
+    const char* start = p;
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + static_cast<unsigned>(*p - '0');
+        if (value > 0xFFFF) return false;
+        p++;
+    }
+    return p != start;
+}
+
+} // namespace
+
+EventFilter::EventFilter() {
+    clear();
+}
+
+void EventFilter::clear() {
+    active_ = false;
+    mask_ = 0;
+    memset(rules_, 0, sizeof(rules_));
+    hasDefault_ = false;
+    memset(&defaultRule_, 0, sizeof(defaultRule_));
+    dropped_ = 0;
+}
+
+bool EventFilter::compile(const uint8_t* spec, size_t len) {
+    clear();
+
+    const char* p = reinterpret_cast<const char*>(spec);
+    const char* end = p + len;
+
+    while (p < end) {
+        const char* comma = p;
+        while (comma < end && *comma != ',') comma++;
+
+        // Trim the rule
+        const char* a = p;
+        const char* b = comma;
+        while (a < b && isSpace(*a)) a++;
+        while (b > a && isSpace(b[-1])) b--;
+
+        if (a < b && !parseRule(a, static_cast<size_t>(b - a))) {
+            clear();
+            return false;
+        }
+        p = comma + 1;
+    }
+
+    active_ = mask_ != 0 || hasDefault_;
+    return true;
+}
+
+bool EventFilter::parseRule(const char* p, size_t len) {
+    const char* end = p + len;
+
+    const char* type = p;
+    while (p < end && *p != '>' && *p != '/' && !isSpace(*p)) p++;
+    size_t typeLen = static_cast<size_t>(p - type);
+    if (typeLen == 0 || typeLen > TYPE_MAX) return false;
+
+    Rule rule;
+    rule.tag = 0;
+    rule.minSeverity = 0;
+    rule.sample = 1;
+    rule.counter = 0;
+
+    while (p < end) {
+        while (p < end && isSpace(*p)) p++;
+        if (p >= end) break;
+
+        unsigned value = 0;
+        if (*p == '>' && p + 1 < end && p[1] == '=') {
+            p += 2;
+            if (!parseNumber(p, end, value) || value > 7) return false;
+            rule.minSeverity = static_cast<uint8_t>(value);
+        } else if (*p == '/') {
+            p++;
+            if (!parseNumber(p, end, value) || value < 1 || value > 255) return false;
+            rule.sample = static_cast<uint8_t>(value);
+        } else {
+            return false;
+        }
+    }
+
+    if (typeLen == 1 && type[0] == '*') {
+        defaultRule_ = rule;
+        hasDefault_ = true;
+    } else {
+        rule.tag = typeHash(reinterpret_cast<const uint8_t*>(type), typeLen);
+        Rule* r = find(rule.tag);
+        if (r) {
+            // Type listed twice - keep the more permissive rule
+            if (rule.minSeverity < r->minSeverity) r->minSeverity = rule.minSeverity;
+            if (rule.sample < r->sample) r->sample = rule.sample;
+            return true;
+        }
+        
+        // Linear probe from the home bucket to the first free one
+        size_t bucket = (rule.tag ^ (rule.tag >> 16)) % BUCKETS;
+        for (size_t i = 0; i < BUCKETS; i++, bucket = (bucket + 1) % BUCKETS) {
+            if (!(mask_ & (1ULL << bucket))) {
+                rules_[bucket] = rule;
+                mask_ |= 1ULL << bucket;
+                return true;
+            }
+        }
+        return false;   // Table full
+    }
+    return true;
+}
+
+EventFilter::Rule* EventFilter::find(uint32_t tag) {
+    // A free bucket ends the probe - nothing is ever removed, only cleared
+    size_t bucket = (tag ^ (tag >> 16)) % BUCKETS;
+    for (size_t i = 0; i < BUCKETS; i++, bucket = (bucket + 1) % BUCKETS) {
+        if (!(mask_ & (1ULL << bucket))) return nullptr;
+        if (rules_[bucket].tag == tag) return &rules_[bucket];
+    }
+    return nullptr;
+}
+
+bool EventFilter::accept(const uint8_t* data, size_t len, uint8_t severity) {
+    if (!active_) return true;
+
+    Rule* rule = find(typeHash(data, len));
+    bool ok;
+    if (rule) {
+        ok = pass(*rule, severity);
+    } else if (hasDefault_) {
+        ok = pass(defaultRule_, severity);
+    } else {
+        ok = false;
+    }
+
+    if (!ok) dropped_++;
+    return ok;
+}
+
+bool EventFilter::pass(Rule& rule, uint8_t severity) {
+    if (severity < rule.minSeverity) return false;
+    if (rule.sample <= 1) return true;
+
+    // Let the first of every N matching events through
+    bool take = rule.counter == 0;
+    rule.counter = static_cast<uint8_t>((rule.counter + 1) % rule.sample);
+    return take;
+}
+
+uint32_t EventFilter::typeHash(const uint8_t* data, size_t len) {
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < len && i < TYPE_MAX && !isTypeEnd(data[i]); i++) {
+        h ^= data[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+uint8_t EventFilter::bucketOf(const uint8_t* data, size_t len) {
+    uint32_t h = typeHash(data, len);
+    return static_cast<uint8_t>((h ^ (h >> 16)) % BUCKETS);
+}
+
+} // namespace espmole
@@ -0,0 +1,102 @@
+#ifndef ESPMOLE_MQTT_EVENT_FILTER_H
+#define ESPMOLE_MQTT_EVENT_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+/// Event severity levels used by MqttTransport::broadcastEvent()
+enum EventSeverity : uint8_t {
+    EVENT_DEBUG = 0,
+    EVENT_INFO = 1,             ///< Severity of plain broadcast() events
+    EVENT_WARNING = 2,
+    EVENT_ERROR = 3,
+    EVENT_CRITICAL = 4
+};
+
+/**
+ * Compiled consumer interest for outgoing events.
+ *
+ * The event type is the first word of the payload (up to a space or ':').
+ * A filter spec is a comma separated list of rules:
+ *
+ *     <type|*>[>=<severity>][/<N>]
+ *
+ * - `type`      event type the rule applies to, `*` for all other types
+ * - `>=sev`     minimum severity (0..7) to pass, default 0
+ * - `/N`        pass only every Nth matching event (1..255), default 1
+ *
+ * Example: `motion, temp>=2/10, *>=3`
+ *
+ * Types without a rule and no `*` rule are dropped. An empty spec passes
+ * everything. Rules sit in a BUCKETS-entry open-addressed table keyed by
+ * the type's 32-bit hash, which each entry stores: types that land in the
+ * same bucket keep their own rules, and an unlisted type never picks up a
+ * listed type's rule through a bucket collision. At most BUCKETS types can
+ * be listed.
+ *
+ * accept() costs one hash of the type word plus a table lookup (a short
+ * probe when buckets collide).
+ *
+ * Platform independent.
+ */
+class EventFilter {
+public:
+    static constexpr size_t BUCKETS = 64;
+    static constexpr size_t TYPE_MAX = 24;
+
+    EventFilter();
+
+    /**
+     * Replace the filter with a compiled spec.
+     * On a syntax error the filter is cleared (everything passes).
+     *
+     * @return  false if the spec could not be parsed
+     */
+    bool compile(const uint8_t* spec, size_t len);
+
+    /// Remove the filter - every event passes
+    void clear();
+
+    /// true if a filter is installed
+    bool active() const { return active_; }
+
+    /**
+     * Decide whether an event goes out.
+     * Updates the sampling counters, so call once per event.
+     */
+    bool accept(const uint8_t* data, size_t len, uint8_t severity);
+
+    /// Events dropped since the last compile()
+    uint32_t dropped() const { return dropped_; }
+
+    /// Hash of the type word at the start of an event payload
+    static uint32_t typeHash(const uint8_t* data, size_t len);
+
+    /// Home bucket of the type word at the start of an event payload
+    static uint8_t bucketOf(const uint8_t* data, size_t len);
+
+private:
+    struct Rule {
+        uint32_t tag;           ///< typeHash() of the rule's type
+        uint8_t minSeverity;
+        uint8_t sample;         ///< 1 = every event
+        uint8_t counter;
+    };
+
+    bool active_ = false;
+    uint64_t mask_ = 0;         ///< Buckets holding a rule
+    Rule rules_[BUCKETS];
+    bool hasDefault_ = false;   ///< `*` rule present
+    Rule defaultRule_;
+    uint32_t dropped_ = 0;
+
+    bool parseRule(const char* p, size_t len);
+    Rule* find(uint32_t tag);
+    bool pass(Rule& rule, uint8_t severity);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_EVENT_FILTER_H
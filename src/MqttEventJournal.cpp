@@ -0,0 +1,103 @@
+#include "MqttEventJournal.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+constexpr size_t LEN_BYTES = 2;
+}
+
+EventJournal::EventJournal() {
+    memset(ring_, 0, sizeof(ring_));
+}
+
+uint32_t EventJournal::append(const uint8_t* data, size_t len) {
+    uint32_t seq = nextSeq_++;
+    size_t need = LEN_BYTES + len;
+
+    if (need > CAPACITY || len > 0xFFFF) {
+        // Cannot be stored - everything before it is now unreachable by
+        // sequence, so start over after this event
+        clear();
+        return seq;
+    }
+
+    while (CAPACITY - used_ < need) {
+        evictOldest();
+    }
+
+    ring_[head_] = static_cast<uint8_t>(len & 0xFF);
+    ring_[advance(head_, 1)] = static_cast<uint8_t>(len >> 8);
+    size_t pos = advance(head_, LEN_BYTES);
+
+    if (len > 0) {
+        size_t first = len;
+        if (first > CAPACITY - pos) first = CAPACITY - pos;
+        memcpy(ring_ + pos, data, first);
+        memcpy(ring_, data + first, len - first);
+    }
+
+    head_ = advance(pos, len);
+    used_ += need;
+    return seq;
+}
+
+bool EventJournal::seek(uint32_t seq, Cursor& cursor) const {
+    if (count() == 0 || seqAfterOrEqual(seq, nextSeq_)) {
+        return false;
+    }
+
+    cursor.seq = firstSeq_;
+    cursor.offset = tail_;
+    while (!seqAfterOrEqual(cursor.seq, seq)) {
+        cursor.offset = advance(cursor.offset, LEN_BYTES + lengthAt(cursor.offset));
+        cursor.seq++;
+    }
+    return true;
+}
+
+bool EventJournal::read(Cursor& cursor, uint8_t* out, size_t cap, size_t& len) const {
+    if (!valid(cursor)) {
+        len = 0;
+        return false;
+    }
+
+    len = lengthAt(cursor.offset);
+    if (len > cap) {
+        return false;
+    }
+
+    copyOut(advance(cursor.offset, LEN_BYTES), out, len);
+    cursor.offset = advance(cursor.offset, LEN_BYTES + len);
+    cursor.seq++;
+    return true;
+}
+
+void EventJournal::clear() {
+    head_ = 0;
+    tail_ = 0;
+    used_ = 0;
+    firstSeq_ = nextSeq_;
+}
+
+void EventJournal::evictOldest() {
+    size_t len = lengthAt(tail_);
+    tail_ = advance(tail_, LEN_BYTES + len);
+    used_ -= LEN_BYTES + len;
+    firstSeq_++;
+}
+
+size_t EventJournal::lengthAt(size_t offset) const {
+    return static_cast<size_t>(ring_[offset])
+         | (static_cast<size_t>(ring_[advance(offset, 1)]) << 8);
+}
+
+void EventJournal::copyOut(size_t offset, uint8_t* out, size_t len) const {
+    size_t first = len;
+    if (first > CAPACITY - offset) first = CAPACITY - offset;
+    memcpy(out, ring_ + offset, first);
+    memcpy(out + first, ring_, len - first);
+}
+
+} // namespace espmole
@@ -0,0 +1,107 @@
+#ifndef ESPMOLE_MQTT_EVENT_JOURNAL_H
+#define ESPMOLE_MQTT_EVENT_JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Bytes reserved for the event journal ring (2 bytes overhead per event)
+#ifndef ESPMOLE_MQTT_JOURNAL_BYTES
+#define ESPMOLE_MQTT_JOURNAL_BYTES 1024
+#endif
+
+namespace espmole {
+
+/**
+ * Ring of the most recent events, addressed by sequence number.
+ *
+ * Sequence numbers are assigned by append() and are consecutive, so the
+ * ring only stores a 2-byte length in front of each payload. When space
+ * runs out the oldest events are evicted.
+ *
+ * Platform independent.
+ */
+class EventJournal {
+public:
+    static constexpr size_t CAPACITY = ESPMOLE_MQTT_JOURNAL_BYTES;
+
+    /**
+     * Read position for streaming events out of the journal.
+     * Stays valid as long as `seq` has not been evicted.
+     */
+    struct Cursor {
+        uint32_t seq = 0;       ///< Next sequence number to read
+        size_t offset = 0;      ///< Ring offset of that event
+    };
+
+    EventJournal();
+
+    /**
+     * Assign the next sequence number to an event and store it.
+     * Events larger than the ring get a sequence number but cannot be
+     * replayed.
+     *
+     * @return  Sequence number of the event (starts at 1)
+     */
+    uint32_t append(const uint8_t* data, size_t len);
+
+    /// Sequence number that the next append() will assign
+    uint32_t nextSeq() const { return nextSeq_; }
+
+    /// Oldest sequence number still stored (== nextSeq() when empty)
+    uint32_t firstSeq() const { return firstSeq_; }
+
+    /// Number of events stored
+    size_t count() const { return nextSeq_ - firstSeq_; }
+
+    /// Bytes of the ring in use
+    size_t used() const { return used_; }
+
+    /**
+     * Position a cursor at the first stored event with sequence >= seq.
+     *
+     * @return  false if no stored event qualifies
+     */
+    bool seek(uint32_t seq, Cursor& cursor) const;
+
+    /**
+     * Copy the event under the cursor and advance it.
+     *
+     * @param cursor  Cursor from seek(); must still be valid()
+     * @param out     Destination buffer
+     * @param cap     Destination capacity
+     * @param len     Receives the event length (even if it did not fit)
+     * @return        false if the cursor is exhausted, evicted, or the event
+     *                does not fit into `cap` (cursor is not advanced then)
+     */
+    bool read(Cursor& cursor, uint8_t* out, size_t cap, size_t& len) const;
+
+    /// true if the cursor still points at a stored event
+    bool valid(const Cursor& cursor) const {
+        return seqAfterOrEqual(cursor.seq, firstSeq_) && cursor.seq != nextSeq_
+            && seqAfterOrEqual(nextSeq_, cursor.seq);
+    }
+
+    /// Drop every stored event (sequence numbering continues)
+    void clear();
+
+private:
+    uint8_t ring_[CAPACITY];
+    size_t head_ = 0;           ///< Write offset
+    size_t tail_ = 0;           ///< Offset of the oldest event
+    size_t used_ = 0;
+    uint32_t firstSeq_ = 1;
+    uint32_t nextSeq_ = 1;
+
+    void evictOldest();
+    size_t lengthAt(size_t offset) const;
+    void copyOut(size_t offset, uint8_t* out, size_t len) const;
+    size_t advance(size_t offset, size_t n) const { return (offset + n) % CAPACITY; }
+
+    static bool seqAfterOrEqual(uint32_t a, uint32_t b) {
+        return static_cast<int32_t>(a - b) >= 0;
+    }
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_EVENT_JOURNAL_H
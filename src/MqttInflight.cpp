@@ -0,0 +1,208 @@
+#include "MqttInflight.h"
+
+#include <string.h>
+
+namespace espmole {
+
+InflightWindow::InflightWindow()
+    : window_(MAX_SLOTS)
+{
+    memset(slots_, 0, sizeof(slots_));
+    memset(early_, 0, sizeof(early_));
+}
+
+void InflightWindow::setWindow(size_t window) {
+    if (window < 1) window = 1;
+    if (window > MAX_SLOTS) window = MAX_SLOTS;
+    window_ = window;
+}
+
+int InflightWindow::reserve(uint32_t now, PublishCompleteCallback cb, void* ctx) {
+    Guard guard(*this);
+    if (!hasRoom()) {
+        stats_.rejected++;
+        return -1;
+    }
+
+    for (size_t i = 0; i < MAX_SLOTS; i++) {
+        Slot& slot = slots_[i];
+        if (!slot.used) {
+            slot.used = true;
+            slot.packetId = 0;
+            slot.sentAt = now;
+            slot.cb = cb;
+            slot.ctx = ctx;
+            count_++;
+            reserved_++;
+            return static_cast<int>(i);
+        }
+    }
+    stats_.rejected++;
+    return -1;
+}
+
+bool InflightWindow::assign(int slot, uint16_t packetId, uint32_t now) {
+    if (slot < 0 || static_cast<size_t>(slot) >= MAX_SLOTS) return false;
+    if (packetId == 0) {
+        cancel(slot);
+        return false;
+    }
+
+    Done done = {};
+    {
+        Guard guard(*this);
+        Slot& s = slots_[slot];
+        if (!s.used || s.packetId != 0) return false;
+        s.packetId = packetId;
+        reserved_--;
+        stats_.tracked++;
+        if (takeEarly(packetId)) {
+            recordLatency(now - s.sentAt);
+            stats_.acked++;
+            done = release(s, true, now);
+        }
+        if (reserved_ == 0) {
+            // Anything left is not ours
+            earlyCount_ = 0;
+        }
+    }
+    notify(&done, 1);
+    return true;
+}
+
+void InflightWindow::cancel(int slot) {
+    if (slot < 0 || static_cast<size_t>(slot) >= MAX_SLOTS) return;
+
+    Guard guard(*this);
+    Slot& s = slots_[slot];
+    if (!s.used || s.packetId != 0) return;
+    s.used = false;
+    s.cb = nullptr;
+    s.ctx = nullptr;
+    count_--;
+    reserved_--;
+    if (reserved_ == 0) {
+        earlyCount_ = 0;
+    }
+}
+
+bool InflightWindow::track(uint16_t packetId, uint32_t now,
+                           PublishCompleteCallback cb, void* ctx) {
+    if (packetId == 0) {
+        return false;
+    }
+    int slot = reserve(now, cb, ctx);
+    return slot >= 0 && assign(slot, packetId, now);
+}
+
+bool InflightWindow::complete(uint16_t packetId, uint32_t now) {
+    if (packetId == 0) return false;
+
+    Done done = {};
+    {
+        Guard guard(*this);
+        size_t i = 0;
+        while (i < MAX_SLOTS && !(slots_[i].used && slots_[i].packetId == packetId)) {
+            i++;
+        }
+        if (i == MAX_SLOTS) {
+            // The client may not have returned this packet ID yet
+            if (reserved_ > 0) {
+                if (earlyCount_ == MAX_SLOTS) {
+                    memmove(early_, early_ + 1, (MAX_SLOTS - 1) * sizeof(early_[0]));
+                    earlyCount_--;
+                }
+                early_[earlyCount_++] = packetId;
+            }
+            return false;
+        }
+        recordLatency(now - slots_[i].sentAt);
+        stats_.acked++;
+        done = release(slots_[i], true, now);
+    }
+    notify(&done, 1);
+    return true;
+}
+
+size_t InflightWindow::expire(uint32_t now, uint32_t timeout) {
+    Done done[MAX_SLOTS];
+    size_t expired = 0;
+    {
+        Guard guard(*this);
+        for (size_t i = 0; i < MAX_SLOTS && count_ > 0; i++) {
+            Slot& slot = slots_[i];
+            if (slot.used && slot.packetId != 0 && now - slot.sentAt >= timeout) {
+                stats_.timedOut++;
+                done[expired++] = release(slot, false, now);
+            }
+        }
+    }
+    notify(done, expired);
+    return expired;
+}
+
+size_t InflightWindow::abortAll(uint32_t now) {
+    Done done[MAX_SLOTS];
+    size_t aborted = 0;
+    {
+        Guard guard(*this);
+        for (size_t i = 0; i < MAX_SLOTS && count_ > 0; i++) {
+            if (slots_[i].used && slots_[i].packetId != 0) {
+                stats_.aborted++;
+                done[aborted++] = release(slots_[i], false, now);
+            }
+        }
+        earlyCount_ = 0;
+    }
+    notify(done, aborted);
+    return aborted;
+}
+
+bool InflightWindow::takeEarly(uint16_t packetId) {
+    for (size_t i = 0; i < earlyCount_; i++) {
+        if (early_[i] == packetId) {
+            early_[i] = early_[--earlyCount_];
+            return true;
+        }
+    }
+    return false;
+}
+
+InflightWindow::Done InflightWindow::release(Slot& slot, bool acked, uint32_t now) {
+    // Free the slot now; the callback runs after the lock is released and
+    // may publish again
+    Done done = {slot.cb, slot.ctx, slot.packetId, acked, now - slot.sentAt};
+
+    slot.used = false;
+    slot.packetId = 0;
+    slot.cb = nullptr;
+    slot.ctx = nullptr;
+    count_--;
+    return done;
+}
+
+void InflightWindow::notify(const Done* done, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (done[i].cb) {
+            done[i].cb(done[i].packetId, done[i].acked, done[i].elapsed, done[i].ctx);
+        }
+    }
+}
+
+void InflightWindow::recordLatency(uint32_t latency) {
+    stats_.lastLatency = latency;
+    if (stats_.acked == 0) {
+        stats_.minLatency = latency;
+        stats_.maxLatency = latency;
+        stats_.avgLatency = latency;
+        return;
+    }
+    if (latency < stats_.minLatency) stats_.minLatency = latency;
+    if (latency > stats_.maxLatency) stats_.maxLatency = latency;
+    // EWMA with 1/8 gain, same smoothing as TCP's SRTT
+    int32_t delta = static_cast<int32_t>(latency - stats_.avgLatency);
+    stats_.avgLatency = static_cast<uint32_t>(
+        static_cast<int32_t>(stats_.avgLatency) + delta / 8);
+}
+
+} // namespace espmole
@@ -0,0 +1,194 @@
+#ifndef ESPMOLE_MQTT_INFLIGHT_H
+#define ESPMOLE_MQTT_INFLIGHT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Upper bound for the QoS 1 in-flight table (MqttConfig::inflightWindow is clamped to it)
+#ifndef ESPMOLE_MQTT_MAX_INFLIGHT
+#define ESPMOLE_MQTT_MAX_INFLIGHT 8
+#endif
+
+namespace espmole {
+
+/**
+ * Completion callback for a tracked QoS 1 publish.
+ *
+ * @param packetId   Packet ID returned by the client for the publish
+ * @param acked      true if PUBACK arrived, false on timeout or disconnect
+ * @param latencyMs  Time from publish to PUBACK (or to failure)
+ * @param ctx        User context passed when the publish was tracked
+ */
+using PublishCompleteCallback = void (*)(uint16_t packetId, bool acked,
+                                         uint32_t latencyMs, void* ctx);
+
+/**
+ * Counters for QoS 1 publishes and their PUBACK latency.
+ */
+struct InflightStats {
+    uint32_t tracked = 0;       ///< QoS 1 publishes handed to the client
+    uint32_t acked = 0;         ///< Publishes completed by PUBACK
+    uint32_t timedOut = 0;      ///< Publishes that got no PUBACK within the timeout
+    uint32_t aborted = 0;       ///< Publishes dropped by a disconnect
+    uint32_t rejected = 0;      ///< Publishes refused because the window was full
+    uint32_t lastLatency = 0;   ///< Most recent PUBACK latency (ms)
+    uint32_t minLatency = 0;    ///< Lowest PUBACK latency seen (ms)
+    uint32_t maxLatency = 0;    ///< Highest PUBACK latency seen (ms)
+    uint32_t avgLatency = 0;    ///< Smoothed PUBACK latency (ms, EWMA 1/8)
+};
+
+/**
+ * Fixed-size table of unacknowledged QoS 1 publishes.
+ *
+ * Entries are keyed by packet ID. The transport refuses new QoS 1
+ * publishes while the table holds `window()` entries, which bounds how
+ * much data sits in the client's outgoing buffer at any time.
+ *
+ * A slot is reserved before the publish is handed to the client and gets
+ * its packet ID afterwards: the PUBACK can arrive on the client's task
+ * before publish() has even returned. Such an early PUBACK is remembered
+ * and completes the publish as soon as its packet ID is assigned.
+ *
+ * PUBACKs arrive on the client's task while publishes and expiry run from
+ * loop(), so install a lock with setLock() on multi-task targets.
+ * Completion callbacks run after the lock is released.
+ *
+ * Platform independent - time is passed in by the caller.
+ */
+class InflightWindow {
+public:
+    static constexpr size_t MAX_SLOTS = ESPMOLE_MQTT_MAX_INFLIGHT;
+
+    /// Lock / unlock for multi-task use (recursive)
+    using LockFn = void (*)(bool lock, void* ctx);
+
+    InflightWindow();
+
+    /// Serialize entry points across tasks
+    void setLock(LockFn lock, void* ctx) {
+        lockFn_ = lock;
+        lockCtx_ = ctx;
+    }
+
+    /**
+     * Set the window size (clamped to 1..MAX_SLOTS).
+     * Shrinking the window does not drop entries already in flight.
+     */
+    void setWindow(size_t window);
+    size_t window() const { return window_; }
+
+    /// Number of publishes awaiting PUBACK
+    size_t inFlight() const { return count_; }
+
+    /// true if another publish fits into the window
+    bool hasRoom() const { return count_ < window_; }
+
+    /**
+     * Reserve a slot for a publish about to be handed to the client.
+     *
+     * @param now       Current time (ms) - latency is measured from here
+     * @param cb        Completion callback (optional)
+     * @param ctx       Context for the callback
+     * @return          Slot for assign() / cancel(), -1 if the window is
+     *                  full (counted as rejected)
+     */
+    int reserve(uint32_t now, PublishCompleteCallback cb = nullptr, void* ctx = nullptr);
+
+    /**
+     * Attach the packet ID the client returned to a reserved slot.
+     * Completes the publish at once if its PUBACK already arrived.
+     *
+     * @return  false if packetId is 0 (the reservation is released)
+     */
+    bool assign(int slot, uint16_t packetId, uint32_t now);
+
+    /// The client refused the publish - release the reservation
+    void cancel(int slot);
+
+    /**
+     * Record a publish that was accepted by the client (reserve + assign).
+     *
+     * @param packetId  Packet ID returned by the client (must be non-zero)
+     * @param now       Current time (ms)
+     * @param cb        Completion callback (optional)
+     * @param ctx       Context for the callback
+     * @return          false if the window is full or packetId is 0
+     */
+    bool track(uint16_t packetId, uint32_t now,
+               PublishCompleteCallback cb = nullptr, void* ctx = nullptr);
+
+    /**
+     * Complete a publish on PUBACK.
+     *
+     * @return  true if the packet ID was in flight (false also for an
+     *          early PUBACK, which completes on assign())
+     */
+    bool complete(uint16_t packetId, uint32_t now);
+
+    /**
+     * Fail every publish older than `timeout`. Reserved slots without a
+     * packet ID are left to their assign() / cancel().
+     *
+     * @return  Number of publishes expired
+     */
+    size_t expire(uint32_t now, uint32_t timeout);
+
+    /**
+     * Fail every publish in flight (connection lost). Reserved slots
+     * without a packet ID are left to their assign() / cancel().
+     *
+     * @return  Number of publishes aborted
+     */
+    size_t abortAll(uint32_t now);
+
+    /// Count a publish refused because the window was full
+    void noteRejected() { stats_.rejected++; }
+
+    const InflightStats& stats() const { return stats_; }
+
+private:
+    struct Slot {
+        bool used;
+        uint16_t packetId;          ///< 0 = reserved, not yet assigned
+        uint32_t sentAt;
+        PublishCompleteCallback cb;
+        void* ctx;
+    };
+
+    /// A completion to report once the lock is released
+    struct Done {
+        PublishCompleteCallback cb;
+        void* ctx;
+        uint16_t packetId;
+        bool acked;
+        uint32_t elapsed;
+    };
+
+    /// RAII helper around the installed lock
+    class Guard {
+    public:
+        explicit Guard(const InflightWindow& w) : w_(w) { if (w_.lockFn_) w_.lockFn_(true, w_.lockCtx_); }
+        ~Guard() { if (w_.lockFn_) w_.lockFn_(false, w_.lockCtx_); }
+    private:
+        const InflightWindow& w_;
+    };
+
+    Slot slots_[MAX_SLOTS];
+    size_t window_;
+    size_t count_ = 0;              ///< Used slots, reserved ones included
+    size_t reserved_ = 0;           ///< Used slots without a packet ID
+    uint16_t early_[MAX_SLOTS];     ///< PUBACKs that beat their assign()
+    size_t earlyCount_ = 0;
+    InflightStats stats_;
+    LockFn lockFn_ = nullptr;
+    void* lockCtx_ = nullptr;
+
+    bool takeEarly(uint16_t packetId);
+    Done release(Slot& slot, bool acked, uint32_t now);
+    void recordLatency(uint32_t latency);
+    static void notify(const Done* done, size_t count);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_INFLIGHT_H
@@ -0,0 +1,156 @@
+#include "MqttLinkMonitor.h"
+
+namespace espmole {
+
+void LinkMonitor::begin(uint16_t keepAlive, uint16_t minKeep, uint16_t maxKeep, bool adaptive) {
+    if (minKeep == 0) minKeep = 1;
+    if (maxKeep < minKeep) maxKeep = minKeep;
+
+    stats_ = LinkStats();
+    stats_.rto = INITIAL_RTO;
+    minKeep_ = minKeep;
+    maxKeep_ = maxKeep;
+    adaptive_ = adaptive;
+
+    if (adaptive_) {
+        if (keepAlive < minKeep_) keepAlive = minKeep_;
+        if (keepAlive > maxKeep_) keepAlive = maxKeep_;
+    }
+    stats_.keepAlive = keepAlive;
+
+    probing_ = false;
+    probeId_ = 0;
+    stable_ = 0;
+    lossStreak_ = 0;
+    reconnect_ = false;
+}
+
+// =============================================================================
+// RTT estimation
+// =============================================================================
+
+void LinkMonitor::noteRtt(uint32_t rtt, uint32_t now) {
+    lastHeard_ = now;
+
+    if (stats_.samples++ == 0) {
+        stats_.srtt = rtt;
+        stats_.rttvar = rtt / 2;
+    } else {
+        // A sample beyond the current RTO is a spike
+        bool spike = rtt > stats_.rto;
+
+        uint32_t err = rtt > stats_.srtt ? rtt - stats_.srtt : stats_.srtt - rtt;
+        stats_.rttvar = stats_.rttvar - stats_.rttvar / 4 + err / 4;
+        int32_t delta = static_cast<int32_t>(rtt - stats_.srtt);
+        stats_.srtt = static_cast<uint32_t>(static_cast<int32_t>(stats_.srtt) + delta / 8);
+
+        if (adaptive_) {
+            if (spike) {
+                stable_ = 0;
+                shrink();
+            } else if (++stable_ >= STABLE_SAMPLES) {
+                stable_ = 0;
+                grow();
+            }
+        }
+    }
+
+    uint32_t rto = stats_.srtt + 4 * stats_.rttvar;
+    if (rto < MIN_RTO) rto = MIN_RTO;
+    if (rto > MAX_RTO) rto = MAX_RTO;
+    stats_.rto = rto;
+
+    lossStreak_ = 0;
+}
+
+// =============================================================================
+// Probes
+// =============================================================================
+
+void LinkMonitor::noteConnected(uint32_t now) {
+    lastHeard_ = now;
+    probing_ = false;
+    probeId_ = 0;
+    lossStreak_ = 0;
+    reconnect_ = false;
+}
+
+bool LinkMonitor::probeDue(uint32_t now) const {
+    if (!adaptive_ || probing_ || reconnect_) return false;
+    return now - lastHeard_ >= stats_.keepAlive * 1000UL / 2;
+}
+
+void LinkMonitor::noteProbeStart(uint32_t now) {
+    probing_ = true;
+    probeId_ = 0;
+    probeSent_ = now;
+    stats_.probes++;
+}
+
+void LinkMonitor::noteProbeSent(uint16_t packetId) {
+    // Already completed by an early PUBACK, or declared lost
+    if (!probing_ || probeId_ != 0) return;
+    if (packetId == 0) {
+        // Never went out
+        probing_ = false;
+        stats_.probes--;
+        return;
+    }
+    probeId_ = packetId;
+}
+
+void LinkMonitor::noteProbeDone(uint16_t packetId, bool acked, uint32_t now) {
+    if (!probing_ || packetId == 0 || (probeId_ != 0 && packetId != probeId_)) return;
+    probing_ = false;
+    probeId_ = 0;
+    if (acked) {
+        lastHeard_ = now;
+    } else {
+        noteLoss();
+    }
+}
+
+void LinkMonitor::check(uint32_t now) {
+    if (probing_ && now - probeSent_ >= stats_.rto) {
+        // A late PUBACK still yields an RTT sample, but the probe is lost.
+        // lastHeard_ stays put, so the next probe goes out right away.
+        probing_ = false;
+        probeId_ = 0;
+        noteLoss();
+    }
+}
+
+void LinkMonitor::noteLoss() {
+    stats_.lost++;
+    stable_ = 0;
+    shrink();
+    if (++lossStreak_ >= LOSS_RECONNECT) {
+        reconnect_ = true;
+    }
+}
+
+void LinkMonitor::noteReconnect() {
+    stats_.reconnects++;
+    reconnect_ = false;
+    lossStreak_ = 0;
+    probing_ = false;
+    probeId_ = 0;
+}
+
+// =============================================================================
+// Keep-alive policy
+// =============================================================================
+
+void LinkMonitor::shrink() {
+    if (!adaptive_) return;
+    uint16_t k = stats_.keepAlive / 2;
+    stats_.keepAlive = k < minKeep_ ? minKeep_ : k;
+}
+
+void LinkMonitor::grow() {
+    uint32_t k = stats_.keepAlive + stats_.keepAlive / 2;
+    if (k == stats_.keepAlive) k++;
+    stats_.keepAlive = static_cast<uint16_t>(k > maxKeep_ ? maxKeep_ : k);
+}
+
+} // namespace espmole
@@ -0,0 +1,114 @@
+#ifndef ESPMOLE_MQTT_LINK_MONITOR_H
+#define ESPMOLE_MQTT_LINK_MONITOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+/**
+ * Round-trip and keep-alive counters.
+ */
+struct LinkStats {
+    uint32_t samples = 0;       ///< RTT samples (PUBACKs of tracked publishes)
+    uint32_t probes = 0;        ///< Probes sent
+    uint32_t lost = 0;          ///< Probes not acknowledged within the RTO
+    uint32_t reconnects = 0;    ///< Early reconnects advised
+    uint32_t srtt = 0;          ///< Smoothed RTT (ms)
+    uint32_t rttvar = 0;        ///< RTT variation (ms)
+    uint32_t rto = 0;           ///< Probe timeout: srtt + 4 * rttvar (ms)
+    uint16_t keepAlive = 0;     ///< Keep-alive for the next connect (s)
+};
+
+/**
+ * Broker round-trip estimator and adaptive keep-alive policy.
+ *
+ * RTT samples are smoothed like TCP (RFC 6298): SRTT with gain 1/8,
+ * RTTVAR with gain 1/4, RTO = SRTT + 4 * RTTVAR. In adaptive mode the
+ * monitor also asks for probes while the link is idle and treats a probe
+ * that is not acknowledged within the RTO as lost:
+ *
+ * - a loss or an RTT spike (sample above the RTO) halves the keep-alive;
+ * - STABLE_SAMPLES clean samples in a row lengthen it by half;
+ * - LOSS_RECONNECT losses in a row advise an early reconnect.
+ *
+ * Probes go out every keepAlive / 2 seconds of silence, so a dead link is
+ * noticed after about that plus the RTO instead of 1.5 keep-alives.
+ *
+ * Platform independent - time is passed in by the caller.
+ */
+class LinkMonitor {
+public:
+    static constexpr uint32_t INITIAL_RTO = 3000;   ///< Before the first sample (ms)
+    static constexpr uint32_t MIN_RTO = 1000;
+    static constexpr uint32_t MAX_RTO = 60000;
+    static constexpr uint8_t STABLE_SAMPLES = 4;
+    static constexpr uint8_t LOSS_RECONNECT = 2;
+
+    /**
+     * @param keepAlive  Initial keep-alive (s)
+     * @param minKeep    Lower bound in adaptive mode (s)
+     * @param maxKeep    Upper bound in adaptive mode (s)
+     * @param adaptive   Probe and adapt; otherwise only measure
+     */
+    void begin(uint16_t keepAlive, uint16_t minKeep, uint16_t maxKeep, bool adaptive);
+
+    /// A tracked publish was acknowledged after `rtt` ms
+    void noteRtt(uint32_t rtt, uint32_t now);
+
+    /// Connection (re)established - forget outstanding probes and losses
+    void noteConnected(uint32_t now);
+
+    /// true if a probe should be sent now
+    bool probeDue(uint32_t now) const;
+
+    /**
+     * A probe is about to be published. Call before publishing: the PUBACK
+     * can complete it before the packet ID is known.
+     */
+    void noteProbeStart(uint32_t now);
+
+    /// The probe went out with this packet ID (0 = the publish failed)
+    void noteProbeSent(uint16_t packetId);
+
+    /**
+     * The probe completed (acked) or failed - failures count as loss.
+     * Before noteProbeSent() any packet ID completes the outstanding probe.
+     */
+    void noteProbeDone(uint16_t packetId, bool acked, uint32_t now);
+
+    /// Declare an outstanding probe lost once it is older than the RTO
+    void check(uint32_t now);
+
+    /// true if the link looks dead and should be reconnected now
+    bool reconnectAdvised() const { return reconnect_; }
+
+    /// The advised reconnect was started
+    void noteReconnect();
+
+    uint16_t keepAlive() const { return stats_.keepAlive; }
+    bool adaptive() const { return adaptive_; }
+    const LinkStats& stats() const { return stats_; }
+
+private:
+    LinkStats stats_;
+    uint16_t minKeep_ = 0;
+    uint16_t maxKeep_ = 0;
+    bool adaptive_ = false;
+
+    uint32_t lastHeard_ = 0;    ///< Last sample or connect
+    bool probing_ = false;      ///< A probe is outstanding
+    uint16_t probeId_ = 0;      ///< Its packet ID, 0 = not known yet
+    uint32_t probeSent_ = 0;
+    uint8_t stable_ = 0;
+    uint8_t lossStreak_ = 0;
+    bool reconnect_ = false;
+
+    void noteLoss();
+    void shrink();
+    void grow();
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_LINK_MONITOR_H
@@ -0,0 +1,207 @@
+#include "MqttLogStream.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+const char LEVEL_CHARS[] = "-EWIDT";
+const char* const LEVEL_NAMES[] = {"off", "error", "warn", "info", "debug", "trace"};
+
+} // namespace
+
+LogStream::LogStream()
+    : head_(0), tail_(0), level_(COMPILED_LEVEL < LOG_INFO ? COMPILED_LEVEL : static_cast<uint8_t>(LOG_INFO)),
+      written_(0), dropped_(0)
+{
+    for (size_t i = 0; i < SLOTS; i++) {
+        slots_[i].seq.store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+    }
+}
+
+void LogStream::setLevel(uint8_t level) {
+    if (level > COMPILED_LEVEL) level = COMPILED_LEVEL;
+    level_.store(level, std::memory_order_relaxed);
+}
+
+// =============================================================================
+// Writers (any task)
+// =============================================================================
+
+void LogStream::log(uint8_t level, const char* fmt, ...) {
+    if (!enabled(level)) return;
+
+    va_list args;
+    va_start(args, fmt);
+    vlog(level, fmt, args);
+    va_end(args);
+}
+
+void LogStream::vlog(uint8_t level, const char* fmt, va_list args) {
+    if (!enabled(level)) return;
+
+    char line[LINE_LEN + 1];
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    if (n < 0) return;
+    write(level, line, static_cast<size_t>(n) < LINE_LEN ? static_cast<size_t>(n) : LINE_LEN);
+}
+
+void LogStream::write(uint8_t level, const char* text, size_t len) {
+    if (!enabled(level)) return;
+
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r')) len--;
+    if (len > LINE_LEN) len = LINE_LEN;
+
+    uint32_t ms = clock_ ? clock_(clockCtx_) : 0;
+    written_.fetch_add(1, std::memory_order_relaxed);
+
+    // Full: evict the oldest line and try again. Other writers may take
+    // the freed slot first, so give up (dropping this line) after a few rounds.
+    for (int attempt = 0; attempt < 4; attempt++) {
+        if (push(level, ms, text, len)) return;
+        if (pop(nullptr, nullptr, nullptr, nullptr)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool LogStream::push(uint8_t level, uint32_t ms, const char* text, size_t len) {
+    uint32_t pos = head_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &slots_[pos & (SLOTS - 1)];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(seq - pos);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false;  // Full
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->ms = ms;
+    slot->level = level;
+    slot->len = static_cast<uint16_t>(len);
+    for (size_t i = 0; i < len; i++) {
+        // One line per log entry in the batch
+        char ch = text[i];
+        slot->text[i] = ch == '\n' || ch == '\r' ? ' ' : ch;
+    }
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool LogStream::pop(uint32_t* ms, uint8_t* level, char* text, uint16_t* len) {
+    uint32_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &slots_[pos & (SLOTS - 1)];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(seq - (pos + 1));
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false;  // Empty, or the oldest line is still being written
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    if (text != nullptr) {
+        *ms = slot->ms;
+        *level = slot->level;
+        *len = slot->len;
+        memcpy(text, slot->text, slot->len);
+    }
+    slot->seq.store(pos + SLOTS, std::memory_order_release);
+    return true;
+}
+
+// =============================================================================
+// Consumer (poll)
+// =============================================================================
+
+size_t LogStream::drain(char* out, size_t cap, size_t& lines) {
+    lines = 0;
+    size_t len = 0;
+
+    uint32_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_) {
+        uint32_t now = clock_ ? clock_(clockCtx_) : 0;
+        int n = snprintf(out, cap, "%lu ! dropped %lu\n",
+                         static_cast<unsigned long>(now),
+                         static_cast<unsigned long>(dropped - reported_));
+        if (n > 0 && static_cast<size_t>(n) < cap) {
+            len = static_cast<size_t>(n);
+            reported_ = dropped;
+        }
+    }
+
+    for (;;) {
+        if (!carry_) {
+            if (!pop(&carryMs_, &carryLevel_, carryText_, &carryLen_)) break;
+            carry_ = true;
+        }
+
+        char head[16];
+        char levelChar = carryLevel_ <= LOG_TRACE ? LEVEL_CHARS[carryLevel_] : '?';
+        int h = snprintf(head, sizeof(head), "%lu %c ",
+                         static_cast<unsigned long>(carryMs_), levelChar);
+        size_t headLen = static_cast<size_t>(h);
+        size_t textLen = carryLen_;
+
+        if (len + headLen + textLen + 1 > cap) {
+            if (len > 0) break;  // Next batch
+            if (cap < headLen + 2) break;
+            textLen = cap - headLen - 1;
+        }
+
+        memcpy(out + len, head, headLen);
+        memcpy(out + len + headLen, carryText_, textLen);
+        len += headLen + textLen;
+        out[len++] = '\n';
+        carry_ = false;
+        lines++;
+    }
+
+    if (len > 0) batches_++;
+    return len;
+}
+
+void LogStream::noteLost(size_t lines) {
+    dropped_.fetch_add(static_cast<uint32_t>(lines), std::memory_order_relaxed);
+}
+
+size_t LogStream::pending() const {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    return static_cast<size_t>(head - tail) + (carry_ ? 1 : 0);
+}
+
+LogStats LogStream::stats() const {
+    LogStats s;
+    s.written = written_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    s.batches = batches_;
+    return s;
+}
+
+const char* LogStream::levelName(uint8_t level) {
+    return level <= LOG_TRACE ? LEVEL_NAMES[level] : "?";
+}
+
+int LogStream::parseLevel(const char* text) {
+    if (text == nullptr) return -1;
+    if (text[0] >= '0' && text[0] <= '5' && text[1] == '\0') return text[0] - '0';
+    for (int i = 0; i <= LOG_TRACE; i++) {
+        if (strcmp(text, LEVEL_NAMES[i]) == 0) return i;
+    }
+    return -1;
+}
+
+} // namespace espmole
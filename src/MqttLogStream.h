@@ -0,0 +1,201 @@
+#ifndef ESPMOLE_MQTT_LOG_STREAM_H
+#define ESPMOLE_MQTT_LOG_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <atomic>
+#include "MqttBuildConfig.h"
+
+/// Log lines held between publishes (power of two)
+#ifndef ESPMOLE_MQTT_LOG_SLOTS
+#define ESPMOLE_MQTT_LOG_SLOTS 32
+#endif
+
+/// Longest log line; longer lines are truncated
+#ifndef ESPMOLE_MQTT_LOG_LINE
+#define ESPMOLE_MQTT_LOG_LINE 96
+#endif
+
+/// Highest level compiled in (0 = off ... 5 = trace), see ESPMOLE_LOGx
+#ifndef ESPMOLE_MQTT_LOG_LEVEL
+#define ESPMOLE_MQTT_LOG_LEVEL 3
+#endif
+
+namespace espmole {
+
+enum LogLevel : uint8_t {
+    LOG_OFF = 0,
+    LOG_ERROR = 1,
+    LOG_WARN = 2,
+    LOG_INFO = 3,
+    LOG_DEBUG = 4,
+    LOG_TRACE = 5
+};
+
+/**
+ * Log counters.
+ */
+struct LogStats {
+    uint32_t written = 0;       ///< Lines queued
+    uint32_t dropped = 0;       ///< Lines evicted, refused or lost on publish
+    uint32_t batches = 0;       ///< drain() calls that produced output
+};
+
+/**
+ * Log lines waiting for the `log` topic.
+ *
+ * A bounded lock-free queue (per-slot sequence numbers, Vyukov style):
+ * any task may call log() concurrently with each other and with the
+ * single consumer calling drain(). When the queue is full the writer
+ * evicts the oldest line, so a stalled connection keeps the newest
+ * SLOTS lines and never blocks the application. Evictions are counted
+ * and reported by a marker line in the next batch.
+ *
+ * Not for interrupt handlers: a writer preempted between claiming and
+ * filling a slot holds back the lines after it until it resumes.
+ *
+ * Levels above the runtime level() return before formatting; levels
+ * above ESPMOLE_MQTT_LOG_LEVEL are removed by the ESPMOLE_LOGx macros,
+ * arguments included.
+ */
+class LogStream {
+public:
+    /// Millisecond clock for line timestamps
+    using Clock = uint32_t (*)(void* ctx);
+
+    static constexpr size_t SLOTS = ESPMOLE_MQTT_LOG_SLOTS;
+    static constexpr size_t LINE_LEN = ESPMOLE_MQTT_LOG_LINE;
+    static constexpr uint8_t COMPILED_LEVEL = ESPMOLE_MQTT_LOG_LEVEL;
+
+    static_assert((SLOTS & (SLOTS - 1)) == 0 && SLOTS >= 2,
+                  "ESPMOLE_MQTT_LOG_SLOTS must be a power of two");
+
+    LogStream();
+
+    /// Clock for timestamps (default: all lines at 0)
+    void setClock(Clock clock, void* ctx = nullptr) {
+        clock_ = clock;
+        clockCtx_ = ctx;
+    }
+
+    /// Most verbose level accepted at runtime (capped at COMPILED_LEVEL)
+    void setLevel(uint8_t level);
+    uint8_t level() const { return level_.load(std::memory_order_relaxed); }
+
+    /// true if a line at `level` would be queued
+    bool enabled(uint8_t level) const {
+        return level != LOG_OFF && level <= this->level();
+    }
+
+    /// Queue a printf-style line
+    void log(uint8_t level, const char* fmt, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+
+    void vlog(uint8_t level, const char* fmt, va_list args);
+
+    /// Queue a line as is
+    void write(uint8_t level, const char* text, size_t len);
+
+    /**
+     * Pack queued lines into one payload, oldest first:
+     * "<ms> <E|W|I|D|T> <text>\n" per line, preceded by
+     * "<ms> ! dropped <n>\n" if lines were lost since the last batch.
+     * Single consumer.
+     *
+     * @param out    Payload buffer
+     * @param cap    Buffer size (at least LINE_LEN + 24)
+     * @param lines  Lines packed (marker not counted)
+     * @return       Payload length, 0 if nothing is queued
+     */
+    size_t drain(char* out, size_t cap, size_t& lines);
+
+    /// Count lines that were drained but could not be published
+    void noteLost(size_t lines);
+
+    /// Lines queued (approximate while writers are active)
+    size_t pending() const;
+
+    LogStats stats() const;
+
+    /// "error", "warn", "info", "debug", "trace" or "off"
+    static const char* levelName(uint8_t level);
+
+    /// Parse a level name or digit, -1 if unknown
+    static int parseLevel(const char* text);
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        uint32_t ms;
+        uint8_t level;
+        uint16_t len;
+        char text[LINE_LEN];
+    };
+
+    Slot slots_[SLOTS];
+    std::atomic<uint32_t> head_;        ///< Next slot to fill
+    std::atomic<uint32_t> tail_;        ///< Next slot to drain
+    std::atomic<uint8_t> level_;
+    std::atomic<uint32_t> written_;
+    std::atomic<uint32_t> dropped_;
+
+    // Consumer side
+    uint32_t reported_ = 0;             ///< dropped_ already announced
+    uint32_t batches_ = 0;
+    bool carry_ = false;                ///< carryText_ did not fit the last batch
+    uint32_t carryMs_ = 0;
+    uint8_t carryLevel_ = 0;
+    uint16_t carryLen_ = 0;
+    char carryText_[LINE_LEN];
+
+    Clock clock_ = nullptr;
+    void* clockCtx_ = nullptr;
+
+    bool push(uint8_t level, uint32_t ms, const char* text, size_t len);
+    bool pop(uint32_t* ms, uint8_t* level, char* text, uint16_t* len);
+};
+
+} // namespace espmole
+
+// -----------------------------------------------------------------------------
+// Level macros - compiled out above ESPMOLE_MQTT_LOG_LEVEL, arguments included.
+// `sink` is anything with log(level, fmt, ...): LogStream or MqttTransport.
+//
+//   ESPMOLE_LOGW(mqtt, "heap low: %u", ESP.getFreeHeap());
+// -----------------------------------------------------------------------------
+
+#if ESPMOLE_MQTT_FEATURE_LOG && ESPMOLE_MQTT_LOG_LEVEL >= 1
+#define ESPMOLE_LOGE(sink, ...) (sink).log(::espmole::LOG_ERROR, __VA_ARGS__)
+#else
+#define ESPMOLE_LOGE(sink, ...) ((void)0)
+#endif
+
+#if ESPMOLE_MQTT_FEATURE_LOG && ESPMOLE_MQTT_LOG_LEVEL >= 2
+#define ESPMOLE_LOGW(sink, ...) (sink).log(::espmole::LOG_WARN, __VA_ARGS__)
+#else
+#define ESPMOLE_LOGW(sink, ...) ((void)0)
+#endif
+
+#if ESPMOLE_MQTT_FEATURE_LOG && ESPMOLE_MQTT_LOG_LEVEL >= 3
+#define ESPMOLE_LOGI(sink, ...) (sink).log(::espmole::LOG_INFO, __VA_ARGS__)
+#else
+#define ESPMOLE_LOGI(sink, ...) ((void)0)
+#endif
+
+#if ESPMOLE_MQTT_FEATURE_LOG && ESPMOLE_MQTT_LOG_LEVEL >= 4
+#define ESPMOLE_LOGD(sink, ...) (sink).log(::espmole::LOG_DEBUG, __VA_ARGS__)
+#else
+#define ESPMOLE_LOGD(sink, ...) ((void)0)
+#endif
+
+#if ESPMOLE_MQTT_FEATURE_LOG && ESPMOLE_MQTT_LOG_LEVEL >= 5
+#define ESPMOLE_LOGT(sink, ...) (sink).log(::espmole::LOG_TRACE, __VA_ARGS__)
+#else
+#define ESPMOLE_LOGT(sink, ...) ((void)0)
+#endif
+
+#endif // ESPMOLE_MQTT_LOG_STREAM_H
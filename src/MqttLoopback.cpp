@@ -0,0 +1,259 @@
+#include "MqttLoopback.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+/// Longest step, so step and drain time stay far from the micros() wrap
+constexpr uint32_t STEP_MS_MAX = 600000;
+
+/// A step that sent less than this share of its target could not keep up
+constexpr uint32_t SEND_PERCENT_MIN = 90;
+
+/// Parse an unsigned decimal and the space after it; false if there is none
+bool parseField(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+    if (p >= end || *p < '0' || *p > '9') return false;
+    uint64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + static_cast<uint64_t>(*p - '0');
+        if (v > 0xFFFFFFFFULL) return false;
+        p++;
+    }
+    if (p >= end || *p != ' ') return false;
+    p++;
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+size_t clamp(int n, size_t cap) {
+    if (n <= 0 || cap == 0) return 0;
+    return static_cast<size_t>(n) < cap ? static_cast<size_t>(n) : cap - 1;
+}
+
+} // namespace
+
+bool LoopbackTest::start(const LoopbackConfig& config, uint32_t nowUs) {
+    if (config.startRate == 0 || config.maxRate < config.startRate || config.stepMs == 0 ||
+        config.stepMs > STEP_MS_MAX || config.drainMs > STEP_MS_MAX) {
+        return false;
+    }
+    config_ = config;
+    result_ = LoopbackResult();
+    result_.running = true;
+    run_++;
+    nextSeq_ = 0;
+    beginStep(config_.startRate, nowUs);
+    return true;
+}
+
+void LoopbackTest::stop() {
+    if (result_.running) {
+        finish(LIMIT_ABORTED);
+    }
+}
+
+void LoopbackTest::beginStep(uint32_t rate, uint32_t nowUs) {
+    step_ = LoopbackStep();
+    step_.rate = rate;
+    latency_.reset();
+    bytes_ = 0;
+    draining_ = false;
+    stepStart_ = nowUs;
+    firstSeq_ = nextSeq_;
+    highestSeq_ = 0;
+    anyReceived_ = false;
+}
+
+// =============================================================================
+// Sending
+// =============================================================================
+
+bool LoopbackTest::due(uint32_t nowUs) const {
+    if (!result_.running || draining_) return false;
+    uint32_t elapsed = nowUs - stepStart_;
+    if (elapsed >= config_.stepMs * 1000ULL) return false;
+
+    // One at the start of the step, then one every 1/rate seconds
+    uint64_t target = static_cast<uint64_t>(elapsed) * step_.rate / 1000000 + 1;
+    return step_.sent + step_.failed < target;
+}
+
+size_t LoopbackTest::next(uint8_t* out, size_t cap, uint32_t nowUs) {
+    if (cap == 0 || !due(nowUs)) return 0;
+
+    char header[HEADER_MAX];
+    size_t n = clamp(snprintf(header, sizeof(header), "%u %lu %lu ", static_cast<unsigned>(run_),
+                              static_cast<unsigned long>(nextSeq_),
+                              static_cast<unsigned long>(nowUs)),
+                     sizeof(header));
+    size_t len = config_.payload > n ? config_.payload : n;
+    if (len > cap) len = cap;
+    if (n > len) n = len;
+    memcpy(out, header, n);
+    memset(out + n, '.', len - n);
+
+    nextSeq_++;
+    step_.sent++;
+    return len;
+}
+
+void LoopbackTest::sendFailed() {
+    if (step_.sent > 0) {
+        step_.sent--;
+        step_.failed++;
+    }
+}
+
+// =============================================================================
+// Receiving
+// =============================================================================
+
+bool LoopbackTest::receive(const uint8_t* data, size_t len, uint32_t nowUs) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint32_t run = 0;
+    uint32_t seq = 0;
+    uint32_t sentUs = 0;
+    if (!parseField(p, end, run) || !parseField(p, end, seq) || !parseField(p, end, sentUs) ||
+        run != run_ || seq >= nextSeq_) {
+        return false;
+    }
+
+    // Back after its step was judged - it counted as lost there
+    if (!result_.running || seq < firstSeq_) {
+        result_.late++;
+        return true;
+    }
+
+    latency_.add(nowUs - sentUs);
+    step_.received++;
+    bytes_ += len;
+    if (anyReceived_ && seq < highestSeq_) {
+        step_.reordered++;
+    } else {
+        highestSeq_ = seq;
+        anyReceived_ = true;
+    }
+    return true;
+}
+
+// =============================================================================
+// Ramp
+// =============================================================================
+
+bool LoopbackTest::update(uint32_t nowUs) {
+    if (!result_.running) return false;
+
+    uint32_t elapsed = nowUs - stepStart_;
+    if (elapsed < config_.stepMs * 1000ULL) return false;
+    draining_ = true;
+    if (elapsed < (config_.stepMs + config_.drainMs) * 1000ULL) return false;
+
+    endStep();
+    if (step_.limit != LIMIT_NONE) {
+        finish(step_.limit);
+        return true;
+    }
+    if (step_.rate >= config_.maxRate) {
+        finish(LIMIT_MAX_RATE);
+        return true;
+    }
+
+    uint32_t rate = step_.rate + step_.rate * config_.rampPercent / 100;
+    if (rate <= step_.rate) rate = step_.rate + 1;
+    if (rate > config_.maxRate) rate = config_.maxRate;
+    beginStep(rate, nowUs);
+    return false;
+}
+
+void LoopbackTest::endStep() {
+    LoopbackStep& s = step_;
+    uint32_t attempted = s.sent + s.failed;
+    uint32_t lost = attempted > s.received ? attempted - s.received : 0;
+    s.lossPermille = attempted > 0 ? static_cast<uint32_t>(lost * 1000ULL / attempted) : 0;
+    if (latency_.count() > 0) {
+        s.p50Us = latency_.percentile(50);
+        s.p95Us = latency_.percentile(95);
+        s.p99Us = latency_.percentile(99);
+        s.maxUs = latency_.max();
+    }
+    s.bytesPerSec = static_cast<uint32_t>(bytes_ * 1000 / config_.stepMs);
+
+    uint64_t target = static_cast<uint64_t>(s.rate) * config_.stepMs / 1000;
+    if (attempted * 100ULL < target * SEND_PERCENT_MIN) {
+        s.limit = LIMIT_SEND;
+    } else if (s.lossPermille > config_.maxLossPermille) {
+        s.limit = LIMIT_LOSS;
+    } else if (latency_.count() == 0 || s.p95Us > config_.maxLatencyUs) {
+        s.limit = LIMIT_LATENCY;
+    }
+
+    result_.last = s;
+    if (s.limit == LIMIT_NONE) {
+        result_.best = s;
+    }
+    if (stepFn_) {
+        stepFn_(result_.steps, s, stepCtx_);
+    }
+    result_.steps++;
+}
+
+void LoopbackTest::finish(LoopbackLimit limit) {
+    result_.running = false;
+    result_.limit = limit;
+}
+
+// =============================================================================
+// Reports
+// =============================================================================
+
+const char* LoopbackTest::limitName(LoopbackLimit limit) {
+    switch (limit) {
+        case LIMIT_MAX_RATE: return "max_rate";
+        case LIMIT_LOSS: return "loss";
+        case LIMIT_LATENCY: return "latency";
+        case LIMIT_SEND: return "send";
+        case LIMIT_ABORTED: return "aborted";
+        default: return "none";
+    }
+}
+
+size_t LoopbackTest::formatStep(char* out, size_t cap, const LoopbackStep& step) {
+    return clamp(snprintf(out, cap,
+                          "rate=%lu sent=%lu recv=%lu loss_pm=%lu p50_us=%lu p95_us=%lu "
+                          "p99_us=%lu max_us=%lu bps=%lu %s",
+                          static_cast<unsigned long>(step.rate),
+                          static_cast<unsigned long>(step.sent + step.failed),
+                          static_cast<unsigned long>(step.received),
+                          static_cast<unsigned long>(step.lossPermille),
+                          static_cast<unsigned long>(step.p50Us),
+                          static_cast<unsigned long>(step.p95Us),
+                          static_cast<unsigned long>(step.p99Us),
+                          static_cast<unsigned long>(step.maxUs),
+                          static_cast<unsigned long>(step.bytesPerSec),
+                          step.limit == LIMIT_NONE ? "ok" : limitName(step.limit)),
+                 cap);
+}
+
+size_t LoopbackTest::formatResult(char* out, size_t cap, const LoopbackResult& result) {
+    const LoopbackStep& b = result.best;
+    return clamp(snprintf(out, cap,
+                          "max_rate=%lu bps=%lu loss_pm=%lu p50_us=%lu p95_us=%lu p99_us=%lu "
+                          "max_us=%lu steps=%u late=%lu limit=%s",
+                          static_cast<unsigned long>(b.rate),
+                          static_cast<unsigned long>(b.bytesPerSec),
+                          static_cast<unsigned long>(b.lossPermille),
+                          static_cast<unsigned long>(b.p50Us),
+                          static_cast<unsigned long>(b.p95Us),
+                          static_cast<unsigned long>(b.p99Us),
+                          static_cast<unsigned long>(b.maxUs),
+                          static_cast<unsigned>(result.steps),
+                          static_cast<unsigned long>(result.late),
+                          limitName(result.limit)),
+                 cap);
+}
+
+} // namespace espmole
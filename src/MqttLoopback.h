@@ -0,0 +1,180 @@
+#ifndef ESPMOLE_MQTT_LOOPBACK_H
+#define ESPMOLE_MQTT_LOOPBACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MqttProbe.h"
+
+namespace espmole {
+
+/**
+ * Why a loopback test stopped ramping.
+ */
+enum LoopbackLimit : uint8_t {
+    LIMIT_NONE = 0,     ///< Still running (test), passed (step)
+    LIMIT_MAX_RATE,     ///< Reached LoopbackConfig::maxRate without failing
+    LIMIT_LOSS,         ///< More than maxLossPermille lost
+    LIMIT_LATENCY,      ///< p95 above maxLatencyUs
+    LIMIT_SEND,         ///< The sender could not keep the rate (loop too slow)
+    LIMIT_ABORTED       ///< stop() or connection lost
+};
+
+/**
+ * Loopback test parameters.
+ */
+struct LoopbackConfig {
+    uint32_t startRate = 10;            ///< First step (messages/s)
+    uint32_t maxRate = 1000;            ///< Highest step tried (messages/s)
+    uint16_t rampPercent = 50;          ///< Each step this much faster than the last
+    uint32_t stepMs = 3000;             ///< Sending time per step
+    uint32_t drainMs = 1000;            ///< Waiting for stragglers after each step
+    uint16_t payload = 64;              ///< Message size (bytes), at least the header
+    uint8_t qos = 0;                    ///< QoS of the probe messages
+    uint16_t maxLossPermille = 10;      ///< A step losing more fails
+    uint32_t maxLatencyUs = 500000;     ///< A step with a slower p95 fails
+};
+
+/**
+ * Outcome of one rate step.
+ */
+struct LoopbackStep {
+    uint32_t rate = 0;                  ///< Target (messages/s)
+    uint32_t sent = 0;                  ///< Published
+    uint32_t failed = 0;                ///< Refused by the client (counted lost)
+    uint32_t received = 0;              ///< Came back before the step ended
+    uint32_t reordered = 0;             ///< Came back after a later message
+    uint32_t lossPermille = 0;
+    uint32_t p50Us = 0;
+    uint32_t p95Us = 0;
+    uint32_t p99Us = 0;
+    uint32_t maxUs = 0;
+    uint32_t bytesPerSec = 0;           ///< Payload bytes that came back, per second of sending
+    LoopbackLimit limit = LIMIT_NONE;   ///< Why the step failed, LIMIT_NONE if it passed
+};
+
+/**
+ * Outcome of a test: the fastest step that passed, and why the next failed.
+ */
+struct LoopbackResult {
+    bool running = false;
+    uint8_t steps = 0;                  ///< Steps completed
+    LoopbackLimit limit = LIMIT_NONE;
+    LoopbackStep best;                  ///< Fastest passing step (rate 0 = none passed)
+    LoopbackStep last;                  ///< Last step run
+    uint32_t late = 0;                  ///< Messages back after their step ended
+};
+
+/**
+ * Loopback throughput self-test.
+ *
+ * The device publishes numbered, timestamped messages to a topic it also
+ * subscribes to, so each one makes the full trip through client, network
+ * and broker and back. Rate ramps up in steps (startRate, then
+ * rampPercent faster each time, up to maxRate); each step sends for
+ * stepMs, waits drainMs for stragglers, and passes if loss, p95 latency
+ * and the achieved send rate are within bounds. The test ends at the first
+ * failing step. The fastest passing step is the rate the combination
+ * sustains.
+ *
+ * Payload: "<run> <seq> <sent-us> " padded with '.' to the configured size.
+ * Latency needs no clock sync - send and receive times are both local.
+ * Messages of an earlier run are ignored.
+ *
+ * Platform independent: the caller publishes what next() writes and feeds
+ * what comes back to receive(); time is micros(), wraps handled.
+ */
+class LoopbackTest {
+public:
+    /// Longest header ("<run> <seq> <sent-us> ")
+    static constexpr size_t HEADER_MAX = 36;
+
+    /// Called at the end of each step
+    using StepFn = void (*)(uint8_t index, const LoopbackStep& step, void* ctx);
+
+    /// Progress callback (nullptr = none)
+    void onStep(StepFn fn, void* ctx) {
+        stepFn_ = fn;
+        stepCtx_ = ctx;
+    }
+
+    /// Start (or restart) a test; false if the config makes no sense
+    bool start(const LoopbackConfig& config, uint32_t nowUs);
+
+    /// Abort a running test (LIMIT_ABORTED)
+    void stop();
+
+    bool running() const { return result_.running; }
+    const LoopbackConfig& config() const { return config_; }
+
+    /// Rate of the step in progress (messages/s)
+    uint32_t rate() const { return step_.rate; }
+
+    /**
+     * Write the next message if one is due.
+     *
+     * @return  Length written (the configured payload, cut to cap), 0 if
+     *          nothing is due or the test is not sending
+     */
+    size_t next(uint8_t* out, size_t cap, uint32_t nowUs);
+
+    /// The message next() wrote could not be published
+    void sendFailed();
+
+    /// Is a message due now (next() would write one)
+    bool due(uint32_t nowUs) const;
+
+    /**
+     * A message arrived on the loopback topic.
+     *
+     * @return  false if it is not one of this run's messages
+     */
+    bool receive(const uint8_t* data, size_t len, uint32_t nowUs);
+
+    /**
+     * End steps whose time is up and ramp.
+     *
+     * @return  true when the test has just finished
+     */
+    bool update(uint32_t nowUs);
+
+    const LoopbackResult& result() const { return result_; }
+
+    static const char* limitName(LoopbackLimit limit);
+
+    /**
+     * "rate=<msg/s> sent= recv= loss_pm= p50_us= p95_us= p99_us= max_us= bps= <ok|limit>"
+     */
+    static size_t formatStep(char* out, size_t cap, const LoopbackStep& step);
+
+    /**
+     * "max_rate=<msg/s> bps= loss_pm= p50_us= p95_us= p99_us= max_us= steps= late= limit="
+     * (figures of the fastest passing step)
+     */
+    static size_t formatResult(char* out, size_t cap, const LoopbackResult& result);
+
+private:
+    LoopbackConfig config_;
+    LoopbackResult result_;
+    LoopbackStep step_;                 // Step in progress
+    LatencyHistogram latency_;          // Of the step in progress
+    uint64_t bytes_ = 0;                // Received in the step in progress
+
+    uint16_t run_ = 0;
+    bool draining_ = false;
+    uint32_t stepStart_ = 0;
+    uint32_t firstSeq_ = 0;             // First message of the step in progress
+    uint32_t nextSeq_ = 0;
+    uint32_t highestSeq_ = 0;           // Highest received in this step
+    bool anyReceived_ = false;
+
+    StepFn stepFn_ = nullptr;
+    void* stepCtx_ = nullptr;
+
+    void beginStep(uint32_t rate, uint32_t nowUs);
+    void endStep();
+    void finish(LoopbackLimit limit);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_LOOPBACK_H
@@ -0,0 +1,114 @@
+#include "MqttMailbox.h"
+
+#include <string.h>
+
+namespace espmole {
+
+CommandMailbox::CommandMailbox() {
+    memset(entries_, 0, sizeof(entries_));
+}
+
+void CommandMailbox::open(uint32_t now) {
+    open_ = true;
+    overflowed_ = false;
+    lastArrival_ = now;
+}
+
+CommandMailbox::Offer CommandMailbox::offer(uint32_t seq, const uint8_t* data,
+                                            size_t len, uint32_t now) {
+    if (len > COMMAND_MAX) {
+        return MAILBOX_TOO_LONG;
+    }
+    if (lastSeq_ != 0 && seq <= lastSeq_) {
+        return MAILBOX_STALE;
+    }
+
+    int free = -1;
+    for (size_t i = 0; i < MAX_SLOTS; i++) {
+        if (!entries_[i].used) {
+            if (free < 0) free = static_cast<int>(i);
+        } else if (entries_[i].seq == seq) {
+            return MAILBOX_DUPLICATE;
+        }
+    }
+
+    if (free < 0) {
+        // Keep the lowest sequences - the dropped one stays on the broker
+        overflowed_ = true;
+        int top = highest();
+        if (seq > entries_[top].seq) {
+            return MAILBOX_FULL;
+        }
+        entries_[top].used = false;
+        pending_--;
+        free = top;
+    }
+
+    MailboxEntry& e = entries_[free];
+    e.seq = seq;
+    e.len = static_cast<uint16_t>(len);
+    e.used = true;
+    memcpy(e.command, data, len);
+    pending_++;
+    lastArrival_ = now;
+    return MAILBOX_QUEUED;
+}
+
+bool CommandMailbox::ready(uint32_t now, uint32_t settleMs) const {
+    return open_ && pending_ > 0 && now - lastArrival_ >= settleMs;
+}
+
+bool CommandMailbox::drained(uint32_t now, uint32_t settleMs) const {
+    return open_ && pending_ == 0 && !overflowed_ && now - lastArrival_ >= settleMs;
+}
+
+const MailboxEntry* CommandMailbox::peek() const {
+    int i = lowest();
+    return i < 0 ? nullptr : &entries_[i];
+}
+
+void CommandMailbox::pop() {
+    int i = lowest();
+    if (i < 0) return;
+    lastSeq_ = entries_[i].seq;
+    entries_[i].used = false;
+    pending_--;
+}
+
+int CommandMailbox::lowest() const {
+    int best = -1;
+    for (size_t i = 0; i < MAX_SLOTS; i++) {
+        if (entries_[i].used && (best < 0 || entries_[i].seq < entries_[best].seq)) {
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+int CommandMailbox::highest() const {
+    int best = -1;
+    for (size_t i = 0; i < MAX_SLOTS; i++) {
+        if (entries_[i].used && (best < 0 || entries_[i].seq > entries_[best].seq)) {
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+bool CommandMailbox::parseSeq(const char* text, uint32_t& seq) {
+    if (text[0] < '0' || text[0] > '9' || (text[0] == '0' && text[1] != '\0')) {
+        return false;
+    }
+
+    uint32_t value = 0;
+    for (const char* p = text; *p; p++) {
+        if (*p < '0' || *p > '9') return false;
+        uint32_t digit = static_cast<uint32_t>(*p - '0');
+        if (value > (UINT32_MAX - digit) / 10) return false;
+        value = value * 10 + digit;
+    }
+    seq = value;
+    return true;
+}
+
+} // namespace espmole
@@ -0,0 +1,123 @@
+#ifndef ESPMOLE_MQTT_MAILBOX_H
+#define ESPMOLE_MQTT_MAILBOX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Retained mailbox commands held in RAM while waiting to run
+#ifndef ESPMOLE_MQTT_MAILBOX_SLOTS
+#define ESPMOLE_MQTT_MAILBOX_SLOTS 8
+#endif
+
+/// Longest mailbox command
+#ifndef ESPMOLE_MQTT_MAILBOX_CMD_MAX
+#define ESPMOLE_MQTT_MAILBOX_CMD_MAX 96
+#endif
+
+namespace espmole {
+
+/**
+ * A command waiting in the mailbox.
+ */
+struct MailboxEntry {
+    uint32_t seq;               ///< Sequence number from the topic
+    uint16_t len;
+    bool used;
+    uint8_t command[ESPMOLE_MQTT_MAILBOX_CMD_MAX];
+};
+
+/**
+ * Orders retained mailbox commands for execution.
+ *
+ * The broker delivers retained messages right after SUBSCRIBE, in no
+ * particular order. Commands are collected until no new one has arrived
+ * for a settle time, then handed out lowest sequence first.
+ *
+ * When the table is full, the highest sequence is dropped. It is still
+ * retained on the broker and comes back on the next subscribe, so order
+ * is preserved.
+ *
+ * Platform independent - time is passed in by the caller.
+ */
+class CommandMailbox {
+public:
+    static constexpr size_t MAX_SLOTS = ESPMOLE_MQTT_MAILBOX_SLOTS;
+    static constexpr size_t COMMAND_MAX = ESPMOLE_MQTT_MAILBOX_CMD_MAX;
+
+    /// Result of offer()
+    enum Offer : uint8_t {
+        MAILBOX_QUEUED = 0,
+        MAILBOX_DUPLICATE,      ///< Already queued
+        MAILBOX_STALE,          ///< Sequence already executed
+        MAILBOX_FULL,           ///< Dropped for now, re-delivered after refill
+        MAILBOX_TOO_LONG        ///< Command exceeds COMMAND_MAX
+    };
+
+    CommandMailbox();
+
+    /**
+     * Start collecting (call after subscribing to the mailbox topic).
+     * Queued entries are kept.
+     */
+    void open(uint32_t now);
+
+    /**
+     * Queue a retained command.
+     *
+     * @param seq   Sequence number parsed from the topic
+     * @param data  Command payload
+     * @param len   Payload length
+     * @param now   Current time (ms)
+     */
+    Offer offer(uint32_t seq, const uint8_t* data, size_t len, uint32_t now);
+
+    /**
+     * true once nothing new arrived for `settleMs` and a command is queued.
+     */
+    bool ready(uint32_t now, uint32_t settleMs) const;
+
+    /**
+     * true once the settle time has passed and every queued command ran.
+     */
+    bool drained(uint32_t now, uint32_t settleMs) const;
+
+    /// Lowest queued sequence (nullptr if empty)
+    const MailboxEntry* peek() const;
+
+    /// Remove the entry returned by peek() after it ran
+    void pop();
+
+    /// Commands queued
+    size_t pending() const { return pending_; }
+
+    /// Highest sequence executed since boot (0 if none)
+    uint32_t lastSeq() const { return lastSeq_; }
+
+    /**
+     * true if entries were dropped because the table was full. The caller
+     * should subscribe again once the queue is empty, so the broker
+     * re-delivers what is still retained.
+     */
+    bool needsRefill() const { return overflowed_ && pending_ == 0; }
+
+    /**
+     * Parse the `<seq>` topic suffix: decimal digits, no leading zeros,
+     * so the topic can be rebuilt exactly to clear it.
+     */
+    static bool parseSeq(const char* text, uint32_t& seq);
+
+private:
+    MailboxEntry entries_[MAX_SLOTS];
+    size_t pending_ = 0;
+    uint32_t lastSeq_ = 0;
+    uint32_t lastArrival_ = 0;
+    bool open_ = false;
+    bool overflowed_ = false;
+
+    int lowest() const;
+    int highest() const;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_MAILBOX_H
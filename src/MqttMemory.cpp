@@ -0,0 +1,103 @@
+#include "MqttMemory.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace espmole {
+
+namespace {
+
+const char* const AREA_NAMES[MEM_AREAS] = {
+    "topics", "client", "inflight", "journal", "sched", "filter",
+    "mailbox", "batch", "bus", "log", "broker", "term",
+};
+
+/// snprintf that appends at out + len and never reports past cap
+size_t append(char* out, size_t cap, size_t len, const char* fmt, ...) {
+    if (len >= cap) return len;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + len, cap - len, fmt, args);
+    va_end(args);
+    if (n < 0) return len;
+    size_t added = static_cast<size_t>(n);
+    return added < cap - len ? len + added : cap - 1;
+}
+
+} // namespace
+
+void MemoryMonitor::update(MemoryArea area, size_t reserved, size_t used) {
+    if (area >= MEM_AREAS) return;
+    MemoryUsage& u = areas_[area];
+    u.reserved = static_cast<uint32_t>(reserved);
+    u.used = static_cast<uint32_t>(used);
+    if (u.used > u.peak) u.peak = u.used;
+}
+
+void MemoryMonitor::sampleHeap(uint32_t freeBytes, uint32_t largestBlock, uint32_t minFree) {
+    heap_.freeBytes = freeBytes;
+    heap_.largestBlock = largestBlock;
+
+    // The platform's own low-water mark also covers time between samples
+    uint32_t low = minFree > 0 ? minFree : freeBytes;
+    if (heap_.samples == 0 || low < heap_.minFree) heap_.minFree = low;
+
+    uint8_t frag = 0;
+    if (freeBytes > 0 && largestBlock < freeBytes) {
+        frag = static_cast<uint8_t>(100 - static_cast<uint64_t>(largestBlock) * 100 / freeBytes);
+    }
+    heap_.fragmentation = frag;
+    if (frag > heap_.worstFragmentation) heap_.worstFragmentation = frag;
+    heap_.samples++;
+}
+
+MemoryUsage MemoryMonitor::total() const {
+    MemoryUsage t;
+    for (size_t i = 0; i < MEM_AREAS; i++) {
+        t.reserved += areas_[i].reserved;
+        t.used += areas_[i].used;
+        t.peak += areas_[i].peak;
+    }
+    return t;
+}
+
+size_t MemoryMonitor::formatSummary(char* out, size_t cap, size_t objectSize) const {
+    if (cap == 0) return 0;
+    MemoryUsage t = total();
+    size_t len = append(out, cap, 0, "mem obj=%lu reserved=%lu used=%lu peak=%lu",
+                        static_cast<unsigned long>(objectSize),
+                        static_cast<unsigned long>(t.reserved),
+                        static_cast<unsigned long>(t.used),
+                        static_cast<unsigned long>(t.peak));
+    if (heap_.samples > 0) {
+        len = append(out, cap, len, " heap=%lu heap_blk=%lu heap_min=%lu frag=%u frag_max=%u",
+                     static_cast<unsigned long>(heap_.freeBytes),
+                     static_cast<unsigned long>(heap_.largestBlock),
+                     static_cast<unsigned long>(heap_.minFree),
+                     static_cast<unsigned>(heap_.fragmentation),
+                     static_cast<unsigned>(heap_.worstFragmentation));
+    }
+    return len;
+}
+
+size_t MemoryMonitor::formatAreas(char* out, size_t cap) const {
+    if (cap == 0) return 0;
+    out[0] = '\0';
+    size_t len = 0;
+    for (size_t i = 0; i < MEM_AREAS; i++) {
+        const MemoryUsage& u = areas_[i];
+        if (u.reserved == 0) continue;
+        len = append(out, cap, len, len == 0 ? "%s=%lu/%lu/%lu" : " %s=%lu/%lu/%lu",
+                     AREA_NAMES[i],
+                     static_cast<unsigned long>(u.used),
+                     static_cast<unsigned long>(u.reserved),
+                     static_cast<unsigned long>(u.peak));
+    }
+    return len;
+}
+
+const char* MemoryMonitor::name(MemoryArea area) {
+    return area < MEM_AREAS ? AREA_NAMES[area] : "?";
+}
+
+} // namespace espmole
@@ -0,0 +1,105 @@
+#ifndef ESPMOLE_MQTT_MEMORY_H
+#define ESPMOLE_MQTT_MEMORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+/// Parts of the transport whose memory is accounted
+enum MemoryArea : uint8_t {
+    MEM_TOPICS = 0,     ///< Topic and device ID buffers
+    MEM_CLIENT,         ///< AsyncMqttClient created by begin() (heap)
+    MEM_INFLIGHT,       ///< QoS 1 window
+    MEM_JOURNAL,        ///< Event journal ring
+    MEM_SCHED,          ///< Scheduled queries
+    MEM_FILTER,         ///< Event filter table
+    MEM_MAILBOX,        ///< Mailbox slots
+    MEM_BATCH,          ///< Duty-cycle buffer
+    MEM_BUS,            ///< Local subscribers
+    MEM_LOG,            ///< Log queue
+    MEM_BROKER,         ///< Embedded broker given to serveLocal()
+    MEM_TERM,           ///< Terminal sessions
+    MEM_AREAS
+};
+
+/**
+ * Bytes of one area.
+ */
+struct MemoryUsage {
+    uint32_t reserved = 0;      ///< Fixed size of the area
+    uint32_t used = 0;          ///< Occupied at the last update
+    uint32_t peak = 0;          ///< Highest `used` seen
+};
+
+/**
+ * Heap health as sampled on the target.
+ *
+ * Fragmentation is 100 - largest block * 100 / free: 0 when all free
+ * memory is one block, close to 100 when it is scattered in small pieces
+ * and a large allocation (a TLS handshake, an OTA buffer) would fail even
+ * though plenty is free.
+ */
+struct HeapHealth {
+    uint32_t freeBytes = 0;     ///< Free heap at the last sample
+    uint32_t largestBlock = 0;  ///< Largest block that could be allocated
+    uint32_t minFree = 0;       ///< Lowest free heap seen (since boot if the platform knows)
+    uint8_t fragmentation = 0;  ///< Percent, last sample
+    uint8_t worstFragmentation = 0;
+    uint32_t samples = 0;
+};
+
+/**
+ * Memory accounting for MqttTransport.
+ *
+ * The transport reports each area's reserved and used bytes from poll()
+ * and samples the heap now and then; the monitor keeps high-water marks.
+ * Peaks are as seen by those updates, so a burst that comes and goes
+ * between two polls is not recorded.
+ *
+ * Slot-based areas (in-flight window, mailbox, bus, log) report the
+ * occupied share of their storage, see share().
+ *
+ * Platform independent.
+ */
+class MemoryMonitor {
+public:
+    /// Record an area's size and current use
+    void update(MemoryArea area, size_t reserved, size_t used);
+
+    /// Record a heap sample; minFree 0 = unknown, tracked from the samples
+    void sampleHeap(uint32_t freeBytes, uint32_t largestBlock, uint32_t minFree);
+
+    const MemoryUsage& usage(MemoryArea area) const { return areas_[area < MEM_AREAS ? area : 0]; }
+
+    /// Sum over all areas (peak = sum of peaks)
+    MemoryUsage total() const;
+
+    const HeapHealth& heap() const { return heap_; }
+
+    /**
+     * "mem obj=<n> reserved=<n> used=<n> peak=<n>" and, once sampled,
+     * " heap=<free> heap_blk=<largest> heap_min=<min> frag=<pct> frag_max=<pct>".
+     *
+     * @param objectSize  sizeof the transport
+     */
+    size_t formatSummary(char* out, size_t cap, size_t objectSize) const;
+
+    /// "<area>=<used>/<reserved>/<peak> ..." for areas with reserved bytes
+    size_t formatAreas(char* out, size_t cap) const;
+
+    /// Bytes held by `n` of `max` equal slots in `reserved` bytes
+    static size_t share(size_t reserved, size_t n, size_t max) {
+        return max > 0 ? reserved * (n < max ? n : max) / max : 0;
+    }
+
+    static const char* name(MemoryArea area);
+
+private:
+    MemoryUsage areas_[MEM_AREAS];
+    HeapHealth heap_;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_MEMORY_H
@@ -0,0 +1,480 @@
+#include "MqttMicroBroker.h"
+
+#include <string.h>
+
+namespace espmole {
+
+MicroBroker::MicroBroker() {
+    memset(clients_, 0, sizeof(clients_));
+    memset(retained_, 0, sizeof(retained_));
+}
+
+void MicroBroker::begin(SendFn send, CloseFn close, void* ctx) {
+    sendFn_ = send;
+    closeFn_ = close;
+    ioCtx_ = ctx;
+}
+
+// =============================================================================
+// Network glue
+// =============================================================================
+
+int MicroBroker::open(uint32_t now) {
+    Guard guard(*this);
+
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        Session& c = clients_[i];
+        if (c.state != FREE) continue;
+
+        memset(&c, 0, sizeof(c));
+        c.state = CONNECTING;
+        c.lastRx = now;
+        c.nextPacketId = 1;
+        return static_cast<int>(i);
+    }
+    stats_.refused++;
+    return -1;
+}
+
+void MicroBroker::receive(int client, const uint8_t* data, size_t len, uint32_t now) {
+    Guard guard(*this);
+    if (!valid(client)) return;
+
+    Session& c = clients_[client];
+    c.lastRx = now;
+
+    while (len > 0 && c.state != FREE) {
+        size_t n = PACKET_MAX - c.rxLen;
+        if (n > len) n = len;
+        memcpy(c.rx + c.rxLen, data, n);
+        c.rxLen += n;
+        data += n;
+        len -= n;
+
+        size_t offset = 0;
+        while (c.state != FREE && offset < c.rxLen) {
+            mqtt::Packet packet;
+            int used = mqtt::parse(c.rx + offset, c.rxLen - offset, packet);
+            if (used == 0) break;
+            if (used < 0 || !handlePacket(client, packet, now)) {
+                stats_.errors++;
+                drop(client, true);
+                return;
+            }
+            offset += static_cast<size_t>(used);
+        }
+        if (c.state == FREE) return;
+
+        // A packet that cannot fit the buffer will never complete
+        if (offset == 0 && c.rxLen == PACKET_MAX) {
+            stats_.errors++;
+            drop(client, true);
+            return;
+        }
+        memmove(c.rx, c.rx + offset, c.rxLen - offset);
+        c.rxLen -= offset;
+    }
+}
+
+void MicroBroker::closed(int client) {
+    Guard guard(*this);
+    if (!valid(client)) return;
+
+    // The glue already lost the connection - forget it without closing again
+    release(client, true);
+}
+
+void MicroBroker::poll(uint32_t now) {
+    Guard guard(*this);
+
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        const Session& c = clients_[i];
+        uint32_t idle = now - c.lastRx;
+
+        if (c.state == CONNECTING && idle > CONNECT_TIMEOUT) {
+            stats_.timeouts++;
+            drop(static_cast<int>(i), false);
+        } else if (c.state == CONNECTED && c.keepAlive > 0 &&
+                   idle > static_cast<uint32_t>(c.keepAlive) * 1500) {
+            stats_.timeouts++;
+            drop(static_cast<int>(i), true);
+        }
+    }
+}
+
+// =============================================================================
+// Device side
+// =============================================================================
+
+bool MicroBroker::publish(const char* topic, const uint8_t* payload, size_t len,
+                          uint8_t qos, bool retain) {
+    Guard guard(*this);
+    if (topic == nullptr) return false;
+
+    size_t topicLen = strlen(topic);
+    if (!validTopic(topic, topicLen)) return false;
+    if (qos > 1) qos = 1;
+
+    bool ok = true;
+    if (retain) ok = this->retain(topic, topicLen, payload, len, qos);
+    route(topic, topicLen, payload, len, qos, false);
+    return ok;
+}
+
+size_t MicroBroker::clients() const {
+    Guard guard(*this);
+
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        if (clients_[i].state == CONNECTED) count++;
+    }
+    return count;
+}
+
+// =============================================================================
+// Packet handling
+// =============================================================================
+
+bool MicroBroker::valid(int client) const {
+    return client >= 0 && static_cast<size_t>(client) < MAX_CLIENTS &&
+           clients_[client].state != FREE;
+}
+
+bool MicroBroker::handlePacket(int client, const mqtt::Packet& packet, uint32_t now) {
+    Session& c = clients_[client];
+
+    // The first packet must be CONNECT, and only the first
+    if ((c.state == CONNECTING) != (packet.type == mqtt::CONNECT)) return false;
+
+    switch (packet.type) {
+        case mqtt::CONNECT:
+            return handleConnect(client, packet, now);
+        case mqtt::PUBLISH:
+            return handlePublish(client, packet);
+        case mqtt::PUBACK:
+            return packet.len == 2;  // Nothing is kept for redelivery
+        case mqtt::SUBSCRIBE:
+            return handleSubscribe(client, packet);
+        case mqtt::UNSUBSCRIBE:
+            return handleUnsubscribe(client, packet);
+        case mqtt::PINGREQ: {
+            size_t n = mqtt::encodeEmpty(tx_, sizeof(tx_), mqtt::PINGRESP);
+            send(client, tx_, n);
+            return true;
+        }
+        case mqtt::DISCONNECT:
+            drop(client, false);
+            return true;
+        default:
+            return false;  // QoS 2 flows and server-to-client packets
+    }
+}
+
+bool MicroBroker::handleConnect(int client, const mqtt::Packet& packet, uint32_t now) {
+    mqtt::ConnectView v;
+    if (!mqtt::decodeConnect(packet, v)) return false;
+
+    uint8_t code = mqtt::CONNACK_ACCEPTED;
+    if (v.protocolLevel != 4) {
+        code = mqtt::CONNACK_BAD_PROTOCOL;
+    } else if (v.clientId.len > CLIENT_ID_MAX) {
+        code = mqtt::CONNACK_ID_REJECTED;
+    } else if (username_ != nullptr &&
+               (!v.username.equals(username_) ||
+                (password_ != nullptr && !v.password.equals(password_)))) {
+        code = mqtt::CONNACK_BAD_CREDENTIALS;
+    } else if (v.hasWill && (!validTopic(v.willTopic.data, v.willTopic.len) ||
+                             v.willPayload.len > RETAINED_MAX)) {
+        code = mqtt::CONNACK_UNAVAILABLE;
+    }
+
+    if (code != mqtt::CONNACK_ACCEPTED) {
+        size_t n = mqtt::encodeConnack(tx_, sizeof(tx_), false, code);
+        send(client, tx_, n);
+        stats_.refused++;
+        drop(client, false);
+        return true;
+    }
+
+    // Same client ID: the new connection takes over
+    if (v.clientId.len > 0) {
+        for (size_t i = 0; i < MAX_CLIENTS; i++) {
+            const Session& other = clients_[i];
+            if (static_cast<int>(i) == client || other.state != CONNECTED) continue;
+            if (v.clientId.equals(other.clientId)) drop(static_cast<int>(i), true);
+        }
+    }
+
+    Session& c = clients_[client];
+    if (v.clientId.len > 0) memcpy(c.clientId, v.clientId.data, v.clientId.len);
+    c.clientId[v.clientId.len] = '\0';
+    c.keepAlive = v.keepAlive;
+    c.lastRx = now;
+
+    c.hasWill = v.hasWill;
+    if (v.hasWill) {
+        memcpy(c.willTopic, v.willTopic.data, v.willTopic.len);
+        c.willTopic[v.willTopic.len] = '\0';
+        if (v.willPayload.len > 0) memcpy(c.willPayload, v.willPayload.data, v.willPayload.len);
+        c.willLen = v.willPayload.len;
+        c.willQos = v.willQos > 1 ? 1 : v.willQos;
+        c.willRetain = v.willRetain;
+    }
+
+    // Sessions are always clean - nothing to resume
+    c.state = CONNECTED;
+    stats_.connects++;
+    size_t n = mqtt::encodeConnack(tx_, sizeof(tx_), false, mqtt::CONNACK_ACCEPTED);
+    send(client, tx_, n);
+    return true;
+}
+
+bool MicroBroker::handlePublish(int client, const mqtt::Packet& packet) {
+    mqtt::PublishView p;
+    if (!mqtt::decodePublish(packet, p)) return false;
+    if (p.qos > 1 || !validTopic(p.topic.data, p.topic.len)) return false;
+    if (p.qos == 1 && p.packetId == 0) return false;
+
+    stats_.received++;
+
+    if (p.qos == 1) {
+        size_t n = mqtt::encodeAck(tx_, sizeof(tx_), mqtt::PUBACK, p.packetId);
+        send(client, tx_, n);
+    }
+
+    if (p.retain) retain(p.topic.data, p.topic.len, p.payload, p.len, p.qos);
+    route(p.topic.data, p.topic.len, p.payload, p.len, p.qos, false);
+
+    if (messageFn_ != nullptr) {
+        char topic[TOPIC_MAX + 1];
+        memcpy(topic, p.topic.data, p.topic.len);
+        topic[p.topic.len] = '\0';
+        messageFn_(topic, p.payload, p.len, messageCtx_);
+    }
+    return true;
+}
+
+bool MicroBroker::handleSubscribe(int client, const mqtt::Packet& packet) {
+    mqtt::TopicListView list;
+    if (!mqtt::decodeSubscribe(packet, list)) return false;
+
+    Session& c = clients_[client];
+    const uint8_t* start = list.pos;
+
+    // Every filter takes at least 4 bytes, so this bounds the filter count
+    uint8_t codes[PACKET_MAX / 4];
+    size_t count = 0;
+
+    mqtt::StringView f;
+    uint8_t qos;
+    const uint8_t* at = list.pos;
+    while (list.next(f, qos)) {
+        at = list.pos;
+        if (count == sizeof(codes)) return false;
+
+        uint8_t granted = qos > 1 ? 1 : qos;
+        if (!validFilter(f.data, f.len)) {
+            codes[count++] = 0x80;
+            continue;
+        }
+
+        Subscription* slot = nullptr;
+        for (size_t i = 0; i < MAX_SUBS; i++) {
+            Subscription& s = c.subs[i];
+            if (s.filter[0] != '\0' && f.equals(s.filter)) {
+                slot = &s;
+                break;
+            }
+            if (s.filter[0] == '\0' && slot == nullptr) slot = &s;
+        }
+        if (slot == nullptr) {
+            codes[count++] = 0x80;
+            continue;
+        }
+        memcpy(slot->filter, f.data, f.len);
+        slot->filter[f.len] = '\0';
+        slot->qos = granted;
+        codes[count++] = granted;
+    }
+    if (count == 0 || at != list.end) return false;
+
+    size_t n = mqtt::encodeSuback(tx_, sizeof(tx_), list.packetId, codes, count);
+    send(client, tx_, n);
+
+    // Retained messages follow the SUBACK
+    list.pos = start;
+    for (size_t i = 0; i < count && list.next(f, qos); i++) {
+        if (codes[i] != 0x80) sendRetained(client, f.data, f.len, codes[i]);
+    }
+    return true;
+}
+
+bool MicroBroker::handleUnsubscribe(int client, const mqtt::Packet& packet) {
+    mqtt::TopicListView list;
+    if (!mqtt::decodeUnsubscribe(packet, list)) return false;
+    list.withQos = false;
+
+    Session& c = clients_[client];
+    mqtt::StringView f;
+    uint8_t qos;
+    size_t count = 0;
+    const uint8_t* at = list.pos;
+    while (list.next(f, qos)) {
+        at = list.pos;
+        count++;
+        for (size_t i = 0; i < MAX_SUBS; i++) {
+            Subscription& s = c.subs[i];
+            if (s.filter[0] != '\0' && f.equals(s.filter)) s.filter[0] = '\0';
+        }
+    }
+    if (count == 0 || at != list.end) return false;
+
+    size_t n = mqtt::encodeAck(tx_, sizeof(tx_), mqtt::UNSUBACK, list.packetId);
+    send(client, tx_, n);
+    return true;
+}
+
+// =============================================================================
+// Routing
+// =============================================================================
+
+void MicroBroker::route(const char* topic, size_t topicLen, const uint8_t* payload, size_t len,
+                        uint8_t qos, bool retain) {
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        Session& c = clients_[i];
+        if (c.state != CONNECTED) continue;
+
+        // Overlapping subscriptions deliver once at the highest granted QoS
+        int granted = -1;
+        for (size_t j = 0; j < MAX_SUBS; j++) {
+            const Subscription& s = c.subs[j];
+            if (s.filter[0] == '\0' || s.qos <= granted) continue;
+            if (mqtt::topicMatches(s.filter, strlen(s.filter), topic, topicLen)) granted = s.qos;
+        }
+        if (granted < 0) continue;
+
+        uint8_t q = qos < granted ? qos : static_cast<uint8_t>(granted);
+        if (deliver(c, static_cast<int>(i), topic, topicLen, payload, len, q, retain)) {
+            stats_.delivered++;
+        } else {
+            stats_.dropped++;
+        }
+    }
+}
+
+bool MicroBroker::deliver(Session& c, int client, const char* topic, size_t topicLen,
+                          const uint8_t* payload, size_t len, uint8_t qos, bool retain) {
+    uint16_t packetId = 0;
+    if (qos > 0) {
+        packetId = c.nextPacketId++;
+        if (c.nextPacketId == 0) c.nextPacketId = 1;
+    }
+    size_t n = mqtt::encodePublish(tx_, sizeof(tx_), topic, topicLen, payload, len,
+                                   qos, retain, packetId);
+    return send(client, tx_, n);
+}
+
+void MicroBroker::sendRetained(int client, const char* filter, size_t filterLen, uint8_t qos) {
+    Session& c = clients_[client];
+    for (size_t i = 0; i < MAX_RETAINED; i++) {
+        const Retained& r = retained_[i];
+        if (r.topic[0] == '\0') continue;
+
+        size_t topicLen = strlen(r.topic);
+        if (!mqtt::topicMatches(filter, filterLen, r.topic, topicLen)) continue;
+
+        uint8_t q = r.qos < qos ? r.qos : qos;
+        if (deliver(c, client, r.topic, topicLen, r.payload, r.len, q, true)) {
+            stats_.delivered++;
+        } else {
+            stats_.dropped++;
+        }
+    }
+}
+
+bool MicroBroker::retain(const char* topic, size_t topicLen, const uint8_t* payload, size_t len,
+                         uint8_t qos) {
+    Retained* slot = nullptr;
+    Retained* existing = nullptr;
+    for (size_t i = 0; i < MAX_RETAINED; i++) {
+        Retained& r = retained_[i];
+        if (r.topic[0] == '\0') {
+            if (slot == nullptr) slot = &r;
+        } else if (strlen(r.topic) == topicLen && memcmp(r.topic, topic, topicLen) == 0) {
+            existing = &r;
+            break;
+        }
+    }
+
+    // An empty payload clears; an oversized one must not leave a stale value
+    if (len == 0 || len > RETAINED_MAX) {
+        if (existing != nullptr) existing->topic[0] = '\0';
+        return len == 0;
+    }
+
+    if (existing != nullptr) slot = existing;
+    if (slot == nullptr) return false;
+
+    memcpy(slot->topic, topic, topicLen);
+    slot->topic[topicLen] = '\0';
+    memcpy(slot->payload, payload, len);
+    slot->len = len;
+    slot->qos = qos;
+    return true;
+}
+
+bool MicroBroker::send(int client, const uint8_t* data, size_t len) {
+    if (len == 0 || sendFn_ == nullptr) return false;
+    return sendFn_(client, data, len, ioCtx_);
+}
+
+void MicroBroker::release(int client, bool publishWill) {
+    Session& c = clients_[client];
+    if (c.state == FREE) return;
+
+    bool will = publishWill && c.state == CONNECTED && c.hasWill;
+    c.state = FREE;
+
+    // The slot is free but untouched until the next open(), so the will
+    // can be routed straight from it
+    if (will) {
+        size_t topicLen = strlen(c.willTopic);
+        if (c.willRetain) retain(c.willTopic, topicLen, c.willPayload, c.willLen, c.willQos);
+        route(c.willTopic, topicLen, c.willPayload, c.willLen, c.willQos, false);
+        if (messageFn_ != nullptr) messageFn_(c.willTopic, c.willPayload, c.willLen, messageCtx_);
+    }
+}
+
+void MicroBroker::drop(int client, bool publishWill) {
+    if (clients_[client].state == FREE) return;
+    release(client, publishWill);
+    if (closeFn_ != nullptr) closeFn_(client, ioCtx_);
+}
+
+// =============================================================================
+// Topic validation
+// =============================================================================
+
+bool MicroBroker::validTopic(const char* topic, size_t len) {
+    if (topic == nullptr || len == 0 || len > TOPIC_MAX) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (topic[i] == '+' || topic[i] == '#' || topic[i] == '\0') return false;
+    }
+    return true;
+}
+
+bool MicroBroker::validFilter(const char* filter, size_t len) {
+    if (filter == nullptr || len == 0 || len > TOPIC_MAX) return false;
+    for (size_t i = 0; i < len; i++) {
+        char ch = filter[i];
+        if (ch == '\0') return false;
+
+        bool levelStart = i == 0 || filter[i - 1] == '/';
+        bool levelEnd = i + 1 == len || filter[i + 1] == '/';
+        if (ch == '+' && !(levelStart && levelEnd)) return false;
+        if (ch == '#' && !(levelStart && i + 1 == len)) return false;
+    }
+    return true;
+}
+
+} // namespace espmole
@@ -0,0 +1,245 @@
+#ifndef ESPMOLE_MQTT_MICRO_BROKER_H
+#define ESPMOLE_MQTT_MICRO_BROKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MqttBuildConfig.h"
+#include "MqttCodec.h"
+
+/// Concurrent LAN clients
+#ifndef ESPMOLE_MQTT_BROKER_CLIENTS
+#define ESPMOLE_MQTT_BROKER_CLIENTS 4
+#endif
+
+/// Subscriptions per client
+#ifndef ESPMOLE_MQTT_BROKER_SUBS
+#define ESPMOLE_MQTT_BROKER_SUBS 8
+#endif
+
+/// Receive buffer per client - also the largest packet accepted or sent
+#ifndef ESPMOLE_MQTT_BROKER_PACKET
+#define ESPMOLE_MQTT_BROKER_PACKET 1024
+#endif
+
+/// Retained messages kept
+#ifndef ESPMOLE_MQTT_BROKER_RETAINED
+#define ESPMOLE_MQTT_BROKER_RETAINED 8
+#endif
+
+/// Largest retained (and will) payload
+#ifndef ESPMOLE_MQTT_BROKER_RETAINED_MAX
+#define ESPMOLE_MQTT_BROKER_RETAINED_MAX 128
+#endif
+
+namespace espmole {
+
+/**
+ * Broker counters.
+ */
+struct BrokerStats {
+    uint32_t connects = 0;      ///< Sessions accepted
+    uint32_t refused = 0;       ///< Connections refused (full, bad CONNECT, credentials)
+    uint32_t received = 0;      ///< PUBLISH packets from clients
+    uint32_t delivered = 0;     ///< PUBLISH packets sent to clients
+    uint32_t dropped = 0;       ///< Deliveries the connection could not take
+    uint32_t timeouts = 0;      ///< Clients dropped for keep-alive or CONNECT timeout
+    uint32_t errors = 0;        ///< Clients dropped for protocol errors
+};
+
+/**
+ * Tiny MQTT 3.1.1 broker for broker-less LAN operation.
+ *
+ * Serves a handful of clients from fixed memory: QoS 0 and 1, clean
+ * sessions, `+`/`#` wildcards, retained messages and wills. Messages that
+ * clients publish are also handed to the device (onMessage(), usually
+ * MqttTransport::handleMessage), and the device publishes through
+ * publish() - the `espmole/<dev>/...` topics work without a broker hop.
+ *
+ * QoS 1 is acknowledged towards publishers and delivered at QoS 1 to QoS 1
+ * subscribers; with clean sessions over TCP nothing is ever redelivered,
+ * so no outbound state is kept.
+ *
+ * The broker does no I/O. The network glue reports connections and data
+ * and supplies the send/close functions: MqttBrokerServer (AsyncTCP) on
+ * the device, PosixBrokerServer in tools/ on Linux. Time is passed in by
+ * the caller. Memory: about CLIENTS * (PACKET + SUBS * TOPIC_MAX) plus the
+ * retained store, all inside the object.
+ *
+ * Entry points may be called from several tasks when a lock is installed
+ * with setLock(); handlers run with the lock held and may call publish().
+ */
+class MicroBroker {
+public:
+    static constexpr size_t MAX_CLIENTS = ESPMOLE_MQTT_BROKER_CLIENTS;
+    static constexpr size_t MAX_SUBS = ESPMOLE_MQTT_BROKER_SUBS;
+    static constexpr size_t PACKET_MAX = ESPMOLE_MQTT_BROKER_PACKET;
+    static constexpr size_t MAX_RETAINED = ESPMOLE_MQTT_BROKER_RETAINED;
+    static constexpr size_t RETAINED_MAX = ESPMOLE_MQTT_BROKER_RETAINED_MAX;
+    static constexpr size_t TOPIC_MAX = ESPMOLE_MQTT_TOPIC_MAX;
+    static constexpr size_t CLIENT_ID_MAX = 23;             ///< MQTT 3.1.1 minimum
+    static constexpr uint32_t CONNECT_TIMEOUT = 10000;      ///< ms to send CONNECT
+
+    /// Queue bytes on a connection; false if it cannot take them now
+    using SendFn = bool (*)(int client, const uint8_t* data, size_t len, void* ctx);
+    /// Close a connection (the broker has already forgotten it)
+    using CloseFn = void (*)(int client, void* ctx);
+    /// A client published a message - topic is NUL-terminated
+    using MessageFn = void (*)(const char* topic, const uint8_t* payload, size_t len, void* ctx);
+    /// Lock / unlock for multi-task use (recursive)
+    using LockFn = void (*)(bool lock, void* ctx);
+
+    MicroBroker();
+
+    /**
+     * Connect the broker to its network glue.
+     *
+     * @param send   Writes to a connection
+     * @param close  Closes a connection
+     * @param ctx    Passed to both
+     */
+    void begin(SendFn send, CloseFn close, void* ctx);
+
+    /// Deliver client publishes to the device
+    void onMessage(MessageFn handler, void* ctx) {
+        messageFn_ = handler;
+        messageCtx_ = ctx;
+    }
+
+    /// Require these credentials in CONNECT (nullptr = accept everyone)
+    void setCredentials(const char* username, const char* password) {
+        username_ = username;
+        password_ = password;
+    }
+
+    /// Serialize entry points across tasks
+    void setLock(LockFn lock, void* ctx) {
+        lockFn_ = lock;
+        lockCtx_ = ctx;
+    }
+
+    // -------------------------------------------------------------------------
+    // Network glue
+    // -------------------------------------------------------------------------
+
+    /**
+     * A connection was accepted.
+     *
+     * @return  Client handle for the other calls, -1 if all slots are busy
+     *          (close the connection)
+     */
+    int open(uint32_t now);
+
+    /// Bytes arrived on a connection
+    void receive(int client, const uint8_t* data, size_t len, uint32_t now);
+
+    /// The connection went away without DISCONNECT - publishes the will
+    void closed(int client);
+
+    /// Enforce keep-alive (1.5x) and CONNECT timeouts
+    void poll(uint32_t now);
+
+    // -------------------------------------------------------------------------
+    // Device side
+    // -------------------------------------------------------------------------
+
+    /**
+     * Publish from the device to subscribed clients (never back to onMessage).
+     *
+     * @return  false if the message is too large or a retained copy could not be kept
+     */
+    bool publish(const char* topic, const uint8_t* payload, size_t len,
+                 uint8_t qos = 0, bool retain = false);
+
+    /// true once begin() gave the broker its network glue
+    bool running() const { return sendFn_ != nullptr; }
+
+    /// Clients that completed CONNECT
+    size_t clients() const;
+
+    const BrokerStats& stats() const { return stats_; }
+
+private:
+    enum State : uint8_t {
+        FREE = 0,
+        CONNECTING,             ///< Waiting for CONNECT
+        CONNECTED
+    };
+
+    struct Subscription {
+        char filter[TOPIC_MAX + 1];     ///< Empty = unused
+        uint8_t qos;
+    };
+
+    struct Session {
+        State state;
+        uint8_t rx[PACKET_MAX];
+        size_t rxLen;
+        uint32_t lastRx;
+        uint16_t keepAlive;
+        uint16_t nextPacketId;
+        char clientId[CLIENT_ID_MAX + 1];
+        Subscription subs[MAX_SUBS];
+        bool hasWill;
+        uint8_t willQos;
+        bool willRetain;
+        char willTopic[TOPIC_MAX + 1];
+        uint8_t willPayload[RETAINED_MAX];
+        size_t willLen;
+    };
+
+    struct Retained {
+        char topic[TOPIC_MAX + 1];      ///< Empty = unused
+        uint8_t payload[RETAINED_MAX];
+        size_t len;
+        uint8_t qos;
+    };
+
+    /// RAII helper around the installed lock
+    class Guard {
+    public:
+        explicit Guard(const MicroBroker& b) : b_(b) { if (b_.lockFn_) b_.lockFn_(true, b_.lockCtx_); }
+        ~Guard() { if (b_.lockFn_) b_.lockFn_(false, b_.lockCtx_); }
+    private:
+        const MicroBroker& b_;
+    };
+
+    Session clients_[MAX_CLIENTS];
+    Retained retained_[MAX_RETAINED];
+    uint8_t tx_[PACKET_MAX];
+    BrokerStats stats_;
+
+    SendFn sendFn_ = nullptr;
+    CloseFn closeFn_ = nullptr;
+    void* ioCtx_ = nullptr;
+    MessageFn messageFn_ = nullptr;
+    void* messageCtx_ = nullptr;
+    LockFn lockFn_ = nullptr;
+    void* lockCtx_ = nullptr;
+    const char* username_ = nullptr;
+    const char* password_ = nullptr;
+
+    bool valid(int client) const;
+    bool handlePacket(int client, const mqtt::Packet& packet, uint32_t now);
+    bool handleConnect(int client, const mqtt::Packet& packet, uint32_t now);
+    bool handlePublish(int client, const mqtt::Packet& packet);
+    bool handleSubscribe(int client, const mqtt::Packet& packet);
+    bool handleUnsubscribe(int client, const mqtt::Packet& packet);
+
+    void route(const char* topic, size_t topicLen, const uint8_t* payload, size_t len,
+               uint8_t qos, bool retain);
+    bool deliver(Session& c, int client, const char* topic, size_t topicLen,
+                 const uint8_t* payload, size_t len, uint8_t qos, bool retain);
+    void sendRetained(int client, const char* filter, size_t filterLen, uint8_t qos);
+    bool retain(const char* topic, size_t topicLen, const uint8_t* payload, size_t len,
+                uint8_t qos);
+    bool send(int client, const uint8_t* data, size_t len);
+    void release(int client, bool publishWill);
+    void drop(int client, bool publishWill);
+
+    static bool validFilter(const char* filter, size_t len);
+    static bool validTopic(const char* topic, size_t len);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_MICRO_BROKER_H
@@ -0,0 +1,176 @@
+#include "MqttProbe.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+/// snprintf that appends at out + len and never reports past cap
+size_t append(char* out, size_t cap, size_t len, const char* fmt, ...) {
+    if (len >= cap) return len;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + len, cap - len, fmt, args);
+    va_end(args);
+    if (n < 0) return len;
+    size_t added = static_cast<size_t>(n);
+    return added < cap - len ? len + added : cap - 1;
+}
+
+bool keyIs(const char* p, size_t keyLen, const char* key) {
+    return strlen(key) == keyLen && strncmp(p, key, keyLen) == 0;
+}
+
+} // namespace
+
+// =============================================================================
+// Reply format
+// =============================================================================
+
+size_t formatProbeReply(char* out, size_t cap, const char* token, size_t tokenLen,
+                        const ProbeSnapshot& s) {
+    if (cap == 0) return 0;
+    if (tokenLen > PROBE_TOKEN_MAX) tokenLen = PROBE_TOKEN_MAX;
+    size_t len = append(out, cap, 0, "probe %.*s rx=%lu tx=%lu up=%lu inflight=%u/%u batch=%lu",
+                        static_cast<int>(tokenLen), token ? token : "",
+                        static_cast<unsigned long>(s.rxUs),
+                        static_cast<unsigned long>(s.txUs),
+                        static_cast<unsigned long>(s.uptimeMs),
+                        static_cast<unsigned>(s.inflight),
+                        static_cast<unsigned>(s.window),
+                        static_cast<unsigned long>(s.batchBytes));
+    if (s.logLines >= 0) {
+        len = append(out, cap, len, " log=%ld", static_cast<long>(s.logLines));
+    }
+    if (s.mailbox >= 0) {
+        len = append(out, cap, len, " mail=%ld", static_cast<long>(s.mailbox));
+    }
+    if (s.heapFree >= 0) {
+        len = append(out, cap, len, " heap=%ld", static_cast<long>(s.heapFree));
+    }
+    return len;
+}
+
+bool parseProbeReply(const char* payload, size_t len, ProbeReply& out) {
+    if (len < 6 || strncmp(payload, "probe ", 6) != 0) {
+        return false;
+    }
+
+    // Copy so strtoul() stops at the payload end
+    char line[192];
+    if (len > sizeof(line) - 1) len = sizeof(line) - 1;
+    memcpy(line, payload, len);
+    line[len] = '\0';
+
+    out = ProbeReply();
+    const char* p = line + 6;
+    const char* tokenEnd = strchr(p, ' ');
+    size_t tokenLen = tokenEnd ? static_cast<size_t>(tokenEnd - p) : strlen(p);
+    out.token = payload + 6;
+    out.tokenLen = tokenLen;
+    p += tokenLen;
+
+    bool rx = false;
+    bool tx = false;
+    ProbeSnapshot& s = out.snapshot;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char* eq = strchr(p, '=');
+        if (!eq) break;
+        size_t keyLen = static_cast<size_t>(eq - p);
+        char* end = nullptr;
+        unsigned long v = strtoul(eq + 1, &end, 10);
+
+        if (keyIs(p, keyLen, "rx")) {
+            s.rxUs = static_cast<uint32_t>(v);
+            rx = true;
+        } else if (keyIs(p, keyLen, "tx")) {
+            s.txUs = static_cast<uint32_t>(v);
+            tx = true;
+        } else if (keyIs(p, keyLen, "up")) {
+            s.uptimeMs = static_cast<uint32_t>(v);
+        } else if (keyIs(p, keyLen, "inflight")) {
+            s.inflight = static_cast<uint16_t>(v);
+            if (*end == '/') s.window = static_cast<uint16_t>(strtoul(end + 1, &end, 10));
+        } else if (keyIs(p, keyLen, "batch")) {
+            s.batchBytes = static_cast<uint32_t>(v);
+        } else if (keyIs(p, keyLen, "log")) {
+            s.logLines = static_cast<int32_t>(v);
+        } else if (keyIs(p, keyLen, "mail")) {
+            s.mailbox = static_cast<int32_t>(v);
+        } else if (keyIs(p, keyLen, "heap")) {
+            s.heapFree = static_cast<int32_t>(v);
+        }
+
+        // Skip the rest of the value, known or not
+        p = end;
+        while (*p && *p != ' ') p++;
+    }
+    return rx && tx;
+}
+
+// =============================================================================
+// LatencyHistogram
+// =============================================================================
+
+size_t LatencyHistogram::bucketOf(uint32_t us) {
+    if (us < SUB_BUCKETS) return us;
+    size_t msb = 31;
+    while (!(us & (1UL << msb))) msb--;
+    return (msb - 1) * SUB_BUCKETS + ((us >> (msb - 2)) & (SUB_BUCKETS - 1));
+}
+
+uint32_t LatencyHistogram::bucketLow(size_t i) {
+    if (i < SUB_BUCKETS) return static_cast<uint32_t>(i);
+    if (i >= BUCKETS) return UINT32_MAX;
+    size_t msb = i / SUB_BUCKETS + 1;
+    return static_cast<uint32_t>((SUB_BUCKETS + i % SUB_BUCKETS) << (msb - 2));
+}
+
+void LatencyHistogram::add(uint32_t us) {
+    buckets_[bucketOf(us)]++;
+    if (count_ == 0 || us < min_) min_ = us;
+    if (us > max_) max_ = us;
+    sum_ += us;
+    count_++;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    if (other.count_ == 0) return;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        buckets_[i] += other.buckets_[i];
+    }
+    if (count_ == 0 || other.min_ < min_) min_ = other.min_;
+    if (other.max_ > max_) max_ = other.max_;
+    sum_ += other.sum_;
+    count_ += other.count_;
+}
+
+uint32_t LatencyHistogram::percentile(double p) const {
+    if (count_ == 0) return 0;
+    if (p <= 0) return min_;
+    if (p >= 100) return max_;
+
+    // Rank of the sample, 1-based
+    uint32_t rank = static_cast<uint32_t>(p * count_ / 100.0 + 0.999999);
+    if (rank == 0) rank = 1;
+
+    uint32_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets_[i];
+        if (seen < rank) continue;
+        uint64_t low = bucketLow(i);
+        uint64_t high = i + 1 < BUCKETS ? bucketLow(i + 1) : 0x100000000ULL;
+        uint64_t mid = low + (high - low) / 2;
+        if (mid < min_) mid = min_;
+        if (mid > max_) mid = max_;
+        return static_cast<uint32_t>(mid);
+    }
+    return max_;
+}
+
+} // namespace espmole
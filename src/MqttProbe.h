@@ -0,0 +1,115 @@
+#ifndef ESPMOLE_MQTT_PROBE_H
+#define ESPMOLE_MQTT_PROBE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+// -----------------------------------------------------------------------------
+// $probe reply
+//
+//   probe <token> rx=<us> tx=<us> up=<ms> inflight=<n>/<window> batch=<bytes>
+//         log=<lines> mail=<cmds> heap=<free>
+//
+// rx and tx are the device's micros() when the probe arrived and when the
+// reply was formatted; their difference is the time spent on the device.
+// Both wrap, so only the difference is meaningful. Keys a build does not
+// have (log, mail, heap) are left out.
+// -----------------------------------------------------------------------------
+
+/**
+ * Device-side timestamps and queue depths carried by a probe reply.
+ */
+struct ProbeSnapshot {
+    uint32_t rxUs = 0;          ///< micros() when the probe was received
+    uint32_t txUs = 0;          ///< micros() when the reply was formatted
+    uint32_t uptimeMs = 0;
+    uint16_t inflight = 0;      ///< Unacknowledged QoS 1 publishes
+    uint16_t window = 0;        ///< In-flight window size
+    uint32_t batchBytes = 0;    ///< Held back by duty-cycle batching
+    int32_t logLines = -1;      ///< Queued log lines, -1 = no log stream
+    int32_t mailbox = -1;       ///< Mailbox commands waiting, -1 = no mailbox
+    int32_t heapFree = -1;      ///< Free heap, -1 = not sampled
+
+    /// Time between receipt and reply on the device
+    uint32_t deviceUs() const { return txUs - rxUs; }
+};
+
+/**
+ * A parsed reply. The token points into the parsed payload.
+ */
+struct ProbeReply {
+    const char* token = nullptr;
+    size_t tokenLen = 0;
+    ProbeSnapshot snapshot;
+};
+
+/// Longest token echoed back by the device
+static constexpr size_t PROBE_TOKEN_MAX = 32;
+
+/**
+ * Format a reply.
+ *
+ * @param token     Token from the request, cut at PROBE_TOKEN_MAX
+ * @return Length written (terminated, truncated to cap - 1)
+ */
+size_t formatProbeReply(char* out, size_t cap, const char* token, size_t tokenLen,
+                        const ProbeSnapshot& s);
+
+/**
+ * Parse a reply. Unknown keys are skipped so newer devices can add them.
+ *
+ * @return false if the payload is not a probe reply
+ */
+bool parseProbeReply(const char* payload, size_t len, ProbeReply& out);
+
+/**
+ * Latency histogram for probe round trips.
+ *
+ * Buckets split every power of two into four, so a percentile read from
+ * the histogram is within 12.5% of the true value. Fixed size, no
+ * allocation; a fleet histogram is the merge() of the per-device ones.
+ *
+ * Platform independent.
+ */
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKETS = 4;                ///< Per power of two
+    static constexpr size_t BUCKETS = 31 * SUB_BUCKETS;     ///< Covers uint32_t
+
+    void add(uint32_t us);
+    void merge(const LatencyHistogram& other);
+    void reset() { *this = LatencyHistogram(); }
+
+    uint32_t count() const { return count_; }
+    uint32_t min() const { return count_ ? min_ : 0; }
+    uint32_t max() const { return max_; }
+    uint32_t mean() const { return count_ ? static_cast<uint32_t>(sum_ / count_) : 0; }
+
+    /**
+     * Value at percentile p (0-100): the middle of the bucket holding it,
+     * clamped to the observed min and max. 0 and 100 are min() and max().
+     */
+    uint32_t percentile(double p) const;
+
+    /// Samples in bucket i
+    uint32_t bucket(size_t i) const { return i < BUCKETS ? buckets_[i] : 0; }
+
+    /// Smallest value that lands in bucket i
+    static uint32_t bucketLow(size_t i);
+
+    /// Bucket a value lands in
+    static size_t bucketOf(uint32_t us);
+
+private:
+    uint32_t buckets_[BUCKETS] = {};
+    uint32_t count_ = 0;
+    uint32_t min_ = 0;
+    uint32_t max_ = 0;
+    uint64_t sum_ = 0;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_PROBE_H
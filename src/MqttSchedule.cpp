@@ -0,0 +1,243 @@
+#include "MqttSchedule.h"
+
+#include <string.h>
+
+namespace espmole {
+
+static_assert(ESPMOLE_MQTT_MAX_SCHEDULES <= 32, "schedule bitmasks are 32 bits wide");
+
+// =============================================================================
+// TimerWheel
+// =============================================================================
+
+TimerWheel::TimerWheel() {
+    memset(timers_, 0, sizeof(timers_));
+    memset(heads_, NONE, sizeof(heads_));
+}
+
+void TimerWheel::arm(uint8_t index, uint32_t delayMs, uint32_t now) {
+    if (index >= MAX_TIMERS) return;
+
+    if (!started_) {
+        started_ = true;
+        tickTime_ = now;
+    }
+    disarm(index);
+
+    uint32_t ticks = (delayMs + TICK_MS - 1) / TICK_MS;
+    if (ticks == 0) ticks = 1;
+
+    // Account for time already elapsed inside the current tick
+    uint32_t intoTick = (now - tickTime_) / TICK_MS;
+    ticks += intoTick;
+
+    Timer& t = timers_[index];
+    t.armed = true;
+    t.slot = static_cast<uint8_t>((tick_ + ticks) % SLOTS);
+    t.rounds = (ticks - 1) / SLOTS;
+    t.next = heads_[t.slot];
+    heads_[t.slot] = index;
+}
+
+void TimerWheel::disarm(uint8_t index) {
+    if (index >= MAX_TIMERS || !timers_[index].armed) return;
+    unlink(index);
+    timers_[index].armed = false;
+}
+
+uint32_t TimerWheel::advance(uint32_t now) {
+    uint32_t fired = 0;
+    if (!started_) return fired;
+
+    uint32_t behind = (now - tickTime_) / TICK_MS;
+    if (behind > SLOTS) {
+        // Stalled for more than a revolution - process each slot once
+        tickTime_ = now - SLOTS * TICK_MS;
+        behind = SLOTS;
+    }
+
+    for (uint32_t i = 0; i < behind; i++) {
+        tick_++;
+        tickTime_ += TICK_MS;
+
+        uint8_t slot = static_cast<uint8_t>(tick_ % SLOTS);
+        uint8_t index = heads_[slot];
+        while (index != NONE) {
+            Timer& t = timers_[index];
+            uint8_t next = t.next;
+            if (t.rounds == 0) {
+                unlink(index);
+                t.armed = false;
+                fired |= 1UL << index;
+            } else {
+                t.rounds--;
+            }
+            index = next;
+        }
+    }
+    return fired;
+}
+
+void TimerWheel::unlink(uint8_t index) {
+    Timer& t = timers_[index];
+    uint8_t* link = &heads_[t.slot];
+    while (*link != NONE) {
+        if (*link == index) {
+            *link = t.next;
+            break;
+        }
+        link = &timers_[*link].next;
+    }
+    t.next = NONE;
+}
+
+// =============================================================================
+// QueryScheduler
+// =============================================================================
+
+QueryScheduler::QueryScheduler() {
+    memset(queries_, 0, sizeof(queries_));
+}
+
+uint8_t QueryScheduler::add(bool watch, uint32_t interval, const char* command, size_t len,
+                            uint32_t lease, uint32_t now, bool state) {
+    if (len == 0 || len >= COMMAND_MAX) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < MAX_QUERIES; i++) {
+        ScheduledQuery& q = queries_[i];
+        if (q.id != 0) continue;
+
+        q.id = static_cast<uint8_t>(i + 1);
+        q.watch = watch;
+        q.state = state;
+        q.interval = interval < MIN_INTERVAL ? MIN_INTERVAL : interval;
+        q.leaseStart = now;
+        q.lease = lease;
+        q.lastHash = 0;
+        q.hasResult = false;
+        memcpy(q.command, command, len);
+        q.command[len] = '\0';
+
+        // State readers should not wait a whole interval for the first value
+        wheel_.arm(static_cast<uint8_t>(i), state ? MIN_INTERVAL : q.interval, now);
+        return q.id;
+    }
+    return 0;
+}
+
+bool QueryScheduler::renew(uint8_t id, uint32_t now) {
+    ScheduledQuery* q = find(id);
+    if (!q) return false;
+    q->leaseStart = now;
+    return true;
+}
+
+bool QueryScheduler::cancel(uint8_t id) {
+    ScheduledQuery* q = find(id);
+    if (!q) return false;
+
+    uint8_t index = static_cast<uint8_t>(id - 1);
+    wheel_.disarm(index);
+    pending_ &= ~(1UL << index);
+    memset(q, 0, sizeof(*q));
+    return true;
+}
+
+const ScheduledQuery* QueryScheduler::get(uint8_t id) const {
+    if (id == 0 || id > MAX_QUERIES || queries_[id - 1].id == 0) {
+        return nullptr;
+    }
+    return &queries_[id - 1];
+}
+
+size_t QueryScheduler::count() const {
+    size_t n = 0;
+    for (size_t i = 0; i < MAX_QUERIES; i++) {
+        if (queries_[i].id != 0) n++;
+    }
+    return n;
+}
+
+bool QueryScheduler::poll(uint32_t now, Due& due) {
+    pending_ |= wheel_.advance(now);
+
+    while (pending_ != 0) {
+        uint8_t index = 0;
+        while ((pending_ & (1UL << index)) == 0) index++;
+        pending_ &= ~(1UL << index);
+
+        ScheduledQuery& q = queries_[index];
+        if (q.id == 0) continue;
+
+        due.id = q.id;
+        due.state = q.state;
+        if (q.lease != 0 && now - q.leaseStart >= q.lease) {
+            due.expired = true;
+            memcpy(due.command, q.command, sizeof(due.command));
+            memset(&q, 0, sizeof(q));
+        } else {
+            due.expired = false;
+            due.command[0] = '\0';
+            wheel_.arm(index, q.interval, now);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool QueryScheduler::noteResult(uint8_t id, const uint8_t* result, size_t len) {
+    ScheduledQuery* q = find(id);
+    if (!q) return false;
+
+    uint32_t h = hash(result, len);
+    bool changed = !q->hasResult || h != q->lastHash;
+    q->lastHash = h;
+    q->hasResult = true;
+    return !q->watch || changed;
+}
+
+void QueryScheduler::forget(uint8_t id) {
+    for (size_t i = 0; i < MAX_QUERIES; i++) {
+        if (id == 0 || queries_[i].id == id) {
+            queries_[i].hasResult = false;
+        }
+    }
+}
+
+size_t QueryScheduler::stateLeaf(char* out, size_t cap, const char* command) {
+    size_t len = 0;
+    bool gap = false;
+    for (const char* p = command; *p; p++) {
+        if (*p == ' ') {
+            gap = len > 0;
+            continue;
+        }
+        if (len + (gap ? 2 : 1) >= cap) return 0;
+        if (gap) out[len++] = '/';
+        gap = false;
+        out[len++] = (*p == '+' || *p == '#' || *p == '/') ? '_' : *p;
+    }
+    if (len == 0 || cap == 0) return 0;
+    out[len] = '\0';
+    return len;
+}
+
+uint32_t QueryScheduler::hash(const uint8_t* data, size_t len) {
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+ScheduledQuery* QueryScheduler::find(uint8_t id) {
+    if (id == 0 || id > MAX_QUERIES || queries_[id - 1].id == 0) {
+        return nullptr;
+    }
+    return &queries_[id - 1];
+}
+
+} // namespace espmole
@@ -0,0 +1,182 @@
+#ifndef ESPMOLE_MQTT_SCHEDULE_H
+#define ESPMOLE_MQTT_SCHEDULE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Number of scheduled/watch queries the device holds (max 32)
+#ifndef ESPMOLE_MQTT_MAX_SCHEDULES
+#define ESPMOLE_MQTT_MAX_SCHEDULES 4
+#endif
+
+/// Longest command line a scheduled query can run
+#ifndef ESPMOLE_MQTT_SCHEDULE_CMD_MAX
+#define ESPMOLE_MQTT_SCHEDULE_CMD_MAX 48
+#endif
+
+namespace espmole {
+
+/**
+ * Hashed timing wheel for a small, fixed set of timers.
+ *
+ * Timers are identified by index (0..MAX_TIMERS-1). Arming and firing are
+ * O(1) per timer regardless of how far in the future they expire; timers
+ * longer than one wheel revolution wait out extra rounds.
+ *
+ * Platform independent - time is passed in by the caller.
+ */
+class TimerWheel {
+public:
+    static constexpr size_t MAX_TIMERS = ESPMOLE_MQTT_MAX_SCHEDULES;
+    static constexpr size_t SLOTS = 32;
+    static constexpr uint32_t TICK_MS = 50;
+
+    TimerWheel();
+
+    /// Arm (or re-arm) timer `index` to fire `delayMs` after `now`
+    void arm(uint8_t index, uint32_t delayMs, uint32_t now);
+
+    /// Disarm timer `index` (no-op if not armed)
+    void disarm(uint8_t index);
+
+    bool armed(uint8_t index) const { return timers_[index].armed; }
+
+    /**
+     * Advance the wheel to `now`.
+     * Catches up at most one revolution per call; if the caller stalled
+     * longer than that, timers fire late rather than in a burst.
+     *
+     * @return  Bitmask of timers that fired (bit i = index i)
+     */
+    uint32_t advance(uint32_t now);
+
+private:
+    static constexpr uint8_t NONE = 0xFF;
+
+    struct Timer {
+        bool armed;
+        uint8_t slot;
+        uint8_t next;           ///< Next timer in the same slot
+        uint32_t rounds;        ///< Revolutions left before firing (any uint32 delay)
+    };
+
+    Timer timers_[MAX_TIMERS];
+    uint8_t heads_[SLOTS];
+    uint32_t tick_ = 0;
+    uint32_t tickTime_ = 0;
+    bool started_ = false;
+
+    void unlink(uint8_t index);
+};
+
+/**
+ * A query registered by a controller via `$sched`, or by the firmware
+ * with publishState().
+ */
+struct ScheduledQuery {
+    uint8_t id;                 ///< 1-based, 0 = free
+    bool watch;                 ///< Publish only when the result changes
+    bool state;                 ///< Result goes retained to state/<command>
+    uint32_t interval;          ///< Run interval (ms)
+    uint32_t leaseStart;        ///< Time of registration or last renew
+    uint32_t lease;             ///< Lease length (ms), 0 = never expires
+    uint32_t lastHash;          ///< Hash of the last published result
+    bool hasResult;
+    char command[ESPMOLE_MQTT_SCHEDULE_CMD_MAX];
+};
+
+/**
+ * Fixed table of scheduled ("every N ms") and watch ("on change") queries.
+ *
+ * Each entry holds a lease; entries that are not renewed before the lease
+ * runs out are dropped the next time they come due. Entries with lease 0
+ * stay until cancelled.
+ *
+ * State queries publish their result as a retained last value, so readers
+ * get it from the broker without asking the device. Their first run is
+ * MIN_INTERVAL after registration rather than a whole interval.
+ *
+ * Platform independent - time is passed in by the caller.
+ */
+class QueryScheduler {
+public:
+    static constexpr size_t MAX_QUERIES = ESPMOLE_MQTT_MAX_SCHEDULES;
+    static constexpr size_t COMMAND_MAX = ESPMOLE_MQTT_SCHEDULE_CMD_MAX;
+    static constexpr uint32_t MIN_INTERVAL = 2 * TimerWheel::TICK_MS;
+
+    /// Result of poll()
+    struct Due {
+        uint8_t id;
+        bool expired;           ///< Lease ran out, entry has been removed
+        bool state;             ///< Expired entry was a state query
+        char command[COMMAND_MAX];  ///< Expired entry's command, to clear its state topic
+    };
+
+    QueryScheduler();
+
+    /**
+     * Register a query. First run is one interval from now (state queries:
+     * MIN_INTERVAL).
+     *
+     * @param lease  Lease length (ms), 0 = until cancelled
+     * @param state  Publish the result retained to the state topic
+     * @return  Query ID (1..MAX_QUERIES), or 0 if the table is full or
+     *          the command does not fit
+     */
+    uint8_t add(bool watch, uint32_t interval, const char* command, size_t len,
+                uint32_t lease, uint32_t now, bool state = false);
+
+    /// Restart the lease of query `id`
+    bool renew(uint8_t id, uint32_t now);
+
+    /// Remove query `id`
+    bool cancel(uint8_t id);
+
+    /// Look up query `id` (nullptr if not registered)
+    const ScheduledQuery* get(uint8_t id) const;
+
+    /// Number of registered queries
+    size_t count() const;
+
+    /**
+     * Fetch the next query that came due. Re-arms the query for its next
+     * run, or removes it if its lease ran out.
+     *
+     * @return  false if nothing is due
+     */
+    bool poll(uint32_t now, Due& due);
+
+    /**
+     * Record the result of a run.
+     *
+     * @return  true if the result should be published (always for
+     *          scheduled queries, on change for watch queries)
+     */
+    bool noteResult(uint8_t id, const uint8_t* result, size_t len);
+
+    /// Forget the last result of query `id` (0 = all), so the next run publishes
+    void forget(uint8_t id);
+
+    /**
+     * Topic leaf of a state query: words of the command become topic
+     * levels ("config get wifi" -> "config/get/wifi"); '+', '#' and '/'
+     * within a word become '_'.
+     *
+     * @return Length written, 0 if it does not fit
+     */
+    static size_t stateLeaf(char* out, size_t cap, const char* command);
+
+    /// FNV-1a hash used to detect changed results
+    static uint32_t hash(const uint8_t* data, size_t len);
+
+private:
+    ScheduledQuery queries_[MAX_QUERIES];
+    TimerWheel wheel_;
+    uint32_t pending_ = 0;      ///< Fired timers not yet returned by poll()
+
+    ScheduledQuery* find(uint8_t id);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_SCHEDULE_H
@@ -0,0 +1,92 @@
+#include "MqttStats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace espmole {
+
+namespace {
+
+/// snprintf that appends at out + len and never reports past cap
+size_t append(char* out, size_t cap, size_t len, const char* fmt, ...) {
+    if (len >= cap) return len;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + len, cap - len, fmt, args);
+    va_end(args);
+    if (n < 0) return len;
+    size_t added = static_cast<size_t>(n);
+    return added < cap - len ? len + added : cap - 1;
+}
+
+} // namespace
+
+size_t formatStats(char* out, size_t cap, const StatsSnapshot& s) {
+    if (cap == 0) return 0;
+    out[0] = '\0';
+    size_t len = 0;
+
+    InflightStats none;
+    const InflightStats& q = s.qos ? *s.qos : none;
+    len = append(out, cap, len,
+                 "inflight=%u/%u acked=%lu timeout=%lu aborted=%lu rejected=%lu "
+                 "puback_ms=%lu/%lu/%lu filtered=%lu",
+                 static_cast<unsigned>(s.inflight),
+                 static_cast<unsigned>(s.window),
+                 static_cast<unsigned long>(q.acked),
+                 static_cast<unsigned long>(q.timedOut),
+                 static_cast<unsigned long>(q.aborted),
+                 static_cast<unsigned long>(q.rejected),
+                 static_cast<unsigned long>(q.minLatency),
+                 static_cast<unsigned long>(q.avgLatency),
+                 static_cast<unsigned long>(q.maxLatency),
+                 static_cast<unsigned long>(s.filtered));
+
+    if (s.batch) {
+        len = append(out, cap, len, " bursts=%lu bursts_h=%lu connected_s=%lu batch_dropped=%lu",
+                     static_cast<unsigned long>(s.batch->bursts),
+                     static_cast<unsigned long>(s.burstsPerHour),
+                     static_cast<unsigned long>(s.batch->connectedMs / 1000),
+                     static_cast<unsigned long>(s.batch->dropped));
+    }
+    if (s.link) {
+        len = append(out, cap, len, " srtt=%lu rttvar=%lu ka=%u rtt_lost=%lu",
+                     static_cast<unsigned long>(s.link->srtt),
+                     static_cast<unsigned long>(s.link->rttvar),
+                     static_cast<unsigned>(s.link->keepAlive),
+                     static_cast<unsigned long>(s.link->lost));
+    }
+    if (s.tls) {
+        len = append(out, cap, len, " tls_full=%lu tls_resumed=%lu tls_failed=%lu tls_ms=%lu/%lu",
+                     static_cast<unsigned long>(s.tls->full),
+                     static_cast<unsigned long>(s.tls->resumed),
+                     static_cast<unsigned long>(s.tls->failed),
+                     static_cast<unsigned long>(s.tls->avgFullMs),
+                     static_cast<unsigned long>(s.tls->avgResumedMs));
+    }
+    if (s.mem) {
+        HeapHealth unsampled;
+        const HeapHealth& h = s.heap ? *s.heap : unsampled;
+        len = append(out, cap, len, " mem=%lu/%lu heap=%lu heap_blk=%lu frag=%u",
+                     static_cast<unsigned long>(s.mem->used),
+                     static_cast<unsigned long>(s.mem->reserved),
+                     static_cast<unsigned long>(h.freeBytes),
+                     static_cast<unsigned long>(h.largestBlock),
+                     static_cast<unsigned>(h.fragmentation));
+    }
+    if (s.work) {
+        len = append(out, cap, len, " poll_us=%lu/%lu poll_over=%lu poll_left=%lu",
+                     static_cast<unsigned long>(s.work->lastCallUs),
+                     static_cast<unsigned long>(s.work->maxCallUs),
+                     static_cast<unsigned long>(s.work->overBudget),
+                     static_cast<unsigned long>(s.work->deferred));
+    }
+    if (s.time) {
+        len = append(out, cap, len, " time_err=%lu drift_ppm=%ld",
+                     static_cast<unsigned long>(s.time->errorMs),
+                     static_cast<long>(s.time->driftPpm));
+    }
+    return len;
+}
+
+} // namespace espmole
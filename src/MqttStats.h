@@ -0,0 +1,64 @@
+#ifndef ESPMOLE_MQTT_STATS_H
+#define ESPMOLE_MQTT_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MqttBatch.h"
+#include "MqttInflight.h"
+#include "MqttLinkMonitor.h"
+#include "MqttMemory.h"
+#include "MqttTimeSync.h"
+#include "MqttTlsSession.h"
+#include "MqttWork.h"
+
+namespace espmole {
+
+// -----------------------------------------------------------------------------
+// Stats record, published on the stats topic every config.statsInterval
+//
+//   inflight=<n>/<window> acked=<n> timeout=<n> aborted=<n> rejected=<n>
+//   puback_ms=<min>/<avg>/<max> filtered=<n>
+//   [bursts=<n> bursts_h=<n> connected_s=<s> batch_dropped=<n>]
+//   [srtt=<ms> rttvar=<ms> ka=<s> rtt_lost=<n>]
+//   [tls_full=<n> tls_resumed=<n> tls_failed=<n> tls_ms=<full>/<resumed>]
+//   [mem=<used>/<reserved> heap=<free> heap_blk=<largest> frag=<pct>]
+//   poll_us=<last>/<max> poll_over=<n> poll_left=<n>
+//   [time_err=<ms> drift_ppm=<ppm>]
+//
+// One line, space separated. Bracketed groups are left out when the build or
+// the configuration does not have them.
+// -----------------------------------------------------------------------------
+
+/**
+ * Everything the stats record reports. A group whose pointer is nullptr is
+ * left out.
+ */
+struct StatsSnapshot {
+    uint16_t inflight = 0;                  ///< Unacknowledged QoS 1 publishes
+    uint16_t window = 0;                    ///< In-flight window size
+    const InflightStats* qos = nullptr;
+    uint32_t filtered = 0;                  ///< Events dropped by the consumer filter
+    const BatchStats* batch = nullptr;
+    uint32_t burstsPerHour = 0;
+    const LinkStats* link = nullptr;
+    const TlsStats* tls = nullptr;
+    const MemoryUsage* mem = nullptr;
+    const HeapHealth* heap = nullptr;       ///< Only with mem
+    const WorkStats* work = nullptr;
+    const TimeSyncStats* time = nullptr;
+};
+
+/// Room for the longest record formatStats() produces (583 bytes with every
+/// group and every value at its widest, see test_stats)
+static constexpr size_t STATS_RECORD_MAX = 640;
+
+/**
+ * Format the stats record.
+ *
+ * @return Length written (terminated, truncated to cap - 1)
+ */
+size_t formatStats(char* out, size_t cap, const StatsSnapshot& s);
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_STATS_H
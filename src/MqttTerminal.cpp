@@ -0,0 +1,202 @@
+#include "MqttTerminal.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+constexpr uint8_t KEY_CTRL_C = 0x03;
+constexpr uint8_t KEY_BACKSPACE = 0x08;
+constexpr uint8_t KEY_CTRL_U = 0x15;
+constexpr uint8_t KEY_DELETE = 0x7F;
+
+} // namespace
+
+bool TerminalSession::open(const char* name, size_t len, uint32_t now) {
+    if (len == 0 || len >= NAME_MAX || memchr(name, '/', len) != nullptr) {
+        return false;
+    }
+    close();
+    memcpy(name_, name, len);
+    name_[len] = '\0';
+    lastInput_ = now;
+    return true;
+}
+
+void TerminalSession::close() {
+    name_[0] = '\0';
+    pending_ = 0;
+    limit_ = BUFFER;
+    push_ = false;
+    closing_ = false;
+    lineLen_ = 0;
+    lineOverflow_ = false;
+    lastCr_ = false;
+    mode_ = TERM_LINES;
+    echo_ = false;
+}
+
+bool TerminalSession::matches(const char* name, size_t len) const {
+    return isOpen() && len < NAME_MAX && strncmp(name_, name, len) == 0 && name_[len] == '\0';
+}
+
+void TerminalSession::setCoalescing(uint32_t delayMs, size_t segment) {
+    delayMs_ = delayMs;
+    segment_ = segment == 0 || segment > BUFFER ? BUFFER : segment;
+}
+
+void TerminalSession::setMode(TermMode mode, bool echo) {
+    mode_ = mode;
+    echo_ = mode == TERM_KEYS && echo;
+}
+
+// =============================================================================
+// Input
+// =============================================================================
+
+void TerminalSession::input(const uint8_t* data, size_t len, uint32_t now,
+                            LineFn onLine, void* ctx) {
+    lastInput_ = now;
+    stats_.bytesIn += static_cast<uint32_t>(len);
+
+    for (size_t i = 0; i < len && !closing_; i++) {
+        uint8_t c = data[i];
+
+        // "\r\n" ends one line, not two
+        if (c == '\n' && lastCr_) {
+            lastCr_ = false;
+            continue;
+        }
+        lastCr_ = c == '\r';
+        if (c == '\r' || c == '\n') {
+            if (echo_) print("\r\n", now);
+            completeLine(now, onLine, ctx);
+            continue;
+        }
+
+        if (mode_ == TERM_KEYS) {
+            if (c == KEY_BACKSPACE || c == KEY_DELETE) {
+                if (lineLen_ > 0) {
+                    lineLen_--;
+                    if (echo_) print("\b \b", now);
+                }
+                continue;
+            }
+            if (c == KEY_CTRL_C) {
+                discardLine("^C", now);
+                continue;
+            }
+            if (c == KEY_CTRL_U) {
+                discardLine("^U", now);
+                continue;
+            }
+            if (c < 0x20 && c != '\t') {
+                continue;
+            }
+        }
+
+        if (lineLen_ + 1 >= LINE_MAX) {
+            lineOverflow_ = true;
+            continue;
+        }
+        line_[lineLen_++] = static_cast<char>(c);
+        if (echo_) write(&c, 1, now);
+    }
+}
+
+void TerminalSession::completeLine(uint32_t now, LineFn onLine, void* ctx) {
+    size_t len = lineLen_;
+    line_[len] = '\0';
+    lineLen_ = 0;
+    stats_.lines++;
+
+    if (lineOverflow_) {
+        lineOverflow_ = false;
+        print("line too long", now);
+        print(newline(), now);
+        prompt(now);
+        return;
+    }
+    onLine(*this, line_, len, ctx);
+}
+
+void TerminalSession::discardLine(const char* echo, uint32_t now) {
+    lineLen_ = 0;
+    lineOverflow_ = false;
+    print(echo, now);
+    print(newline(), now);
+    prompt(now);
+}
+
+void TerminalSession::prompt(uint32_t now) {
+    if (prompt_) print(prompt_, now);
+    push();
+}
+
+// =============================================================================
+// Output
+// =============================================================================
+
+size_t TerminalSession::write(const uint8_t* data, size_t len, uint32_t now) {
+    if (!isOpen()) return 0;
+
+    size_t room = limit_ > pending_ ? limit_ - pending_ : 0;
+    size_t n = len < room ? len : room;
+    if (n > 0) {
+        if (pending_ == 0) firstAt_ = now;
+        memcpy(out_ + pending_, data, n);
+        pending_ += n;
+    }
+    stats_.dropped += static_cast<uint32_t>(len - n);
+    return n;
+}
+
+size_t TerminalSession::print(const char* text, uint32_t now) {
+    return write(reinterpret_cast<const uint8_t*>(text), strlen(text), now);
+}
+
+uint8_t* TerminalSession::beginCommand(size_t& cap) {
+    size_t split = pending_ + (BUFFER - pending_) / 2;
+    limit_ = split;
+    cap = BUFFER - split;
+    return out_ + split;
+}
+
+void TerminalSession::endCommand(size_t len, uint32_t now) {
+    size_t split = limit_;
+    limit_ = BUFFER;
+    if (len > BUFFER - split) len = BUFFER - split;
+
+    if (len > 0) {
+        // Close the gap between output streamed meanwhile and the result
+        if (pending_ == 0) firstAt_ = now;
+        memmove(out_ + pending_, out_ + split, len);
+        pending_ += len;
+        if (out_[pending_ - 1] != '\n') print(newline(), now);
+    }
+    prompt(now);
+}
+
+bool TerminalSession::flushDue(uint32_t now) const {
+    if (pending_ == 0 || limit_ < BUFFER) return false;
+    return push_ || closing_ || pending_ >= segment_ || now - firstAt_ >= delayMs_;
+}
+
+size_t TerminalSession::peek(const uint8_t*& data) const {
+    data = out_;
+    return pending_ < segment_ ? pending_ : segment_;
+}
+
+void TerminalSession::consume(size_t n) {
+    if (n > pending_) n = pending_;
+    if (n == 0) return;
+
+    memmove(out_, out_ + n, pending_ - n);
+    pending_ -= n;
+    stats_.bytesOut += static_cast<uint32_t>(n);
+    stats_.chunks++;
+    if (pending_ == 0) push_ = false;
+}
+
+} // namespace espmole
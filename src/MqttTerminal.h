@@ -0,0 +1,185 @@
+#ifndef ESPMOLE_MQTT_TERMINAL_H
+#define ESPMOLE_MQTT_TERMINAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MqttBuildConfig.h"
+
+/// Terminal sessions open at once
+#ifndef ESPMOLE_MQTT_TERM_SESSIONS
+#define ESPMOLE_MQTT_TERM_SESSIONS 2
+#endif
+
+/// Output buffer per session; also bounds one command's output
+#ifndef ESPMOLE_MQTT_TERM_BUFFER
+#define ESPMOLE_MQTT_TERM_BUFFER 1024
+#endif
+
+/// Longest input line per session
+#ifndef ESPMOLE_MQTT_TERM_LINE
+#define ESPMOLE_MQTT_TERM_LINE 128
+#endif
+
+namespace espmole {
+
+/**
+ * How a terminal session reads its input.
+ */
+enum TermMode : uint8_t {
+    TERM_LINES = 0,     ///< Messages carry whole lines; the client edits and echoes
+    TERM_KEYS           ///< Messages carry keystrokes; the session edits (and echoes)
+};
+
+/**
+ * Terminal counters.
+ */
+struct TermStats {
+    uint32_t lines = 0;         ///< Lines completed
+    uint32_t bytesIn = 0;       ///< Input bytes received
+    uint32_t bytesOut = 0;      ///< Output bytes taken by consume()
+    uint32_t chunks = 0;        ///< consume() calls (publishes)
+    uint32_t dropped = 0;       ///< Output bytes lost to a full buffer
+};
+
+/**
+ * One interactive session on the terminal topics.
+ *
+ * Input arrives in arbitrary pieces and is assembled into lines: in
+ * TERM_LINES mode a message may hold several lines or part of one, in
+ * TERM_KEYS mode each message holds a few keystrokes and the session
+ * handles backspace, Ctrl-U (erase line) and Ctrl-C (discard line), and
+ * optionally echoes. Each completed line goes to a callback.
+ *
+ * Output is collected in a fixed buffer and leaves in segments, Nagle
+ * style: a segment goes out when SEGMENT bytes are waiting, when the
+ * oldest waiting byte is older than the coalescing delay, or at once
+ * after push(). Keystroke echo and output streamed in many small writes
+ * thus share publishes, while a finished command (which pushes) is not
+ * delayed.
+ *
+ * A command writes its result straight into the buffer (beginCommand() /
+ * endCommand()), so results are not limited by the response buffer.
+ * Output written while it runs lands before the result.
+ *
+ * Platform independent - the caller passes time in and publishes what
+ * peek() returns.
+ */
+class TerminalSession {
+public:
+    static constexpr size_t BUFFER = ESPMOLE_MQTT_TERM_BUFFER;
+    static constexpr size_t LINE_MAX = ESPMOLE_MQTT_TERM_LINE;
+    static constexpr size_t NAME_MAX = 16;      ///< Session name, including NUL
+
+    /// Receives a completed line (NUL-terminated, without line end)
+    using LineFn = void (*)(TerminalSession& session, const char* line, size_t len, void* ctx);
+
+    /**
+     * Start a session.
+     *
+     * @param name  Session name (topic level), 1..NAME_MAX-1 chars, no '/'
+     * @return      false if the name is not usable
+     */
+    bool open(const char* name, size_t len, uint32_t now);
+
+    /// End the session and discard everything buffered
+    void close();
+
+    bool isOpen() const { return name_[0] != '\0'; }
+    bool matches(const char* name, size_t len) const;
+    const char* name() const { return name_; }
+
+    /// Time since the last input
+    uint32_t idleMs(uint32_t now) const { return now - lastInput_; }
+
+    /**
+     * Output coalescing.
+     *
+     * @param delayMs  Longest time a byte waits for company (0 = no waiting)
+     * @param segment  Bytes per publish, and the amount that goes at once
+     */
+    void setCoalescing(uint32_t delayMs, size_t segment);
+
+    void setMode(TermMode mode, bool echo);
+    TermMode mode() const { return mode_; }
+    bool echo() const { return echo_; }
+
+    /// Written after each command and discarded line (nullptr = none)
+    void setPrompt(const char* prompt) { prompt_ = prompt; }
+
+    /// Line end for output the session adds: "\r\n" with keystrokes, "\n" with lines
+    const char* newline() const { return mode_ == TERM_KEYS ? "\r\n" : "\n"; }
+
+    /**
+     * Feed input; each completed line goes to onLine. Lines longer than
+     * LINE_MAX - 1 are reported and discarded instead.
+     */
+    void input(const uint8_t* data, size_t len, uint32_t now, LineFn onLine, void* ctx);
+
+    // -------------------------------------------------------------------------
+    // Output
+    // -------------------------------------------------------------------------
+
+    /// Append output; returns bytes taken (the rest is counted dropped)
+    size_t write(const uint8_t* data, size_t len, uint32_t now);
+    size_t print(const char* text, uint32_t now);
+
+    /**
+     * Area for a command's result: the upper half of the free space, so
+     * output written while the command runs still fits below it.
+     *
+     * @param cap  Receives the area's size
+     */
+    uint8_t* beginCommand(size_t& cap);
+
+    /// Take `len` result bytes from the area, end the line, prompt and push
+    void endCommand(size_t len, uint32_t now);
+
+    /// Send what is buffered without waiting
+    void push() { push_ = pending_ > 0; }
+
+    /// End the session once the buffered output is out
+    void closeWhenFlushed() { closing_ = true; push(); }
+    bool closing() const { return closing_; }
+
+    /// Is a segment ready to go
+    bool flushDue(uint32_t now) const;
+
+    /// Next segment (up to the segment size); returns its length
+    size_t peek(const uint8_t*& data) const;
+
+    /// Drop `n` bytes after they were published
+    void consume(size_t n);
+
+    size_t pending() const { return pending_; }
+    const TermStats& stats() const { return stats_; }
+
+private:
+    char name_[NAME_MAX] = {};
+    uint8_t out_[BUFFER];
+    size_t pending_ = 0;
+    size_t limit_ = BUFFER;         // write() bound, lowered while a command runs
+    uint32_t firstAt_ = 0;          // When the oldest pending byte was written
+    bool push_ = false;
+    bool closing_ = false;
+
+    char line_[LINE_MAX];
+    size_t lineLen_ = 0;
+    bool lineOverflow_ = false;
+    bool lastCr_ = false;
+    uint32_t lastInput_ = 0;
+
+    TermMode mode_ = TERM_LINES;
+    bool echo_ = false;
+    const char* prompt_ = nullptr;
+    uint32_t delayMs_ = 20;
+    size_t segment_ = 512;
+    TermStats stats_;
+
+    void completeLine(uint32_t now, LineFn onLine, void* ctx);
+    void discardLine(const char* echo, uint32_t now);
+    void prompt(uint32_t now);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_TERMINAL_H
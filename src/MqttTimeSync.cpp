@@ -0,0 +1,244 @@
+#include "MqttTimeSync.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+/// Drift left after estimating it, and crystal tolerance before (ppm)
+constexpr uint32_t RESIDUAL_DRIFT_PPM = 10;
+constexpr uint32_t UNKNOWN_DRIFT_PPM = 100;
+
+/// Parse an unsigned decimal at p, advance past it; false if there is none
+bool parseNumber(const char*& p, const char* end, uint64_t& value) {
+    if (p >= end || *p < '0' || *p > '9') return false;
+    uint64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + static_cast<uint64_t>(*p - '0');
+        p++;
+    }
+    value = v;
+    return true;
+}
+
+} // namespace
+
+void TimeSync::begin(uint32_t intervalMs) {
+    interval_ = intervalMs;
+    reset();
+}
+
+void TimeSync::reset() {
+    count_ = 0;
+    next_ = 0;
+    best_ = SAMPLES;
+    driftRef_ = false;
+    driftValid_ = false;
+    driftPpm_ = 0;
+    outstanding_ = false;
+    requested_ = false;
+}
+
+bool TimeSync::requestDue(uint32_t now) const {
+    if (interval_ == 0 || outstanding_) return false;
+    if (!requested_) return true;
+    uint32_t wait = count_ < SAMPLES ? BURST_INTERVAL_MS : interval_;
+    return now - lastRequest_ >= wait;
+}
+
+size_t TimeSync::startRequest(char* out, size_t cap, uint32_t now) {
+    advance(now);
+    int n = snprintf(out, cap, "time? %lu", static_cast<unsigned long>(now));
+    if (n <= 0 || static_cast<size_t>(n) >= cap) return 0;
+
+    outstanding_ = true;
+    sentAt_ = clock_;
+    lastRequest_ = now;
+    requested_ = true;
+    return static_cast<size_t>(n);
+}
+
+void TimeSync::expire(uint32_t now) {
+    advance(now);
+    if (outstanding_ && clock_ - sentAt_ >= TIMEOUT_MS) {
+        outstanding_ = false;
+        lost_++;
+    }
+}
+
+bool TimeSync::onReply(uint32_t t1, uint64_t T2, uint64_t T3, uint32_t t4) {
+    advance(t4);
+    if (!outstanding_ || static_cast<uint32_t>(sentAt_) != t1 || T3 < T2) {
+        rejected_++;
+        return false;
+    }
+    outstanding_ = false;
+
+    uint64_t rtt = clock_ - sentAt_;
+    uint64_t server = T3 - T2;
+    uint64_t delay = server < rtt ? rtt - server : 0;
+    // A millisecond either way is clock resolution, more is nonsense
+    if (server > rtt + 2 || delay > MAX_DELAY_MS) {
+        rejected_++;
+        return false;
+    }
+
+    Sample& s = samples_[next_];
+    s.local = clock_;
+    s.delay = static_cast<uint32_t>(delay);
+    s.offset = ((static_cast<int64_t>(T2) - static_cast<int64_t>(sentAt_)) +
+                (static_cast<int64_t>(T3) - static_cast<int64_t>(clock_))) / 2;
+    next_ = (next_ + 1) % SAMPLES;
+    if (count_ < SAMPLES) count_++;
+    accepted_++;
+
+    selectBest();
+    return true;
+}
+
+void TimeSync::selectBest() {
+    // Clock filter: the least delayed sample has the least asymmetry
+    size_t best = SAMPLES;
+    for (size_t i = 0; i < count_; i++) {
+        if (best == SAMPLES || samples_[i].delay < samples_[best].delay ||
+            (samples_[i].delay == samples_[best].delay &&
+             samples_[i].local > samples_[best].local)) {
+            best = i;
+        }
+    }
+    best_ = best;
+    const Sample& b = samples_[best_];
+
+    if (!driftRef_) {
+        driftLocal_ = b.local;
+        driftOffset_ = b.offset;
+        driftRef_ = true;
+        return;
+    }
+    if (b.local < driftLocal_ || b.local - driftLocal_ < DRIFT_SPAN_MS) {
+        return;
+    }
+
+    int64_t span = static_cast<int64_t>(b.local - driftLocal_);
+    int64_t slope = (b.offset - driftOffset_) * 1000000 / span;
+    if (slope >= -MAX_DRIFT_PPM && slope <= MAX_DRIFT_PPM) {
+        int32_t ppm = static_cast<int32_t>(slope);
+        driftPpm_ = driftValid_ ? (3 * driftPpm_ + ppm) / 4 : ppm;
+        driftValid_ = true;
+    }
+    driftLocal_ = b.local;
+    driftOffset_ = b.offset;
+}
+
+int64_t TimeSync::offsetAt(uint64_t local) const {
+    const Sample& b = samples_[best_];
+    int64_t since = static_cast<int64_t>(local - b.local);
+    return b.offset + since * driftPpm_ / 1000000;
+}
+
+uint64_t TimeSync::extend(uint32_t now) const {
+    if (clock_ == 0) return now;
+    int32_t delta = static_cast<int32_t>(now - static_cast<uint32_t>(clock_));
+    return clock_ + static_cast<int64_t>(delta);
+}
+
+uint64_t TimeSync::epochMillis(uint32_t now) const {
+    if (!synced()) return 0;
+    uint64_t local = extend(now);
+    return static_cast<uint64_t>(static_cast<int64_t>(local) + offsetAt(local));
+}
+
+TimeSyncStats TimeSync::stats(uint32_t now) const {
+    TimeSyncStats s;
+    s.samples = accepted_;
+    s.rejected = rejected_;
+    s.lost = lost_;
+    s.driftPpm = driftPpm_;
+    if (!synced()) return s;
+
+    const Sample& b = samples_[best_];
+    uint64_t local = extend(now);
+    s.synced = true;
+    s.offsetMs = offsetAt(local);
+    s.delayMs = b.delay;
+    s.ageMs = static_cast<uint32_t>(local - b.local);
+
+    // Half the round trip, plus what the drift error adds up to since
+    uint32_t rate = driftValid_ ? RESIDUAL_DRIFT_PPM : UNKNOWN_DRIFT_PPM;
+    s.errorMs = b.delay / 2 + 1 +
+                static_cast<uint32_t>(static_cast<uint64_t>(s.ageMs) * rate / 1000000);
+    return s;
+}
+
+// =============================================================================
+// Wire Format
+// =============================================================================
+
+bool TimeSync::parseRequest(const char* text, size_t len, uint32_t& t1) {
+    const char* end = text + len;
+    if (len < 7 || strncmp(text, "time? ", 6) != 0) return false;
+    const char* p = text + 6;
+    uint64_t v = 0;
+    if (!parseNumber(p, end, v) || p != end || v > 0xFFFFFFFFULL) return false;
+    t1 = static_cast<uint32_t>(v);
+    return true;
+}
+
+bool TimeSync::parseReply(const char* args, uint32_t& t1, uint64_t& T2, uint64_t& T3) {
+    const char* p = args;
+    const char* end = args + strlen(args);
+    uint64_t v = 0;
+    if (!parseNumber(p, end, v) || v > 0xFFFFFFFFULL || p >= end || *p++ != ' ') return false;
+    t1 = static_cast<uint32_t>(v);
+    if (!parseNumber(p, end, T2) || p >= end || *p++ != ' ') return false;
+    if (!parseNumber(p, end, T3)) return false;
+    while (p < end && *p == ' ') p++;
+    return p == end;
+}
+
+size_t TimeSync::formatReply(char* out, size_t cap, uint32_t t1, uint64_t T2, uint64_t T3) {
+    int n = snprintf(out, cap, "$time %lu %llu %llu", static_cast<unsigned long>(t1),
+                     static_cast<unsigned long long>(T2), static_cast<unsigned long long>(T3));
+    if (n <= 0 || static_cast<size_t>(n) >= cap) return 0;
+    return static_cast<size_t>(n);
+}
+
+// =============================================================================
+// TimeStamper
+// =============================================================================
+
+size_t TimeStamper::stamp(char* out, size_t cap, uint64_t epochMs) {
+    bool absolute = count_ == 0 || epochMs < last_ || epochMs - last_ > DELTA_MAX_MS;
+    int n = absolute
+        ? snprintf(out, cap, "@%llu ", static_cast<unsigned long long>(epochMs))
+        : snprintf(out, cap, "+%lu ", static_cast<unsigned long>(epochMs - last_));
+    if (n <= 0 || static_cast<size_t>(n) >= cap) return 0;
+
+    last_ = epochMs;
+    count_ = absolute ? 1 : static_cast<uint8_t>(count_ + 1);
+    if (count_ >= ABSOLUTE_EVERY) count_ = 0;
+    return static_cast<size_t>(n);
+}
+
+bool TimeStamper::parse(const char* text, size_t len, uint64_t& prev,
+                        uint64_t& epochMs, size_t& consumed) {
+    if (len < 3 || (text[0] != '@' && text[0] != '+')) return false;
+    const char* p = text + 1;
+    const char* end = text + len;
+    uint64_t v = 0;
+    if (!parseNumber(p, end, v) || p >= end || *p != ' ') return false;
+
+    if (text[0] == '@') {
+        epochMs = v;
+    } else {
+        if (prev == 0) return false;
+        epochMs = prev + v;
+    }
+    prev = epochMs;
+    consumed = static_cast<size_t>(p + 1 - text);
+    return true;
+}
+
+} // namespace espmole
@@ -0,0 +1,185 @@
+#ifndef ESPMOLE_MQTT_TIME_SYNC_H
+#define ESPMOLE_MQTT_TIME_SYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+/**
+ * Sync quality.
+ */
+struct TimeSyncStats {
+    bool synced = false;
+    int64_t offsetMs = 0;       ///< Reference time minus local time, at ageMs ago
+    int32_t driftPpm = 0;       ///< Local clock rate error (positive = local runs slow)
+    uint32_t delayMs = 0;       ///< Round trip of the sample in use
+    uint32_t errorMs = 0;       ///< Bound on the error of epochMillis() now
+    uint32_t ageMs = 0;         ///< Since the sample in use was taken
+    uint32_t samples = 0;       ///< Replies accepted
+    uint32_t rejected = 0;      ///< Replies that matched no request or made no sense
+    uint32_t lost = 0;          ///< Requests not answered within TIMEOUT_MS
+};
+
+/**
+ * NTP-style offset and drift estimation against a controller's clock.
+ *
+ * The device sends its local time t1 in a request; the controller answers
+ * with t1, its receive time T2 and its send time T3 (Unix ms); the reply
+ * arrives at local t4. Then, as in NTP:
+ *
+ *   offset = ((T2 - t1) + (T3 - t4)) / 2
+ *   delay  = (t4 - t1) - (T3 - T2)
+ *
+ * The offset is exact if both legs took equally long, and wrong by at most
+ * delay / 2 otherwise. Like NTP's clock filter, the sample with the
+ * smallest delay among the last SAMPLES is used, since queueing only ever
+ * adds delay. Drift is the slope between the samples used over at least
+ * DRIFT_SPAN_MS, smoothed; it carries the offset forward between samples.
+ *
+ * The first SAMPLES requests go out every BURST_INTERVAL_MS to converge
+ * quickly, then every interval given to begin().
+ *
+ * Local time is a 32-bit millisecond clock passed in by the caller (wraps
+ * after 49 days; calls must come more often than every 24 days).
+ * Platform independent.
+ */
+class TimeSync {
+public:
+    static constexpr size_t SAMPLES = 8;
+    static constexpr uint32_t BURST_INTERVAL_MS = 2000;
+    static constexpr uint32_t TIMEOUT_MS = 5000;
+    static constexpr uint32_t MAX_DELAY_MS = 4000;
+    static constexpr uint32_t DRIFT_SPAN_MS = 60000;
+    static constexpr int32_t MAX_DRIFT_PPM = 500;
+
+    /// Longest "time? <t1>" request
+    static constexpr size_t REQUEST_MAX = 24;
+
+    /// @param intervalMs  Between requests once converged, 0 = never request
+    void begin(uint32_t intervalMs);
+
+    /// Forget all samples (e.g. the controller changed)
+    void reset();
+
+    /// Should a request go out now
+    bool requestDue(uint32_t now) const;
+
+    /**
+     * Start a request at local time `now`.
+     *
+     * @param out  Receives "time? <t1>"
+     * @return     Length written, 0 if out is too small
+     */
+    size_t startRequest(char* out, size_t cap, uint32_t now);
+
+    /// Count an unanswered request as lost after TIMEOUT_MS
+    void expire(uint32_t now);
+
+    /**
+     * Apply a reply.
+     *
+     * @param t1   Local time echoed from the request
+     * @param T2   Controller receive time (Unix ms)
+     * @param T3   Controller send time (Unix ms)
+     * @param t4   Local time the reply arrived
+     * @return     false if it matched no outstanding request or was implausible
+     */
+    bool onReply(uint32_t t1, uint64_t T2, uint64_t T3, uint32_t t4);
+
+    bool synced() const { return best_ < SAMPLES; }
+
+    /// Reference (Unix ms) time for local time `now`, 0 if not synced
+    uint64_t epochMillis(uint32_t now) const;
+
+    TimeSyncStats stats(uint32_t now) const;
+
+    // -------------------------------------------------------------------------
+    // Wire format (shared with the controller side)
+    // -------------------------------------------------------------------------
+
+    /// Parse "time? <t1>"; false if `text` is not a request
+    static bool parseRequest(const char* text, size_t len, uint32_t& t1);
+
+    /// Parse the arguments of "$time <t1> <T2> <T3>"
+    static bool parseReply(const char* args, uint32_t& t1, uint64_t& T2, uint64_t& T3);
+
+    /// Format "$time <t1> <T2> <T3>"
+    static size_t formatReply(char* out, size_t cap, uint32_t t1, uint64_t T2, uint64_t T3);
+
+private:
+    struct Sample {
+        uint64_t local = 0;         // t4, extended to 64 bits
+        int64_t offset = 0;
+        uint32_t delay = 0;
+    };
+
+    Sample samples_[SAMPLES];
+    size_t count_ = 0;              // Samples held (up to SAMPLES)
+    size_t next_ = 0;               // Ring position for the next sample
+    size_t best_ = SAMPLES;         // Sample in use, SAMPLES = none
+
+    // Drift reference: the sample in use DRIFT_SPAN_MS ago or more
+    uint64_t driftLocal_ = 0;
+    int64_t driftOffset_ = 0;
+    bool driftRef_ = false;
+    bool driftValid_ = false;
+    int32_t driftPpm_ = 0;
+
+    uint32_t interval_ = 0;
+    uint64_t clock_ = 0;            // Last local time seen, extended
+    bool outstanding_ = false;
+    uint64_t sentAt_ = 0;
+    uint32_t lastRequest_ = 0;
+    bool requested_ = false;
+
+    uint32_t accepted_ = 0;
+    uint32_t rejected_ = 0;
+    uint32_t lost_ = 0;
+
+    uint64_t extend(uint32_t now) const;
+    void advance(uint32_t now) { clock_ = extend(now); }
+    void selectBest();
+    int64_t offsetAt(uint64_t local) const;
+};
+
+/**
+ * Compact timestamps for one stream of messages.
+ *
+ * A stamp is "@<unix-ms> " (absolute) or "+<ms> " (since the previous
+ * stamp of the stream). Absolute stamps go out first, after reset(), every
+ * ABSOLUTE_EVERY stamps, when the delta would exceed DELTA_MAX_MS and
+ * when time went backwards (a sync correction). A consumer that missed a
+ * message therefore resynchronizes within ABSOLUTE_EVERY messages.
+ */
+class TimeStamper {
+public:
+    static constexpr size_t STAMP_MAX = 24;
+    static constexpr uint8_t ABSOLUTE_EVERY = 16;
+    static constexpr uint32_t DELTA_MAX_MS = 600000;
+
+    /// Write the stamp for `epochMs`; returns its length (0 if cap is too small)
+    size_t stamp(char* out, size_t cap, uint64_t epochMs);
+
+    /// Next stamp is absolute (e.g. after reconnecting)
+    void reset() { count_ = 0; }
+
+    /**
+     * Consumer side: read the stamp at the start of `text`.
+     *
+     * @param prev      Time of the previous stamp of the stream, updated
+     * @param epochMs   Receives the message time
+     * @param consumed  Receives the stamp length (including the space)
+     * @return          false if there is no stamp, or a delta without a previous time
+     */
+    static bool parse(const char* text, size_t len, uint64_t& prev,
+                      uint64_t& epochMs, size_t& consumed);
+
+private:
+    uint64_t last_ = 0;
+    uint8_t count_ = 0;             // Stamps since the last absolute one, 0 = next is absolute
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_TIME_SYNC_H
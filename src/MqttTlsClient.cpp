@@ -0,0 +1,280 @@
+#include "MqttTlsClient.h"
+
+#if defined(ESP32) && !defined(NATIVE_BUILD)
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/version.h>
+
+namespace espmole {
+
+TlsClient::TlsClient(Client& transport, TlsSessionCache* cache)
+    : transport_(transport)
+    , ownCache_()
+    , cache_(cache ? cache : &ownCache_)
+{
+}
+
+TlsClient::~TlsClient() {
+    stop();
+}
+
+// =============================================================================
+// Connection
+// =============================================================================
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+    stop();
+    if (!transport_.connect(ip, port)) {
+        return 0;
+    }
+    String host = ip.toString();
+    return startTls(host.c_str(), port) ? 1 : 0;
+}
+
+int TlsClient::connect(const char* host, uint16_t port) {
+    stop();
+    if (!transport_.connect(host, port)) {
+        return 0;
+    }
+    return startTls(host, port) ? 1 : 0;
+}
+
+bool TlsClient::startTls(const char* host, uint16_t port) {
+    mbedtls_ssl_init(&ssl_);
+    mbedtls_ssl_config_init(&conf_);
+    mbedtls_ctr_drbg_init(&drbg_);
+    mbedtls_entropy_init(&entropy_);
+    mbedtls_x509_crt_init(&ca_);
+    active_ = true;
+
+    static const char PERS[] = "espmole-tls";
+    bool ok = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_,
+                                    reinterpret_cast<const unsigned char*>(PERS),
+                                    sizeof(PERS) - 1) == 0
+           && mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT,
+                                          MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT) == 0;
+
+    if (ok && caCert_) {
+        ok = mbedtls_x509_crt_parse(&ca_, reinterpret_cast<const unsigned char*>(caCert_),
+                                    strlen(caCert_) + 1) == 0;
+        mbedtls_ssl_conf_ca_chain(&conf_, &ca_, nullptr);
+        mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else {
+        mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+    }
+
+    if (ok) {
+        mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+        ok = mbedtls_ssl_setup(&ssl_, &conf_) == 0
+          && mbedtls_ssl_set_hostname(&ssl_, host) == 0;
+    }
+
+    if (!ok) {
+        stats_.noteFailure();
+        stop();
+        return false;
+    }
+
+    mbedtls_ssl_set_bio(&ssl_, this, bioSend, bioRecv, nullptr);
+
+    // Offer the cached session - the server decides whether to resume
+    bool offered = false;
+    size_t len = 0;
+    const uint8_t* blob = cache_->load(host, port, len);
+    if (blob) {
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        offered = mbedtls_ssl_session_load(&session, blob, len) == 0
+               && mbedtls_ssl_set_session(&ssl_, &session) == 0;
+        mbedtls_ssl_session_free(&session);
+        if (!offered) cache_->clear();
+    }
+
+    uint32_t start = millis();
+    if (!handshake()) {
+        // A session the server chokes on must not be offered again
+        if (offered) cache_->clear();
+        stats_.noteFailure();
+        stop();
+        return false;
+    }
+    stats_.noteHandshake(resumed_, millis() - start);
+
+    // Servers may issue a fresh ticket on every handshake
+    saveSession(host, port);
+    return true;
+}
+
+bool TlsClient::handshake() {
+    resumed_ = false;
+    uint32_t start = millis();
+
+    // Step manually so the abbreviated handshake can be observed
+    while (ssl_.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        int ret = mbedtls_ssl_handshake_step(&ssl_);
+#if MBEDTLS_VERSION_MAJOR < 3
+        if (ssl_.handshake != nullptr && ssl_.handshake->resume) {
+            resumed_ = true;
+        }
+#endif
+        if (ret == 0) continue;
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return false;
+        }
+        if (millis() - start > handshakeTimeout_) {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
+}
+
+void TlsClient::saveSession(const char* host, uint16_t port) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    size_t len = 0;
+    if (mbedtls_ssl_get_session(&ssl_, &session) == 0
+        && mbedtls_ssl_session_save(&session, cache_->buffer(),
+                                    TlsSessionCache::SESSION_MAX, &len) == 0) {
+        cache_->commit(host, port, len);
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
+void TlsClient::freeTls() {
+    if (!active_) return;
+    mbedtls_ssl_free(&ssl_);
+    mbedtls_ssl_config_free(&conf_);
+    mbedtls_ctr_drbg_free(&drbg_);
+    mbedtls_entropy_free(&entropy_);
+    mbedtls_x509_crt_free(&ca_);
+    active_ = false;
+}
+
+void TlsClient::stop() {
+    if (active_ && ssl_.state == MBEDTLS_SSL_HANDSHAKE_OVER) {
+        mbedtls_ssl_close_notify(&ssl_);
+    }
+    freeTls();
+    transport_.stop();
+    peeked_ = -1;
+}
+
+uint8_t TlsClient::connected() {
+    if (!active_) return 0;
+    return transport_.connected() || mbedtls_ssl_get_bytes_avail(&ssl_) > 0;
+}
+
+// =============================================================================
+// Data
+// =============================================================================
+
+size_t TlsClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t TlsClient::write(const uint8_t* buf, size_t size) {
+    if (!active_) return 0;
+
+    size_t sent = 0;
+    uint32_t start = millis();
+    while (sent < size) {
+        int ret = mbedtls_ssl_write(&ssl_, buf + sent, size - sent);
+        if (ret > 0) {
+            sent += static_cast<size_t>(ret);
+            continue;
+        }
+        if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+            || millis() - start > handshakeTimeout_) {
+            break;
+        }
+        delay(1);
+    }
+    return sent;
+}
+
+int TlsClient::available() {
+    if (!active_) return 0;
+
+    // A zero-length read processes incoming records without consuming data
+    int ret = mbedtls_ssl_read(&ssl_, nullptr, 0);
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        stop();
+        return 0;
+    }
+    return static_cast<int>(mbedtls_ssl_get_bytes_avail(&ssl_)) + (peeked_ >= 0 ? 1 : 0);
+}
+
+int TlsClient::read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsClient::read(uint8_t* buf, size_t size) {
+    if (!active_ || size == 0) return -1;
+
+    size_t n = 0;
+    if (peeked_ >= 0) {
+        buf[n++] = static_cast<uint8_t>(peeked_);
+        peeked_ = -1;
+        if (n == size || mbedtls_ssl_get_bytes_avail(&ssl_) == 0) {
+            return static_cast<int>(n);
+        }
+    }
+
+    int ret = mbedtls_ssl_read(&ssl_, buf + n, size - n);
+    if (ret > 0) {
+        return static_cast<int>(n) + ret;
+    }
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        stop();
+    }
+    return n > 0 ? static_cast<int>(n) : -1;
+}
+
+int TlsClient::peek() {
+    if (peeked_ < 0) {
+        uint8_t b;
+        if (read(&b, 1) == 1) peeked_ = b;
+    }
+    return peeked_;
+}
+
+void TlsClient::flush() {
+    transport_.flush();
+}
+
+// =============================================================================
+// mbedTLS I/O over the wrapped client
+// =============================================================================
+
+int TlsClient::bioSend(void* ctx, const unsigned char* buf, size_t len) {
+    TlsClient* self = static_cast<TlsClient*>(ctx);
+    size_t n = self->transport_.write(buf, len);
+    if (n == 0) {
+        return self->transport_.connected() ? MBEDTLS_ERR_SSL_WANT_WRITE
+                                            : MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return static_cast<int>(n);
+}
+
+int TlsClient::bioRecv(void* ctx, unsigned char* buf, size_t len) {
+    TlsClient* self = static_cast<TlsClient*>(ctx);
+    int avail = self->transport_.available();
+    if (avail <= 0) {
+        return self->transport_.connected() ? MBEDTLS_ERR_SSL_WANT_READ
+                                            : MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    if (static_cast<size_t>(avail) < len) len = static_cast<size_t>(avail);
+    int n = self->transport_.read(buf, len);
+    return n > 0 ? n : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+} // namespace espmole
+
+#endif // ESP32 && !NATIVE_BUILD
@@ -0,0 +1,100 @@
+#ifndef ESPMOLE_MQTT_TLS_CLIENT_H
+#define ESPMOLE_MQTT_TLS_CLIENT_H
+
+#if defined(ESP32) && !defined(NATIVE_BUILD)
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#include "MqttTlsSession.h"
+
+namespace espmole {
+
+/**
+ * TLS client with session resumption, for PubSubClient.
+ *
+ * Wraps a plain Client (usually WiFiClient) in mbedTLS. After every full
+ * handshake the session (ticket or ID) is saved into a TlsSessionCache and
+ * offered again on the next connect, which turns the >1 s full handshake
+ * into a single round trip. Put the cache in RTC memory to keep it across
+ * deep sleep.
+ *
+ * @code
+ *   RTC_NOINIT_ATTR espmole::TlsSessionCache session;
+ *   WiFiClient tcp;
+ *   espmole::TlsClient tls(tcp, &session);
+ *   tls.setCACert(rootCa);
+ *   PubSubClient mqtt(tls);
+ *   mqtt.setServer("broker.example.com", 8883);
+ *   mole.attachTo(&mqtt);
+ *   mole.reportTlsStats(&tls.handshakeStats());
+ * @endcode
+ */
+class TlsClient : public Client {
+public:
+    /**
+     * @param transport  Underlying TCP client
+     * @param cache      Session cache (nullptr = keep one in this object)
+     */
+    explicit TlsClient(Client& transport, TlsSessionCache* cache = nullptr);
+    ~TlsClient();
+
+    /// PEM root certificate; without one the server is NOT verified
+    void setCACert(const char* pem) { caCert_ = pem; }
+
+    /// Give up on a handshake after this long (default 10 s)
+    void setHandshakeTimeout(uint32_t ms) { handshakeTimeout_ = ms; }
+
+    /// true if the last handshake resumed a cached session
+    bool resumed() const { return resumed_; }
+
+    const TlsHandshakeStats& handshakeStats() const { return stats_; }
+    TlsSessionCache& sessionCache() { return *cache_; }
+
+    // Client interface
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+private:
+    Client& transport_;
+    TlsSessionCache ownCache_;
+    TlsSessionCache* cache_;
+    TlsHandshakeStats stats_;
+    const char* caCert_ = nullptr;
+    uint32_t handshakeTimeout_ = 10000;
+
+    mbedtls_ssl_context ssl_;
+    mbedtls_ssl_config conf_;
+    mbedtls_ctr_drbg_context drbg_;
+    mbedtls_entropy_context entropy_;
+    mbedtls_x509_crt ca_;
+    bool active_ = false;
+    bool resumed_ = false;
+    int peeked_ = -1;
+
+    bool startTls(const char* host, uint16_t port);
+    bool handshake();
+    void saveSession(const char* host, uint16_t port);
+    void freeTls();
+
+    static int bioSend(void* ctx, const unsigned char* buf, size_t len);
+    static int bioRecv(void* ctx, unsigned char* buf, size_t len);
+};
+
+} // namespace espmole
+
+#endif // ESP32 && !NATIVE_BUILD
+#endif // ESPMOLE_MQTT_TLS_CLIENT_H
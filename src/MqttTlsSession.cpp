@@ -0,0 +1,106 @@
+#include "MqttTlsSession.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+constexpr uint32_t SESSION_MAGIC = 0x544C5331;      // "TLS1"
+
+uint32_t fnv1a(uint32_t h, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+uint32_t checksumOf(const TlsSessionCache& c) {
+    uint32_t h = 2166136261UL;
+    h = fnv1a(h, reinterpret_cast<const uint8_t*>(&c.key), sizeof(c.key));
+    h = fnv1a(h, reinterpret_cast<const uint8_t*>(&c.length), sizeof(c.length));
+    return fnv1a(h, c.blob, c.length);
+}
+
+} // namespace
+
+// =============================================================================
+// TlsSessionCache
+// =============================================================================
+
+uint32_t TlsSessionCache::keyOf(const char* host, uint16_t port) {
+    uint32_t h = fnv1a(2166136261UL, reinterpret_cast<const uint8_t*>(host), strlen(host));
+    uint8_t p[2] = {static_cast<uint8_t>(port >> 8), static_cast<uint8_t>(port)};
+    return fnv1a(h, p, sizeof(p));
+}
+
+bool TlsSessionCache::store(const char* host, uint16_t port, const uint8_t* data, size_t len) {
+    if (len == 0 || len > SESSION_MAX) {
+        clear();
+        return false;
+    }
+    memcpy(buffer(), data, len);
+    return commit(host, port, len);
+}
+
+uint8_t* TlsSessionCache::buffer() {
+    clear();
+    return blob;
+}
+
+bool TlsSessionCache::commit(const char* host, uint16_t port, size_t len) {
+    if (len == 0 || len > SESSION_MAX) {
+        clear();
+        return false;
+    }
+
+    key = keyOf(host, port);
+    length = static_cast<uint32_t>(len);
+    checksum = checksumOf(*this);
+    magic = SESSION_MAGIC;
+    return true;
+}
+
+const uint8_t* TlsSessionCache::load(const char* host, uint16_t port, size_t& len) const {
+    if (!valid() || key != keyOf(host, port)) {
+        return nullptr;
+    }
+    len = length;
+    return blob;
+}
+
+void TlsSessionCache::clear() {
+    magic = 0;
+    length = 0;
+}
+
+bool TlsSessionCache::valid() const {
+    return magic == SESSION_MAGIC
+        && length > 0 && length <= SESSION_MAX
+        && checksum == checksumOf(*this);
+}
+
+// =============================================================================
+// TlsHandshakeStats
+// =============================================================================
+
+uint32_t TlsHandshakeStats::average(uint32_t avg, uint32_t count, uint32_t sample) {
+    // First sample seeds the average
+    if (count == 1) return sample;
+    int32_t delta = static_cast<int32_t>(sample - avg);
+    return static_cast<uint32_t>(static_cast<int32_t>(avg) + delta / 8);
+}
+
+void TlsHandshakeStats::noteHandshake(bool resumed, uint32_t ms) {
+    stats_.lastMs = ms;
+    if (resumed) {
+        stats_.resumed++;
+        stats_.avgResumedMs = average(stats_.avgResumedMs, stats_.resumed, ms);
+    } else {
+        stats_.full++;
+        stats_.avgFullMs = average(stats_.avgFullMs, stats_.full, ms);
+    }
+}
+
+} // namespace espmole
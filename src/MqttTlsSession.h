@@ -0,0 +1,112 @@
+#ifndef ESPMOLE_MQTT_TLS_SESSION_H
+#define ESPMOLE_MQTT_TLS_SESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Largest serialized TLS session (ticket + session data) that can be cached
+#ifndef ESPMOLE_MQTT_TLS_SESSION_MAX
+#define ESPMOLE_MQTT_TLS_SESSION_MAX 2048
+#endif
+
+namespace espmole {
+
+/**
+ * Cache for one serialized TLS session, used to resume the handshake on
+ * reconnect (session ticket or session ID, whatever the server issued).
+ *
+ * The cache is a plain aggregate with no constructor, so it can live in
+ * memory that survives deep sleep:
+ *
+ * @code
+ *   RTC_NOINIT_ATTR espmole::TlsSessionCache tlsSession;
+ * @endcode
+ *
+ * After a cold boot such memory holds garbage; a magic value and a
+ * checksum make load() ignore it. Zero-initialized storage is empty.
+ *
+ * The blob format belongs to the TLS library that produced it; the cache
+ * only stores it, keyed by server.
+ */
+struct TlsSessionCache {
+    static constexpr size_t SESSION_MAX = ESPMOLE_MQTT_TLS_SESSION_MAX;
+
+    /**
+     * Store a session for a server, replacing any previous one.
+     *
+     * @param host  Server name the session belongs to
+     * @param port  Server port
+     * @param blob  Serialized session
+     * @param len   Blob length
+     * @return      false if the blob is too large (the cache is cleared)
+     */
+    bool store(const char* host, uint16_t port, const uint8_t* blob, size_t len);
+
+    /**
+     * Session for a server.
+     *
+     * @param len  Set to the blob length
+     * @return     Serialized session, nullptr if none is cached for this server
+     */
+    const uint8_t* load(const char* host, uint16_t port, size_t& len) const;
+
+    /**
+     * Serialize straight into the cache: write up to SESSION_MAX bytes to
+     * buffer(), then commit() them. The old session is invalid meanwhile.
+     */
+    uint8_t* buffer();
+
+    /// Commit `len` bytes written to buffer() as the session for a server
+    bool commit(const char* host, uint16_t port, size_t len);
+
+    /// Forget the session (e.g. after the server rejected it)
+    void clear();
+
+    /// true if a session for any server is cached
+    bool valid() const;
+
+    // Storage - public only to keep the type an aggregate
+    uint32_t magic;
+    uint32_t key;
+    uint32_t checksum;
+    uint32_t length;
+    uint8_t blob[SESSION_MAX];
+
+    static uint32_t keyOf(const char* host, uint16_t port);
+};
+
+/**
+ * Handshake counters. Full handshakes pay for the certificate chain and
+ * key exchange; resumed ones only for a round trip.
+ */
+struct TlsStats {
+    uint32_t full = 0;              ///< Full handshakes completed
+    uint32_t resumed = 0;           ///< Abbreviated (resumed) handshakes completed
+    uint32_t failed = 0;            ///< Handshakes that failed or timed out
+    uint32_t lastMs = 0;            ///< Duration of the last handshake
+    uint32_t avgFullMs = 0;         ///< EWMA (1/8) of full handshake time
+    uint32_t avgResumedMs = 0;      ///< EWMA (1/8) of resumed handshake time
+};
+
+/**
+ * Records handshake outcomes into TlsStats.
+ */
+class TlsHandshakeStats {
+public:
+    /// A handshake completed after `ms` milliseconds
+    void noteHandshake(bool resumed, uint32_t ms);
+
+    /// A handshake failed
+    void noteFailure() { stats_.failed++; }
+
+    const TlsStats& stats() const { return stats_; }
+
+private:
+    TlsStats stats_;
+
+    static uint32_t average(uint32_t avg, uint32_t count, uint32_t sample);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_TLS_SESSION_H
@@ -0,0 +1,158 @@
+#include "MqttTrace.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+const size_t ALIGN = 8;
+
+size_t padTo(size_t len) {
+    return (len + ALIGN - 1) & ~(ALIGN - 1);
+}
+
+} // namespace
+
+// =============================================================================
+// Writer
+// =============================================================================
+
+bool TraceWriter::begin(SinkFn sink, void* sinkCtx, Clock clock, void* clockCtx) {
+    sink_ = sink;
+    sinkCtx_ = sinkCtx;
+    clock_ = clock;
+    clockCtx_ = clockCtx;
+    stats_ = TraceStats();
+    elapsed_ = 0;
+    start_ = last_ = clock_ ? clock_(clockCtx_) : 0;
+
+    TraceFileHeader header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.headerSize = sizeof(TraceFileHeader);
+    header.recordAlign = ALIGN;
+    header.reserved = 0;
+    if (!put(&header, sizeof(header))) {
+        sink_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool TraceWriter::record(TraceDirection direction, const char* topic, const uint8_t* payload,
+                         size_t len, uint8_t qos, bool retain) {
+    if (lockFn_) lockFn_(true, lockCtx_);
+
+    bool ok = false;
+    if (sink_ != nullptr) {
+        // Unsigned difference survives one wrap between records
+        uint32_t now = clock_ ? clock_(clockCtx_) : start_;
+        elapsed_ += now - last_;
+        last_ = now;
+
+        size_t topicLen = strlen(topic);
+        if (topicLen > 0xffff) topicLen = 0xffff;
+
+        TraceRecordHeader header;
+        header.timeUs = elapsed_;
+        header.payloadLen = static_cast<uint32_t>(len);
+        header.topicLen = static_cast<uint16_t>(topicLen);
+        header.direction = direction;
+        header.flags = static_cast<uint8_t>((qos & 0x03) | (retain ? 0x04 : 0));
+
+        static const uint8_t zeros[ALIGN] = {0};
+        size_t body = topicLen + 1 + len;
+        ok = put(&header, sizeof(header)) &&
+             put(topic, topicLen) &&
+             put(zeros, 1) &&
+             (len == 0 || put(payload, len)) &&
+             (padTo(body) == body || put(zeros, padTo(body) - body));
+
+        if (ok) {
+            stats_.records++;
+        } else {
+            // A partial record ends the trace; readers stop at it
+            stats_.failed++;
+            sink_ = nullptr;
+        }
+    }
+
+    if (lockFn_) lockFn_(false, lockCtx_);
+    return ok;
+}
+
+bool TraceWriter::put(const void* data, size_t len) {
+    if (!sink_(static_cast<const uint8_t*>(data), len, sinkCtx_)) {
+        return false;
+    }
+    stats_.bytes += len;
+    return true;
+}
+
+size_t TraceWriter::recordSize(size_t topicLen, size_t payloadLen) {
+    return sizeof(TraceRecordHeader) + padTo(topicLen + 1 + payloadLen);
+}
+
+// =============================================================================
+// Reader
+// =============================================================================
+
+TraceReader::TraceReader(const uint8_t* data, size_t size)
+    : data_(data), size_(size), pos_(0), valid_(false)
+{
+    if (data_ == nullptr || size_ < sizeof(TraceFileHeader)) {
+        return;
+    }
+    TraceFileHeader header;
+    memcpy(&header, data_, sizeof(header));
+    valid_ = header.magic == TRACE_MAGIC && header.version == TRACE_VERSION &&
+             header.headerSize >= sizeof(TraceFileHeader) && header.headerSize <= size_ &&
+             header.recordAlign == ALIGN;
+    pos_ = valid_ ? padTo(header.headerSize) : 0;
+}
+
+bool TraceReader::next(TraceEvent& event) {
+    if (!valid_ || pos_ >= size_) {
+        return false;
+    }
+    if (size_ - pos_ < sizeof(TraceRecordHeader)) {
+        truncated_ = true;
+        return false;
+    }
+
+    TraceRecordHeader header;
+    memcpy(&header, data_ + pos_, sizeof(header));
+    size_t body = static_cast<size_t>(header.topicLen) + 1 + header.payloadLen;
+    size_t avail = size_ - pos_ - sizeof(header);
+    const char* topic = reinterpret_cast<const char*>(data_ + pos_ + sizeof(header));
+    if (body > avail || topic[header.topicLen] != '\0' || header.direction > TRACE_OUT) {
+        truncated_ = true;
+        return false;
+    }
+
+    event.timeUs = header.timeUs;
+    event.direction = header.direction;
+    event.qos = header.flags & 0x03;
+    event.retain = (header.flags & 0x04) != 0;
+    event.topic = topic;
+    event.topicLen = header.topicLen;
+    event.payload = reinterpret_cast<const uint8_t*>(topic + header.topicLen + 1);
+    event.len = header.payloadLen;
+
+    // The last record's padding may be missing if the sink was cut short
+    size_t step = sizeof(header) + padTo(body);
+    pos_ = step <= size_ - pos_ ? pos_ + step : size_;
+    return true;
+}
+
+void TraceReader::rewind() {
+    truncated_ = false;
+    if (valid_) {
+        TraceFileHeader header;
+        memcpy(&header, data_, sizeof(header));
+        pos_ = padTo(header.headerSize);
+    }
+}
+
+} // namespace espmole
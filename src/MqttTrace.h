@@ -0,0 +1,168 @@
+#ifndef ESPMOLE_MQTT_TRACE_H
+#define ESPMOLE_MQTT_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+// -----------------------------------------------------------------------------
+// Trace file format (little-endian, version 1)
+//
+//   TraceFileHeader
+//   { TraceRecordHeader, topic, '\0', payload, padding to 8 bytes } ...
+//
+// Every record header is 8-byte aligned, so a mapped file can be walked in
+// place: topics are NUL-terminated and payloads are contiguous.
+// -----------------------------------------------------------------------------
+
+static constexpr uint32_t TRACE_MAGIC = 0x52544d45;    ///< "EMTR"
+static constexpr uint16_t TRACE_VERSION = 1;
+
+enum TraceDirection : uint8_t {
+    TRACE_IN = 0,               ///< Received (handleMessage)
+    TRACE_OUT = 1               ///< Published (mqttPublish)
+};
+
+struct TraceFileHeader {
+    uint32_t magic;             ///< TRACE_MAGIC
+    uint16_t version;           ///< TRACE_VERSION
+    uint16_t headerSize;        ///< sizeof(TraceFileHeader)
+    uint32_t recordAlign;       ///< 8
+    uint32_t reserved;
+};
+
+struct TraceRecordHeader {
+    uint64_t timeUs;            ///< Microseconds since the trace started
+    uint32_t payloadLen;
+    uint16_t topicLen;          ///< Without the terminating NUL
+    uint8_t direction;          ///< TraceDirection
+    uint8_t flags;              ///< Bits 0-1 QoS, bit 2 retain
+};
+
+static_assert(sizeof(TraceFileHeader) == 16, "trace header layout");
+static_assert(sizeof(TraceRecordHeader) == 16, "trace record layout");
+
+/**
+ * One record, pointing into the trace buffer.
+ */
+struct TraceEvent {
+    uint64_t timeUs = 0;
+    uint8_t direction = TRACE_IN;
+    uint8_t qos = 0;
+    bool retain = false;
+    const char* topic = nullptr;        ///< NUL-terminated
+    size_t topicLen = 0;
+    const uint8_t* payload = nullptr;
+    size_t len = 0;
+};
+
+/**
+ * Trace counters.
+ */
+struct TraceStats {
+    uint32_t records = 0;       ///< Records written
+    uint32_t failed = 0;        ///< Records the sink refused (trace stopped)
+    uint64_t bytes = 0;         ///< Bytes written, header included
+};
+
+/**
+ * Writes timestamped inbound and outbound messages to a sink.
+ *
+ * The sink is anything that takes bytes: a LittleFS/SD File, a RAM
+ * buffer, a socket. A record is written as a few consecutive sink calls;
+ * once the sink refuses a write the trace stops, so a full card leaves a
+ * valid (truncated) trace behind. MqttTransport::setTrace() connects the
+ * writer to handleMessage() and mqttPublish().
+ *
+ * Inbound messages arrive on the MQTT client's task while publishes come
+ * from the application, so install a lock with setLock() on multi-task
+ * targets.
+ */
+class TraceWriter {
+public:
+    /// Append bytes; false if they could not all be written
+    using SinkFn = bool (*)(const uint8_t* data, size_t len, void* ctx);
+    /// Free-running microsecond clock (wraps are handled)
+    using Clock = uint32_t (*)(void* ctx);
+    /// Lock / unlock around one record
+    using LockFn = void (*)(bool lock, void* ctx);
+
+    /**
+     * Start a trace: writes the file header and zeroes the clock.
+     *
+     * @return  false if the sink refused the header
+     */
+    bool begin(SinkFn sink, void* sinkCtx, Clock clock, void* clockCtx = nullptr);
+
+    /// Stop writing (the sink is not touched again)
+    void end() { sink_ = nullptr; }
+
+    bool active() const { return sink_ != nullptr; }
+
+    void setLock(LockFn lock, void* ctx) {
+        lockFn_ = lock;
+        lockCtx_ = ctx;
+    }
+
+    /**
+     * Append one message.
+     *
+     * @return  false if the trace is not active or the sink failed
+     */
+    bool record(TraceDirection direction, const char* topic, const uint8_t* payload,
+                size_t len, uint8_t qos, bool retain);
+
+    const TraceStats& stats() const { return stats_; }
+
+    /// Bytes one record takes, padding included
+    static size_t recordSize(size_t topicLen, size_t payloadLen);
+
+private:
+    SinkFn sink_ = nullptr;
+    void* sinkCtx_ = nullptr;
+    Clock clock_ = nullptr;
+    void* clockCtx_ = nullptr;
+    LockFn lockFn_ = nullptr;
+    void* lockCtx_ = nullptr;
+    uint32_t start_ = 0;
+    uint32_t last_ = 0;
+    uint64_t elapsed_ = 0;      ///< Unwrapped time of the last record
+    TraceStats stats_;
+
+    bool put(const void* data, size_t len);
+};
+
+/**
+ * Walks a trace held in memory (a mapped file or a RAM buffer).
+ *
+ * Events point into the buffer - no copies are made. A record cut short
+ * by the end of the buffer ends the walk; truncated() then reports it.
+ */
+class TraceReader {
+public:
+    TraceReader(const uint8_t* data, size_t size);
+
+    /// true if the buffer starts with a supported trace header
+    bool valid() const { return valid_; }
+
+    /// Read the next record; false at the end of the trace
+    bool next(TraceEvent& event);
+
+    /// Start again from the first record
+    void rewind();
+
+    /// true if the walk stopped at an incomplete or corrupt record
+    bool truncated() const { return truncated_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_;
+    bool valid_;
+    bool truncated_ = false;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_TRACE_H
@@ -1,8 +1,17 @@
-#ifndef NATIVE_BUILD
+#if !defined(NATIVE_BUILD) || defined(ESPMOLE_MQTT_NATIVE_TRANSPORT)
 
 #include "MqttTransport.h"
 #include <ESPMoleCore.h>
 #include <AsyncMqttClient.h>
+#if ESPMOLE_MQTT_FEATURE_BROKER
+#include "MqttMicroBroker.h"
+#endif
+#if ESPMOLE_MQTT_FEATURE_TRACE
+#include "MqttTrace.h"
+#endif
+#if ESPMOLE_MQTT_FEATURE_PROBE
+#include "MqttProbe.h"
+#endif
 
 // PubSubClient support is optional - only include if available
 #if __has_include(<PubSubClient.h>)
@@ -14,12 +23,64 @@
 
 #if defined(ESP32)
     #include <WiFi.h>
+    #include <esp_heap_caps.h>
 #elif defined(ESP8266)
     #include <ESP8266WiFi.h>
 #endif
 
+#include <stdarg.h>
+#include <stdlib.h>
+
 namespace espmole {
 
+// =============================================================================
+// Helpers
+// =============================================================================
+
+namespace {
+
+/// snprintf into a byte buffer, returns bytes written (truncated to cap - 1)
+size_t formatTo(uint8_t* out, size_t cap, const char* fmt, ...) {
+    if (cap == 0) return 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(reinterpret_cast<char*>(out), cap, fmt, args);
+    va_end(args);
+    if (n <= 0) return 0;
+    return static_cast<size_t>(n) < cap ? static_cast<size_t>(n) : cap - 1;
+}
+
+#if ESPMOLE_MQTT_FEATURE_JOURNAL || ESPMOLE_MQTT_FEATURE_SCHED || ESPMOLE_MQTT_FEATURE_LOG || \
+    ESPMOLE_MQTT_FEATURE_MEM || ESPMOLE_MQTT_FEATURE_TIME || ESPMOLE_MQTT_FEATURE_TERM || \
+    ESPMOLE_MQTT_FEATURE_SELFTEST
+/// Consume `word` from the start of `p` if it is a whole word, skipping trailing spaces
+bool takeWord(const char*& p, const char* word) {
+    size_t n = strlen(word);
+    if (strncmp(p, word, n) != 0 || (p[n] != '\0' && p[n] != ' ')) {
+        return false;
+    }
+    p += n;
+    while (*p == ' ') p++;
+    return true;
+}
+#endif
+
+#if ESPMOLE_MQTT_FEATURE_BATCH || ESPMOLE_MQTT_FEATURE_LOG
+/// Clock for the duty-cycle batch and log timestamps
+uint32_t arduinoMillis(void* ctx) {
+    (void)ctx;
+    return millis();
+}
+#endif
+
+/// Clock for the poll() budget
+uint32_t arduinoMicros(void* ctx) {
+    (void)ctx;
+    return micros();
+}
+
+} // namespace
+
 // =============================================================================
 // Constructors / Destructor
 // =============================================================================
@@ -29,11 +90,16 @@ MqttTransport::MqttTransport(Dispatcher* dispatcher)
     , standaloneMode_(false)
 {
     // Integration mode - topics will be built when attachTo() is called
-    memset(cmdTopic_, 0, sizeof(cmdTopic_));
-    memset(respTopic_, 0, sizeof(respTopic_));
-    memset(statusTopic_, 0, sizeof(statusTopic_));
-    memset(eventTopic_, 0, sizeof(eventTopic_));
-    memset(deviceId_, 0, sizeof(deviceId_));
+    inflight_.setWindow(config_.inflightWindow);
+    inflight_.setLock(onLock, this);
+    work_.begin(WORK_TASKS, workStep, this, arduinoMicros);
+#if ESPMOLE_MQTT_FEATURE_LOG
+    log_.setClock(arduinoMillis);
+    log_.setLevel(config_.logLevel);
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    timeSync_.begin(config_.timeSyncInterval);
+#endif
 }
 
 MqttTransport::MqttTransport(Dispatcher* dispatcher, const MqttConfig& config)
@@ -41,11 +107,16 @@ MqttTransport::MqttTransport(Dispatcher* dispatcher, const MqttConfig& config)
     , config_(config)
     , standaloneMode_(true)
 {
-    memset(cmdTopic_, 0, sizeof(cmdTopic_));
-    memset(respTopic_, 0, sizeof(respTopic_));
-    memset(statusTopic_, 0, sizeof(statusTopic_));
-    memset(eventTopic_, 0, sizeof(eventTopic_));
-    memset(deviceId_, 0, sizeof(deviceId_));
+    inflight_.setWindow(config_.inflightWindow);
+    inflight_.setLock(onLock, this);
+    work_.begin(WORK_TASKS, workStep, this, arduinoMicros);
+#if ESPMOLE_MQTT_FEATURE_LOG
+    log_.setClock(arduinoMillis);
+    log_.setLevel(config_.logLevel);
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    timeSync_.begin(config_.timeSyncInterval);
+#endif
 }
 
 MqttTransport::~MqttTransport() {
@@ -60,14 +131,18 @@ MqttTransport::~MqttTransport() {
 // Topic Building
 // =============================================================================
 
+#if !ESPMOLE_MQTT_STATIC_TOPICS
+
 void MqttTransport::buildDeviceId() {
     if (config_.deviceId != nullptr) {
         strncpy(deviceId_, config_.deviceId, DEVICE_ID_MAX_LEN - 1);
         deviceId_[DEVICE_ID_MAX_LEN - 1] = '\0';
     } else {
         // Use MAC address as device ID
-        uint8_t mac[6];
+        uint8_t mac[6] = {0, 0, 0, 0, 0, 0};
+#if defined(ESP32) || defined(ESP8266)
         WiFi.macAddress(mac);
+#endif
         snprintf(deviceId_, DEVICE_ID_MAX_LEN, "%02X%02X%02X%02X%02X%02X",
                  mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     }
@@ -82,8 +157,66 @@ void MqttTransport::buildTopics() {
     snprintf(respTopic_, TOPIC_MAX_LEN, "%s/%s/resp", base, deviceId_);
     snprintf(statusTopic_, TOPIC_MAX_LEN, "%s/%s/status", base, deviceId_);
     snprintf(eventTopic_, TOPIC_MAX_LEN, "%s/%s/event", base, deviceId_);
+    snprintf(statsTopic_, TOPIC_MAX_LEN, "%s/%s/stats", base, deviceId_);
+    snprintf(rttTopic_, TOPIC_MAX_LEN, "%s/%s/rtt", base, deviceId_);
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    snprintf(replayTopic_, TOPIC_MAX_LEN, "%s/%s/replay", base, deviceId_);
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    snprintf(filterTopic_, TOPIC_MAX_LEN, "%s/%s/filter", base, deviceId_);
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    snprintf(mailboxTopic_, TOPIC_MAX_LEN, "%s/%s/mailbox/+", base, deviceId_);
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    snprintf(logTopic_, TOPIC_MAX_LEN, "%s/%s/log", base, deviceId_);
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+    snprintf(termTopic_, TOPIC_MAX_LEN, "%s/%s/term/+/in", base, deviceId_);
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    snprintf(selfTestTopic_, TOPIC_MAX_LEN, "%s/%s/selftest", base, deviceId_);
+#endif
+}
+
+#else
+
+#if __cplusplus < 201703L
+// Namespace-scope definitions of the topics and the transport's pointers to
+// them, needed before C++17 made them inline
+constexpr decltype(StaticTopics::cmd) StaticTopics::cmd;
+constexpr decltype(StaticTopics::resp) StaticTopics::resp;
+constexpr decltype(StaticTopics::status) StaticTopics::status;
+constexpr decltype(StaticTopics::event) StaticTopics::event;
+constexpr decltype(StaticTopics::stats) StaticTopics::stats;
+constexpr decltype(StaticTopics::replay) StaticTopics::replay;
+constexpr decltype(StaticTopics::filter) StaticTopics::filter;
+constexpr decltype(StaticTopics::mailbox) StaticTopics::mailbox;
+constexpr decltype(StaticTopics::rtt) StaticTopics::rtt;
+constexpr decltype(StaticTopics::log) StaticTopics::log;
+constexpr decltype(StaticTopics::term) StaticTopics::term;
+constexpr decltype(StaticTopics::selftest) StaticTopics::selftest;
+constexpr const char* MqttTransport::cmdTopic_;
+constexpr const char* MqttTransport::respTopic_;
+constexpr const char* MqttTransport::statusTopic_;
+constexpr const char* MqttTransport::eventTopic_;
+constexpr const char* MqttTransport::statsTopic_;
+constexpr const char* MqttTransport::replayTopic_;
+constexpr const char* MqttTransport::filterTopic_;
+constexpr const char* MqttTransport::mailboxTopic_;
+constexpr const char* MqttTransport::rttTopic_;
+constexpr const char* MqttTransport::logTopic_;
+constexpr const char* MqttTransport::termTopic_;
+constexpr const char* MqttTransport::selfTestTopic_;
+constexpr const char* MqttTransport::deviceId_;
+#endif
+
+void MqttTransport::buildTopics() {
+    // Topics are compile-time constants
 }
 
+#endif // ESPMOLE_MQTT_STATIC_TOPICS
+
 // =============================================================================
 // Standalone Mode Implementation
 // =============================================================================
@@ -95,18 +228,52 @@ void MqttTransport::begin() {
     }
     
     buildTopics();
+    link_.begin(config_.keepAlive, config_.keepAliveMin, config_.keepAliveMax,
+                config_.adaptiveKeepAlive);
+    
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    if (config_.batchInterval > 0) {
+        batch_.begin(config_.batchInterval, arduinoMillis);
+    }
+#endif
     
     if (config_.broker == nullptr) {
         // No broker configured, cannot start
         return;
     }
     
-    // Create AsyncMqttClient
+#if !ASYNC_TCP_SSL_ENABLED
+    if (config_.tls) {
+        // AsyncTCP built without TLS - never fall back to plain TCP
+        return;
+    }
+#endif
+    
+    if (ownsClient_ && asyncClient_) {
+        // begin() again: reconnect the client we have. A new one would leave
+        // the old one's heap block behind, and its callbacks are still set.
+        asyncClient_->connect();
+        return;
+    }
+    
+    // Create AsyncMqttClient - the only allocation the transport makes
     asyncClient_ = new AsyncMqttClient();
     ownsClient_ = true;
     
     // Configure server
     asyncClient_->setServer(config_.broker, config_.port);
+    asyncClient_->setKeepAlive(link_.keepAlive());
+    
+#if ASYNC_TCP_SSL_ENABLED
+    if (config_.tls) {
+        // AsyncTCP's TLS does not expose session resumption; use TlsClient
+        // with PubSubClient for resumed handshakes
+        asyncClient_->setSecure(true);
+        if (config_.tlsFingerprint != nullptr) {
+            asyncClient_->addServerFingerprint(config_.tlsFingerprint);
+        }
+    }
+#endif
     
     // Configure credentials if provided
     if (config_.username != nullptr) {
@@ -131,7 +298,8 @@ void MqttTransport::begin() {
         );
     }
     
-    // Set up callbacks using lambdas that capture 'this'
+    // Set up callbacks using lambdas that capture only 'this', which
+    // std::function keeps inline (no heap block per lambda)
     asyncClient_->onConnect([this](bool sessionPresent) {
         this->onAsyncConnect(sessionPresent);
     });
@@ -147,28 +315,183 @@ void MqttTransport::begin() {
         this->onAsyncMessage(topic, payload, len, index, total);
     });
     
+    registerAsyncPublishCallback();
+    
     // Connect
     asyncClient_->connect();
 }
 
 void MqttTransport::poll() {
-    // AsyncMqttClient is event-driven, so poll() mainly handles reconnection
+    poll(config_.pollBudget);
+}
+
+size_t MqttTransport::poll(uint32_t budgetMicros) {
+    return work_.run(millis(), budgetMicros);
+}
+
+bool MqttTransport::workStep(uint8_t task, uint32_t now, void* ctx) {
+    return static_cast<MqttTransport*>(ctx)->runWork(task, now);
+}
+
+bool MqttTransport::runWork(uint8_t task, uint32_t now) {
+    // One bounded step; true if the task has more right now
+    switch (task) {
+        case WORK_ACKS:
+            // Fail QoS 1 publishes whose PUBACK never arrived
+            inflight_.expire(now, config_.ackTimeout);
+            return false;
+            
+        case WORK_CONNECT:
+            maintainConnection(now);
+            return false;
+            
+        case WORK_BROKER:
+#if ESPMOLE_MQTT_FEATURE_BROKER
+            if (broker_) {
+                broker_->poll(now);
+            }
+#endif
+            return false;
+            
+        case WORK_LINK:
+            if (link_.adaptive()) {
+                probeLink(now);
+            }
+            return false;
+            
+        case WORK_MEM: {
+#if ESPMOLE_MQTT_FEATURE_MEM
+            // $mem accounts from the client's task
+            Guard guard(*this);
+            accountMemory(now);
+#endif
+            return false;
+        }
+            
+        case WORK_STATS:
+            if (config_.statsInterval > 0 && now - lastStatsPublish_ >= config_.statsInterval) {
+                lastStatsPublish_ = now;
+                publishStats();
+            }
+            return false;
+            
+        case WORK_REPLAY: {
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+            // $replay moves the cursor from the client's task
+            Guard guard(*this);
+            return replayActive_ && pumpReplay();
+#else
+            return false;
+#endif
+        }
+            
+        case WORK_SCHED: {
+#if ESPMOLE_MQTT_FEATURE_SCHED
+            Guard guard(*this);
+            return runSchedules(now);
+#else
+            return false;
+#endif
+        }
+            
+        case WORK_MAILBOX:
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+            return config_.mailbox && drainMailbox(now);
+#else
+            return false;
+#endif
+            
+        case WORK_LOG:
+#if ESPMOLE_MQTT_FEATURE_LOG
+            return pumpLog(now);
+#else
+            return false;
+#endif
+            
+        case WORK_BATCH:
+#if ESPMOLE_MQTT_FEATURE_BATCH
+            if (config_.batchInterval > 0) {
+#if ESPMOLE_HAS_PUBSUBCLIENT
+                // PubSubClient has no disconnect event to tell us
+                if (pubSubClient_) {
+                    Guard guard(*this);
+                    batch_.noteConnected(pubSubClient_->connected());
+                }
+#endif
+                return flushStep();
+            }
+#endif
+            return false;
+            
+        case WORK_TERM:
+#if ESPMOLE_MQTT_FEATURE_TERM
+            return config_.terminal && pumpTerminal(now);
+#else
+            return false;
+#endif
+            
+        case WORK_TIME:
+#if ESPMOLE_MQTT_FEATURE_TIME
+            syncTime(now);
+#endif
+            return false;
+            
+        case WORK_SELFTEST:
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+            return runSelfTest();
+#else
+            return false;
+#endif
+            
+        default:
+            return false;
+    }
+}
+
+void MqttTransport::maintainConnection(uint32_t now) {
+    // AsyncMqttClient is event-driven, so this only handles reconnection
     if (!standaloneMode_ || asyncClient_ == nullptr) {
         return;
     }
     
     bool isConnected = asyncClient_->connected();
     
+    // Probes were lost - don't wait for the keep-alive to notice
+    bool advised = false;
+    uint32_t srtt = 0;
+    {
+        Guard guard(*this);
+        if (isConnected && link_.reconnectAdvised()) {
+            advised = true;
+            srtt = link_.stats().srtt;
+            link_.noteReconnect();
+        }
+    }
+    if (advised) {
+        ESPMOLE_LOGW(*this, "mqtt link lost, reconnecting (srtt=%lu ms)",
+                     static_cast<unsigned long>(srtt));
+        (void)srtt;  // Unused when ESPMOLE_MQTT_FEATURE_LOG is off
+        asyncClient_->disconnect(true);
+        lastReconnectAttempt_ = now - config_.reconnectInterval;
+        isConnected = false;
+    }
+    
     // Handle reconnection
     if (!isConnected && wasConnected_) {
         // Just disconnected
         wasConnected_ = false;
+        resetInflight();
     }
     
     if (!isConnected) {
-        uint32_t now = millis();
         if (now - lastReconnectAttempt_ >= config_.reconnectInterval) {
             lastReconnectAttempt_ = now;
+            uint16_t keepAlive;
+            {
+                Guard guard(*this);
+                keepAlive = link_.keepAlive();
+            }
+            asyncClient_->setKeepAlive(keepAlive);
             asyncClient_->connect();
         }
     }
@@ -177,9 +500,41 @@ void MqttTransport::poll() {
 void MqttTransport::onAsyncConnect(bool sessionPresent) {
     (void)sessionPresent;
     wasConnected_ = true;
+    ESPMOLE_LOGI(*this, "mqtt connected keepalive=%u", link_.keepAlive());
+    
+    // Clean session - nothing from the previous connection will be acked
+    resetInflight();
+    {
+        Guard guard(*this);
+        link_.noteConnected(millis());
+    }
+    
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    {
+        Guard guard(*this);
+        batch_.noteConnected(true);
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_TIME
+    // Consumers may have missed the last stamps - start with absolute ones
+    {
+        Guard guard(*this);
+        respStamp_.reset();
+        eventStamp_.reset();
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    // The broker may have lost retained state (restart, other broker)
+    {
+        Guard guard(*this);
+        schedules_.forget(0);
+    }
+#endif
     
     // Subscribe to command topic
-    subscribeToCommandTopic();
+    subscribeToTopics();
     
     // Publish birth message
     publishBirth();
@@ -187,7 +542,23 @@ void MqttTransport::onAsyncConnect(bool sessionPresent) {
 
 void MqttTransport::onAsyncDisconnect(int8_t reason) {
     (void)reason;
+    ESPMOLE_LOGW(*this, "mqtt disconnected reason=%d", reason);
+    onMqttDisconnect();
+}
+
+void MqttTransport::onMqttDisconnect() {
     wasConnected_ = false;
+    resetInflight();
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    Guard guard(*this);
+    batch_.noteConnected(false);
+#endif
+}
+
+void MqttTransport::registerAsyncPublishCallback() {
+    asyncClient_->onPublish([this](uint16_t packetId) {
+        this->onMqttPublish(packetId);
+    });
 }
 
 void MqttTransport::onAsyncMessage(char* topic, char* payload, 
@@ -212,6 +583,15 @@ void MqttTransport::attachTo(AsyncMqttClient* client) {
     standaloneMode_ = false;
     
     buildTopics();
+    link_.begin(config_.keepAlive, config_.keepAliveMin, config_.keepAliveMax,
+                config_.adaptiveKeepAlive);
+    
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    // Batching needs its clock in integration mode too
+    if (config_.batchInterval > 0) {
+        batch_.begin(config_.batchInterval, arduinoMillis);
+    }
+#endif
     
     // For AsyncMqttClient, LWT must be set before connect()
     // User should call attachTo() before mqtt.connect()
@@ -223,6 +603,14 @@ void MqttTransport::attachTo(AsyncMqttClient* client) {
             config_.lwtPayload
         );
     }
+    
+    // AsyncMqttClient keeps a list of publish and disconnect callbacks, so
+    // this does not replace handlers the application registered
+    registerAsyncPublishCallback();
+    client->onDisconnect([this](AsyncMqttClientDisconnectReason reason) {
+        (void)reason;
+        this->onMqttDisconnect();
+    });
 }
 
 void MqttTransport::attachTo(PubSubClient* client) {
@@ -232,10 +620,18 @@ void MqttTransport::attachTo(PubSubClient* client) {
     standaloneMode_ = false;
     
     buildTopics();
+    link_.begin(config_.keepAlive, config_.keepAliveMin, config_.keepAliveMax,
+                config_.adaptiveKeepAlive);
     
     // For PubSubClient, we subscribe immediately since it's typically
     // called after connect()
-    subscribeToCommandTopic();
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    if (config_.batchInterval > 0) {
+        batch_.begin(config_.batchInterval, arduinoMillis);
+    }
+    batch_.noteConnected(client->connected());
+#endif
+    subscribeToTopics();
     publishBirth();
 #else
     (void)client;
@@ -245,11 +641,93 @@ void MqttTransport::attachTo(PubSubClient* client) {
 
 void MqttTransport::onMqttConnect() {
     // Called by user from their onConnect callback (AsyncMqttClient integration)
-    subscribeToCommandTopic();
+    resetInflight();
+    {
+        Guard guard(*this);
+        link_.noteConnected(millis());
+    }
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    {
+        Guard guard(*this);
+        batch_.noteConnected(true);
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    {
+        Guard guard(*this);
+        schedules_.forget(0);
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    {
+        Guard guard(*this);
+        respStamp_.reset();
+        eventStamp_.reset();
+    }
+#endif
+    subscribeToTopics();
     publishBirth();
 }
 
+void MqttTransport::onMqttPublish(uint16_t packetId) {
+    uint32_t now = millis();
+    if (inflight_.complete(packetId, now)) {
+        // Every PUBACK doubles as an RTT sample
+        Guard guard(*this);
+        link_.noteRtt(inflight_.stats().lastLatency, now);
+    }
+}
+
 bool MqttTransport::handleMessage(const char* topic, const uint8_t* payload, size_t len) {
+#if ESPMOLE_MQTT_FEATURE_PROBE || ESPMOLE_MQTT_FEATURE_SELFTEST
+    // Before anything else, so the probe reply includes our own overhead
+    uint32_t rxUs = micros();
+#endif
+#if ESPMOLE_MQTT_FEATURE_TRACE
+    if (trace_) {
+        trace_->record(TRACE_IN, topic, payload, len, 0, false);
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    // Our own loopback messages, back through the broker
+    if (strcmp(topic, selfTestTopic_) == 0) {
+        // runSelfTest() drives the same steps from poll()
+        Guard guard(*this);
+        selfTest_.receive(payload, len, rxUs);
+        return true;
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    // Consumer filter spec (retained) - empty payload removes the filter
+    if (config_.eventFilter && strcmp(topic, filterTopic_) == 0) {
+        // Compiled off to the side on the client's task; broadcast() only
+        // ever sees a finished table
+        EventFilter* next = filter_ == &filters_[0] ? &filters_[1] : &filters_[0];
+        next->compile(payload, len);
+        Guard guard(*this);
+        filter_ = next;
+        return true;
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    // Retained mailbox command - match ".../mailbox/" without the '+'
+    if (config_.mailbox && strncmp(topic, mailboxTopic_, strlen(mailboxTopic_) - 1) == 0) {
+        handleMailbox(topic, payload, len);
+        return true;
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_TERM
+    // Terminal input - match ".../term/" without the "+/in"
+    if (config_.terminal && strncmp(topic, termTopic_, strlen(termTopic_) - 4) == 0) {
+        handleTerminal(topic, payload, len);
+        return true;
+    }
+#endif
+    
     // Check if this is our command topic
     if (strcmp(topic, cmdTopic_) != 0) {
         // Not our topic - check if it's any ESPMole topic we should ignore
@@ -259,11 +737,17 @@ bool MqttTransport::handleMessage(const char* topic, const uint8_t* payload, siz
         
         // Not an ESPMole topic - forward to user callback if set
         if (userCallback_) {
-            userCallback_(topic, payload, len);
+            userCallback_(topic, payload, len, userCallbackCtx_);
         }
         return false;  // Not handled by ESPMole
     }
     
+#if ESPMOLE_MQTT_FEATURE_PROBE
+    if (answerProbe(payload, len, rxUs)) {
+        return true;
+    }
+#endif
+    
     // Process command through dispatcher
     processCommand(payload, len);
     return true;
@@ -274,6 +758,13 @@ bool MqttTransport::handleMessage(const char* topic, const uint8_t* payload, siz
 // =============================================================================
 
 bool MqttTransport::connected() const {
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    // LAN clients are reached through the embedded broker whether or not
+    // the upstream broker is up
+    if (broker_ && broker_->running()) {
+        return true;
+    }
+#endif
     if (asyncClient_) {
         return asyncClient_->connected();
     }
@@ -285,78 +776,1796 @@ bool MqttTransport::connected() const {
     return false;
 }
 
-void MqttTransport::subscribeToCommandTopic() {
+void MqttTransport::subscribeToTopics() {
     if (asyncClient_) {
         asyncClient_->subscribe(cmdTopic_, config_.qos);
+#if ESPMOLE_MQTT_FEATURE_FILTER
+        if (config_.eventFilter) {
+            asyncClient_->subscribe(filterTopic_, 1);
+        }
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+        if (config_.terminal) {
+            asyncClient_->subscribe(termTopic_, config_.qos);
+        }
+#endif
     } 
 #if ESPMOLE_HAS_PUBSUBCLIENT
     else if (pubSubClient_) {
         pubSubClient_->subscribe(cmdTopic_);
+#if ESPMOLE_MQTT_FEATURE_FILTER
+        if (config_.eventFilter) {
+            pubSubClient_->subscribe(filterTopic_);
+        }
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+        if (config_.terminal) {
+            pubSubClient_->subscribe(termTopic_);
+        }
+#endif
     }
 #endif
+    
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    if (config_.mailbox) {
+        subscribeMailbox();
+    }
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+
+void MqttTransport::subscribeMailbox() {
+    // (Re)subscribing makes the broker deliver every retained command again
+    if (asyncClient_) {
+        asyncClient_->subscribe(mailboxTopic_, 1);
+    }
+#if ESPMOLE_HAS_PUBSUBCLIENT
+    else if (pubSubClient_) {
+        pubSubClient_->subscribe(mailboxTopic_, 1);
+    }
+#endif
+    Guard guard(*this);
+    mailbox_.open(millis());
 }
 
+#endif // ESPMOLE_MQTT_FEATURE_MAILBOX
+
 void MqttTransport::publishBirth() {
     if (!config_.enableStatus) return;
     
-    mqttPublish(statusTopic_, 
-                reinterpret_cast<const uint8_t*>(config_.birthPayload),
-                strlen(config_.birthPayload),
+    if (!config_.announceCapabilities) {
+        mqttPublish(statusTopic_, 
+                    reinterpret_cast<const uint8_t*>(config_.birthPayload),
+                    strlen(config_.birthPayload),
+                    1,  // QoS 1 for birth
+                    config_.retainStatus);
+        return;
+    }
+    
+    // "online caps=qos1,journal,..." - parsed by tools/status_aggregator
+    char birth[RESPONSE_BUFFER_SIZE];
+    size_t len = formatTo(reinterpret_cast<uint8_t*>(birth), sizeof(birth),
+                          "%s caps=", config_.birthPayload);
+    len += formatCapabilities(birth + len, sizeof(birth) - len);
+    
+    mqttPublish(statusTopic_, reinterpret_cast<const uint8_t*>(birth), len,
                 1,  // QoS 1 for birth
                 config_.retainStatus);
 }
 
+size_t MqttTransport::formatCapabilities(char* out, size_t cap) const {
+    const char* names[12];
+    size_t count = 0;
+    
+    if (config_.qos > 0) names[count++] = "qos1";
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    if (config_.sequenceEvents) names[count++] = "journal";
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    if (config_.eventFilter) names[count++] = "filter";
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    names[count++] = "sched";
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    if (config_.mailbox) names[count++] = "mailbox";
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    names[count++] = "log";
+#endif
+#if ESPMOLE_MQTT_FEATURE_MEM
+    names[count++] = "mem";
+#endif
+#if ESPMOLE_MQTT_FEATURE_PROBE
+    names[count++] = "probe";
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+    if (config_.terminal) names[count++] = "term";
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    if (config_.timeSyncInterval > 0) names[count++] = "time";
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    names[count++] = "selftest";
+#endif
+    
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        len += formatTo(reinterpret_cast<uint8_t*>(out) + len, cap - len,
+                        i == 0 ? "%s" : ",%s", names[i]);
+    }
+    return len;
+}
+
 bool MqttTransport::mqttPublish(const char* topic, const uint8_t* payload, 
                                  size_t len, uint8_t qos, bool retain) {
+    bool local = false;
+#if ESPMOLE_MQTT_FEATURE_TRACE
+    if (trace_) {
+        trace_->record(TRACE_OUT, topic, payload, len, qos, retain);
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    if (broker_) {
+        local = broker_->publish(topic, payload, len, qos, retain);
+    }
+#endif
+    
+    if (asyncClient_ && qos > 0) {
+        return mqttPublishTracked(topic, payload, len, qos, retain,
+                                  publishCb_, publishCbCtx_) != 0 || local;
+    }
     if (asyncClient_ && asyncClient_->connected()) {
-        asyncClient_->publish(topic, qos, retain, 
-                              reinterpret_cast<const char*>(payload), len);
-        return true;
+        // Returns 0 when the client could not queue the packet
+        return asyncClient_->publish(topic, qos, retain, 
+                                     reinterpret_cast<const char*>(payload), len) != 0 || local;
     }
 #if ESPMOLE_HAS_PUBSUBCLIENT
     if (pubSubClient_ && pubSubClient_->connected()) {
-        return pubSubClient_->publish(topic, payload, len, retain);
+        return pubSubClient_->publish(topic, payload, len, retain) || local;
     }
 #endif
-    return false;
+    return local;
+}
+
+uint16_t MqttTransport::mqttPublishTracked(const char* topic, const uint8_t* payload,
+                                           size_t len, uint8_t qos, bool retain,
+                                           PublishCompleteCallback cb, void* ctx) {
+    if (!asyncClient_ || !asyncClient_->connected()) {
+        return 0;
+    }
+    
+    // Reserve first: the PUBACK can be handled on the client's task before
+    // publish() returns. A full window is backpressure - let the broker
+    // catch up before queueing more
+    int slot = inflight_.reserve(millis(), cb, ctx);
+    if (slot < 0) {
+        return 0;
+    }
+    
+    uint16_t packetId = asyncClient_->publish(topic, qos, retain,
+                                              reinterpret_cast<const char*>(payload), len);
+    if (!inflight_.assign(slot, packetId, millis())) {
+        return 0;
+    }
+    
+    lastPacketId_ = packetId;
+    return packetId;
+}
+
+void MqttTransport::resetInflight() {
+    inflight_.abortAll(millis());
+}
+
+void MqttTransport::onLock(bool lock, void* ctx) {
+#if defined(ESP32)
+    MqttTransport* self = static_cast<MqttTransport*>(ctx);
+    if (lock) {
+        xSemaphoreTakeRecursive(self->lock_, portMAX_DELAY);
+    } else {
+        xSemaphoreGiveRecursive(self->lock_);
+    }
+#else
+    (void)lock;
+    (void)ctx;
+#endif
+}
+
+void MqttTransport::probeLink(uint32_t now) {
+    {
+        Guard guard(*this);
+        link_.check(now);
+        if (!link_.probeDue(now)) return;
+        // Before publishing: the PUBACK may complete the probe first
+        link_.noteProbeStart(now);
+    }
+    
+    // Empty QoS 1 publish - the PUBACK measures the round trip
+    uint16_t packetId = mqttPublishTracked(rttTopic_, nullptr, 0, 1, false,
+                                           onProbeComplete, this);
+    Guard guard(*this);
+    link_.noteProbeSent(packetId);
+}
+
+void MqttTransport::onProbeComplete(uint16_t packetId, bool acked, uint32_t latencyMs, void* ctx) {
+    (void)latencyMs;
+    MqttTransport* self = static_cast<MqttTransport*>(ctx);
+    Guard guard(*self);
+    self->link_.noteProbeDone(packetId, acked, millis());
+}
+
+void MqttTransport::publishStats() {
+    StatsSnapshot snap;
+    snap.inflight = static_cast<uint16_t>(inflight_.inFlight());
+    snap.window = static_cast<uint16_t>(inflight_.window());
+    snap.qos = &inflight_.stats();
+    snap.filtered = eventsFiltered();
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    BatchStats b;
+    if (config_.batchInterval > 0) {
+        b = batchStats();
+        snap.batch = &b;
+        Guard guard(*this);
+        snap.burstsPerHour = batch_.burstsPerHour();
+    }
+#endif
+    LinkStats l;
+    {
+        Guard guard(*this);
+        l = link_.stats();
+    }
+    if (l.samples > 0 || link_.adaptive()) {
+        snap.link = &l;
+    }
+    if (tlsStats_) {
+        snap.tls = &tlsStats_->stats();
+    }
+#if ESPMOLE_MQTT_FEATURE_MEM
+    MemoryUsage m = memoryTotal();
+    HeapHealth h = heapHealth();
+    snap.mem = &m;
+    snap.heap = &h;
+#endif
+    snap.work = &work_.stats();
+#if ESPMOLE_MQTT_FEATURE_TIME
+    TimeSyncStats t = timeSyncStats();
+    if (t.synced) {
+        snap.time = &t;
+    }
+#endif
+    
+    // Sized for every group, not RESPONSE_BUFFER_SIZE
+    char buf[STATS_RECORD_MAX];
+    size_t len = formatStats(buf, sizeof(buf), snap);
+    mqttPublish(statsTopic_, reinterpret_cast<const uint8_t*>(buf), len, 0, false);
 }
 
 bool MqttTransport::isMoleTopic(const char* topic) const {
+    // Same base the topics were built from
+#if ESPMOLE_MQTT_STATIC_TOPICS
+    const char* base = ESPMOLE_MQTT_BASE_TOPIC;
+#else
     const char* base = config_.baseTopic ? config_.baseTopic : "espmole";
+#endif
     size_t baseLen = strlen(base);
     return strncmp(topic, base, baseLen) == 0 && topic[baseLen] == '/';
 }
 
 void MqttTransport::processCommand(const uint8_t* payload, size_t len) {
-    if (!dispatcher_) return;
-    
+#if ESPMOLE_MQTT_FEATURE_TIME
+    // Room for the timestamp in front of the result
+    uint8_t buf[TimeStamper::STAMP_MAX + RESPONSE_BUFFER_SIZE];
+    uint8_t* response = buf + TimeStamper::STAMP_MAX;
+#else
     uint8_t response[RESPONSE_BUFFER_SIZE];
-    size_t respLen = dispatcher_->ingest(
-        PEER_MQTT,
-        payload,
-        len,
-        response,
-        sizeof(response)
-    );
+#endif
+    size_t respLen = executeCommand(payload, len, response, RESPONSE_BUFFER_SIZE);
     
     if (respLen > 0) {
+#if ESPMOLE_MQTT_FEATURE_TIME
+        size_t stamp = stampBefore(BATCH_RESPONSE, response);
+        response -= stamp;
+        respLen += stamp;
+#endif
         // Publish response
         mqttPublish(respTopic_, response, respLen, config_.qos, false);
     }
 }
 
-// =============================================================================
-// ITransport Interface
-// =============================================================================
+size_t MqttTransport::executeCommand(const uint8_t* payload, size_t len,
+                                     uint8_t* response, size_t cap) {
+    return executeCommand(payload, len, response, cap, PEER_MQTT);
+}
 
-bool MqttTransport::send(PeerHandle peer, const uint8_t* data, size_t len) {
-    (void)peer;  // MQTT responses always go to response topic
-    return mqttPublish(respTopic_, data, len, config_.qos, false);
+size_t MqttTransport::executeCommand(const uint8_t* payload, size_t len,
+                                     uint8_t* response, size_t cap, PeerHandle peer) {
+    size_t respLen = 0;
+    if (handleBuiltin(payload, len, response, cap, respLen)) {
+        return respLen;
+    }
+    
+    if (!dispatcher_) return 0;
+    
+    return dispatcher_->ingest(
+        peer,
+        payload,
+        len,
+        response,
+        cap
+    );
+}
+
+// =============================================================================
+// Built-in Commands
+// =============================================================================
+
+bool MqttTransport::handleBuiltin(const uint8_t* payload, size_t len,
+                                  uint8_t* response, size_t cap, size_t& respLen) {
+    if (len == 0 || payload[0] != BUILTIN_PREFIX) {
+        return false;
+    }
+    
+    // Builtins change state that poll() walks ($sched, $replay, ...), and
+    // MQTT commands arrive on the client's task
+    Guard guard(*this);
+    
+    // NUL-terminated copy without the prefix and trailing line ending
+    char line[BUILTIN_LINE_MAX];
+    size_t n = len - 1;
+    if (n > sizeof(line) - 1) n = sizeof(line) - 1;
+    memcpy(line, payload + 1, n);
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r' || line[n - 1] == ' ')) n--;
+    line[n] = '\0';
+    
+    const char* args = line;
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    if (takeWord(args, "replay")) {
+        respLen = builtinReplay(args, response, cap);
+        return true;
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    if (takeWord(args, "sched")) {
+        respLen = builtinSched(args, response, cap);
+        return true;
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    if (takeWord(args, "log")) {
+        respLen = builtinLog(args, response, cap);
+        return true;
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_MEM
+    if (takeWord(args, "mem")) {
+        respLen = builtinMem(args, response, cap);
+        return true;
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    if (takeWord(args, "time")) {
+        respLen = builtinTime(args, response, cap);
+        return true;
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    if (takeWord(args, "selftest")) {
+        respLen = builtinSelfTest(args, response, cap);
+        return true;
+    }
+#endif
+#if !ESPMOLE_MQTT_FEATURE_JOURNAL && !ESPMOLE_MQTT_FEATURE_SCHED && !ESPMOLE_MQTT_FEATURE_LOG && \
+    !ESPMOLE_MQTT_FEATURE_MEM && !ESPMOLE_MQTT_FEATURE_TIME && !ESPMOLE_MQTT_FEATURE_SELFTEST
+    (void)args;
+    (void)response;
+    (void)cap;
+    (void)respLen;
+#endif
+    
+    // Unknown built-in - let the dispatcher have it
+    return false;
+}
+
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+
+size_t MqttTransport::builtinReplay(const char* args, uint8_t* response, size_t cap) {
+    if (!config_.sequenceEvents) {
+        return formatTo(response, cap, "replay: sequenceEvents disabled");
+    }
+    
+    char* end = nullptr;
+    unsigned long from = strtoul(args, &end, 10);
+    if (end == args) {
+        return formatTo(response, cap, "replay: usage $replay <seq>");
+    }
+    
+    uint32_t next = journal_.nextSeq();
+    EventJournal::Cursor cursor;
+    if (!journal_.seek(static_cast<uint32_t>(from), cursor)) {
+        replayActive_ = false;
+        return formatTo(response, cap, "replay none next=%lu",
+                        static_cast<unsigned long>(next));
+    }
+    
+    replayCursor_ = cursor;
+    replayEnd_ = next;
+    replayActive_ = true;
+    
+    if (cursor.seq != from) {
+        // Part of the requested range was evicted - consumer must re-query it
+        return formatTo(response, cap, "replay %lu-%lu gap %lu-%lu",
+                        static_cast<unsigned long>(cursor.seq),
+                        static_cast<unsigned long>(next - 1),
+                        from,
+                        static_cast<unsigned long>(cursor.seq - 1));
+    }
+    return formatTo(response, cap, "replay %lu-%lu",
+                    static_cast<unsigned long>(cursor.seq),
+                    static_cast<unsigned long>(next - 1));
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_JOURNAL
+
+#if ESPMOLE_MQTT_FEATURE_SCHED
+
+size_t MqttTransport::builtinSched(const char* args, uint8_t* response, size_t cap) {
+    uint32_t now = millis();
+    bool every = takeWord(args, "every");
+    bool watch = !every && takeWord(args, "watch");
+    bool state = !every && !watch && takeWord(args, "state");
+    
+    if (every || watch || state) {
+        char* cmd = nullptr;
+        unsigned long interval = strtoul(args, &cmd, 10);
+        while (cmd && *cmd == ' ') cmd++;
+        if (cmd == args || cmd == nullptr || *cmd == '\0') {
+            return formatTo(response, cap, "sched: usage $sched every|watch|state <ms> <command>");
+        }
+        if (strncmp(cmd, "$sched", 6) == 0) {
+            return formatTo(response, cap, "sched: cannot schedule $sched");
+        }
+        
+        // State topics are last values - refreshed when the result changes
+        uint8_t id = schedules_.add(watch || state, static_cast<uint32_t>(interval),
+                                    cmd, strlen(cmd), config_.scheduleLease, now, state);
+        if (id == 0) {
+            return formatTo(response, cap, "sched: table full");
+        }
+        return formatTo(response, cap, "sched %u", static_cast<unsigned>(id));
+    }
+    
+    if (takeWord(args, "renew")) {
+        unsigned id = static_cast<unsigned>(strtoul(args, nullptr, 10));
+        if (!schedules_.renew(static_cast<uint8_t>(id), now)) {
+            return formatTo(response, cap, "sched: no query %u", id);
+        }
+        return formatTo(response, cap, "sched %u renewed", id);
+    }
+    
+    if (takeWord(args, "cancel")) {
+        unsigned id = static_cast<unsigned>(strtoul(args, nullptr, 10));
+        if (!stopState(static_cast<uint8_t>(id))) {
+            return formatTo(response, cap, "sched: no query %u", id);
+        }
+        return formatTo(response, cap, "sched %u cancelled", id);
+    }
+    
+    if (takeWord(args, "list")) {
+        size_t pos = formatTo(response, cap, "sched %u/%u",
+                              static_cast<unsigned>(schedules_.count()),
+                              static_cast<unsigned>(QueryScheduler::MAX_QUERIES));
+        for (uint8_t id = 1; id <= QueryScheduler::MAX_QUERIES; id++) {
+            const ScheduledQuery* q = schedules_.get(id);
+            if (!q) continue;
+            const char* mode = q->state ? "state" : q->watch ? "watch" : "every";
+            if (q->lease == 0) {
+                pos += formatTo(response + pos, cap - pos, "; %u %s %lu lease=- %s",
+                                static_cast<unsigned>(id), mode,
+                                static_cast<unsigned long>(q->interval), q->command);
+                continue;
+            }
+            uint32_t left = q->lease - (now - q->leaseStart);
+            pos += formatTo(response + pos, cap - pos, "; %u %s %lu lease=%lu %s",
+                            static_cast<unsigned>(id), mode,
+                            static_cast<unsigned long>(q->interval),
+                            static_cast<unsigned long>(left), q->command);
+        }
+        return pos;
+    }
+    
+    return formatTo(response, cap, "sched: usage $sched every|watch|state|renew|cancel|list");
+}
+
+bool MqttTransport::runSchedules(uint32_t now) {
+    // One due query per step
+    QueryScheduler::Due due;
+    if (!schedules_.poll(now, due)) {
+        return false;
+    }
+    
+    uint8_t event[RESPONSE_BUFFER_SIZE];
+    size_t hdr = formatTo(event, sizeof(event), "sched %u ", static_cast<unsigned>(due.id));
+    
+    if (due.expired) {
+        if (due.state) {
+            publishStateTopic(due.command, nullptr, 0);
+        }
+        size_t len = hdr + formatTo(event + hdr, sizeof(event) - hdr, "expired");
+        broadcast(event, len);
+        return true;
+    }
+    
+    const ScheduledQuery* q = schedules_.get(due.id);
+    size_t len = executeCommand(reinterpret_cast<const uint8_t*>(q->command),
+                                strlen(q->command),
+                                event + hdr, sizeof(event) - hdr);
+    
+    // Watch and state queries stay silent until the result changes
+    if (!schedules_.noteResult(due.id, event + hdr, len)) {
+        return true;
+    }
+    if (!q->state) {
+        broadcast(event, hdr + len);
+    } else if (!publishStateTopic(q->command, event + hdr, len)) {
+        // Offline - publish on the next run even if unchanged
+        schedules_.forget(due.id);
+    }
+    return true;
+}
+
+bool MqttTransport::publishStateTopic(const char* command, const uint8_t* data, size_t len) {
+    // "<base>/<device-id>/state/<leaf>", next to the response topic
+    char topic[TOPIC_MAX_LEN + QueryScheduler::COMMAND_MAX];
+    size_t prefix = strlen(respTopic_) - 4;
+    if (prefix + 6 >= sizeof(topic)) return false;
+    memcpy(topic, respTopic_, prefix);
+    memcpy(topic + prefix, "state/", 6);
+    if (QueryScheduler::stateLeaf(topic + prefix + 6, sizeof(topic) - prefix - 6, command) == 0) {
+        return false;
+    }
+    
+    // Retained; an empty payload clears the last value
+    return mqttPublish(topic, data, len, config_.qos, true);
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_SCHED
+
+uint8_t MqttTransport::publishState(const char* command, uint32_t intervalMs, bool onChange) {
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    if (command == nullptr) return 0;
+    Guard guard(*this);
+    return schedules_.add(onChange, intervalMs, command, strlen(command), 0, millis(), true);
+#else
+    (void)command;
+    (void)intervalMs;
+    (void)onChange;
+    return 0;
+#endif
+}
+
+bool MqttTransport::stopState(uint8_t id) {
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    Guard guard(*this);
+    const ScheduledQuery* q = schedules_.get(id);
+    if (!q) return false;
+    if (q->state) {
+        publishStateTopic(q->command, nullptr, 0);
+    }
+    return schedules_.cancel(id);
+#else
+    (void)id;
+    return false;
+#endif
+}
+
+// =============================================================================
+// Event Journal
+// =============================================================================
+
+uint32_t MqttTransport::getLastEventSeq() const {
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    Guard guard(*this);
+    return journal_.nextSeq() - 1;
+#else
+    return 0;
+#endif
+}
+
+uint32_t MqttTransport::getFirstReplayableSeq() const {
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    Guard guard(*this);
+    return journal_.firstSeq();
+#else
+    return 0;
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+
+bool MqttTransport::publishSequencedEvent(const uint8_t* data, size_t len, bool urgent) {
+    if (len > RESPONSE_BUFFER_SIZE) {
+        return false;
+    }
+    
+    uint8_t buf[EVENT_HEADER_MAX + RESPONSE_BUFFER_SIZE];
+    uint32_t seq;
+    {
+        // Same ring $replay seeks and pumpReplay() reads
+        Guard guard(*this);
+        seq = journal_.append(data, len);
+    }
+    size_t hdr = formatTo(buf, EVENT_HEADER_MAX, "[%lu] ", static_cast<unsigned long>(seq));
+    memcpy(buf + hdr, data, len);
+    
+    return publishOutbound(BATCH_EVENT, buf, hdr + len, urgent);
+}
+
+bool MqttTransport::pumpReplay() {
+    // An event that fits no batch would stall the cursor for good
+    static_assert(REPLAY_BATCH_SIZE >= EVENT_HEADER_MAX + RESPONSE_BUFFER_SIZE + 1,
+                  "a journaled event (up to RESPONSE_BUFFER_SIZE) must fit a replay batch");
+    
+    // One batch per step - "[seq:len] payload\n" records back to back
+    uint8_t batch[REPLAY_BATCH_SIZE];
+    size_t pos = 0;
+    
+    if (!journal_.valid(replayCursor_) && replayCursor_.seq != replayEnd_) {
+        // Evicted while streaming - skip ahead, consumer sees the gap
+        if (!journal_.seek(replayCursor_.seq, replayCursor_)) {
+            replayActive_ = false;
+            return false;
+        }
+    }
+    
+    EventJournal::Cursor cursor = replayCursor_;
+    while (static_cast<int32_t>(replayEnd_ - cursor.seq) > 0) {
+        // Read payload behind room for the header, then close the gap
+        size_t room = sizeof(batch) - pos;
+        if (room <= EVENT_HEADER_MAX + 1) break;
+        
+        EventJournal::Cursor next = cursor;
+        size_t len = 0;
+        uint8_t* slot = batch + pos + EVENT_HEADER_MAX;
+        if (!journal_.read(next, slot, room - EVENT_HEADER_MAX - 1, len)) break;
+        
+        char hdr[EVENT_HEADER_MAX + 8];
+        int h = snprintf(hdr, sizeof(hdr), "[%lu:%u] ",
+                         static_cast<unsigned long>(cursor.seq),
+                         static_cast<unsigned>(len));
+        if (h <= 0 || static_cast<size_t>(h) > EVENT_HEADER_MAX) break;
+        
+        memcpy(batch + pos, hdr, h);
+        memmove(batch + pos + h, slot, len);
+        pos += h + len;
+        batch[pos++] = '\n';
+        cursor = next;
+    }
+    
+    if (pos == 0) {
+        replayActive_ = static_cast<int32_t>(replayEnd_ - cursor.seq) > 0
+                     && journal_.valid(cursor);
+        return false;
+    }
+    
+    // Only advance once the batch is out; retry on the next poll otherwise
+    if (!mqttPublish(replayTopic_, batch, pos, config_.qos, false)) {
+        return false;
+    }
+    replayCursor_ = cursor;
+    replayActive_ = static_cast<int32_t>(replayEnd_ - cursor.seq) > 0;
+    return replayActive_;
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_JOURNAL
+
+// =============================================================================
+// Mailbox
+// =============================================================================
+
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+
+void MqttTransport::handleMailbox(const char* topic, const uint8_t* payload, size_t len) {
+    // Our own clears come back as empty retained messages
+    if (len == 0) return;
+    
+    uint32_t seq = 0;
+    if (!CommandMailbox::parseSeq(topic + strlen(mailboxTopic_) - 1, seq)) {
+        return;
+    }
+    
+    // Stored on the client's task, run from poll() (drainMailbox)
+    CommandMailbox::Offer offer;
+    {
+        Guard guard(*this);
+        offer = mailbox_.offer(seq, payload, len, millis());
+    }
+    if (offer == CommandMailbox::MAILBOX_TOO_LONG) {
+        // Would sit on the broker forever - report and remove it
+        uint8_t response[RESPONSE_BUFFER_SIZE];
+        size_t respLen = formatTo(response, sizeof(response),
+                                  "mailbox %lu error: longer than %u bytes",
+                                  static_cast<unsigned long>(seq),
+                                  static_cast<unsigned>(CommandMailbox::COMMAND_MAX));
+        mqttPublish(respTopic_, response, respLen, config_.qos, false);
+        clearMailbox(seq);
+    }
+}
+
+bool MqttTransport::drainMailbox(uint32_t now) {
+    if (!connected()) return false;
+    
+    // Commands dropped while the table was full are still retained
+    bool refill;
+    {
+        Guard guard(*this);
+        refill = mailbox_.needsRefill();
+    }
+    if (refill) {
+        subscribeMailbox();
+    }
+    
+    // Result and clear both need a slot when publishing at QoS 1
+    size_t needed = config_.qos > 0 ? 2 : 1;
+    if (asyncClient_ && inflight_.window() - inflight_.inFlight() < needed) {
+        return false;
+    }
+    
+    // One command per step, taken out under the lock so offer() on the
+    // client's task cannot move it; run without the lock held
+    uint8_t command[CommandMailbox::COMMAND_MAX];
+    size_t commandLen;
+    uint32_t seq;
+    {
+        Guard guard(*this);
+        if (!mailbox_.ready(now, config_.mailboxSettle)) {
+            return false;
+        }
+        const MailboxEntry* entry = mailbox_.peek();
+        seq = entry->seq;
+        commandLen = entry->len;
+        memcpy(command, entry->command, commandLen);
+        mailbox_.pop();
+    }
+    
+    uint8_t response[RESPONSE_BUFFER_SIZE];
+    size_t hdr = formatTo(response, sizeof(response), "mailbox %lu ",
+                          static_cast<unsigned long>(seq));
+    size_t len = executeCommand(command, commandLen, response + hdr, sizeof(response) - hdr);
+    
+    mqttPublish(respTopic_, response, hdr + len, config_.qos, false);
+    clearMailbox(seq);
+    
+    Guard guard(*this);
+    return mailbox_.ready(now, config_.mailboxSettle);
+}
+
+void MqttTransport::clearMailbox(uint32_t seq) {
+    char topic[TOPIC_MAX_LEN];
+    int n = snprintf(topic, sizeof(topic), "%.*s%lu",
+                     static_cast<int>(strlen(mailboxTopic_) - 1), mailboxTopic_,
+                     static_cast<unsigned long>(seq));
+    if (n <= 0 || static_cast<size_t>(n) >= sizeof(topic)) return;
+    
+    // An empty retained message deletes the retained command
+    mqttPublish(topic, nullptr, 0, 1, true);
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_MAILBOX
+
+bool MqttTransport::mailboxDrained() const {
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    if (!config_.mailbox) return true;
+    Guard guard(*this);
+    return connected() && mailbox_.drained(millis(), config_.mailboxSettle);
+#else
+    return true;
+#endif
+}
+
+uint32_t MqttTransport::getLastMailboxSeq() const {
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    Guard guard(*this);
+    return mailbox_.lastSeq();
+#else
+    return 0;
+#endif
+}
+
+// =============================================================================
+// Duty-Cycle Batching
+// =============================================================================
+
+bool MqttTransport::publishOutbound(uint8_t topic, const uint8_t* data, size_t len, bool urgent) {
+    const char* target = topic == BATCH_RESPONSE ? respTopic_ : eventTopic_;
+    
+#if ESPMOLE_MQTT_FEATURE_TIME
+    // Stamped when produced, not when a batch goes out
+    uint8_t stamped[TimeStamper::STAMP_MAX + EVENT_HEADER_MAX + RESPONSE_BUFFER_SIZE];
+    const size_t room = sizeof(stamped) - TimeStamper::STAMP_MAX;
+    if (config_.timestamps && len <= room) {
+        uint8_t* body = stamped + TimeStamper::STAMP_MAX;
+        memcpy(body, data, len);
+        size_t stamp = stampBefore(topic, body);
+        data = body - stamp;
+        len += stamp;
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    // Too big to ever buffer - send it on its own
+    if (config_.batchInterval == 0 || !OutboundBatch::fits(len)) {
+        return mqttPublish(target, data, len, config_.qos, false);
+    }
+    
+    // send() and broadcast() run on the client's task too
+    Guard guard(*this);
+    if (!batch_.add(topic, data, len, urgent)) {
+        // Buffer full - make room with an early burst
+        flush();
+        if (!batch_.add(topic, data, len, urgent)) {
+            batch_.noteDropped();
+            return false;
+        }
+    }
+    
+    if (urgent) {
+        flush();
+    }
+    return true;
+#else
+    (void)urgent;
+    return mqttPublish(target, data, len, config_.qos, false);
+#endif
+}
+
+bool MqttTransport::flush() {
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    Guard guard(*this);
+    if (!connected()) {
+        return batch_.pending() == 0;
+    }
+    
+    uint8_t topic = 0;
+    const uint8_t* data = nullptr;
+    size_t len = 0;
+    while (batch_.peek(topic, data, len)) {
+        const char* target = topic == BATCH_RESPONSE ? respTopic_ : eventTopic_;
+        if (!mqttPublish(target, data, len, config_.qos, false)) {
+            // In-flight window full or client queue busy - continue next poll()
+            break;
+        }
+        batch_.pop();
+    }
+    return batch_.pending() == 0;
+#else
+    return true;
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_BATCH
+
+bool MqttTransport::flushStep() {
+    // One message of a due burst per step
+    Guard guard(*this);
+    if (!batch_.flushDue() || !connected()) {
+        return false;
+    }
+    
+    uint8_t topic = 0;
+    const uint8_t* data = nullptr;
+    size_t len = 0;
+    batch_.peek(topic, data, len);
+    const char* target = topic == BATCH_RESPONSE ? respTopic_ : eventTopic_;
+    if (!mqttPublish(target, data, len, config_.qos, false)) {
+        // In-flight window full or client queue busy - continue next poll()
+        return false;
+    }
+    batch_.pop();
+    return batch_.flushDue();
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_BATCH
+
+uint32_t MqttTransport::nextFlush() const {
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    if (config_.batchInterval > 0) {
+        Guard guard(*this);
+        return batch_.nextFlush();
+    }
+#endif
+    return millis();
+}
+
+uint32_t MqttTransport::msUntilFlush() const {
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    if (config_.batchInterval > 0) {
+        Guard guard(*this);
+        return batch_.msUntilFlush();
+    }
+#endif
+    return 0;
+}
+
+BatchStats MqttTransport::batchStats() const {
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    Guard guard(*this);
+    return batch_.stats();
+#else
+    return BatchStats();
+#endif
+}
+
+// =============================================================================
+// ITransport Interface
+// =============================================================================
+
+bool MqttTransport::send(PeerHandle peer, const uint8_t* data, size_t len) {
+#if ESPMOLE_MQTT_FEATURE_TERM
+    // Output for a terminal session joins its stream
+    if (peer - PEER_MQTT_TERM < ESPMOLE_MQTT_TERM_SESSIONS) {
+        Guard guard(*this);
+        TerminalSession& session = terms_[peer - PEER_MQTT_TERM];
+        return session.isOpen() && session.write(data, len, millis()) == len;
+    }
+#else
+    (void)peer;
+#endif
+    // Other MQTT responses go to the response topic
+    return publishOutbound(BATCH_RESPONSE, data, len, false);
+}
+
+uint32_t MqttTransport::eventsFiltered() const {
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    return filter_->dropped();
+#else
+    return 0;
+#endif
 }
 
 bool MqttTransport::broadcast(const uint8_t* data, size_t len) {
+    return broadcastEvent(data, len, EVENT_INFO);
+}
+
+bool MqttTransport::broadcastEvent(const uint8_t* data, size_t len, uint8_t severity) {
+#if ESPMOLE_MQTT_FEATURE_BUS
+    // On-device consumers first - by reference, no broker involved
+    if (bus_.publish(data, len, severity)) {
+        return true;
+    }
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    // Drop events nobody asked for before spending anything on them
+    if (config_.eventFilter) {
+        Guard guard(*this);
+        if (!filter_->accept(data, len, severity)) {
+            return false;
+        }
+    }
+#endif
+    
+    bool urgent = severity >= config_.batchUrgentSeverity;
+    
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    if (config_.sequenceEvents) {
+        return publishSequencedEvent(data, len, urgent);
+    }
+#endif
+    
     // Broadcasts go to event topic
-    return mqttPublish(eventTopic_, data, len, config_.qos, false);
+    return publishOutbound(BATCH_EVENT, data, len, urgent);
+}
+
+int MqttTransport::subscribeLocal(LocalEventHandler handler, void* ctx, const char* type,
+                                  uint8_t minSeverity, BusPolicy policy) {
+#if ESPMOLE_MQTT_FEATURE_BUS
+    return bus_.subscribe(handler, ctx, type, minSeverity, policy);
+#else
+    (void)handler;
+    (void)ctx;
+    (void)type;
+    (void)minSeverity;
+    (void)policy;
+    return -1;
+#endif
+}
+
+void MqttTransport::unsubscribeLocal(int id) {
+#if ESPMOLE_MQTT_FEATURE_BUS
+    bus_.unsubscribe(id);
+#else
+    (void)id;
+#endif
+}
+
+BusStats MqttTransport::busStats() const {
+#if ESPMOLE_MQTT_FEATURE_BUS
+    return bus_.stats();
+#else
+    return BusStats();
+#endif
+}
+
+// =============================================================================
+// Log Stream
+// =============================================================================
+
+void MqttTransport::log(uint8_t level, const char* fmt, ...) {
+#if ESPMOLE_MQTT_FEATURE_LOG
+    va_list args;
+    va_start(args, fmt);
+    log_.vlog(level, fmt, args);
+    va_end(args);
+#else
+    (void)level;
+    (void)fmt;
+#endif
+}
+
+void MqttTransport::setLogLevel(uint8_t level) {
+#if ESPMOLE_MQTT_FEATURE_LOG
+    log_.setLevel(level);
+#else
+    (void)level;
+#endif
+}
+
+uint8_t MqttTransport::logLevel() const {
+#if ESPMOLE_MQTT_FEATURE_LOG
+    return log_.level();
+#else
+    return LOG_OFF;
+#endif
+}
+
+LogStats MqttTransport::logStats() const {
+#if ESPMOLE_MQTT_FEATURE_LOG
+    return log_.stats();
+#else
+    return LogStats();
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_LOG
+
+size_t MqttTransport::builtinLog(const char* args, uint8_t* response, size_t cap) {
+    if (*args != '\0') {
+        int level = LogStream::parseLevel(args);
+        if (level < 0) {
+            return formatTo(response, cap, "log: usage $log [off|error|warn|info|debug|trace]");
+        }
+        log_.setLevel(static_cast<uint8_t>(level));
+    }
+    
+    LogStats s = log_.stats();
+    return formatTo(response, cap, "log level=%s max=%s queued=%u dropped=%lu",
+                    LogStream::levelName(log_.level()),
+                    LogStream::levelName(LogStream::COMPILED_LEVEL),
+                    static_cast<unsigned>(log_.pending()),
+                    static_cast<unsigned long>(s.dropped));
+}
+
+bool MqttTransport::pumpLog(uint32_t now) {
+    // Collect lines for logInterval unless the queue is filling up
+    if (!logBurst_ && now - lastLogPublish_ < config_.logInterval
+            && log_.pending() < LogStream::SLOTS / 2) {
+        return false;
+    }
+    
+    // While disconnected the queue keeps the newest lines
+    if (!connected()) {
+        logBurst_ = false;
+        return false;
+    }
+    if (!logBurst_) {
+        lastLogPublish_ = now;
+        logBurst_ = true;
+    }
+    
+    // One batch per step, until the queue is empty
+    char batch[LOG_BATCH_SIZE];
+    size_t lines = 0;
+    size_t len = log_.drain(batch, sizeof(batch), lines);
+    if (len == 0) {
+        logBurst_ = false;
+        return false;
+    }
+    if (!mqttPublish(logTopic_, reinterpret_cast<const uint8_t*>(batch), len, 0, false)) {
+        log_.noteLost(lines);
+        logBurst_ = false;
+        return false;
+    }
+    logBurst_ = log_.pending() > 0;
+    return logBurst_;
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_LOG
+
+// =============================================================================
+// Terminal
+// =============================================================================
+
+size_t MqttTransport::terminalSessions() const {
+#if ESPMOLE_MQTT_FEATURE_TERM
+    Guard guard(*this);
+    size_t open = 0;
+    for (const TerminalSession& session : terms_) {
+        if (session.isOpen()) open++;
+    }
+    return open;
+#else
+    return 0;
+#endif
+}
+
+TermStats MqttTransport::terminalStats() const {
+    TermStats total;
+#if ESPMOLE_MQTT_FEATURE_TERM
+    Guard guard(*this);
+    for (const TerminalSession& session : terms_) {
+        const TermStats& s = session.stats();
+        total.lines += s.lines;
+        total.bytesIn += s.bytesIn;
+        total.bytesOut += s.bytesOut;
+        total.chunks += s.chunks;
+        total.dropped += s.dropped;
+    }
+#endif
+    return total;
+}
+
+#if ESPMOLE_MQTT_FEATURE_TERM
+
+void MqttTransport::handleTerminal(const char* topic, const uint8_t* payload, size_t len) {
+    // ".../term/<session>/in"
+    const char* name = topic + strlen(termTopic_) - 4;
+    const char* end = strchr(name, '/');
+    if (end == nullptr || strcmp(end, "/in") != 0) return;
+    size_t nameLen = static_cast<size_t>(end - name);
+    
+    // Input arrives on the client's task while poll() flushes the same
+    // sessions; lines run under the (recursive) lock too
+    Guard guard(*this);
+    uint32_t now = millis();
+    TerminalSession* session = nullptr;
+    TerminalSession* unused = nullptr;
+    for (TerminalSession& s : terms_) {
+        if (s.matches(name, nameLen)) {
+            session = &s;
+            break;
+        }
+        if (!unused && !s.isOpen()) unused = &s;
+    }
+    
+    if (!session) {
+        if (!unused || !unused->open(name, nameLen, now)) {
+            // No slot - tell the operator on the session's output topic
+            char out[TOPIC_MAX_LEN + TerminalSession::NAME_MAX];
+            int n = snprintf(out, sizeof(out), "%.*s%.*s/out",
+                             static_cast<int>(strlen(termTopic_) - 4), termTopic_,
+                             static_cast<int>(nameLen), name);
+            static const char busy[] = "term: no free session\n";
+            if (n > 0 && static_cast<size_t>(n) < sizeof(out)) {
+                mqttPublish(out, reinterpret_cast<const uint8_t*>(busy), sizeof(busy) - 1,
+                            config_.qos, false);
+            }
+            return;
+        }
+        session = unused;
+        session->setCoalescing(config_.termFlushDelay, config_.termSegment);
+        session->setPrompt(config_.termPrompt);
+        ESPMOLE_LOGI(*this, "term %s opened", session->name());
+    }
+    
+    session->input(payload, len, now, onTerminalLine, this);
+}
+
+void MqttTransport::onTerminalLine(TerminalSession& session, const char* line, size_t len,
+                                   void* ctx) {
+    static_cast<MqttTransport*>(ctx)->runTerminalLine(session, line, len);
+}
+
+void MqttTransport::runTerminalLine(TerminalSession& session, const char* line, size_t len) {
+    uint32_t now = millis();
+    size_t cap = 0;
+    uint8_t* out = session.beginCommand(cap);
+    size_t outLen = 0;
+    
+    const char* p = line;
+    if (takeWord(p, "$term")) {
+        if (takeWord(p, "keys")) {
+            bool echo = takeWord(p, "echo");
+            session.setMode(TERM_KEYS, echo);
+            outLen = formatTo(out, cap, "term: keys%s", echo ? ", echo" : "");
+        } else if (takeWord(p, "lines")) {
+            session.setMode(TERM_LINES, false);
+            outLen = formatTo(out, cap, "term: lines");
+        } else if (takeWord(p, "exit")) {
+            session.endCommand(formatTo(out, cap, "bye%s", session.newline()), now);
+            session.closeWhenFlushed();
+            return;
+        } else {
+            outLen = formatTo(out, cap, "term: usage $term keys [echo]|lines|exit");
+        }
+    } else if (len > 0) {
+        size_t slot = static_cast<size_t>(&session - terms_);
+        outLen = executeCommand(reinterpret_cast<const uint8_t*>(line), len, out, cap,
+                                PEER_MQTT_TERM + static_cast<PeerHandle>(slot));
+    }
+    session.endCommand(outLen, now);
+}
+
+bool MqttTransport::pumpTerminal(uint32_t now) {
+    // One segment per session per step
+    Guard guard(*this);
+    bool more = false;
+    for (TerminalSession& session : terms_) {
+        if (!session.isOpen()) continue;
+        
+        if (session.closing() && session.pending() == 0) {
+            closeTerminal(session);
+            continue;
+        }
+        if (!session.closing() && session.idleMs(now) >= config_.termIdleTimeout) {
+            session.print("term: idle timeout", now);
+            session.print(session.newline(), now);
+            session.closeWhenFlushed();
+        }
+        if (!session.flushDue(now) || !connected()) continue;
+        
+        // ".../term/<session>/out"
+        char topic[TOPIC_MAX_LEN + TerminalSession::NAME_MAX];
+        int n = snprintf(topic, sizeof(topic), "%.*s%s/out",
+                         static_cast<int>(strlen(termTopic_) - 4), termTopic_, session.name());
+        if (n <= 0 || static_cast<size_t>(n) >= sizeof(topic)) {
+            closeTerminal(session);
+            continue;
+        }
+        
+        const uint8_t* data = nullptr;
+        size_t len = session.peek(data);
+        if (!mqttPublish(topic, data, len, config_.qos, false)) {
+            // In-flight window full or client busy - keep it for the next poll()
+            continue;
+        }
+        session.consume(len);
+        more = more || session.flushDue(now) || (session.closing() && session.pending() == 0);
+    }
+    return more;
+}
+
+void MqttTransport::closeTerminal(TerminalSession& session) {
+    ESPMOLE_LOGI(*this, "term %s closed", session.name());
+    session.close();
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_TERM
+
+// =============================================================================
+// Time Sync
+// =============================================================================
+
+uint64_t MqttTransport::epochMillis() const {
+#if ESPMOLE_MQTT_FEATURE_TIME
+    Guard guard(*this);
+    return timeSync_.epochMillis(millis());
+#else
+    return 0;
+#endif
+}
+
+TimeSyncStats MqttTransport::timeSyncStats() const {
+#if ESPMOLE_MQTT_FEATURE_TIME
+    Guard guard(*this);
+    return timeSync_.stats(millis());
+#else
+    return TimeSyncStats();
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_TIME
+
+void MqttTransport::syncTime(uint32_t now) {
+    if (config_.timeSyncInterval == 0) {
+        return;
+    }
+    
+    // Replies are taken on the client's task ($time <t1> <T2> <T3>)
+    char request[TimeSync::REQUEST_MAX];
+    size_t n;
+    {
+        Guard guard(*this);
+        timeSync_.expire(now);
+        if (!connected() || !timeSync_.requestDue(now)) {
+            return;
+        }
+        
+        // QoS 0 straight out, like probe replies: queueing only adds delay.
+        // t1 is taken here, not at the start of poll()
+        n = timeSync_.startRequest(request, sizeof(request), millis());
+    }
+    mqttPublish(respTopic_, reinterpret_cast<const uint8_t*>(request), n, 0, false);
+}
+
+size_t MqttTransport::builtinTime(const char* args, uint8_t* response, size_t cap) {
+    uint32_t now = millis();
+    if (*args != '\0') {
+        // A controller's answer - nothing goes back
+        uint32_t t1 = 0;
+        uint64_t received = 0;
+        uint64_t sent = 0;
+        if (TimeSync::parseReply(args, t1, received, sent)) {
+            timeSync_.onReply(t1, received, sent, now);
+            return 0;
+        }
+        return formatTo(response, cap, "time: usage $time [<t1> <T2> <T3>]");
+    }
+    
+    TimeSyncStats s = timeSync_.stats(now);
+    size_t len = formatTo(response, cap, "time synced=%d", s.synced ? 1 : 0);
+    if (s.synced) {
+        len += formatTo(response + len, cap - len,
+                        " now=%llu offset=%lld drift_ppm=%ld err=%lu delay=%lu age=%lu",
+                        static_cast<unsigned long long>(timeSync_.epochMillis(now)),
+                        static_cast<long long>(s.offsetMs),
+                        static_cast<long>(s.driftPpm),
+                        static_cast<unsigned long>(s.errorMs),
+                        static_cast<unsigned long>(s.delayMs),
+                        static_cast<unsigned long>(s.ageMs));
+    }
+    len += formatTo(response + len, cap - len, " samples=%lu rejected=%lu lost=%lu",
+                    static_cast<unsigned long>(s.samples),
+                    static_cast<unsigned long>(s.rejected),
+                    static_cast<unsigned long>(s.lost));
+    return len;
+}
+
+size_t MqttTransport::stampBefore(uint8_t topic, uint8_t* data) {
+    // Written into the STAMP_MAX bytes the caller left in front of data
+    Guard guard(*this);
+    if (!config_.timestamps || !timeSync_.synced()) {
+        return 0;
+    }
+    TimeStamper& stream = topic == BATCH_RESPONSE ? respStamp_ : eventStamp_;
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    // Batched output and direct responses can leave out of order, and a
+    // delta is only readable in order
+    if (config_.batchInterval > 0) {
+        stream.reset();
+    }
+#endif
+    
+    char stamp[TimeStamper::STAMP_MAX];
+    size_t n = stream.stamp(stamp, sizeof(stamp), timeSync_.epochMillis(millis()));
+    memcpy(data - n, stamp, n);
+    return n;
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_TIME
+
+// =============================================================================
+// Self-Test
+// =============================================================================
+
+bool MqttTransport::startSelfTest(const LoopbackConfig& config) {
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    Guard guard(*this);
+    if (!connected() || selfTest_.running()) {
+        return false;
+    }
+    // Subscribe before the first message leaves; the broker handles
+    // SUBSCRIBE before the PUBLISH that follows it
+    if (!subscribe(selfTestTopic_, config.qos) || !selfTest_.start(config, micros())) {
+        return false;
+    }
+    selfTest_.onStep(onSelfTestStep, this);
+    ESPMOLE_LOGI(*this, "selftest started rate=%lu..%lu payload=%u",
+                 static_cast<unsigned long>(config.startRate),
+                 static_cast<unsigned long>(config.maxRate),
+                 static_cast<unsigned>(config.payload));
+    return true;
+#else
+    (void)config;
+    return false;
+#endif
+}
+
+void MqttTransport::stopSelfTest() {
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    Guard guard(*this);
+    if (selfTest_.running()) {
+        selfTest_.stop();
+        finishSelfTest();
+    }
+#endif
+}
+
+bool MqttTransport::selfTestRunning() const {
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    Guard guard(*this);
+    return selfTest_.running();
+#else
+    return false;
+#endif
+}
+
+LoopbackResult MqttTransport::selfTestResult() const {
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    Guard guard(*this);
+    return selfTest_.result();
+#else
+    return LoopbackResult();
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+
+bool MqttTransport::runSelfTest() {
+    // Replies are received on the client's task
+    Guard guard(*this);
+    if (!selfTest_.running()) {
+        return false;
+    }
+    if (!connected()) {
+        stopSelfTest();
+        return false;
+    }
+    if (selfTest_.update(micros())) {
+        finishSelfTest();
+        return false;
+    }
+    
+    // Straight to the client: batching would hold messages back and
+    // measure the batch interval instead of the link
+    uint8_t buf[RESPONSE_BUFFER_SIZE];
+    size_t n = selfTest_.next(buf, sizeof(buf), micros());
+    if (n > 0 && !mqttPublish(selfTestTopic_, buf, n, selfTest_.config().qos, false)) {
+        selfTest_.sendFailed();
+    }
+    return selfTest_.due(micros());
+}
+
+void MqttTransport::finishSelfTest() {
+    char buf[160];
+    size_t len = formatTo(reinterpret_cast<uint8_t*>(buf), sizeof(buf), "selftest ");
+    len += LoopbackTest::formatResult(buf + len, sizeof(buf) - len, selfTest_.result());
+    mqttPublish(statsTopic_, reinterpret_cast<const uint8_t*>(buf), len, 0, false);
+    ESPMOLE_LOGI(*this, "%s", buf);
+    
+    // Stragglers still on their way are dropped by the broker
+    if (asyncClient_) {
+        asyncClient_->unsubscribe(selfTestTopic_);
+    }
+#if ESPMOLE_HAS_PUBSUBCLIENT
+    else if (pubSubClient_) {
+        pubSubClient_->unsubscribe(selfTestTopic_);
+    }
+#endif
+}
+
+void MqttTransport::onSelfTestStep(uint8_t index, const LoopbackStep& step, void* ctx) {
+    MqttTransport* self = static_cast<MqttTransport*>(ctx);
+    char buf[160];
+    size_t len = formatTo(reinterpret_cast<uint8_t*>(buf), sizeof(buf), "selftest step=%u ",
+                          static_cast<unsigned>(index));
+    len += LoopbackTest::formatStep(buf + len, sizeof(buf) - len, step);
+    self->mqttPublish(self->statsTopic_, reinterpret_cast<const uint8_t*>(buf), len, 0, false);
+}
+
+size_t MqttTransport::builtinSelfTest(const char* args, uint8_t* response, size_t cap) {
+    if (takeWord(args, "start")) {
+        LoopbackConfig config;
+        char* end = nullptr;
+        unsigned long maxRate = strtoul(args, &end, 10);
+        if (end != args) {
+            config.maxRate = static_cast<uint32_t>(maxRate);
+            args = end;
+            unsigned long payload = strtoul(args, &end, 10);
+            if (end != args) {
+                config.payload = static_cast<uint16_t>(payload);
+            }
+        }
+        if (config.maxRate < config.startRate) {
+            config.startRate = config.maxRate;
+        }
+        if (config.payload <= RESPONSE_BUFFER_SIZE && startSelfTest(config)) {
+            return formatTo(response, cap, "selftest started max_rate=%lu payload=%u",
+                            static_cast<unsigned long>(config.maxRate),
+                            static_cast<unsigned>(config.payload));
+        }
+        if (selfTest_.running()) {
+            return formatTo(response, cap, "selftest: already running");
+        }
+        return formatTo(response, cap, "selftest: usage $selftest start [<max-rate> [<bytes>]]");
+    }
+    
+    if (takeWord(args, "stop")) {
+        if (!selfTest_.running()) {
+            return formatTo(response, cap, "selftest: not running");
+        }
+        stopSelfTest();
+        return formatTo(response, cap, "selftest stopped");
+    }
+    
+    if (*args != '\0') {
+        return formatTo(response, cap, "selftest: usage $selftest [start [<max-rate> [<bytes>]]|stop]");
+    }
+    
+    const LoopbackResult& r = selfTest_.result();
+    if (r.running) {
+        return formatTo(response, cap, "selftest running step=%u rate=%lu",
+                        static_cast<unsigned>(r.steps),
+                        static_cast<unsigned long>(selfTest_.rate()));
+    }
+    if (r.steps == 0) {
+        return formatTo(response, cap, "selftest idle");
+    }
+    size_t len = formatTo(response, cap, "selftest ");
+    len += LoopbackTest::formatResult(reinterpret_cast<char*>(response) + len, cap - len, r);
+    return len;
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_SELFTEST
+
+// =============================================================================
+// Memory
+// =============================================================================
+
+MemoryUsage MqttTransport::memoryUsage(MemoryArea area) const {
+#if ESPMOLE_MQTT_FEATURE_MEM
+    Guard guard(*this);
+    return memory_.usage(area);
+#else
+    (void)area;
+    return MemoryUsage();
+#endif
+}
+
+MemoryUsage MqttTransport::memoryTotal() const {
+#if ESPMOLE_MQTT_FEATURE_MEM
+    Guard guard(*this);
+    return memory_.total();
+#else
+    return MemoryUsage();
+#endif
+}
+
+HeapHealth MqttTransport::heapHealth() const {
+#if ESPMOLE_MQTT_FEATURE_MEM
+    Guard guard(*this);
+    return memory_.heap();
+#else
+    return HeapHealth();
+#endif
+}
+
+#if ESPMOLE_MQTT_FEATURE_MEM
+
+void MqttTransport::accountMemory(uint32_t now) {
+#if ESPMOLE_MQTT_STATIC_TOPICS
+    // Topics live in flash
+    memory_.update(MEM_TOPICS, 0, 0);
+#else
+    const char* const topics[] = {
+        cmdTopic_, respTopic_, statusTopic_, eventTopic_, statsTopic_, rttTopic_,
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+        replayTopic_,
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+        filterTopic_,
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+        mailboxTopic_,
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+        logTopic_,
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+        termTopic_,
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+        selfTestTopic_,
+#endif
+    };
+    size_t count = sizeof(topics) / sizeof(topics[0]);
+    size_t used = strlen(deviceId_) + 1;
+    for (size_t i = 0; i < count; i++) {
+        used += strlen(topics[i]) + 1;
+    }
+    memory_.update(MEM_TOPICS, count * TOPIC_MAX_LEN + DEVICE_ID_MAX_LEN, used);
+#endif
+    
+    size_t client = ownsClient_ && asyncClient_ ? sizeof(AsyncMqttClient) : 0;
+    memory_.update(MEM_CLIENT, client, client);
+    memory_.update(MEM_INFLIGHT, sizeof(inflight_),
+                   MemoryMonitor::share(sizeof(inflight_), inflight_.inFlight(),
+                                        InflightWindow::MAX_SLOTS));
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    memory_.update(MEM_JOURNAL, sizeof(journal_), journal_.used());
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    memory_.update(MEM_SCHED, sizeof(schedules_),
+                   MemoryMonitor::share(sizeof(schedules_), schedules_.count(),
+                                        QueryScheduler::MAX_QUERIES));
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    memory_.update(MEM_FILTER, sizeof(filters_), filter_->active() ? sizeof(EventFilter) : 0);
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    memory_.update(MEM_MAILBOX, sizeof(mailbox_),
+                   MemoryMonitor::share(sizeof(mailbox_), mailbox_.pending(),
+                                        CommandMailbox::MAX_SLOTS));
+#endif
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    memory_.update(MEM_BATCH, sizeof(batch_), batch_.used());
+#endif
+#if ESPMOLE_MQTT_FEATURE_BUS
+    memory_.update(MEM_BUS, sizeof(bus_),
+                   MemoryMonitor::share(sizeof(bus_), bus_.subscribers(),
+                                        LocalEventBus::MAX_SUBSCRIBERS));
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    memory_.update(MEM_LOG, sizeof(log_),
+                   MemoryMonitor::share(sizeof(log_), log_.pending(), LogStream::SLOTS));
+#endif
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    if (broker_) {
+        memory_.update(MEM_BROKER, sizeof(MicroBroker),
+                       MemoryMonitor::share(sizeof(MicroBroker), broker_->clients(),
+                                            MicroBroker::MAX_CLIENTS));
+    } else {
+        memory_.update(MEM_BROKER, 0, 0);
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+    memory_.update(MEM_TERM, sizeof(terms_),
+                   MemoryMonitor::share(sizeof(terms_), terminalSessions(),
+                                        ESPMOLE_MQTT_TERM_SESSIONS));
+#endif
+    
+    // Walking the heap for the largest block is not free - once a second
+    if (memory_.heap().samples > 0 && now - lastHeapSample_ < HEAP_SAMPLE_MS) {
+        return;
+    }
+    lastHeapSample_ = now;
+#if defined(ESP32)
+    memory_.sampleHeap(heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                       heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                       heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+#elif defined(ESP8266)
+    memory_.sampleHeap(ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), 0);
+#endif
+}
+
+size_t MqttTransport::builtinMem(const char* args, uint8_t* response, size_t cap) {
+    char* out = reinterpret_cast<char*>(response);
+    accountMemory(millis());
+    if (takeWord(args, "areas")) {
+        return memory_.formatAreas(out, cap);
+    }
+    if (*args != '\0') {
+        return formatTo(response, cap, "mem: usage $mem [areas]");
+    }
+    return memory_.formatSummary(out, cap, sizeof(*this));
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_MEM
+
+// =============================================================================
+// Round-trip Probes
+// =============================================================================
+
+#if ESPMOLE_MQTT_FEATURE_PROBE
+
+bool MqttTransport::answerProbe(const uint8_t* payload, size_t len, uint32_t rxUs) {
+    static const char PROBE[] = "$probe";
+    const size_t prefix = sizeof(PROBE) - 1;
+    if (len < prefix || memcmp(payload, PROBE, prefix) != 0 ||
+        (len > prefix && payload[prefix] != ' ' && payload[prefix] != '\r' &&
+         payload[prefix] != '\n')) {
+        return false;
+    }
+    
+    // Token: the first word after "$probe"
+    const char* token = reinterpret_cast<const char*>(payload) + prefix;
+    const char* end = reinterpret_cast<const char*>(payload) + len;
+    while (token < end && *token == ' ') token++;
+    size_t tokenLen = 0;
+    while (token + tokenLen < end && token[tokenLen] != ' ' &&
+           token[tokenLen] != '\r' && token[tokenLen] != '\n') {
+        tokenLen++;
+    }
+    
+    ProbeSnapshot s;
+    s.rxUs = rxUs;
+    s.uptimeMs = millis();
+    s.inflight = static_cast<uint16_t>(inflight_.inFlight());
+    s.window = static_cast<uint16_t>(inflight_.window());
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    {
+        Guard guard(*this);
+        s.batchBytes = static_cast<uint32_t>(batch_.used());
+    }
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    s.logLines = static_cast<int32_t>(log_.pending());
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    if (config_.mailbox) s.mailbox = static_cast<int32_t>(mailbox_.pending());
+#endif
+#if defined(ESP32)
+    s.heapFree = static_cast<int32_t>(heap_caps_get_free_size(MALLOC_CAP_8BIT));
+#elif defined(ESP8266)
+    s.heapFree = static_cast<int32_t>(ESP.getFreeHeap());
+#endif
+    
+    // QoS 0 straight out: no dispatcher, no batching, no in-flight window,
+    // so the round trip is the network plus this function
+    char reply[160];
+    s.txUs = micros();
+    size_t n = formatProbeReply(reply, sizeof(reply), token, tokenLen, s);
+    mqttPublish(respTopic_, reinterpret_cast<const uint8_t*>(reply), n, 0, false);
+    return true;
+}
+
+#endif // ESPMOLE_MQTT_FEATURE_PROBE
+
+// =============================================================================
+// Embedded Broker
+// =============================================================================
+
+void MqttTransport::serveLocal(MicroBroker* broker) {
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    if (broker_) {
+        broker_->onMessage(nullptr, nullptr);
+    }
+    broker_ = broker;
+    if (broker == nullptr) {
+        return;
+    }
+    
+    buildTopics();
+    broker->onMessage(onLocalMessage, this);
+    
+    // Retained, so LAN clients that subscribe later see the device online
+    publishBirth();
+#else
+    (void)broker;
+#endif
+}
+
+MicroBroker* MqttTransport::localBroker() const {
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    return broker_;
+#else
+    return nullptr;
+#endif
+}
+
+void MqttTransport::onLocalMessage(const char* topic, const uint8_t* payload, size_t len,
+                                   void* ctx) {
+    static_cast<MqttTransport*>(ctx)->handleMessage(topic, payload, len);
+}
+
+// =============================================================================
+// Traffic Capture
+// =============================================================================
+
+void MqttTransport::setTrace(TraceWriter* trace) {
+#if ESPMOLE_MQTT_FEATURE_TRACE
+    trace_ = trace;
+#else
+    (void)trace;
+#endif
+}
+
+TraceWriter* MqttTransport::trace() const {
+#if ESPMOLE_MQTT_FEATURE_TRACE
+    return trace_;
+#else
+    return nullptr;
+#endif
 }
 
 // =============================================================================
@@ -381,6 +2590,11 @@ bool MqttTransport::publish(const char* topic, const uint8_t* payload,
     return mqttPublish(topic, payload, len, qos, retain);
 }
 
+uint16_t MqttTransport::publishTracked(const char* topic, const uint8_t* payload, size_t len,
+                                       PublishCompleteCallback cb, void* ctx, bool retain) {
+    return mqttPublishTracked(topic, payload, len, 1, retain, cb, ctx);
+}
+
 } // namespace espmole
 
-#endif // NATIVE_BUILD
+#endif // !NATIVE_BUILD || ESPMOLE_MQTT_NATIVE_TRANSPORT
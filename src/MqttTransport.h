@@ -1,11 +1,39 @@
 #ifndef ESPMOLE_MQTT_TRANSPORT_H
 #define ESPMOLE_MQTT_TRANSPORT_H
 
-#ifndef NATIVE_BUILD
+// Host builds leave the transport out unless they supply stand-ins for the
+// Arduino core, espmole-core and AsyncMqttClient (test/stubs)
+#if !defined(NATIVE_BUILD) || defined(ESPMOLE_MQTT_NATIVE_TRANSPORT)
 
 #include <Arduino.h>
 #include <ESPMoleCore.h>
-#include <functional>
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#endif
+#include "MqttBuildConfig.h"
+#include "MqttInflight.h"
+#include "MqttLinkMonitor.h"
+#include "MqttEventFilter.h"
+#include "MqttTlsSession.h"
+#include "MqttStats.h"
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+#include "MqttEventJournal.h"
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+#include "MqttSchedule.h"
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+#include "MqttMailbox.h"
+#endif
+#include "MqttBatch.h"
+#include "MqttEventBus.h"
+#include "MqttLogStream.h"
+#include "MqttMemory.h"
+#include "MqttWork.h"
+#include "MqttTerminal.h"
+#include "MqttTimeSync.h"
+#include "MqttLoopback.h"
 
 // Forward declaration - we don't want to force include of AsyncMqttClient
 class AsyncMqttClient;
@@ -14,6 +42,8 @@ class PubSubClient;
 namespace espmole {
 
 class Dispatcher;
+class MicroBroker;
+class TraceWriter;
 
 /**
  * MQTT configuration structure.
@@ -28,6 +58,10 @@ struct MqttConfig {
     const char* password = nullptr;     ///< Authentication password (optional)
     const char* clientId = nullptr;     ///< Client ID (nullptr = auto-generate from MAC)
     
+    // TLS (standalone mode, AsyncMqttClient built with ASYNC_TCP_SSL_ENABLED)
+    bool tls = false;                   ///< Connect over TLS (usually port 8883)
+    const uint8_t* tlsFingerprint = nullptr;  ///< SHA-1 fingerprint of the server certificate (20 bytes)
+    
     // Topic settings
     const char* baseTopic = "espmole";  ///< Base topic prefix
     const char* deviceId = nullptr;     ///< Device identifier (nullptr = MAC address)
@@ -37,10 +71,55 @@ struct MqttConfig {
     const char* birthPayload = "online";
     const char* lwtPayload = "offline";
     bool retainStatus = true;           ///< Retain status messages
+    bool announceCapabilities = false;  ///< Append " caps=a,b,c" to the birth payload
     
     // Behavior
     uint32_t reconnectInterval = 5000;  ///< Reconnection attempt interval (ms)
     uint8_t qos = 0;                    ///< QoS level for cmd/resp topics
+    
+    // Keep-alive
+    uint16_t keepAlive = 15;            ///< MQTT keep-alive (s), sent with CONNECT (standalone mode)
+    bool adaptiveKeepAlive = false;     ///< Probe RTT when idle, adapt keep-alive, reconnect early on loss
+    uint16_t keepAliveMin = 10;         ///< Adaptive keep-alive lower bound (s)
+    uint16_t keepAliveMax = 300;        ///< Adaptive keep-alive upper bound (s)
+    
+    // QoS 1 flow control
+    uint8_t inflightWindow = 4;         ///< Max unacknowledged QoS 1 publishes (1..ESPMOLE_MQTT_MAX_INFLIGHT)
+    uint32_t ackTimeout = 10000;        ///< PUBACK timeout (ms) before a publish counts as lost
+    
+    // Events
+    bool sequenceEvents = false;        ///< Prefix events with "[seq] " and journal them for replay
+    bool eventFilter = false;           ///< Apply consumer filter from espmole/<device-id>/filter
+    
+    // Scheduled queries
+    uint32_t scheduleLease = 60000;     ///< Lease for $sched queries (ms), restarted by "$sched renew"
+    
+    // Mailbox for duty-cycled devices
+    bool mailbox = false;               ///< Run retained commands from espmole/<device-id>/mailbox/<seq>
+    uint32_t mailboxSettle = 500;       ///< Quiet time after the last retained command before running (ms)
+    
+    // Duty-cycle batching
+    uint32_t batchInterval = 0;         ///< Buffer send()/broadcast() and flush every N ms (0 = publish at once)
+    uint8_t batchUrgentSeverity = EVENT_ERROR;  ///< Events at or above this severity flush immediately
+    
+    // Diagnostics
+    uint32_t statsInterval = 0;         ///< Stats publish interval (ms), 0 = disabled
+    uint8_t logLevel = LOG_INFO;        ///< Runtime log level (capped at ESPMOLE_MQTT_LOG_LEVEL), "$log <level>" changes it
+    uint32_t logInterval = 1000;        ///< Collect log lines this long (ms) before publishing a batch
+    
+    // Terminal sessions
+    bool terminal = false;              ///< Serve interactive sessions on espmole/<device-id>/term/<session>/in
+    uint32_t termFlushDelay = 20;       ///< Longest time terminal output waits to be coalesced (ms)
+    uint16_t termSegment = 512;         ///< Terminal output bytes per publish; this much goes at once
+    uint32_t termIdleTimeout = 300000;  ///< Close a session after this long without input (ms)
+    const char* termPrompt = "> ";      ///< Written after each command (nullptr = none)
+    
+    // Time sync
+    uint32_t timeSyncInterval = 0;      ///< Ask the controller for its time this often (ms), 0 = never
+    bool timestamps = false;            ///< Prefix events and responses with "@<unix-ms> " / "+<ms> " once synced
+    
+    // Loop latency
+    uint32_t pollBudget = 2000;         ///< Time poll() may spend on queued work (us), 0 = one step of each task
 };
 
 /**
@@ -59,6 +138,53 @@ struct MqttConfig {
  * - `espmole/<device-id>/resp`   - Responses FROM the device (publish)
  * - `espmole/<device-id>/status` - Online/offline status (birth/LWT)
  * - `espmole/<device-id>/event`  - Async events/broadcasts (publish)
+ * - `espmole/<device-id>/stats`  - Transport statistics (publish, optional)
+ * - `espmole/<device-id>/replay` - Replayed events (publish, on request)
+ * - `espmole/<device-id>/filter` - Event filter spec (subscribe, retained, optional)
+ * - `espmole/<device-id>/mailbox/<seq>` - Retained commands (subscribe, optional)
+ * - `espmole/<device-id>/rtt`    - Empty QoS 1 RTT probes (publish, adaptiveKeepAlive)
+ * - `espmole/<device-id>/log`    - Log lines, several per message (publish)
+ * - `espmole/<device-id>/state/<command>` - Retained query results (publish, publishState())
+ * - `espmole/<device-id>/term/<session>/in|out` - Interactive terminal (optional)
+ * - `espmole/<device-id>/selftest` - Loopback test messages (publish and subscribe, during $selftest)
+ * 
+ * Payloads on the command topic that start with `$` are built-in transport
+ * commands and never reach the dispatcher:
+ * - `$replay <seq>` - stream journaled events with sequence >= seq
+ * - `$sched every|watch <ms> <command>` - run a command periodically and
+ *   push the result (every run, or only on change) to the event topic;
+ *   `$sched state <ms> <command>` keeps it retained on state/<command>;
+ *   `$sched renew|cancel <id>`, `$sched list`
+ * - `$log [off|error|warn|info|debug|trace]` - show or set the log level
+ * - `$probe [token]` - answered as soon as it arrives with device timestamps
+ *   and queue depths, see MqttProbe.h; for round-trip measurements
+ * - `$time <t1> <T2> <T3>` - a controller's answer to "time? <t1>" on the
+ *   response topic (config.timeSyncInterval); `$time` alone reports the sync
+ * - `$selftest start [<max-rate> [<bytes>]]`, `$selftest stop`, `$selftest` -
+ *   loopback throughput test through the broker, results on the stats topic
+ * 
+ * Mailbox commands are published retained by controllers while the device
+ * sleeps. After connecting they run in sequence order, the result goes to
+ * the response topic as "mailbox <seq> <result>", and the retained message
+ * is cleared with an empty payload.
+ * 
+ * broadcast() first hands the event to local subscribers (subscribeLocal())
+ * by reference; a subscriber can keep it off the network.
+ * 
+ * With serveLocal() the same topics are also served by an embedded
+ * MicroBroker, so LAN clients can talk to the device without a broker.
+ * 
+ * With config.batchInterval set, send() and broadcast() only buffer the
+ * message; poll() publishes the buffer in one burst when the interval
+ * elapses, the buffer fills up, or an urgent event arrives.
+ * 
+ * QoS 1 publishes (config.qos = 1, birth message) are tracked by packet ID
+ * in a fixed in-flight window. When the window is full, send()/broadcast()
+ * return false until PUBACKs arrive or the entries time out.
+ * 
+ * Buffer sizes and optional features can be fixed at build time, see
+ * MqttBuildConfig.h. Defining ESPMOLE_MQTT_DEVICE_ID builds all topics at
+ * compile time; config.baseTopic and config.deviceId are then ignored.
  * 
  * Usage (Standalone):
  * @code
@@ -84,13 +210,24 @@ struct MqttConfig {
  */
 class MqttTransport : public ITransport {
 public:
-    /// Callback type for user messages (non-ESPMole topics)
-    using UserMessageCallback = std::function<void(const char*, const uint8_t*, size_t)>;
+    /// Callback type for user messages (non-ESPMole topics). A function
+    /// pointer, not std::function: pass captured state through ctx.
+    using UserMessageCallback = void (*)(const char* topic, const uint8_t* payload, size_t len,
+                                         void* ctx);
     
     // Topic buffer sizes
-    static constexpr size_t TOPIC_MAX_LEN = 80;
-    static constexpr size_t DEVICE_ID_MAX_LEN = 32;
-    static constexpr size_t RESPONSE_BUFFER_SIZE = 256;
+    static constexpr size_t TOPIC_MAX_LEN = ESPMOLE_MQTT_TOPIC_MAX;
+    static constexpr size_t DEVICE_ID_MAX_LEN = ESPMOLE_MQTT_DEVICE_ID_MAX;
+    static constexpr size_t RESPONSE_BUFFER_SIZE = ESPMOLE_MQTT_RESPONSE_BUFFER;
+    static constexpr size_t EVENT_HEADER_MAX = 24;      ///< Room for "[seq] " or "[seq:len] "
+    /// One replay publish: 512, or more so the largest event fits with its header
+    static constexpr size_t REPLAY_BATCH_SIZE =
+        EVENT_HEADER_MAX + RESPONSE_BUFFER_SIZE + 1 > 512 ? EVENT_HEADER_MAX + RESPONSE_BUFFER_SIZE + 1
+                                                          : 512;
+    static constexpr size_t LOG_BATCH_SIZE = 512;
+    static constexpr uint32_t HEAP_SAMPLE_MS = 1000;   ///< Heap sampling period in poll()
+    static constexpr size_t BUILTIN_LINE_MAX = 96;
+    static constexpr char BUILTIN_PREFIX = '$';
 
     /**
      * Construct MQTT transport for integration mode (no config needed).
@@ -123,11 +260,30 @@ public:
     void begin();
     
     /**
-     * Process MQTT events (standalone mode).
-     * Call in loop(). Handles reconnection, keep-alive, incoming messages.
+     * Process MQTT events.
+     * Call in loop(). Handles reconnection (standalone mode), PUBACK
+     * timeouts and the periodic stats publish (both modes).
+     * Same as poll(config.pollBudget).
      */
     void poll();
     
+    /**
+     * Process MQTT events within a time budget.
+     * 
+     * Every deferred task - PUBACK timeouts, reconnection, replay, scheduled
+     * queries, mailbox, log and batch flushing - runs in small steps from one
+     * scheduler. Each task gets one step per call; tasks with a backlog then
+     * share the rest of the budget in turn. Work left over continues on the
+     * next call, starting with the task after the last one that ran.
+     * 
+     * A step is not interrupted, so a call can overrun the budget by one
+     * step (one publish or one command); workStats() shows by how much.
+     * 
+     * @param budgetMicros  Time to spend (us), 0 = one step of each task
+     * @return              Tasks with work left - call again soon if > 0
+     */
+    size_t poll(uint32_t budgetMicros);
+    
     /**
      * Subscribe to additional topic (standalone mode).
      * Messages will be delivered to UserMessageCallback.
@@ -151,13 +307,48 @@ public:
     bool publish(const char* topic, const uint8_t* payload, size_t len, 
                  uint8_t qos = 0, bool retain = false);
     
+    /**
+     * Publish at QoS 1 and get notified when the broker acknowledges it.
+     * Requires AsyncMqttClient (PubSubClient cannot publish at QoS 1).
+     * 
+     * @param topic    Topic to publish to
+     * @param payload  Message payload
+     * @param len      Payload length
+     * @param cb       Called once with the PUBACK result (or timeout)
+     * @param ctx      Context passed to the callback
+     * @param retain   Retain flag (default false)
+     * @return         Packet ID, or 0 if not sent (disconnected or window full)
+     */
+    uint16_t publishTracked(const char* topic, const uint8_t* payload, size_t len,
+                            PublishCompleteCallback cb, void* ctx = nullptr,
+                            bool retain = false);
+    
+    /**
+     * Set callback for QoS 1 publishes made without their own callback
+     * (send(), broadcast(), birth). Use getLastPacketId() after send()
+     * to correlate.
+     * 
+     * @param cb   Completion callback (nullptr to disable)
+     * @param ctx  Context passed to the callback
+     */
+    void setPublishCallback(PublishCompleteCallback cb, void* ctx = nullptr) {
+        publishCb_ = cb;
+        publishCbCtx_ = ctx;
+    }
+    
     /**
      * Set callback for user's messages (non-ESPMole topics).
      * Used in standalone mode when user wants to handle additional topics.
+     * A plain function pointer, so registering and calling it never
+     * touches the heap.
      * 
-     * @param cb  Callback function
+     * @param cb   Callback function (nullptr to disable)
+     * @param ctx  Context passed to the callback
      */
-    void setUserCallback(UserMessageCallback cb) { userCallback_ = cb; }
+    void setUserCallback(UserMessageCallback cb, void* ctx = nullptr) {
+        userCallback_ = cb;
+        userCallbackCtx_ = ctx;
+    }
 
     // =========================================================================
     // Integration Mode API
@@ -197,13 +388,31 @@ public:
      * Call this from your onConnect callback to subscribe and publish birth.
      */
     void onMqttConnect();
+    
+    /**
+     * Called when MQTT disconnects (integration mode).
+     * attachTo(AsyncMqttClient*) registers this automatically; call it from
+     * your own disconnect handling with other clients.
+     */
+    void onMqttDisconnect();
+    
+    /**
+     * Called when a PUBACK arrives (integration mode).
+     * attachTo(AsyncMqttClient*) registers this automatically; call it
+     * yourself only when forwarding acknowledgements from another client.
+     * 
+     * @param packetId  Acknowledged packet ID
+     */
+    void onMqttPublish(uint16_t packetId);
 
     // =========================================================================
     // Common API
     // =========================================================================
     
     /**
-     * Check if connected to MQTT broker.
+     * Check if messages can go out: connected to the MQTT broker, or
+     * serving an embedded broker (serveLocal()), even while the upstream
+     * broker is down.
      */
     bool connected() const;
     
@@ -226,6 +435,45 @@ public:
      * Get the device ID being used.
      */
     const char* getDeviceId() const { return deviceId_; }
+    
+    /**
+     * Get packet ID of the last tracked (QoS 1) publish.
+     */
+    uint16_t getLastPacketId() const { return lastPacketId_; }
+    
+    /**
+     * Number of QoS 1 publishes awaiting PUBACK.
+     */
+    size_t inFlight() const { return inflight_.inFlight(); }
+    
+    /**
+     * true if a QoS 1 publish would currently fit into the in-flight window.
+     */
+    bool canPublish() const { return inflight_.hasRoom(); }
+    
+    /**
+     * QoS 1 delivery counters and PUBACK latency.
+     */
+    const InflightStats& inflightStats() const { return inflight_.stats(); }
+    
+    /**
+     * Smoothed broker RTT, its variation and the keep-alive in use.
+     * Every PUBACK is an RTT sample; with adaptiveKeepAlive the transport
+     * also sends probes while idle.
+     */
+    const LinkStats& linkStats() const { return link_.stats(); }
+    
+    /**
+     * Keep-alive (s) for the next connect. Standalone mode applies it
+     * itself; in integration mode pass it to the client before connecting.
+     */
+    uint16_t keepAlive() const { return link_.keepAlive(); }
+    
+    /**
+     * true if probes were lost and the connection should be dropped and
+     * re-established (standalone mode does this itself).
+     */
+    bool reconnectAdvised() const { return link_.reconnectAdvised(); }
 
     // =========================================================================
     // ITransport Interface
@@ -234,18 +482,367 @@ public:
     bool send(PeerHandle peer, const uint8_t* data, size_t len) override;
     bool broadcast(const uint8_t* data, size_t len) override;
     const char* name() const override { return "MQTT"; }
+    
+    /**
+     * Broadcast an event with an explicit severity.
+     * broadcast() is equivalent to broadcastEvent(data, len, EVENT_INFO).
+     * 
+     * @return  false if the event was filtered out or could not be published
+     */
+    bool broadcastEvent(const uint8_t* data, size_t len, uint8_t severity);
+    
+    /**
+     * Number of events dropped by the consumer filter since it was last updated.
+     */
+    uint32_t eventsFiltered() const;
+    
+    // =========================================================================
+    // Local Event Bus
+    // =========================================================================
+    
+    /**
+     * Receive events on the device without a broker round trip.
+     * Handlers run inside broadcast()/broadcastEvent(), before the MQTT
+     * publish and before the consumer filter, and get the caller's buffer.
+     * 
+     * @param handler      Called for every matching event
+     * @param ctx          Passed to the handler
+     * @param type         Event type (first payload word) to match, nullptr = all
+     * @param minSeverity  Lowest severity delivered
+     * @param policy       BUS_OBSERVE: also publish; BUS_CONSUME: keep the
+     *                     event local; BUS_HANDLER: handler returns true to keep it
+     * @return             Subscriber ID, -1 if no slot is free
+     */
+    int subscribeLocal(LocalEventHandler handler, void* ctx = nullptr,
+                       const char* type = nullptr, uint8_t minSeverity = 0,
+                       BusPolicy policy = BUS_OBSERVE);
+    
+    /// Remove a local subscriber
+    void unsubscribeLocal(int id);
+    
+    /// Local delivery counters
+    BusStats busStats() const;
+    
+    // =========================================================================
+    // Event Journal
+    // =========================================================================
+    
+    /**
+     * Sequence number of the last event passed to broadcast()
+     * (0 if none, or if sequenceEvents is disabled).
+     * 
+     * With sequenceEvents enabled, events are journaled before publishing,
+     * so an event that failed to publish can still be replayed. Events
+     * larger than RESPONSE_BUFFER_SIZE are refused.
+     */
+    uint32_t getLastEventSeq() const;
+    
+    /**
+     * Oldest event sequence number that can still be replayed.
+     */
+    uint32_t getFirstReplayableSeq() const;
+    
+    // =========================================================================
+    // State Topics
+    // =========================================================================
+    
+    /**
+     * Keep the result of a read-only command as a retained last value on
+     * `<base>/<device-id>/state/<command>` (words become topic levels:
+     * "config get" -> state/config/get). Subscribers get it from the
+     * broker without asking the device.
+     * 
+     * Runs in the `$sched` table without a lease, first shortly after the
+     * call, then every intervalMs; republished after every reconnect.
+     * 
+     * @param command     Command line, as sent to the command topic
+     * @param intervalMs  How often the command runs
+     * @param onChange    Publish only when the result changed (false: every run)
+     * @return            Query ID for stopState(), 0 if the table is full
+     */
+    uint8_t publishState(const char* command, uint32_t intervalMs, bool onChange = true);
+    
+    /**
+     * Stop a query started by publishState() or `$sched`; a state query's
+     * retained value is cleared.
+     */
+    bool stopState(uint8_t id);
+    
+    // =========================================================================
+    // Mailbox
+    // =========================================================================
+    
+    /**
+     * true once every retained mailbox command has run and been cleared.
+     * A duty-cycled device can go back to sleep when this (and
+     * inFlight() == 0) holds.
+     */
+    bool mailboxDrained() const;
+    
+    /**
+     * Sequence number of the last mailbox command executed since boot.
+     */
+    uint32_t getLastMailboxSeq() const;
+    
+    // =========================================================================
+    // Duty-Cycle Batching
+    // =========================================================================
+    
+    /**
+     * millis() time of the next burst (config.batchInterval > 0).
+     * The application can sleep until then; buffered messages are kept.
+     */
+    uint32_t nextFlush() const;
+    
+    /**
+     * Milliseconds until nextFlush(), 0 if a burst is due.
+     */
+    uint32_t msUntilFlush() const;
+    
+    /**
+     * Publish everything buffered now.
+     * 
+     * @return  true if the buffer is empty afterwards
+     */
+    bool flush();
+    
+    /**
+     * Burst counters and connected time (energy proxies).
+     */
+    BatchStats batchStats() const;
+    
+    // =========================================================================
+    // Log Stream
+    // =========================================================================
+    
+    /**
+     * Queue a printf-style line for the log topic. Safe from any task,
+     * never blocks: when the queue is full the oldest line is dropped.
+     * Prefer the ESPMOLE_LOGE/W/I/D/T macros, which compile out levels
+     * above ESPMOLE_MQTT_LOG_LEVEL.
+     * 
+     * @param level  LogLevel
+     * @param fmt    printf format
+     */
+    void log(uint8_t level, const char* fmt, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+    
+    /// Runtime log level (also set remotely with "$log <level>")
+    void setLogLevel(uint8_t level);
+    uint8_t logLevel() const;
+    
+    /// Lines written, dropped and batches published
+    LogStats logStats() const;
+    
+    // =========================================================================
+    // Memory
+    // =========================================================================
+    
+    /**
+     * Bytes reserved, used and the high-water mark of one area, as of the
+     * last poll(). Also reported by "$mem" and, with statsInterval, on the
+     * stats topic (" mem=<used>/<reserved> heap= heap_blk= frag=").
+     */
+    MemoryUsage memoryUsage(MemoryArea area) const;
+    
+    /// All areas together
+    MemoryUsage memoryTotal() const;
+    
+    /// Free heap, largest free block and fragmentation (sampled every HEAP_SAMPLE_MS)
+    HeapHealth heapHealth() const;
+    
+    // =========================================================================
+    // Work Scheduling
+    // =========================================================================
+    
+    /// Tasks with work left after the last poll()
+    size_t workPending() const { return work_.pending(); }
+    
+    /**
+     * poll() calls, steps, calls that left work behind and calls over their
+     * budget, with the longest call. Also on the stats topic
+     * (" poll_us=<last>/<max> poll_over= poll_left=").
+     */
+    const WorkStats& workStats() const { return work_.stats(); }
+    
+    // =========================================================================
+    // Terminal
+    // =========================================================================
+    
+    /**
+     * Interactive sessions (config.terminal): input published to
+     * `term/<session>/in` runs line by line like commands on the cmd topic,
+     * output comes back on `term/<session>/out` in coalesced segments of
+     * up to config.termSegment bytes. A finished command goes out at once;
+     * smaller writes wait up to config.termFlushDelay for company.
+     * 
+     * Handlers are called with PEER_MQTT_TERM + slot as their peer, and
+     * send() to that peer streams into the session - progress output of a
+     * long command shares publishes with the result. Results are limited
+     * by the session buffer (ESPMOLE_MQTT_TERM_BUFFER), not by
+     * ESPMOLE_MQTT_RESPONSE_BUFFER.
+     * 
+     * Input starting with `$term` controls the session:
+     * - `$term keys [echo]` - keystroke input, edited (and echoed) here
+     * - `$term lines` - whole-line input, the client edits and echoes (default)
+     * - `$term exit` - close the session
+     */
+    
+    /// Sessions open now
+    size_t terminalSessions() const;
+    
+    /// Lines, bytes in and out, publishes and dropped output, all sessions together
+    TermStats terminalStats() const;
+    
+    // =========================================================================
+    // Time Sync
+    // =========================================================================
+    
+    /**
+     * Controller time (config.timeSyncInterval): the device publishes
+     * "time? <t1>" on the response topic, a controller answers on the
+     * command topic with "$time <t1> <T2> <T3>" (its receive and send time,
+     * Unix ms), and the offset and drift of millis() are estimated from
+     * the least delayed of the recent exchanges (see MqttTimeSync.h).
+     * 
+     * With config.timestamps, events and responses published once synced
+     * start with "@<unix-ms> " or "+<ms since the previous one> ", per topic.
+     */
+    
+    /// Controller time now (Unix ms), 0 if not synced
+    uint64_t epochMillis() const;
+    
+    /// Offset, drift, error bound and exchange counters; also "$time"
+    TimeSyncStats timeSyncStats() const;
+    
+    // =========================================================================
+    // Self-Test
+    // =========================================================================
+    
+    /**
+     * Measure what device, network and broker sustain together: publish
+     * numbered, timestamped messages to the `selftest` topic, which the
+     * device subscribes to for the duration, at rising rates until loss,
+     * latency or the loop's own pace fails a step (see MqttLoopback.h).
+     * The messages bypass batching and the dispatcher. poll() sends one
+     * message per step, so the rates reached also reflect how often
+     * loop() calls poll().
+     * 
+     * Each step is reported on the stats topic as "selftest step=<n>
+     * rate= sent= recv= loss_pm= p50_us= p95_us= p99_us= max_us= bps=
+     * ok|<limit>", the end as "selftest max_rate=<msg/s> bps= loss_pm=
+     * p50_us= p95_us= p99_us= max_us= steps= late= limit=". The test aborts if
+     * the connection drops.
+     * 
+     * @return false if not connected, already running or the config is invalid
+     */
+    bool startSelfTest(const LoopbackConfig& config = LoopbackConfig());
+    
+    /// Abort a running self-test (reported as limit=aborted)
+    void stopSelfTest();
+    
+    bool selfTestRunning() const;
+    
+    /// Last (or running) test's result
+    LoopbackResult selfTestResult() const;
+    
+    // =========================================================================
+    // TLS
+    // =========================================================================
+    
+    /**
+     * Add handshake counters to the stats topic (" tls_full= tls_resumed=
+     * tls_failed= tls_ms=<full>/<resumed>"), e.g. from a TlsClient used
+     * with PubSubClient. nullptr stops reporting.
+     */
+    void reportTlsStats(const TlsHandshakeStats* stats) { tlsStats_ = stats; }
+    
+    // =========================================================================
+    // Embedded Broker
+    // =========================================================================
+    
+    /**
+     * Serve the ESPMole topics from an embedded broker as well (broker-less
+     * LAN operation). Messages LAN clients publish go through handleMessage(),
+     * every publish is mirrored to the broker, and the birth message is
+     * published there retained. Works without begin()'s upstream broker
+     * (config.broker = nullptr) or next to it. poll() runs the broker's
+     * keep-alive checks. nullptr detaches.
+     * 
+     * @param broker  Broker fed by MqttBrokerServer (or other network glue)
+     */
+    void serveLocal(MicroBroker* broker);
+    
+    /// Broker given to serveLocal(), nullptr if none
+    MicroBroker* localBroker() const;
+    
+    // =========================================================================
+    // Traffic Capture
+    // =========================================================================
+    
+    /**
+     * Record every message handleMessage() receives and every publish
+     * (before it is handed to the client) into a trace, for replay with
+     * tools/trace_replay. The writer must have been started with begin().
+     * nullptr stops recording.
+     */
+    void setTrace(TraceWriter* trace);
+    
+    /// Trace given to setTrace(), nullptr if none
+    TraceWriter* trace() const;
 
 private:
     Dispatcher* dispatcher_;
     MqttConfig config_;
     bool standaloneMode_ = false;
     
+#if ESPMOLE_MQTT_STATIC_TOPICS
+    // Topics (built at compile time, in flash). Static, so no instance
+    // carries pointers to them either
+    static constexpr const char* cmdTopic_ = StaticTopics::cmd.c_str();
+    static constexpr const char* respTopic_ = StaticTopics::resp.c_str();
+    static constexpr const char* statusTopic_ = StaticTopics::status.c_str();
+    static constexpr const char* eventTopic_ = StaticTopics::event.c_str();
+    static constexpr const char* statsTopic_ = StaticTopics::stats.c_str();
+    static constexpr const char* replayTopic_ = StaticTopics::replay.c_str();
+    static constexpr const char* filterTopic_ = StaticTopics::filter.c_str();
+    static constexpr const char* mailboxTopic_ = StaticTopics::mailbox.c_str();
+    static constexpr const char* rttTopic_ = StaticTopics::rtt.c_str();
+    static constexpr const char* logTopic_ = StaticTopics::log.c_str();
+    static constexpr const char* termTopic_ = StaticTopics::term.c_str();
+    static constexpr const char* selfTestTopic_ = StaticTopics::selftest.c_str();
+    static constexpr const char* deviceId_ = ESPMOLE_MQTT_DEVICE_ID;
+#else
     // Topics (built during initialization)
-    char cmdTopic_[TOPIC_MAX_LEN];
-    char respTopic_[TOPIC_MAX_LEN];
-    char statusTopic_[TOPIC_MAX_LEN];
-    char eventTopic_[TOPIC_MAX_LEN];
-    char deviceId_[DEVICE_ID_MAX_LEN];
+    char cmdTopic_[TOPIC_MAX_LEN] = {};
+    char respTopic_[TOPIC_MAX_LEN] = {};
+    char statusTopic_[TOPIC_MAX_LEN] = {};
+    char eventTopic_[TOPIC_MAX_LEN] = {};
+    char statsTopic_[TOPIC_MAX_LEN] = {};
+    char rttTopic_[TOPIC_MAX_LEN] = {};
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    char replayTopic_[TOPIC_MAX_LEN] = {};
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    char filterTopic_[TOPIC_MAX_LEN] = {};
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    char mailboxTopic_[TOPIC_MAX_LEN] = {};     // ".../mailbox/+"
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    char logTopic_[TOPIC_MAX_LEN] = {};
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+    char termTopic_[TOPIC_MAX_LEN] = {};        // ".../term/+/in"
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    char selfTestTopic_[TOPIC_MAX_LEN] = {};
+#endif
+    char deviceId_[DEVICE_ID_MAX_LEN] = {};
+#endif
     
     // Client references (only one will be non-null)
     AsyncMqttClient* asyncClient_ = nullptr;
@@ -253,26 +850,224 @@ private:
     bool ownsClient_ = false;  // true if we created the client (standalone mode)
     
     // User callback for non-ESPMole messages
-    UserMessageCallback userCallback_;
+    UserMessageCallback userCallback_ = nullptr;
+    void* userCallbackCtx_ = nullptr;
+    
+    // QoS 1 tracking
+    InflightWindow inflight_;
+    PublishCompleteCallback publishCb_ = nullptr;
+    void* publishCbCtx_ = nullptr;
+    uint16_t lastPacketId_ = 0;
+    
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    // Event journal and replay stream
+    EventJournal journal_;
+    EventJournal::Cursor replayCursor_;
+    uint32_t replayEnd_ = 0;            // First sequence NOT to replay
+    bool replayActive_ = false;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    // Scheduled and watch queries
+    QueryScheduler schedules_;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    // Consumer interest filter for events: the active table, and a spare
+    // that a new spec is compiled into before it is swapped in
+    EventFilter filters_[2];
+    EventFilter* filter_ = &filters_[0];
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    // Retained commands for duty-cycled devices
+    CommandMailbox mailbox_;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    // Outbound buffer for duty-cycle mode
+    OutboundBatch batch_;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_BUS
+    // On-device event subscribers
+    LocalEventBus bus_;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_LOG
+    // Log lines waiting for the log topic
+    LogStream log_;
+    uint32_t lastLogPublish_ = 0;
+    bool logBurst_ = false;             // Publishing until the queue is empty
+#endif
+    
+    // Broker RTT and keep-alive policy
+    LinkMonitor link_;
+    
+    // Handshake counters of the TLS client, if any
+    const TlsHandshakeStats* tlsStats_ = nullptr;
+    
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    // Embedded broker for LAN clients
+    MicroBroker* broker_ = nullptr;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_TRACE
+    // Traffic capture
+    TraceWriter* trace_ = nullptr;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_MEM
+    // Memory accounting
+    MemoryMonitor memory_;
+    uint32_t lastHeapSample_ = 0;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_TERM
+    // Interactive sessions
+    TerminalSession terms_[ESPMOLE_MQTT_TERM_SESSIONS];
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_TIME
+    // Controller clock and per-topic timestamp streams
+    TimeSync timeSync_;
+    TimeStamper respStamp_;
+    TimeStamper eventStamp_;
+#endif
+    
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    // Loopback throughput test
+    LoopbackTest selfTest_;
+#endif
+    
+    // Deferred work run by poll(), in the order of a pass
+    enum WorkTask : uint8_t {
+        WORK_ACKS,
+        WORK_CONNECT,
+        WORK_BROKER,
+        WORK_LINK,
+        WORK_MEM,
+        WORK_STATS,
+        WORK_REPLAY,
+        WORK_SCHED,
+        WORK_MAILBOX,
+        WORK_LOG,
+        WORK_BATCH,
+        WORK_TERM,
+        WORK_TIME,
+        WORK_SELFTEST,
+        WORK_TASKS
+    };
+    WorkScheduler work_;
     
     // State
     bool wasConnected_ = false;
     uint32_t lastReconnectAttempt_ = 0;
+    uint32_t lastStatsPublish_ = 0;
+    
+    // Serializes state shared by the MQTT client's task and loop(). Only
+    // ESP32 runs client callbacks on a task of their own; elsewhere they run
+    // between loop() calls. Static, so constructing the transport never
+    // touches the heap.
+#if defined(ESP32)
+    StaticSemaphore_t lockBuffer_;
+    SemaphoreHandle_t lock_ = xSemaphoreCreateRecursiveMutexStatic(&lockBuffer_);
+#endif
+    static void onLock(bool lock, void* ctx);
+    
+    /// RAII helper around the transport lock (recursive)
+    class Guard {
+    public:
+        explicit Guard(const MqttTransport& t) : t_(const_cast<MqttTransport&>(t)) { onLock(true, &t_); }
+        ~Guard() { onLock(false, &t_); }
+    private:
+        MqttTransport& t_;
+    };
     
     // Internal methods
     void buildTopics();
+#if !ESPMOLE_MQTT_STATIC_TOPICS
     void buildDeviceId();
-    void subscribeToCommandTopic();
+#endif
+    void subscribeToTopics();
     void publishBirth();
+    size_t formatCapabilities(char* out, size_t cap) const;
     void publishLwt();
     bool mqttPublish(const char* topic, const uint8_t* payload, size_t len, 
                      uint8_t qos = 0, bool retain = false);
+    uint16_t mqttPublishTracked(const char* topic, const uint8_t* payload, size_t len,
+                                uint8_t qos, bool retain,
+                                PublishCompleteCallback cb, void* ctx);
+    void resetInflight();
+    void publishStats();
+    static bool workStep(uint8_t task, uint32_t now, void* ctx);
+    bool runWork(uint8_t task, uint32_t now);
+    void maintainConnection(uint32_t now);
+    void probeLink(uint32_t now);
+    static void onProbeComplete(uint16_t packetId, bool acked, uint32_t latencyMs, void* ctx);
+    static void onLocalMessage(const char* topic, const uint8_t* payload, size_t len, void* ctx);
     bool isMoleTopic(const char* topic) const;
     void processCommand(const uint8_t* payload, size_t len);
+    size_t executeCommand(const uint8_t* payload, size_t len,
+                          uint8_t* response, size_t cap);
+    size_t executeCommand(const uint8_t* payload, size_t len,
+                          uint8_t* response, size_t cap, PeerHandle peer);
+    bool handleBuiltin(const uint8_t* payload, size_t len,
+                       uint8_t* response, size_t cap, size_t& respLen);
+    bool publishOutbound(uint8_t topic, const uint8_t* data, size_t len, bool urgent);
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    bool flushStep();
+#endif
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    size_t builtinReplay(const char* args, uint8_t* response, size_t cap);
+    bool publishSequencedEvent(const uint8_t* data, size_t len, bool urgent);
+    bool pumpReplay();
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    size_t builtinSched(const char* args, uint8_t* response, size_t cap);
+    bool runSchedules(uint32_t now);
+    bool publishStateTopic(const char* command, const uint8_t* data, size_t len);
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    void subscribeMailbox();
+    void handleMailbox(const char* topic, const uint8_t* payload, size_t len);
+    bool drainMailbox(uint32_t now);
+    void clearMailbox(uint32_t seq);
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    size_t builtinLog(const char* args, uint8_t* response, size_t cap);
+    bool pumpLog(uint32_t now);
+#endif
+#if ESPMOLE_MQTT_FEATURE_MEM
+    void accountMemory(uint32_t now);
+    size_t builtinMem(const char* args, uint8_t* response, size_t cap);
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+    void handleTerminal(const char* topic, const uint8_t* payload, size_t len);
+    static void onTerminalLine(TerminalSession& session, const char* line, size_t len, void* ctx);
+    void runTerminalLine(TerminalSession& session, const char* line, size_t len);
+    bool pumpTerminal(uint32_t now);
+    void closeTerminal(TerminalSession& session);
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    size_t builtinTime(const char* args, uint8_t* response, size_t cap);
+    void syncTime(uint32_t now);
+    size_t stampBefore(uint8_t topic, uint8_t* data);
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    size_t builtinSelfTest(const char* args, uint8_t* response, size_t cap);
+    bool runSelfTest();
+    void finishSelfTest();
+    static void onSelfTestStep(uint8_t index, const LoopbackStep& step, void* ctx);
+#endif
+#if ESPMOLE_MQTT_FEATURE_PROBE
+    bool answerProbe(const uint8_t* payload, size_t len, uint32_t rxUs);
+#endif
     
     // AsyncMqttClient callbacks (standalone mode)
     void onAsyncConnect(bool sessionPresent);
     void onAsyncDisconnect(int8_t reason);
+    void registerAsyncPublishCallback();
     void onAsyncMessage(char* topic, char* payload, 
                         size_t len, size_t index, size_t total);
 };
@@ -280,7 +1075,10 @@ private:
 /// Special PeerHandle value for MQTT messages
 constexpr PeerHandle PEER_MQTT = 0xFFFF0001;
 
+/// PeerHandle of terminal session slot 0; slot n is PEER_MQTT_TERM + n
+constexpr PeerHandle PEER_MQTT_TERM = 0xFFFF0100;
+
 } // namespace espmole
 
-#endif // NATIVE_BUILD
+#endif // !NATIVE_BUILD || ESPMOLE_MQTT_NATIVE_TRANSPORT
 #endif // ESPMOLE_MQTT_TRANSPORT_H
@@ -0,0 +1,70 @@
+#include "MqttWork.h"
+
+namespace espmole {
+
+void WorkScheduler::begin(uint8_t tasks, StepFn step, void* ctx, ClockFn clock) {
+    tasks_ = tasks < MAX_TASKS ? tasks : static_cast<uint8_t>(MAX_TASKS);
+    step_ = step;
+    ctx_ = ctx;
+    clock_ = clock;
+    cursor_ = 0;
+    pending_ = 0;
+}
+
+size_t WorkScheduler::run(uint32_t now, uint32_t budgetUs) {
+    if (tasks_ == 0 || step_ == nullptr) return 0;
+    stats_.calls++;
+
+    // Every task gets looked at once per call - most only check a timer
+    uint32_t all = tasks_ == 32 ? 0xFFFFFFFFUL : (1UL << tasks_) - 1;
+    uint32_t visit = all;
+    uint32_t more = pending_;
+    bool timed = budgetUs > 0 && clock_ != nullptr;
+    uint32_t start = micros();
+    uint32_t steps = 0;
+
+    for (;;) {
+        // Past the single pass, only tasks that said they have more
+        uint32_t todo = timed ? (visit | more) : visit;
+        if (todo == 0) break;
+        if (timed && steps > 0 && micros() - start >= budgetUs) break;
+
+        uint8_t task = cursor_;
+        while ((todo & (1UL << task)) == 0) {
+            task = static_cast<uint8_t>(task + 1 < tasks_ ? task + 1 : 0);
+        }
+        cursor_ = static_cast<uint8_t>(task + 1 < tasks_ ? task + 1 : 0);
+
+        uint32_t t0 = micros();
+        bool again = step_(task, now, ctx_);
+        uint32_t took = micros() - t0;
+        if (took > maxStep_[task]) maxStep_[task] = took;
+        steps++;
+
+        visit &= ~(1UL << task);
+        if (again) {
+            more |= 1UL << task;
+        } else {
+            more &= ~(1UL << task);
+        }
+    }
+
+    // Tasks the budget did not reach still need their look
+    pending_ = (more | visit) & all;
+
+    uint32_t took = micros() - start;
+    stats_.steps += steps;
+    stats_.lastCallUs = took;
+    if (took > stats_.maxCallUs) stats_.maxCallUs = took;
+    if (timed && took > budgetUs) stats_.overBudget++;
+    if (pending_ != 0) stats_.deferred++;
+    return pending();
+}
+
+size_t WorkScheduler::pending() const {
+    size_t n = 0;
+    for (uint32_t m = pending_; m != 0; m &= m - 1) n++;
+    return n;
+}
+
+} // namespace espmole
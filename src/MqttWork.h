@@ -0,0 +1,89 @@
+#ifndef ESPMOLE_MQTT_WORK_H
+#define ESPMOLE_MQTT_WORK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace espmole {
+
+/**
+ * Counters of a WorkScheduler.
+ */
+struct WorkStats {
+    uint32_t calls = 0;         ///< run() calls
+    uint32_t steps = 0;         ///< Task steps run
+    uint32_t deferred = 0;      ///< Calls that returned with work left
+    uint32_t overBudget = 0;    ///< Calls that took longer than their budget
+    uint32_t lastCallUs = 0;
+    uint32_t maxCallUs = 0;     ///< Longest call
+};
+
+/**
+ * Cooperative scheduler for deferred work with a time budget.
+ *
+ * Tasks are numbered 0..tasks-1 and run through one step function. A step
+ * does one bounded unit of work (publish one batch, run one query) and
+ * returns true if it has more. run() visits every task once, then, while
+ * the budget lasts, keeps stepping tasks that have more. It stops when
+ * the budget is used and the next call resumes with the task after the
+ * last one that ran, so a tight budget still serves every task in turn.
+ *
+ * A step is never interrupted: a call overruns its budget by at most the
+ * longest step, see maxStepUs().
+ *
+ * Platform independent - time comes from the clock given to begin().
+ */
+class WorkScheduler {
+public:
+    static constexpr size_t MAX_TASKS = 32;
+
+    /// Run one step of `task`; true if the task has more work
+    using StepFn = bool (*)(uint8_t task, uint32_t now, void* ctx);
+
+    /// Microsecond clock
+    using ClockFn = uint32_t (*)(void* ctx);
+
+    /**
+     * @param tasks  Number of tasks (at most MAX_TASKS)
+     * @param step   Runs one step of a task
+     * @param ctx    Passed to step and clock
+     * @param clock  Microseconds; nullptr = every call is a single pass
+     */
+    void begin(uint8_t tasks, StepFn step, void* ctx, ClockFn clock);
+
+    /**
+     * Run tasks until all are idle or the budget is used.
+     *
+     * @param now       Passed to the steps (the caller's time base)
+     * @param budgetUs  Time this call may take; 0 = one step of every task
+     * @return          Tasks with work left (including ones not reached)
+     */
+    size_t run(uint32_t now, uint32_t budgetUs);
+
+    /// Tasks with work left after the last run()
+    size_t pending() const;
+
+    /// Did `task` have work left after the last run()
+    bool pending(uint8_t task) const { return task < tasks_ && (pending_ & (1UL << task)) != 0; }
+
+    /// Longest single step of `task`
+    uint32_t maxStepUs(uint8_t task) const { return task < MAX_TASKS ? maxStep_[task] : 0; }
+
+    const WorkStats& stats() const { return stats_; }
+
+private:
+    StepFn step_ = nullptr;
+    ClockFn clock_ = nullptr;
+    void* ctx_ = nullptr;
+    uint8_t tasks_ = 0;
+    uint8_t cursor_ = 0;        ///< Next task to visit
+    uint32_t pending_ = 0;
+    uint32_t maxStep_[MAX_TASKS] = {};
+    WorkStats stats_;
+
+    uint32_t micros() const { return clock_ ? clock_(ctx_) : 0; }
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_MQTT_WORK_H
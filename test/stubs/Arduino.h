@@ -0,0 +1,33 @@
+/**
+ * Host stand-in for the Arduino core - just what MqttTransport uses.
+ *
+ * The clock only moves when a test moves it: stub::advance().
+ */
+
+#ifndef ESPMOLE_STUB_ARDUINO_H
+#define ESPMOLE_STUB_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace stub {
+
+inline uint32_t& nowMicros() {
+    static uint32_t us = 0;
+    return us;
+}
+
+inline void advance(uint32_t ms) {
+    nowMicros() += ms * 1000;
+}
+
+} // namespace stub
+
+inline uint32_t millis() { return stub::nowMicros() / 1000; }
+inline uint32_t micros() { return stub::nowMicros(); }
+inline void delay(uint32_t ms) { stub::advance(ms); }
+
+#endif // ESPMOLE_STUB_ARDUINO_H
@@ -0,0 +1,99 @@
+/**
+ * Host stand-in for AsyncMqttClient. Never connects anywhere: publish()
+ * counts and hands out packet IDs, the test acknowledges them through
+ * MqttTransport::onMqttPublish().
+ */
+
+#ifndef ESPMOLE_STUB_ASYNC_MQTT_CLIENT_H
+#define ESPMOLE_STUB_ASYNC_MQTT_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+enum class AsyncMqttClientDisconnectReason : int8_t {
+    TCP_DISCONNECTED = 0
+};
+
+struct AsyncMqttClientMessageProperties {
+    uint8_t qos;
+    bool dup;
+    bool retain;
+};
+
+class AsyncMqttClient {
+public:
+    AsyncMqttClient& setKeepAlive(uint16_t keepAlive) { (void)keepAlive; return *this; }
+    AsyncMqttClient& setClientId(const char* clientId) { (void)clientId; return *this; }
+    AsyncMqttClient& setCredentials(const char* username, const char* password = nullptr) {
+        (void)username;
+        (void)password;
+        return *this;
+    }
+    AsyncMqttClient& setWill(const char* topic, uint8_t qos, bool retain,
+                             const char* payload = nullptr, size_t length = 0) {
+        (void)topic;
+        (void)qos;
+        (void)retain;
+        (void)payload;
+        (void)length;
+        return *this;
+    }
+    AsyncMqttClient& setServer(const char* host, uint16_t port) {
+        (void)host;
+        (void)port;
+        return *this;
+    }
+    AsyncMqttClient& onConnect(std::function<void(bool)> cb) { (void)cb; return *this; }
+    AsyncMqttClient& onDisconnect(std::function<void(AsyncMqttClientDisconnectReason)> cb) {
+        (void)cb;
+        return *this;
+    }
+    AsyncMqttClient& onMessage(std::function<void(char*, char*, AsyncMqttClientMessageProperties,
+                                                  size_t, size_t, size_t)> cb) {
+        (void)cb;
+        return *this;
+    }
+    AsyncMqttClient& onPublish(std::function<void(uint16_t)> cb) { (void)cb; return *this; }
+
+    bool connected() const { return isConnected; }
+    void connect() { isConnected = true; }
+    void disconnect(bool force = false) { (void)force; isConnected = false; }
+
+    uint16_t subscribe(const char* topic, uint8_t qos) {
+        (void)topic;
+        (void)qos;
+        return nextId();
+    }
+    uint16_t unsubscribe(const char* topic) {
+        (void)topic;
+        return nextId();
+    }
+    uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload = nullptr,
+                     size_t length = 0, bool dup = false, uint16_t message_id = 0) {
+        (void)topic;
+        (void)retain;
+        (void)payload;
+        (void)length;
+        (void)dup;
+        (void)message_id;
+        published++;
+        if (qos == 0) return 1;
+        lastPacketId = nextId();
+        return lastPacketId;
+    }
+
+    bool isConnected = true;
+    uint32_t published = 0;
+    uint16_t lastPacketId = 0;
+
+private:
+    uint16_t nextId() {
+        if (++packetId_ == 0) packetId_ = 1;
+        return packetId_;
+    }
+
+    uint16_t packetId_ = 0;
+};
+
+#endif // ESPMOLE_STUB_ASYNC_MQTT_CLIENT_H
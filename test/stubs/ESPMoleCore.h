@@ -0,0 +1,43 @@
+/**
+ * Host stand-in for espmole-core - the transport interface and a dispatcher
+ * that answers every command with "ok <n>".
+ */
+
+#ifndef ESPMOLE_STUB_CORE_H
+#define ESPMOLE_STUB_CORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+namespace espmole {
+
+typedef uint32_t PeerHandle;
+
+class ITransport {
+public:
+    virtual ~ITransport() {}
+    virtual bool send(PeerHandle peer, const uint8_t* data, size_t len) = 0;
+    virtual bool broadcast(const uint8_t* data, size_t len) = 0;
+    virtual const char* name() const = 0;
+};
+
+class Dispatcher {
+public:
+    size_t ingest(PeerHandle peer, const uint8_t* data, size_t len,
+                  uint8_t* response, size_t cap) {
+        (void)peer;
+        (void)data;
+        (void)len;
+        commands++;
+        int n = snprintf(reinterpret_cast<char*>(response), cap, "ok %lu",
+                         static_cast<unsigned long>(commands));
+        return n > 0 && static_cast<size_t>(n) < cap ? static_cast<size_t>(n) : 0;
+    }
+
+    uint32_t commands = 0;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_STUB_CORE_H
@@ -0,0 +1,428 @@
+/**
+ * Steady-state allocation tests
+ *
+ * Counts heap allocations while MqttTransport's command, send() and
+ * broadcast() paths run, after one warm-up pass. Any allocation fails the
+ * test: long-running devices fragment their heap one small block at a time.
+ *
+ * Natively the transport builds against the stand-ins in test/stubs
+ * (ESPMOLE_MQTT_NATIVE_TRANSPORT): a dispatcher that answers every command
+ * and an AsyncMqttClient whose packets the test acknowledges.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+// -----------------------------------------------------------------------------
+// Allocation counter. With glibc every malloc() is seen (operator new ends
+// up there too); elsewhere only operator new is.
+// -----------------------------------------------------------------------------
+
+static std::atomic<bool> counting(false);
+static std::atomic<unsigned long> allocations(0);
+
+static void noteAllocation() {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+#if defined(__GLIBC__)
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size) {
+    noteAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    noteAllocation();
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) {
+    noteAllocation();
+    return __libc_realloc(p, size);
+}
+}
+
+#else
+
+void* operator new(size_t size) {
+    noteAllocation();
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+#endif
+
+static void startCounting() {
+    allocations.store(0);
+    counting.store(true);
+}
+
+static unsigned long stopCounting() {
+    counting.store(false);
+    return allocations.load();
+}
+
+#include <unity.h>
+#include <ESPMoleCore.h>
+#include <MqttMicroBroker.h>
+#include <MqttTransport.h>
+
+using namespace espmole;
+
+// -----------------------------------------------------------------------------
+// LAN side: the embedded broker's connections go nowhere
+// -----------------------------------------------------------------------------
+
+static bool wireSend(int client, const uint8_t* data, size_t len, void* ctx) {
+    (void)client;
+    (void)data;
+    (void)len;
+    (void)ctx;
+    return true;
+}
+
+static void wireClose(int client, void* ctx) {
+    (void)client;
+    (void)ctx;
+}
+
+static void onUserMessage(const char* topic, const uint8_t* payload, size_t len, void* ctx) {
+    (void)topic;
+    (void)payload;
+    (void)len;
+    ++*static_cast<uint32_t*>(ctx);
+}
+
+static bool onLocalEvent(const uint8_t* data, size_t len, uint8_t severity, void* ctx) {
+    (void)data;
+    (void)severity;
+    *static_cast<size_t*>(ctx) += len;
+    return false;
+}
+
+#ifdef NATIVE_BUILD
+
+#include <AsyncMqttClient.h>
+#include <MqttCodec.h>
+#include <MqttTrace.h>
+
+// -----------------------------------------------------------------------------
+// Fixture: the transport attached to the stand-in client, serving the LAN
+// through the embedded broker and tracing into a fixed buffer
+// -----------------------------------------------------------------------------
+
+static const char DEVICE[] = "alloc-test";
+
+static uint8_t traceBuf[8192];
+static size_t traceLen = 0;
+
+static bool traceSink(const uint8_t* data, size_t len, void* ctx) {
+    (void)ctx;
+    if (len > sizeof(traceBuf) - traceLen) traceLen = sizeof(TraceFileHeader);
+    memcpy(traceBuf + traceLen, data, len);
+    traceLen += len;
+    return true;
+}
+
+static uint32_t traceClock(void* ctx) {
+    (void)ctx;
+    return millis();
+}
+
+static Dispatcher* dispatcher = nullptr;
+static AsyncMqttClient* client = nullptr;
+static MicroBroker* broker = nullptr;
+static TraceWriter* trace = nullptr;
+static MqttTransport* mole = nullptr;
+static uint16_t lastAcked = 0;
+
+static MqttConfig testConfig() {
+    MqttConfig config;
+    config.deviceId = DEVICE;
+    config.qos = 1;
+    config.inflightWindow = 8;
+    return config;
+}
+
+static void attach(const MqttConfig& config) {
+    mole = new MqttTransport(dispatcher, config);
+    mole->attachTo(client);
+    mole->serveLocal(broker);
+    mole->setTrace(trace);
+    mole->onMqttConnect();
+
+    // A LAN controller watching everything the device publishes
+    uint8_t buf[128];
+    mqtt::ConnectOptions o;
+    o.clientId = "ctl";
+    int c = broker->open(millis());
+    broker->receive(c, buf, mqtt::encodeConnect(buf, sizeof(buf), o), millis());
+    broker->receive(c, buf, mqtt::encodeSubscribe(buf, sizeof(buf), 1, "espmole/alloc-test/#", 0),
+                    millis());
+}
+
+/// The upstream broker acknowledges everything published so far
+static void ackAll() {
+    while (lastAcked != client->lastPacketId) {
+        if (++lastAcked == 0) lastAcked = 1;
+        mole->onMqttPublish(lastAcked);
+    }
+}
+
+static void step(uint32_t ms) {
+    stub::advance(ms);
+    ackAll();
+    mole->poll();
+    broker->poll(millis());
+}
+
+static void publishTo(const char* topic, const char* payload) {
+    mole->handleMessage(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+}
+
+// -----------------------------------------------------------------------------
+// Tests
+// -----------------------------------------------------------------------------
+
+void setUp(void) {
+    dispatcher = new Dispatcher();
+    client = new AsyncMqttClient();
+    broker = new MicroBroker();
+    trace = new TraceWriter();
+    broker->begin(wireSend, wireClose, nullptr);
+    trace->begin(traceSink, nullptr, traceClock);
+    lastAcked = 0;
+}
+
+void tearDown(void) {
+    delete mole;
+    delete trace;
+    delete broker;
+    delete client;
+    delete dispatcher;
+    mole = nullptr;
+}
+
+void test_counter_sees_allocations() {
+    startCounting();
+    void* volatile p = malloc(64);
+    int* volatile q = new int(7);
+    unsigned long n = stopCounting();
+    free(p);
+    delete q;
+    TEST_ASSERT_TRUE(n >= 2);
+}
+
+void test_command_path() {
+    attach(testConfig());
+    uint32_t userMessages = 0;
+    mole->setUserCallback(onUserMessage, &userMessages);
+    const char* cmd = mole->getCommandTopic();
+
+    publishTo(cmd, "status");                   // Warm-up
+    publishTo("home/sensor/temp", "21.5");
+    step(1);
+
+    startCounting();
+    for (uint32_t i = 0; i < 1000; i++) {
+        publishTo(cmd, "status");
+        publishTo("home/sensor/temp", "21.5");
+        step(1);
+    }
+    unsigned long n = stopCounting();
+
+    TEST_ASSERT_EQUAL(1001, dispatcher->commands);
+    TEST_ASSERT_EQUAL(1001, userMessages);
+    TEST_ASSERT_EQUAL(0, mole->inflightStats().rejected);
+    TEST_ASSERT_EQUAL(0, n);
+}
+
+void test_mailbox_path() {
+    MqttConfig config = testConfig();
+    config.mailbox = true;
+    attach(config);
+
+    char topic[64];
+    startCounting();
+    for (uint32_t i = 1; i <= 1000; i++) {
+        snprintf(topic, sizeof(topic), "espmole/%s/mailbox/%lu", DEVICE,
+                 static_cast<unsigned long>(i));
+        publishTo(topic, "reboot");
+        step(config.mailboxSettle + 1);
+    }
+    unsigned long n = stopCounting();
+
+    TEST_ASSERT_EQUAL(1000, dispatcher->commands);
+    TEST_ASSERT_EQUAL(0, n);
+}
+
+void test_send_path() {
+    MqttConfig config = testConfig();
+    config.batchInterval = 100;
+    attach(config);
+    const uint8_t resp[] = "ok temp=21.5";
+
+    mole->send(PEER_MQTT, resp, sizeof(resp) - 1);  // Warm-up
+    step(config.batchInterval);
+    uint32_t published = client->published;
+
+    startCounting();
+    for (uint32_t i = 0; i < 1000; i++) {
+        mole->send(PEER_MQTT, resp, sizeof(resp) - 1);
+        step(10);
+    }
+    unsigned long n = stopCounting();
+
+    TEST_ASSERT_TRUE(client->published > published);
+    TEST_ASSERT_TRUE(mole->inflightStats().acked > 0);
+    TEST_ASSERT_EQUAL(0, n);
+}
+
+void test_broadcast_path() {
+    MqttConfig config = testConfig();
+    config.sequenceEvents = true;
+    config.eventFilter = true;
+    config.batchInterval = 100;
+    attach(config);
+    size_t seen = 0;
+    mole->subscribeLocal(onLocalEvent, &seen, "motion", 0, BUS_OBSERVE);
+
+    char topic[64];
+    snprintf(topic, sizeof(topic), "espmole/%s/filter", DEVICE);
+    publishTo(topic, "motion, temp>=2/10, *>=3");
+
+    const char* events[] = {"motion zone=2", "temp 21.5", "door open"};
+    for (uint32_t i = 0; i < 3; i++) {           // Warm-up
+        mole->broadcastEvent(reinterpret_cast<const uint8_t*>(events[i]), strlen(events[i]), 4);
+        mole->broadcast(reinterpret_cast<const uint8_t*>(events[i]), strlen(events[i]));
+    }
+    publishTo(mole->getCommandTopic(), "$replay 1");
+    step(config.batchInterval);
+
+    startCounting();
+    for (uint32_t i = 0; i < 1000; i++) {
+        const char* e = events[i % 3];
+        mole->broadcastEvent(reinterpret_cast<const uint8_t*>(e), strlen(e),
+                             static_cast<uint8_t>(i % 5));
+        mole->broadcast(reinterpret_cast<const uint8_t*>(e), strlen(e));
+        if (i % 100 == 0) {
+            publishTo(mole->getCommandTopic(), "$replay 1");
+        }
+        step(10);
+    }
+    unsigned long n = stopCounting();
+
+    TEST_ASSERT_TRUE(seen > 0);
+    TEST_ASSERT_TRUE(mole->eventsFiltered() > 0);
+    TEST_ASSERT_TRUE(mole->getLastEventSeq() > 3);
+    TEST_ASSERT_EQUAL(0, n);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_counter_sees_allocations);
+    RUN_TEST(test_command_path);
+    RUN_TEST(test_mailbox_path);
+    RUN_TEST(test_send_path);
+    RUN_TEST(test_broadcast_path);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - the same entry points against the real core and
+// client, with the embedded broker standing in for the network
+
+static Dispatcher dispatcher;
+static CliProtocol protocol;
+static MicroBroker broker;
+static MqttTransport* mole = nullptr;
+static uint32_t userMessages = 0;
+
+static CommandResult pingHandler(const RequestView& req, void* ctx) {
+    (void)req;
+    (void)ctx;
+    return CommandResult::ok("pong", 4);
+}
+
+static unsigned long runEntryPoints(uint32_t rounds) {
+    const uint8_t cmd[] = "ping";
+    const uint8_t user[] = "21.5";
+    const uint8_t resp[] = "ok temp=21.5";
+    const uint8_t event[] = "motion zone=2";
+
+    startCounting();
+    for (uint32_t i = 0; i < rounds; i++) {
+        mole->handleMessage(mole->getCommandTopic(), cmd, sizeof(cmd) - 1);
+        mole->handleMessage("home/sensor/temp", user, sizeof(user) - 1);
+        mole->send(PEER_MQTT, resp, sizeof(resp) - 1);
+        mole->broadcast(event, sizeof(event) - 1);
+        mole->poll();
+    }
+    return stopCounting();
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_entry_points() {
+    size_t seen = 0;
+    mole->subscribeLocal(onLocalEvent, &seen, "motion", 0, BUS_OBSERVE);
+
+    runEntryPoints(1);              // Warm-up
+    unsigned long n = runEntryPoints(1000);
+
+    TEST_ASSERT_EQUAL(1001, userMessages);
+    TEST_ASSERT_TRUE(seen > 0);
+    TEST_ASSERT_EQUAL(0, n);
+}
+
+void setup() {
+    delay(2000);
+
+    MqttConfig config;
+    config.deviceId = "alloc-test";
+    mole = new MqttTransport(&dispatcher, config);
+    dispatcher.setProtocol(&protocol);
+    dispatcher.setTransport(mole);
+    dispatcher.registerCommand("ping", pingHandler);
+    mole->setUserCallback(onUserMessage, &userMessages);
+    broker.begin(wireSend, wireClose, nullptr);
+    mole->serveLocal(&broker);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_entry_points);
+    UNITY_END();
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
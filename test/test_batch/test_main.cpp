@@ -0,0 +1,232 @@
+/**
+ * Tests for OutboundBatch (duty-cycle batching) driven by a fake clock
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttBatch.h>
+
+using espmole::OutboundBatch;
+using espmole::BatchStats;
+using espmole::BATCH_EVENT;
+using espmole::BATCH_RESPONSE;
+
+static uint32_t fakeNow = 0;
+
+static uint32_t fakeClock(void* ctx) {
+    (void)ctx;
+    return fakeNow;
+}
+
+static bool add(OutboundBatch& b, const char* msg, bool urgent = false) {
+    return b.add(BATCH_EVENT, reinterpret_cast<const uint8_t*>(msg), strlen(msg), urgent);
+}
+
+/// Pop everything, as the transport does when connected
+static size_t drain(OutboundBatch& b) {
+    uint8_t topic;
+    const uint8_t* data;
+    size_t len;
+    size_t n = 0;
+    while (b.peek(topic, data, len)) {
+        b.pop();
+        n++;
+    }
+    return n;
+}
+
+void test_flushes_on_schedule() {
+    fakeNow = 1000;
+    OutboundBatch b;
+    b.begin(60000, fakeClock);
+    TEST_ASSERT_EQUAL_UINT32(61000, b.nextFlush());
+    
+    fakeNow = 5000;
+    TEST_ASSERT_TRUE(add(b, "temp 21.5"));
+    TEST_ASSERT_FALSE(b.flushDue());
+    TEST_ASSERT_EQUAL_UINT32(56000, b.msUntilFlush());
+    
+    fakeNow = 61000;
+    TEST_ASSERT_TRUE(b.flushDue());
+    TEST_ASSERT_EQUAL_UINT32(0, b.msUntilFlush());
+    TEST_ASSERT_EQUAL(1, drain(b));
+    TEST_ASSERT_EQUAL_UINT32(121000, b.nextFlush());
+    TEST_ASSERT_EQUAL(1, b.stats().bursts);
+}
+
+void test_keeps_order_and_topics() {
+    fakeNow = 0;
+    OutboundBatch b;
+    b.begin(1000, fakeClock);
+    add(b, "first");
+    b.add(BATCH_RESPONSE, reinterpret_cast<const uint8_t*>("second"), 6);
+    
+    uint8_t topic;
+    const uint8_t* data;
+    size_t len;
+    TEST_ASSERT_TRUE(b.peek(topic, data, len));
+    TEST_ASSERT_EQUAL(BATCH_EVENT, topic);
+    TEST_ASSERT_EQUAL(5, len);
+    TEST_ASSERT_EQUAL_MEMORY("first", data, 5);
+    b.pop();
+    TEST_ASSERT_TRUE(b.peek(topic, data, len));
+    TEST_ASSERT_EQUAL(BATCH_RESPONSE, topic);
+    TEST_ASSERT_EQUAL_MEMORY("second", data, 6);
+}
+
+void test_urgent_flushes_early() {
+    fakeNow = 0;
+    OutboundBatch b;
+    b.begin(60000, fakeClock);
+    add(b, "temp 21.5");
+    fakeNow = 100;
+    add(b, "smoke detected", true);
+    TEST_ASSERT_TRUE(b.flushDue());
+    TEST_ASSERT_EQUAL_UINT32(100, b.nextFlush());
+    
+    drain(b);
+    BatchStats s = b.stats();
+    TEST_ASSERT_EQUAL(1, s.urgentFlushes);
+    // Schedule restarts after the burst
+    TEST_ASSERT_EQUAL_UINT32(60100, b.nextFlush());
+}
+
+void test_high_water_flushes_early() {
+    fakeNow = 0;
+    OutboundBatch b;
+    b.begin(60000, fakeClock);
+    
+    uint8_t chunk[64];
+    memset(chunk, 'x', sizeof(chunk));
+    size_t added = 0;
+    while (!b.flushDue()) {
+        TEST_ASSERT_TRUE(b.add(BATCH_EVENT, chunk, sizeof(chunk)));
+        added++;
+    }
+    TEST_ASSERT_TRUE(b.used() >= OutboundBatch::HIGH_WATER);
+    TEST_ASSERT_EQUAL(added, drain(b));
+    TEST_ASSERT_EQUAL(1, b.stats().fullFlushes);
+    TEST_ASSERT_EQUAL(added * sizeof(chunk), b.stats().bytes);
+}
+
+void test_rejects_when_full() {
+    fakeNow = 0;
+    OutboundBatch b;
+    b.begin(60000, fakeClock);
+    
+    uint8_t chunk[200];
+    memset(chunk, 'x', sizeof(chunk));
+    size_t added = 0;
+    while (b.add(BATCH_EVENT, chunk, sizeof(chunk))) added++;
+    TEST_ASSERT_EQUAL(OutboundBatch::CAPACITY / (sizeof(chunk) + OutboundBatch::RECORD_HEADER), added);
+    TEST_ASSERT_TRUE(b.flushDue());
+    
+    // Space freed by a partial flush is reused
+    uint8_t topic;
+    const uint8_t* data;
+    size_t len;
+    b.peek(topic, data, len);
+    b.pop();
+    TEST_ASSERT_TRUE(b.add(BATCH_EVENT, chunk, sizeof(chunk)));
+    
+    TEST_ASSERT_FALSE(OutboundBatch::fits(OutboundBatch::CAPACITY));
+}
+
+void test_idle_slots_are_skipped() {
+    fakeNow = 0;
+    OutboundBatch b;
+    b.begin(1000, fakeClock);
+    
+    // Nothing to send for a few slots; a late message waits for the next one
+    fakeNow = 3500;
+    TEST_ASSERT_EQUAL_UINT32(4000, b.nextFlush());
+    add(b, "late");
+    TEST_ASSERT_FALSE(b.flushDue());
+    fakeNow = 4000;
+    TEST_ASSERT_TRUE(b.flushDue());
+}
+
+void test_energy_proxies_over_one_hour() {
+    // Sensor samples every 10 s, batch flushes once a minute and the
+    // radio is only up for 2 s around each burst
+    fakeNow = 0;
+    OutboundBatch b;
+    b.begin(60000, fakeClock);
+    
+    uint32_t connectUntil = 0;
+    for (fakeNow = 0; fakeNow < 3600000; fakeNow += 500) {
+        if (fakeNow % 10000 == 0) add(b, "temp 21.5");
+        
+        if (b.flushDue()) {
+            b.noteConnected(true);
+            drain(b);
+            connectUntil = fakeNow + 2000;
+        }
+        if (fakeNow >= connectUntil) b.noteConnected(false);
+    }
+    
+    BatchStats s = b.stats();
+    TEST_ASSERT_EQUAL(59, s.bursts);            // The last minute is still buffered
+    TEST_ASSERT_EQUAL(355, s.messages);         // 360 samples, 5 not yet sent
+    TEST_ASSERT_EQUAL(59, b.burstsPerHour());
+    TEST_ASSERT_EQUAL(59 * 2000, s.connectedMs);
+    TEST_ASSERT_EQUAL_UINT32(3600000, s.elapsedMs);
+}
+
+void test_connected_time_starts_disconnected() {
+    // Connecting 30 s after begin() must not count those 30 s
+    fakeNow = 1000;
+    OutboundBatch b;
+    b.begin(60000, fakeClock);
+    
+    fakeNow = 31000;
+    TEST_ASSERT_EQUAL(0, b.stats().connectedMs);
+    b.noteConnected(true);
+    fakeNow = 41000;
+    b.noteConnected(false);
+    fakeNow = 91000;
+    
+    BatchStats s = b.stats();
+    TEST_ASSERT_EQUAL_UINT32(10000, s.connectedMs);
+    TEST_ASSERT_EQUAL_UINT32(90000, s.elapsedMs);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_flushes_on_schedule);
+    RUN_TEST(test_keeps_order_and_topics);
+    RUN_TEST(test_urgent_flushes_early);
+    RUN_TEST(test_high_water_flushes_early);
+    RUN_TEST(test_rejects_when_full);
+    RUN_TEST(test_idle_slots_are_skipped);
+    RUN_TEST(test_energy_proxies_over_one_hour);
+    RUN_TEST(test_connected_time_starts_disconnected);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttBatch.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttBatch compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * Tests for compile-time topics and build configuration
+ */
+
+#ifdef NATIVE_BUILD
+
+// Fixed device ID for this test - topics are built at compile time
+#define ESPMOLE_MQTT_BASE_TOPIC "plant"
+#define ESPMOLE_MQTT_DEVICE_ID "press-07"
+#define ESPMOLE_MQTT_FEATURE_MAILBOX 0
+
+#include <unity.h>
+#include <string.h>
+#include <MqttBuildConfig.h>
+
+using espmole::makeTopic;
+using espmole::StaticTopics;
+
+// Everything below is evaluated by the compiler
+constexpr auto kCmd = makeTopic("espmole", "kitchen-1", "cmd");
+static_assert(kCmd.length() == 21, "topic length");
+static_assert(kCmd.str[7] == '/' && kCmd.str[17] == '/', "separators");
+static_assert(kCmd.str[21] == '\0', "terminated");
+static_assert(sizeof(kCmd) == 22, "no padding beyond the terminator");
+
+static_assert(ESPMOLE_MQTT_STATIC_TOPICS == 1, "device ID enables static topics");
+static_assert(ESPMOLE_MQTT_FEATURE_MAILBOX == 0, "switch can be overridden");
+static_assert(ESPMOLE_MQTT_FEATURE_JOURNAL == 1, "features default to on");
+static_assert(ESPMOLE_MQTT_RESPONSE_BUFFER == 256, "default response buffer");
+
+void test_make_topic() {
+    TEST_ASSERT_EQUAL_STRING("espmole/kitchen-1/cmd", kCmd.c_str());
+    TEST_ASSERT_EQUAL(strlen(kCmd.c_str()), kCmd.length());
+}
+
+void test_static_topics() {
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/cmd", StaticTopics::cmd.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/resp", StaticTopics::resp.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/status", StaticTopics::status.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/event", StaticTopics::event.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/stats", StaticTopics::stats.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/replay", StaticTopics::replay.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/filter", StaticTopics::filter.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/mailbox/+", StaticTopics::mailbox.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/rtt", StaticTopics::rtt.c_str());
+    TEST_ASSERT_EQUAL_STRING("plant/press-07/log", StaticTopics::log.c_str());
+}
+
+void test_empty_parts() {
+    constexpr auto t = makeTopic("", "dev", "x");
+    TEST_ASSERT_EQUAL_STRING("/dev/x", t.c_str());
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_make_topic);
+    RUN_TEST(test_static_topics);
+    RUN_TEST(test_empty_parts);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttBuildConfig.h>
+
+constexpr auto kTopic = espmole::makeTopic("espmole", "test", "cmd");
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println(kTopic.c_str());
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * Tests for LocalEventBus (in-process event fan-out)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttEventBus.h>
+
+using namespace espmole;
+
+struct Sink {
+    int calls = 0;
+    const uint8_t* data = nullptr;
+    size_t len = 0;
+    uint8_t severity = 0;
+    bool keep = false;
+};
+
+static bool onEvent(const uint8_t* data, size_t len, uint8_t severity, void* ctx) {
+    Sink* s = static_cast<Sink*>(ctx);
+    s->calls++;
+    s->data = data;
+    s->len = len;
+    s->severity = severity;
+    return s->keep;
+}
+
+static bool publish(LocalEventBus& bus, const char* event, uint8_t severity = 1) {
+    return bus.publish(reinterpret_cast<const uint8_t*>(event), strlen(event), severity);
+}
+
+void test_delivers_by_reference() {
+    LocalEventBus bus;
+    Sink sink;
+    TEST_ASSERT_EQUAL(0, bus.subscribe(onEvent, &sink));
+    
+    const char* event = "motion zone=2";
+    TEST_ASSERT_FALSE(publish(bus, event, 3));
+    TEST_ASSERT_EQUAL(1, sink.calls);
+    
+    // The subscriber sees the caller's buffer itself
+    TEST_ASSERT_EQUAL_PTR(event, sink.data);
+    TEST_ASSERT_EQUAL(strlen(event), sink.len);
+    TEST_ASSERT_EQUAL(3, sink.severity);
+}
+
+void test_type_and_severity_filters() {
+    LocalEventBus bus;
+    Sink temp, errors;
+    bus.subscribe(onEvent, &temp, "temp");
+    bus.subscribe(onEvent, &errors, nullptr, 3);
+    
+    publish(bus, "temp 21.5");
+    publish(bus, "temp:22");
+    publish(bus, "temp");
+    publish(bus, "temperature 20");     // Different type word
+    publish(bus, "motion", 3);
+    publish(bus, "temp 99", 4);
+    
+    TEST_ASSERT_EQUAL(4, temp.calls);
+    TEST_ASSERT_EQUAL(2, errors.calls);
+}
+
+void test_network_policies() {
+    LocalEventBus bus;
+    Sink observer, consumer, decider;
+    bus.subscribe(onEvent, &observer);
+    bus.subscribe(onEvent, &consumer, "ui", 0, BUS_CONSUME);
+    bus.subscribe(onEvent, &decider, "log", 0, BUS_HANDLER);
+    
+    TEST_ASSERT_FALSE(publish(bus, "motion"));
+    TEST_ASSERT_TRUE(publish(bus, "ui refresh"));
+    
+    TEST_ASSERT_FALSE(publish(bus, "log line"));
+    decider.keep = true;
+    TEST_ASSERT_TRUE(publish(bus, "log line"));
+    
+    // Observers see everything, even consumed events
+    TEST_ASSERT_EQUAL(4, observer.calls);
+    TEST_ASSERT_EQUAL(4, bus.stats().events);
+    TEST_ASSERT_EQUAL(2, bus.stats().consumed);
+    TEST_ASSERT_EQUAL(7, bus.stats().deliveries);
+}
+
+void test_table_full_and_unsubscribe() {
+    LocalEventBus bus;
+    Sink sink;
+    for (size_t i = 0; i < LocalEventBus::MAX_SUBSCRIBERS; i++) {
+        TEST_ASSERT_EQUAL(static_cast<int>(i), bus.subscribe(onEvent, &sink));
+    }
+    TEST_ASSERT_EQUAL(-1, bus.subscribe(onEvent, &sink));
+    TEST_ASSERT_EQUAL(-1, bus.subscribe(nullptr, &sink));
+    
+    bus.unsubscribe(1);
+    bus.unsubscribe(1);
+    bus.unsubscribe(99);
+    TEST_ASSERT_EQUAL(LocalEventBus::MAX_SUBSCRIBERS - 1, bus.subscribers());
+    TEST_ASSERT_EQUAL(1, bus.subscribe(onEvent, &sink));
+    
+    // Type longer than TYPE_MAX
+    LocalEventBus other;
+    TEST_ASSERT_EQUAL(-1, other.subscribe(onEvent, &sink, "a-very-long-event-type-name-x"));
+}
+
+static LocalEventBus* nestedBus = nullptr;
+static int nestedCalls = 0;
+static bool nestedConsumed = false;
+
+static bool onNested(const uint8_t* data, size_t len, uint8_t severity, void* ctx) {
+    (void)data;
+    (void)len;
+    (void)severity;
+    (void)ctx;
+    nestedCalls++;
+    // Re-publishing from a handler must not recurse
+    nestedConsumed |= publish(*nestedBus, "echo");
+    return false;
+}
+
+static bool onOnce(const uint8_t* data, size_t len, uint8_t severity, void* ctx) {
+    (void)data;
+    (void)len;
+    (void)severity;
+    nestedBus->unsubscribe(*static_cast<int*>(ctx));
+    return false;
+}
+
+void test_reentrancy() {
+    LocalEventBus bus;
+    nestedBus = &bus;
+    nestedCalls = 0;
+    bus.subscribe(onNested, nullptr);
+    
+    publish(bus, "tick");
+    TEST_ASSERT_EQUAL(1, nestedCalls);
+    TEST_ASSERT_FALSE(nestedConsumed);
+    
+    // A handler may unsubscribe itself
+    static int onceId;
+    onceId = bus.subscribe(onOnce, &onceId);
+    publish(bus, "tick");
+    publish(bus, "tick");
+    TEST_ASSERT_EQUAL(1, bus.subscribers());
+    TEST_ASSERT_EQUAL(3, nestedCalls);
+}
+
+void test_no_subscribers_is_free() {
+    LocalEventBus bus;
+    TEST_ASSERT_FALSE(publish(bus, "motion"));
+    TEST_ASSERT_EQUAL(0, bus.stats().events);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_delivers_by_reference);
+    RUN_TEST(test_type_and_severity_filters);
+    RUN_TEST(test_network_policies);
+    RUN_TEST(test_table_full_and_unsubscribe);
+    RUN_TEST(test_reentrancy);
+    RUN_TEST(test_no_subscribers_is_free);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttEventBus.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttEventBus compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
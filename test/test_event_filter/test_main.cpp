@@ -0,0 +1,192 @@
+/**
+ * Tests for EventFilter (consumer-driven event filtering)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <MqttEventFilter.h>
+
+using espmole::EventFilter;
+
+static bool compileStr(EventFilter& f, const char* spec) {
+    return f.compile(reinterpret_cast<const uint8_t*>(spec), strlen(spec));
+}
+
+static bool acceptStr(EventFilter& f, const char* event, uint8_t severity = espmole::EVENT_INFO) {
+    return f.accept(reinterpret_cast<const uint8_t*>(event), strlen(event), severity);
+}
+
+void test_no_filter_passes_everything() {
+    EventFilter f;
+    TEST_ASSERT_FALSE(f.active());
+    TEST_ASSERT_TRUE(acceptStr(f, "anything at all"));
+}
+
+void test_empty_spec_clears_filter() {
+    EventFilter f;
+    compileStr(f, "motion");
+    TEST_ASSERT_TRUE(compileStr(f, ""));
+    TEST_ASSERT_FALSE(f.active());
+    TEST_ASSERT_TRUE(acceptStr(f, "temp 21.5"));
+}
+
+void test_listed_types_pass_others_dropped() {
+    EventFilter f;
+    TEST_ASSERT_TRUE(compileStr(f, "motion, door"));
+    TEST_ASSERT_TRUE(f.active());
+    
+    TEST_ASSERT_TRUE(acceptStr(f, "motion detected"));
+    TEST_ASSERT_TRUE(acceptStr(f, "door: open"));
+    TEST_ASSERT_FALSE(acceptStr(f, "temperature 21.5"));
+    TEST_ASSERT_EQUAL(1, f.dropped());
+}
+
+void test_minimum_severity() {
+    EventFilter f;
+    compileStr(f, "temp>=2");
+    
+    TEST_ASSERT_FALSE(acceptStr(f, "temp 21.5", espmole::EVENT_INFO));
+    TEST_ASSERT_TRUE(acceptStr(f, "temp 85.0", espmole::EVENT_WARNING));
+}
+
+void test_wildcard_rule() {
+    EventFilter f;
+    compileStr(f, "motion, *>=3");
+    
+    TEST_ASSERT_TRUE(acceptStr(f, "motion detected", espmole::EVENT_DEBUG));
+    TEST_ASSERT_FALSE(acceptStr(f, "heap low", espmole::EVENT_WARNING));
+    TEST_ASSERT_TRUE(acceptStr(f, "heap exhausted", espmole::EVENT_ERROR));
+}
+
+void test_sampling_passes_one_in_n() {
+    EventFilter f;
+    compileStr(f, "temp/4");
+    
+    int passed = 0;
+    for (int i = 0; i < 12; i++) {
+        if (acceptStr(f, "temp 21.5")) passed++;
+    }
+    TEST_ASSERT_EQUAL(3, passed);
+    TEST_ASSERT_TRUE(acceptStr(f, "temp 21.5"));
+}
+
+void test_combined_rule() {
+    EventFilter f;
+    TEST_ASSERT_TRUE(compileStr(f, " temp >=1 /2 "));
+    
+    TEST_ASSERT_FALSE(acceptStr(f, "temp 1", espmole::EVENT_DEBUG));
+    TEST_ASSERT_TRUE(acceptStr(f, "temp 2", espmole::EVENT_INFO));
+    TEST_ASSERT_FALSE(acceptStr(f, "temp 3", espmole::EVENT_INFO));
+}
+
+void test_invalid_spec_passes_everything() {
+    EventFilter f;
+    TEST_ASSERT_FALSE(compileStr(f, "motion>=9"));
+    TEST_ASSERT_FALSE(f.active());
+    TEST_ASSERT_FALSE(compileStr(f, "motion/0"));
+    TEST_ASSERT_FALSE(compileStr(f, "motion ?"));
+    TEST_ASSERT_TRUE(acceptStr(f, "temp 21.5"));
+}
+
+void test_type_ends_at_space_or_colon() {
+    TEST_ASSERT_EQUAL(EventFilter::bucketOf(reinterpret_cast<const uint8_t*>("door"), 4),
+                      EventFilter::bucketOf(reinterpret_cast<const uint8_t*>("door: open"), 10));
+    TEST_ASSERT_EQUAL(EventFilter::bucketOf(reinterpret_cast<const uint8_t*>("door"), 4),
+                      EventFilter::bucketOf(reinterpret_cast<const uint8_t*>("door open"), 9));
+}
+
+/// A type name other than `type` whose home bucket is the same
+static void collidingType(const char* type, char* out, size_t cap) {
+    uint8_t home = EventFilter::bucketOf(reinterpret_cast<const uint8_t*>(type), strlen(type));
+    for (unsigned i = 0;; i++) {
+        snprintf(out, cap, "t%u", i);
+        if (strcmp(out, type) != 0 &&
+            EventFilter::bucketOf(reinterpret_cast<const uint8_t*>(out), strlen(out)) == home) {
+            return;
+        }
+    }
+}
+
+void test_unlisted_colliding_type_is_dropped() {
+    EventFilter f;
+    char other[16];
+    collidingType("motion", other, sizeof(other));
+    
+    TEST_ASSERT_TRUE(compileStr(f, "motion"));
+    TEST_ASSERT_TRUE(acceptStr(f, "motion detected"));
+    TEST_ASSERT_FALSE(acceptStr(f, other));
+    
+    // With a wildcard it gets the wildcard's rule, not motion's
+    TEST_ASSERT_TRUE(compileStr(f, "motion, *>=3"));
+    TEST_ASSERT_FALSE(acceptStr(f, other, espmole::EVENT_INFO));
+    TEST_ASSERT_TRUE(acceptStr(f, other, espmole::EVENT_ERROR));
+}
+
+void test_colliding_listed_types_keep_own_rules() {
+    EventFilter f;
+    char other[16];
+    char spec[48];
+    collidingType("door", other, sizeof(other));
+    snprintf(spec, sizeof(spec), "door>=4, %s", other);
+    
+    TEST_ASSERT_TRUE(compileStr(f, spec));
+    TEST_ASSERT_FALSE(acceptStr(f, "door open", espmole::EVENT_INFO));
+    TEST_ASSERT_TRUE(acceptStr(f, "door open", espmole::EVENT_CRITICAL));
+    TEST_ASSERT_TRUE(acceptStr(f, other, espmole::EVENT_INFO));
+}
+
+void test_too_many_types_rejected() {
+    EventFilter f;
+    char spec[EventFilter::BUCKETS * 6 + 8] = "";
+    size_t n = 0;
+    for (size_t i = 0; i <= EventFilter::BUCKETS; i++) {
+        n += snprintf(spec + n, sizeof(spec) - n, "%st%u", i ? "," : "", static_cast<unsigned>(i));
+    }
+    TEST_ASSERT_FALSE(compileStr(f, spec));
+    TEST_ASSERT_FALSE(f.active());
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_no_filter_passes_everything);
+    RUN_TEST(test_empty_spec_clears_filter);
+    RUN_TEST(test_listed_types_pass_others_dropped);
+    RUN_TEST(test_minimum_severity);
+    RUN_TEST(test_wildcard_rule);
+    RUN_TEST(test_sampling_passes_one_in_n);
+    RUN_TEST(test_combined_rule);
+    RUN_TEST(test_invalid_spec_passes_everything);
+    RUN_TEST(test_type_ends_at_space_or_colon);
+    RUN_TEST(test_unlisted_colliding_type_is_dropped);
+    RUN_TEST(test_colliding_listed_types_keep_own_rules);
+    RUN_TEST(test_too_many_types_rejected);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttEventFilter.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttEventFilter compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
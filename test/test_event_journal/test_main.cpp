@@ -0,0 +1,173 @@
+/**
+ * Tests for EventJournal (sequenced event ring)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttEventJournal.h>
+
+using espmole::EventJournal;
+
+static uint32_t appendStr(EventJournal& j, const char* s) {
+    return j.append(reinterpret_cast<const uint8_t*>(s), strlen(s));
+}
+
+static void assertRead(EventJournal& j, EventJournal::Cursor& c, const char* expected) {
+    uint8_t buf[64];
+    size_t len = 0;
+    TEST_ASSERT_TRUE(j.read(c, buf, sizeof(buf), len));
+    TEST_ASSERT_EQUAL(strlen(expected), len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buf, len);
+}
+
+void test_sequence_numbers_start_at_one() {
+    EventJournal j;
+    TEST_ASSERT_EQUAL(0, j.count());
+    TEST_ASSERT_EQUAL(1, appendStr(j, "a"));
+    TEST_ASSERT_EQUAL(2, appendStr(j, "b"));
+    TEST_ASSERT_EQUAL(3, j.nextSeq());
+    TEST_ASSERT_EQUAL(2, j.count());
+}
+
+void test_seek_and_read_range() {
+    EventJournal j;
+    appendStr(j, "one");
+    appendStr(j, "two");
+    appendStr(j, "three");
+    
+    EventJournal::Cursor c;
+    TEST_ASSERT_TRUE(j.seek(2, c));
+    TEST_ASSERT_EQUAL(2, c.seq);
+    assertRead(j, c, "two");
+    assertRead(j, c, "three");
+    
+    uint8_t buf[8];
+    size_t len = 0;
+    TEST_ASSERT_FALSE(j.read(c, buf, sizeof(buf), len));
+}
+
+void test_seek_past_end_fails() {
+    EventJournal j;
+    EventJournal::Cursor c;
+    TEST_ASSERT_FALSE(j.seek(1, c));
+    appendStr(j, "x");
+    TEST_ASSERT_FALSE(j.seek(2, c));
+}
+
+void test_oldest_events_are_evicted() {
+    EventJournal j;
+    char payload[100];
+    memset(payload, 'p', sizeof(payload));
+    
+    size_t perEvent = sizeof(payload) + 2;
+    size_t fits = EventJournal::CAPACITY / perEvent;
+    for (size_t i = 0; i < fits + 3; i++) {
+        j.append(reinterpret_cast<const uint8_t*>(payload), sizeof(payload));
+    }
+    
+    TEST_ASSERT_EQUAL(fits, j.count());
+    TEST_ASSERT_EQUAL(4, j.firstSeq());
+    
+    // Seeking into the evicted range lands on the oldest stored event
+    EventJournal::Cursor c;
+    TEST_ASSERT_TRUE(j.seek(1, c));
+    TEST_ASSERT_EQUAL(4, c.seq);
+}
+
+void test_wrapped_event_reads_back_intact() {
+    EventJournal j;
+    char payload[300];
+    for (size_t i = 0; i < sizeof(payload); i++) payload[i] = static_cast<char>('a' + i % 26);
+    
+    for (int i = 0; i < 10; i++) {
+        j.append(reinterpret_cast<const uint8_t*>(payload), sizeof(payload));
+    }
+    
+    EventJournal::Cursor c;
+    TEST_ASSERT_TRUE(j.seek(j.firstSeq(), c));
+    while (j.valid(c)) {
+        uint8_t buf[sizeof(payload)];
+        size_t len = 0;
+        TEST_ASSERT_TRUE(j.read(c, buf, sizeof(buf), len));
+        TEST_ASSERT_EQUAL(sizeof(payload), len);
+        TEST_ASSERT_EQUAL_MEMORY(payload, buf, len);
+    }
+}
+
+void test_cursor_invalidated_by_eviction() {
+    EventJournal j;
+    appendStr(j, "first");
+    
+    EventJournal::Cursor c;
+    TEST_ASSERT_TRUE(j.seek(1, c));
+    
+    char big[EventJournal::CAPACITY - 4];
+    memset(big, 'x', sizeof(big));
+    j.append(reinterpret_cast<const uint8_t*>(big), sizeof(big));
+    
+    TEST_ASSERT_FALSE(j.valid(c));
+}
+
+void test_oversized_event_gets_sequence_but_clears_ring() {
+    EventJournal j;
+    appendStr(j, "kept?");
+    
+    static uint8_t huge[EventJournal::CAPACITY + 1];
+    TEST_ASSERT_EQUAL(2, j.append(huge, sizeof(huge)));
+    TEST_ASSERT_EQUAL(0, j.count());
+    TEST_ASSERT_EQUAL(3, j.firstSeq());
+    TEST_ASSERT_EQUAL(3, appendStr(j, "next"));
+}
+
+void test_read_does_not_advance_when_buffer_too_small() {
+    EventJournal j;
+    appendStr(j, "longer than four");
+    
+    EventJournal::Cursor c;
+    j.seek(1, c);
+    uint8_t buf[4];
+    size_t len = 0;
+    TEST_ASSERT_FALSE(j.read(c, buf, sizeof(buf), len));
+    TEST_ASSERT_EQUAL(16, len);
+    TEST_ASSERT_EQUAL(1, c.seq);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_sequence_numbers_start_at_one);
+    RUN_TEST(test_seek_and_read_range);
+    RUN_TEST(test_seek_past_end_fails);
+    RUN_TEST(test_oldest_events_are_evicted);
+    RUN_TEST(test_wrapped_event_reads_back_intact);
+    RUN_TEST(test_cursor_invalidated_by_eviction);
+    RUN_TEST(test_oversized_event_gets_sequence_but_clears_ring);
+    RUN_TEST(test_read_does_not_advance_when_buffer_too_small);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttEventJournal.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttEventJournal compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * Tests for InflightWindow (QoS 1 in-flight tracking)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <MqttInflight.h>
+
+using espmole::InflightWindow;
+
+struct Completion {
+    int calls = 0;
+    uint16_t packetId = 0;
+    bool acked = false;
+    uint32_t latency = 0;
+};
+
+static void onComplete(uint16_t packetId, bool acked, uint32_t latencyMs, void* ctx) {
+    Completion* c = static_cast<Completion*>(ctx);
+    c->calls++;
+    c->packetId = packetId;
+    c->acked = acked;
+    c->latency = latencyMs;
+}
+
+void test_window_limits_inflight() {
+    InflightWindow w;
+    w.setWindow(2);
+    
+    TEST_ASSERT_TRUE(w.track(1, 0));
+    TEST_ASSERT_TRUE(w.track(2, 0));
+    TEST_ASSERT_FALSE(w.hasRoom());
+    TEST_ASSERT_FALSE(w.track(3, 0));
+    
+    TEST_ASSERT_TRUE(w.complete(1, 10));
+    TEST_ASSERT_TRUE(w.hasRoom());
+    TEST_ASSERT_EQUAL(1, w.inFlight());
+}
+
+void test_window_is_clamped() {
+    InflightWindow w;
+    w.setWindow(0);
+    TEST_ASSERT_EQUAL(1, w.window());
+    w.setWindow(1000);
+    TEST_ASSERT_EQUAL(InflightWindow::MAX_SLOTS, w.window());
+}
+
+void test_packet_id_zero_is_rejected() {
+    InflightWindow w;
+    TEST_ASSERT_FALSE(w.track(0, 0));
+    TEST_ASSERT_FALSE(w.complete(0, 0));
+}
+
+void test_puback_completes_with_latency() {
+    InflightWindow w;
+    Completion c;
+    
+    TEST_ASSERT_TRUE(w.track(42, 100, onComplete, &c));
+    TEST_ASSERT_FALSE(w.complete(43, 120));
+    TEST_ASSERT_TRUE(w.complete(42, 130));
+    
+    TEST_ASSERT_EQUAL(1, c.calls);
+    TEST_ASSERT_EQUAL(42, c.packetId);
+    TEST_ASSERT_TRUE(c.acked);
+    TEST_ASSERT_EQUAL(30, c.latency);
+    TEST_ASSERT_EQUAL(30, w.stats().lastLatency);
+    TEST_ASSERT_EQUAL(1, w.stats().acked);
+}
+
+void test_timeout_fails_publish() {
+    InflightWindow w;
+    Completion c;
+    
+    w.track(7, 1000, onComplete, &c);
+    TEST_ASSERT_EQUAL(0, w.expire(1500, 1000));
+    TEST_ASSERT_EQUAL(1, w.expire(2000, 1000));
+    
+    TEST_ASSERT_EQUAL(1, c.calls);
+    TEST_ASSERT_FALSE(c.acked);
+    TEST_ASSERT_EQUAL(1, w.stats().timedOut);
+    TEST_ASSERT_EQUAL(0, w.inFlight());
+}
+
+void test_timeout_handles_millis_wrap() {
+    InflightWindow w;
+    w.track(7, 0xFFFFFF00u);
+    TEST_ASSERT_EQUAL(0, w.expire(0x00000010u, 1000));
+    TEST_ASSERT_EQUAL(1, w.expire(0x00000400u, 1000));
+}
+
+void test_abort_all_on_disconnect() {
+    InflightWindow w;
+    Completion c;
+    
+    w.track(1, 0, onComplete, &c);
+    w.track(2, 0, onComplete, &c);
+    TEST_ASSERT_EQUAL(2, w.abortAll(5));
+    TEST_ASSERT_EQUAL(2, c.calls);
+    TEST_ASSERT_EQUAL(2, w.stats().aborted);
+    TEST_ASSERT_EQUAL(0, w.inFlight());
+}
+
+void test_latency_min_max_avg() {
+    InflightWindow w;
+    
+    w.track(1, 0);
+    w.complete(1, 80);
+    w.track(2, 100);
+    w.complete(2, 120);
+    
+    TEST_ASSERT_EQUAL(20, w.stats().minLatency);
+    TEST_ASSERT_EQUAL(80, w.stats().maxLatency);
+    TEST_ASSERT_EQUAL(73, w.stats().avgLatency);  // 80 + (20 - 80) / 8
+}
+
+void test_reservation_counts_against_window() {
+    InflightWindow w;
+    w.setWindow(1);
+    
+    int slot = w.reserve(0);
+    TEST_ASSERT_TRUE(slot >= 0);
+    TEST_ASSERT_FALSE(w.hasRoom());
+    TEST_ASSERT_EQUAL(-1, w.reserve(0));
+    TEST_ASSERT_EQUAL(1, w.stats().rejected);
+    
+    // Publish refused by the client
+    w.cancel(slot);
+    TEST_ASSERT_EQUAL(0, w.inFlight());
+    TEST_ASSERT_EQUAL(0, w.stats().tracked);
+    TEST_ASSERT_FALSE(w.assign(w.reserve(0), 0, 0));
+    TEST_ASSERT_EQUAL(0, w.inFlight());
+}
+
+void test_early_puback_completes_on_assign() {
+    InflightWindow w;
+    Completion c;
+    
+    // PUBACK handled on the client's task before publish() returned
+    int slot = w.reserve(100, onComplete, &c);
+    TEST_ASSERT_FALSE(w.complete(9, 110));
+    TEST_ASSERT_EQUAL(0, c.calls);
+    
+    TEST_ASSERT_TRUE(w.assign(slot, 9, 115));
+    TEST_ASSERT_EQUAL(1, c.calls);
+    TEST_ASSERT_TRUE(c.acked);
+    TEST_ASSERT_EQUAL(15, c.latency);
+    TEST_ASSERT_EQUAL(0, w.inFlight());
+    TEST_ASSERT_EQUAL(1, w.stats().acked);
+    TEST_ASSERT_EQUAL(0, w.expire(5000, 1000));
+}
+
+void test_stray_puback_is_not_remembered() {
+    InflightWindow w;
+    Completion c;
+    
+    // No reservation open - an unknown PUBACK is not a future one
+    TEST_ASSERT_FALSE(w.complete(9, 0));
+    TEST_ASSERT_TRUE(w.track(9, 0, onComplete, &c));
+    TEST_ASSERT_EQUAL(0, c.calls);
+    TEST_ASSERT_EQUAL(1, w.inFlight());
+}
+
+void test_reservation_survives_expire_and_abort() {
+    InflightWindow w;
+    Completion c;
+    
+    int slot = w.reserve(0, onComplete, &c);
+    TEST_ASSERT_EQUAL(0, w.expire(5000, 1000));
+    TEST_ASSERT_EQUAL(0, w.abortAll(5000));
+    TEST_ASSERT_TRUE(w.assign(slot, 3, 5000));
+    TEST_ASSERT_EQUAL(1, w.abortAll(5001));
+    TEST_ASSERT_EQUAL(1, c.calls);
+    TEST_ASSERT_FALSE(c.acked);
+}
+
+struct LockState {
+    int depth = 0;
+    int maxDepth = 0;
+    int locks = 0;
+    int depthInCallback = -1;
+};
+
+static LockState lockState;
+
+static void onLock(bool lock, void* ctx) {
+    LockState* l = static_cast<LockState*>(ctx);
+    if (lock) {
+        l->locks++;
+        l->depth++;
+        if (l->depth > l->maxDepth) l->maxDepth = l->depth;
+    } else {
+        l->depth--;
+    }
+}
+
+static void onCompleteCheckLock(uint16_t, bool, uint32_t, void*) {
+    lockState.depthInCallback = lockState.depth;
+}
+
+void test_lock_released_before_callbacks() {
+    lockState = LockState();
+    InflightWindow w;
+    w.setLock(onLock, &lockState);
+    
+    w.track(1, 0, onCompleteCheckLock, nullptr);
+    TEST_ASSERT_TRUE(lockState.locks >= 2);
+    TEST_ASSERT_TRUE(w.complete(1, 5));
+    TEST_ASSERT_EQUAL(0, lockState.depthInCallback);
+    
+    lockState.depthInCallback = -1;
+    w.track(2, 0, onCompleteCheckLock, nullptr);
+    w.expire(5000, 1000);
+    TEST_ASSERT_EQUAL(0, lockState.depthInCallback);
+    TEST_ASSERT_EQUAL(0, lockState.depth);
+    TEST_ASSERT_EQUAL(1, lockState.maxDepth);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_window_limits_inflight);
+    RUN_TEST(test_window_is_clamped);
+    RUN_TEST(test_packet_id_zero_is_rejected);
+    RUN_TEST(test_puback_completes_with_latency);
+    RUN_TEST(test_timeout_fails_publish);
+    RUN_TEST(test_timeout_handles_millis_wrap);
+    RUN_TEST(test_abort_all_on_disconnect);
+    RUN_TEST(test_latency_min_max_avg);
+    RUN_TEST(test_reservation_counts_against_window);
+    RUN_TEST(test_early_puback_completes_on_assign);
+    RUN_TEST(test_stray_puback_is_not_remembered);
+    RUN_TEST(test_reservation_survives_expire_and_abort);
+    RUN_TEST(test_lock_released_before_callbacks);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttInflight.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttInflight compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
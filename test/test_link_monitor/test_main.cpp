@@ -0,0 +1,280 @@
+/**
+ * Tests for LinkMonitor (broker RTT estimation and adaptive keep-alive)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <MqttLinkMonitor.h>
+
+using espmole::LinkMonitor;
+
+/// Publish a probe that gets packet ID `id`
+static void sendProbe(LinkMonitor& m, uint16_t id, uint32_t now) {
+    m.noteProbeStart(now);
+    m.noteProbeSent(id);
+}
+
+/// Answer a due probe after `rtt` ms
+static bool answerProbe(LinkMonitor& m, uint16_t id, uint32_t& now, uint32_t rtt) {
+    if (!m.probeDue(now)) return false;
+    sendProbe(m, id, now);
+    now += rtt;
+    m.noteProbeDone(id, true, now);
+    m.noteRtt(rtt, now);
+    return true;
+}
+
+void test_rtt_smoothing() {
+    LinkMonitor m;
+    m.begin(30, 10, 300, false);
+    TEST_ASSERT_EQUAL(LinkMonitor::INITIAL_RTO, m.stats().rto);
+    
+    m.noteRtt(100, 0);
+    TEST_ASSERT_EQUAL(100, m.stats().srtt);
+    TEST_ASSERT_EQUAL(50, m.stats().rttvar);
+    TEST_ASSERT_EQUAL(LinkMonitor::MIN_RTO, m.stats().rto);
+    
+    m.noteRtt(200, 10);
+    TEST_ASSERT_EQUAL(112, m.stats().srtt);
+    TEST_ASSERT_EQUAL(63, m.stats().rttvar);
+    
+    // Slow link: RTO follows SRTT + 4 * RTTVAR
+    for (int i = 0; i < 50; i++) m.noteRtt(2000, 20);
+    TEST_ASSERT_UINT32_WITHIN(20, 2000, m.stats().srtt);
+    TEST_ASSERT_UINT32_WITHIN(100, 2000, m.stats().rto);
+    TEST_ASSERT_EQUAL(52, m.stats().samples);
+}
+
+void test_measure_only_mode() {
+    LinkMonitor m;
+    m.begin(15, 10, 300, false);
+    m.noteConnected(0);
+    
+    TEST_ASSERT_FALSE(m.probeDue(100000));
+    m.noteRtt(100, 0);
+    m.noteRtt(9000, 0);
+    TEST_ASSERT_EQUAL(15, m.keepAlive());
+    TEST_ASSERT_FALSE(m.reconnectAdvised());
+}
+
+void test_probe_cadence() {
+    LinkMonitor m;
+    m.begin(20, 10, 300, true);
+    m.noteConnected(1000);
+    
+    // Every keepAlive / 2 of silence
+    TEST_ASSERT_FALSE(m.probeDue(10999));
+    TEST_ASSERT_TRUE(m.probeDue(11000));
+    
+    // One at a time
+    sendProbe(m, 7, 11000);
+    TEST_ASSERT_FALSE(m.probeDue(30000));
+    
+    // Traffic counts as activity
+    m.noteProbeDone(7, true, 11100);
+    m.noteRtt(100, 11100);
+    TEST_ASSERT_FALSE(m.probeDue(15000));
+    m.noteRtt(100, 15000);
+    TEST_ASSERT_FALSE(m.probeDue(24999));
+    TEST_ASSERT_TRUE(m.probeDue(25000));
+    TEST_ASSERT_EQUAL(1, m.stats().probes);
+}
+
+void test_keepalive_clamped_to_bounds() {
+    LinkMonitor m;
+    m.begin(5, 10, 60, true);
+    TEST_ASSERT_EQUAL(10, m.keepAlive());
+    m.begin(600, 10, 60, true);
+    TEST_ASSERT_EQUAL(60, m.keepAlive());
+    
+    // Measuring only: the configured value is used as is
+    m.begin(600, 10, 60, false);
+    TEST_ASSERT_EQUAL(600, m.keepAlive());
+}
+
+void test_stable_link_lengthens_keepalive() {
+    LinkMonitor m;
+    m.begin(20, 10, 120, true);
+    m.noteConnected(0);
+    
+    uint32_t now = 0;
+    uint16_t id = 1;
+    uint16_t last = m.keepAlive();
+    for (int i = 0; i < 900; i++) {
+        now += 1000;
+        answerProbe(m, id++, now, 80);
+        TEST_ASSERT_TRUE(m.keepAlive() >= last);
+        last = m.keepAlive();
+    }
+    TEST_ASSERT_EQUAL(120, m.keepAlive());
+    TEST_ASSERT_EQUAL(0, m.stats().lost);
+    
+    // Radio time: far fewer probes than the 90 a fixed 20 s keep-alive needs
+    TEST_ASSERT_TRUE(m.stats().probes < 40);
+}
+
+void test_rtt_spike_shortens_keepalive() {
+    LinkMonitor m;
+    m.begin(80, 10, 300, true);
+    m.noteConnected(0);
+    
+    for (int i = 0; i < 3; i++) m.noteRtt(100, 0);
+    TEST_ASSERT_EQUAL(80, m.keepAlive());
+    
+    // Far above SRTT + 4 * RTTVAR (and the 1 s RTO floor)
+    m.noteRtt(2500, 0);
+    TEST_ASSERT_EQUAL(40, m.keepAlive());
+    TEST_ASSERT_FALSE(m.reconnectAdvised());
+}
+
+void test_lost_probes_advise_reconnect() {
+    LinkMonitor m;
+    m.begin(40, 10, 300, true);
+    m.noteConnected(0);
+    m.noteRtt(100, 0);
+    uint32_t rto = m.stats().rto;
+    
+    sendProbe(m, 1, 20000);
+    m.check(20000 + rto - 1);
+    TEST_ASSERT_EQUAL(0, m.stats().lost);
+    m.check(20000 + rto);
+    TEST_ASSERT_EQUAL(1, m.stats().lost);
+    TEST_ASSERT_EQUAL(20, m.keepAlive());
+    TEST_ASSERT_FALSE(m.reconnectAdvised());
+    
+    // The late PUBACK of the lost probe changes nothing
+    m.noteProbeDone(1, true, 20000 + rto + 5);
+    TEST_ASSERT_EQUAL(1, m.stats().lost);
+    
+    // Retry at once
+    uint32_t now = 20000 + rto;
+    TEST_ASSERT_TRUE(m.probeDue(now));
+    sendProbe(m, 2, now);
+    m.noteProbeDone(2, false, now + 10);    // PUBACK timeout / disconnect
+    TEST_ASSERT_EQUAL(2, m.stats().lost);
+    TEST_ASSERT_TRUE(m.reconnectAdvised());
+    TEST_ASSERT_FALSE(m.probeDue(now + 100000));
+    
+    m.noteReconnect();
+    TEST_ASSERT_FALSE(m.reconnectAdvised());
+    TEST_ASSERT_EQUAL(1, m.stats().reconnects);
+    TEST_ASSERT_EQUAL(10, m.keepAlive());
+}
+
+void test_early_puback_completes_probe() {
+    LinkMonitor m;
+    m.begin(40, 10, 300, true);
+    m.noteConnected(0);
+    m.noteRtt(100, 0);
+    uint32_t rto = m.stats().rto;
+    
+    // Acked before publish() returned the packet ID
+    m.noteProbeStart(20000);
+    m.noteProbeDone(5, true, 20002);
+    m.noteProbeSent(5);
+    m.check(20000 + rto);
+    TEST_ASSERT_EQUAL(0, m.stats().lost);
+    TEST_ASSERT_EQUAL(1, m.stats().probes);
+    TEST_ASSERT_FALSE(m.probeDue(20002 + 19999));
+    TEST_ASSERT_TRUE(m.probeDue(20002 + 20000));
+    
+    // A publish that failed is no probe and no loss
+    m.noteProbeStart(50000);
+    TEST_ASSERT_FALSE(m.probeDue(50000));
+    m.noteProbeSent(0);
+    m.check(50000 + rto);
+    TEST_ASSERT_EQUAL(0, m.stats().lost);
+    TEST_ASSERT_EQUAL(1, m.stats().probes);
+    TEST_ASSERT_TRUE(m.probeDue(50000));
+    
+    // Once the ID is known, other packets do not complete it
+    sendProbe(m, 9, 60000);
+    m.noteProbeDone(8, true, 60010);
+    m.check(60000 + rto);
+    TEST_ASSERT_EQUAL(1, m.stats().lost);
+}
+
+void test_sample_resets_loss_streak() {
+    LinkMonitor m;
+    m.begin(40, 10, 300, true);
+    m.noteConnected(0);
+    
+    sendProbe(m, 1, 20000);
+    m.check(30000);
+    m.noteRtt(150, 30000);
+    sendProbe(m, 2, 50000);
+    m.check(60000);
+    TEST_ASSERT_EQUAL(2, m.stats().lost);
+    TEST_ASSERT_FALSE(m.reconnectAdvised());
+}
+
+void test_dead_link_detected_before_keepalive() {
+    // Fixed keep-alive: the broker notices after 1.5 keep-alives; a client
+    // waits for its PINGRESP for up to another keep-alive
+    const uint32_t KEEPALIVE = 60;
+    
+    LinkMonitor m;
+    m.begin(KEEPALIVE, 10, KEEPALIVE, true);
+    m.noteConnected(0);
+    
+    uint32_t now = 0;
+    uint16_t id = 1;
+    while (now < 300000) {
+        now += 100;
+        answerProbe(m, id++, now, 120);
+    }
+    
+    // Link dies; probes go unanswered
+    uint32_t died = now;
+    while (!m.reconnectAdvised() && now - died < 10 * KEEPALIVE * 1000) {
+        now += 100;
+        m.check(now);
+        if (m.probeDue(now)) sendProbe(m, id++, now);
+    }
+    TEST_ASSERT_TRUE(m.reconnectAdvised());
+    
+    uint32_t detection = now - died;
+    TEST_ASSERT_TRUE(detection <= KEEPALIVE * 1000 / 2 + 2 * m.stats().rto + 200);
+    TEST_ASSERT_TRUE(detection < KEEPALIVE * 1500);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_rtt_smoothing);
+    RUN_TEST(test_measure_only_mode);
+    RUN_TEST(test_probe_cadence);
+    RUN_TEST(test_keepalive_clamped_to_bounds);
+    RUN_TEST(test_stable_link_lengthens_keepalive);
+    RUN_TEST(test_rtt_spike_shortens_keepalive);
+    RUN_TEST(test_lost_probes_advise_reconnect);
+    RUN_TEST(test_early_puback_completes_probe);
+    RUN_TEST(test_sample_resets_loss_streak);
+    RUN_TEST(test_dead_link_detected_before_keepalive);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttLinkMonitor.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttLinkMonitor compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,248 @@
+/**
+ * Tests for LogStream (log topic queue)
+ */
+
+#ifdef NATIVE_BUILD
+
+// Debug and trace compiled out for test_compile_time_levels
+#define ESPMOLE_MQTT_LOG_LEVEL 3
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <MqttLogStream.h>
+
+using namespace espmole;
+
+static uint32_t fakeNow = 0;
+
+static uint32_t fakeClock(void* ctx) {
+    (void)ctx;
+    return fakeNow;
+}
+
+static std::string drainAll(LogStream& log, size_t cap = 512) {
+    std::vector<char> buf(cap);
+    size_t lines = 0;
+    size_t len = log.drain(buf.data(), buf.size(), lines);
+    return std::string(buf.data(), len);
+}
+
+void test_lines_are_packed_in_order() {
+    LogStream log;
+    log.setClock(fakeClock);
+    fakeNow = 1200;
+    log.log(LOG_INFO, "boot %d", 1);
+    fakeNow = 1250;
+    log.log(LOG_WARN, "rssi=%d\n", -80);   // Trailing newline removed
+    log.write(LOG_ERROR, "two\nlines", 9);  // Embedded newline flattened
+    TEST_ASSERT_EQUAL(3, log.pending());
+
+    char buf[256];
+    size_t lines = 0;
+    size_t len = log.drain(buf, sizeof(buf), lines);
+    TEST_ASSERT_EQUAL(3, lines);
+    TEST_ASSERT_EQUAL_STRING_LEN("1200 I boot 1\n1250 W rssi=-80\n1250 E two lines\n", buf, len);
+    TEST_ASSERT_EQUAL(0, log.pending());
+    TEST_ASSERT_EQUAL(0, log.drain(buf, sizeof(buf), lines));
+    TEST_ASSERT_EQUAL(1, log.stats().batches);
+}
+
+void test_runtime_level() {
+    LogStream log;
+    TEST_ASSERT_EQUAL(LOG_INFO, log.level());
+    log.log(LOG_DEBUG, "hidden");
+    TEST_ASSERT_EQUAL(0, log.pending());
+
+    // Capped at the compiled-in level
+    log.setLevel(LOG_TRACE);
+    TEST_ASSERT_EQUAL(LOG_INFO, log.level());
+
+    log.setLevel(LOG_ERROR);
+    log.log(LOG_WARN, "hidden");
+    log.log(LOG_ERROR, "shown");
+    TEST_ASSERT_EQUAL(1, log.pending());
+
+    log.setLevel(LOG_OFF);
+    log.log(LOG_ERROR, "hidden");
+    TEST_ASSERT_EQUAL(1, log.pending());
+    TEST_ASSERT_EQUAL(1, log.stats().written);
+
+    TEST_ASSERT_EQUAL(LOG_DEBUG, LogStream::parseLevel("debug"));
+    TEST_ASSERT_EQUAL(2, LogStream::parseLevel("2"));
+    TEST_ASSERT_EQUAL(-1, LogStream::parseLevel("loud"));
+    TEST_ASSERT_EQUAL_STRING("warn", LogStream::levelName(LOG_WARN));
+}
+
+static int sideEffects = 0;
+
+static int touch() {
+    return ++sideEffects;
+}
+
+void test_compile_time_levels() {
+    LogStream log;
+    ESPMOLE_LOGI(log, "kept %d", touch());
+    ESPMOLE_LOGD(log, "gone %d", touch());
+    ESPMOLE_LOGT(log, "gone %d", touch());
+
+    // Disabled levels do not even evaluate their arguments
+    TEST_ASSERT_EQUAL(1, sideEffects);
+    TEST_ASSERT_EQUAL(1, log.pending());
+}
+
+void test_drop_oldest_with_marker() {
+    LogStream log;
+    log.setClock(fakeClock);
+    fakeNow = 7;
+    for (size_t i = 0; i < LogStream::SLOTS + 5; i++) {
+        log.log(LOG_INFO, "line %u", static_cast<unsigned>(i));
+    }
+    TEST_ASSERT_EQUAL(LogStream::SLOTS, log.pending());
+    TEST_ASSERT_EQUAL(5, log.stats().dropped);
+
+    fakeNow = 9;
+    std::string out = drainAll(log, 4096);
+    TEST_ASSERT_EQUAL(0, out.find("9 ! dropped 5\n7 I line 5\n"));
+    char last[32];
+    snprintf(last, sizeof(last), "7 I line %u\n", static_cast<unsigned>(LogStream::SLOTS + 4));
+    TEST_ASSERT_EQUAL(out.size() - strlen(last), out.rfind(last));
+
+    // Reported once
+    log.log(LOG_INFO, "after");
+    TEST_ASSERT_EQUAL_STRING("9 I after\n", drainAll(log).c_str());
+}
+
+void test_batches_split_at_capacity() {
+    LogStream log;
+    for (int i = 0; i < 10; i++) log.log(LOG_INFO, "message number %02d", i);
+
+    // 0 I message number 00\n = 22 bytes; 50 bytes hold two lines
+    char buf[50];
+    size_t lines = 0;
+    size_t total = 0;
+    int batches = 0;
+    size_t len;
+    while ((len = log.drain(buf, sizeof(buf), lines)) > 0) {
+        TEST_ASSERT_EQUAL(2, lines);
+        TEST_ASSERT_EQUAL(44, len);
+        total += lines;
+        batches++;
+    }
+    TEST_ASSERT_EQUAL(10, total);
+    TEST_ASSERT_EQUAL(5, batches);
+
+    // A line longer than the batch is truncated rather than stuck
+    std::string lng(LogStream::LINE_LEN + 20, 'x');
+    log.write(LOG_INFO, lng.c_str(), lng.size());
+    char small[32];
+    len = log.drain(small, sizeof(small), lines);
+    TEST_ASSERT_EQUAL(sizeof(small), len);
+    TEST_ASSERT_EQUAL('\n', small[len - 1]);
+    TEST_ASSERT_EQUAL(0, log.pending());
+
+    // Lines that could not be published show up as dropped
+    log.noteLost(2);
+    TEST_ASSERT_EQUAL(0, drainAll(log).find("0 ! dropped 2\n"));
+}
+
+void test_concurrent_writers() {
+    LogStream log;
+    const int WRITERS = 4;
+    const int LINES = 20000;
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < WRITERS; w++) {
+        threads.emplace_back([&log, w] {
+            for (int i = 0; i < LINES; i++) log.log(LOG_INFO, "w%d %d", w, i);
+        });
+    }
+
+    // Single consumer: every line intact, per-writer order kept
+    int last[WRITERS];
+    for (int w = 0; w < WRITERS; w++) last[w] = -1;
+    size_t received = 0;
+    bool intact = true;
+    bool ordered = true;
+
+    auto consume = [&] {
+        char buf[512];
+        size_t lines = 0;
+        size_t len = log.drain(buf, sizeof(buf), lines);
+        std::string batch(buf, len);
+        size_t pos = 0;
+        while (pos < batch.size()) {
+            size_t end = batch.find('\n', pos);
+            std::string line = batch.substr(pos, end - pos);
+            pos = end + 1;
+            int w = -1, i = -1;
+            if (line.find(" ! dropped ") != std::string::npos) continue;
+            if (sscanf(line.c_str(), "0 I w%d %d", &w, &i) != 2 || w < 0 || w >= WRITERS) {
+                intact = false;
+                continue;
+            }
+            if (i <= last[w]) ordered = false;
+            last[w] = i;
+            received++;
+        }
+        return len > 0;
+    };
+
+    for (auto& t : threads) {
+        while (t.joinable()) {
+            consume();
+            t.join();
+        }
+    }
+    while (consume()) {}
+
+    LogStats s = log.stats();
+    TEST_ASSERT_TRUE(intact);
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_EQUAL(static_cast<uint32_t>(WRITERS * LINES), s.written);
+    TEST_ASSERT_EQUAL(static_cast<size_t>(WRITERS * LINES), received + s.dropped);
+    TEST_ASSERT_EQUAL(0, log.pending());
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_lines_are_packed_in_order);
+    RUN_TEST(test_runtime_level);
+    RUN_TEST(test_compile_time_levels);
+    RUN_TEST(test_drop_oldest_with_marker);
+    RUN_TEST(test_batches_split_at_capacity);
+    RUN_TEST(test_concurrent_writers);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttLogStream.h>
+
+espmole::LogStream logStream;
+
+void setup() {
+    Serial.begin(115200);
+    ESPMOLE_LOGI(logStream, "boot heap=%u", ESP.getFreeHeap());
+    Serial.println("MqttLogStream compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
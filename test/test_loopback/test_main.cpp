@@ -0,0 +1,357 @@
+/**
+ * Tests for LoopbackTest (throughput self-test), run through MicroBroker
+ * over a simulated link
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <MqttCodec.h>
+#include <MqttLoopback.h>
+#include <MqttMicroBroker.h>
+
+using namespace espmole;
+
+static const char TOPIC[] = "espmole/dev/selftest";
+
+/**
+ * A device connected to MicroBroker. Both directions take `latencyUs`;
+ * broker-to-device also has `bytesPerSec` of bandwidth (0 = unlimited)
+ * and a send queue of `queueMax` bytes, beyond which the broker drops.
+ */
+struct Sim {
+    struct Chunk {
+        uint32_t at;
+        std::vector<uint8_t> bytes;
+    };
+
+    MicroBroker broker;
+    LoopbackTest test;
+    int client = -1;
+    uint32_t now = 0;                   // us
+
+    uint32_t latencyUs = 2000;
+    uint32_t bytesPerSec = 0;
+    uint32_t queueMax = 4096;
+    uint32_t loopUs = 0;                // Sender runs only this often (0 = every tick)
+
+    std::deque<Chunk> up;
+    std::deque<Chunk> down;
+    uint32_t busyUntil = 0;             // Downlink serializing until
+    std::vector<uint8_t> rx;            // Device receive buffer
+    uint32_t lastLoop = 0;
+    std::vector<std::string> stepLines;
+
+    static bool onSend(int, const uint8_t* data, size_t len, void* ctx) {
+        return static_cast<Sim*>(ctx)->transmit(data, len);
+    }
+
+    static void onClose(int, void*) {}
+
+    static void onStep(uint8_t, const LoopbackStep& step, void* ctx) {
+        char line[160];
+        LoopbackTest::formatStep(line, sizeof(line), step);
+        static_cast<Sim*>(ctx)->stepLines.push_back(line);
+    }
+
+    bool transmit(const uint8_t* data, size_t len) {
+        uint32_t start = now;
+        if (bytesPerSec > 0) {
+            if (static_cast<int32_t>(busyUntil - now) > 0) start = busyUntil;
+            uint64_t backlog = static_cast<uint64_t>(start - now) * bytesPerSec / 1000000;
+            if (backlog + len > queueMax) return false;
+            busyUntil = start + static_cast<uint32_t>(len * 1000000ULL / bytesPerSec);
+            start = busyUntil;
+        }
+        down.push_back(Chunk{start + latencyUs, std::vector<uint8_t>(data, data + len)});
+        return true;
+    }
+
+    void begin(uint32_t startUs = 0) {
+        now = startUs;
+        busyUntil = startUs;
+        lastLoop = startUs;
+        broker.begin(onSend, onClose, this);
+        client = broker.open(0);
+
+        uint8_t buf[128];
+        mqtt::ConnectOptions o;
+        o.clientId = "dev";
+        broker.receive(client, buf, mqtt::encodeConnect(buf, sizeof(buf), o), 0);
+        broker.receive(client, buf, mqtt::encodeSubscribe(buf, sizeof(buf), 1, TOPIC, 0), 0);
+        deliverDown();
+        test.onStep(onStep, this);
+    }
+
+    /// Hand the device what has arrived
+    void deliverDown() {
+        while (!down.empty() && static_cast<int32_t>(now - down.front().at) >= 0) {
+            rx.insert(rx.end(), down.front().bytes.begin(), down.front().bytes.end());
+            down.pop_front();
+        }
+        size_t pos = 0;
+        mqtt::Packet p;
+        int n;
+        while ((n = mqtt::parse(rx.data() + pos, rx.size() - pos, p)) > 0) {
+            pos += static_cast<size_t>(n);
+            mqtt::PublishView msg;
+            if (p.type == mqtt::PUBLISH && mqtt::decodePublish(p, msg)) {
+                test.receive(msg.payload, msg.len, now);
+            }
+        }
+        rx.erase(rx.begin(), rx.begin() + static_cast<long>(pos));
+    }
+
+    void tick() {
+        if (loopUs == 0 || now - lastLoop >= loopUs) {
+            lastLoop = now;
+            uint8_t payload[256];
+            uint8_t packet[300];
+            while (size_t len = test.next(payload, sizeof(payload), now)) {
+                size_t n = mqtt::encodePublish(packet, sizeof(packet), TOPIC, strlen(TOPIC),
+                                               payload, len, 0, false, 0);
+                up.push_back(Chunk{now + latencyUs, std::vector<uint8_t>(packet, packet + n)});
+                if (loopUs > 0) break;
+            }
+        }
+        while (!up.empty() && static_cast<int32_t>(now - up.front().at) >= 0) {
+            broker.receive(client, up.front().bytes.data(), up.front().bytes.size(), now / 1000);
+            up.pop_front();
+        }
+        deliverDown();
+        test.update(now);
+    }
+
+    /// Run the test to its end (or `limitUs`)
+    void run(const LoopbackConfig& config, uint32_t limitUs = 120000000) {
+        TEST_ASSERT_TRUE(test.start(config, now));
+        uint32_t start = now;
+        while (test.running() && now - start < limitUs) {
+            now += 100;
+            tick();
+        }
+    }
+};
+
+static Sim* sim;
+
+static LoopbackConfig quickConfig() {
+    LoopbackConfig c;
+    c.startRate = 50;
+    c.maxRate = 1000;
+    c.rampPercent = 50;
+    c.stepMs = 1000;
+    c.drainMs = 200;
+    return c;
+}
+
+void setUp() {
+    sim = new Sim();
+}
+
+void tearDown() {
+    delete sim;
+}
+
+void test_unlimited_link_reaches_max_rate() {
+    sim->begin();
+    sim->run(quickConfig());
+
+    const LoopbackResult& r = sim->test.result();
+    TEST_ASSERT_FALSE(r.running);
+    TEST_ASSERT_EQUAL(LIMIT_MAX_RATE, r.limit);
+    TEST_ASSERT_EQUAL(1000, r.best.rate);
+    TEST_ASSERT_EQUAL(1000, r.best.received);
+    TEST_ASSERT_EQUAL(0, r.best.lossPermille);
+    TEST_ASSERT_EQUAL(64000, r.best.bytesPerSec);
+
+    // 50, 75, 112, 168, 252, 378, 567, 850, 1000
+    TEST_ASSERT_EQUAL(9, r.steps);
+    TEST_ASSERT_EQUAL(9, sim->stepLines.size());
+
+    // Two legs of 2 ms, within the histogram's 12.5%
+    TEST_ASSERT_UINT32_WITHIN(500, 4000, r.best.p50Us);
+    TEST_ASSERT_UINT32_WITHIN(500, 4000, r.best.p99Us);
+}
+
+void test_bandwidth_limit_found() {
+    // ~90 bytes per PUBLISH: 45 kB/s is about 500 messages/s
+    sim->bytesPerSec = 45000;
+    sim->begin();
+    sim->run(quickConfig());
+
+    const LoopbackResult& r = sim->test.result();
+    TEST_ASSERT_EQUAL(LIMIT_LOSS, r.limit);
+    TEST_ASSERT_EQUAL(378, r.best.rate);
+    TEST_ASSERT_EQUAL(567, r.last.rate);
+    TEST_ASSERT_TRUE(r.last.lossPermille > 10);
+    TEST_ASSERT_TRUE(sim->broker.stats().dropped > 0);
+
+    // Queueing shows in the tail before anything is lost
+    TEST_ASSERT_TRUE(r.last.p99Us > r.best.p99Us);
+    TEST_ASSERT_EQUAL_STRING(
+        "rate=567 sent=567", sim->stepLines.back().substr(0, 17).c_str());
+    TEST_ASSERT_TRUE(sim->stepLines.back().find(" loss") != std::string::npos);
+}
+
+void test_slow_link_fails_on_latency() {
+    sim->latencyUs = 300000;
+    sim->begin();
+    LoopbackConfig c = quickConfig();
+    c.drainMs = 1000;
+    sim->run(c);
+
+    const LoopbackResult& r = sim->test.result();
+    TEST_ASSERT_EQUAL(LIMIT_LATENCY, r.limit);
+    TEST_ASSERT_EQUAL(0, r.best.rate);
+    TEST_ASSERT_EQUAL(0, r.last.lossPermille);
+    TEST_ASSERT_UINT32_WITHIN(75000, 600000, r.last.p50Us);
+}
+
+void test_slow_sender_fails_on_send_rate() {
+    // The loop gets to send once every 10 ms: 100 messages/s at most
+    sim->loopUs = 10000;
+    sim->begin();
+    LoopbackConfig c = quickConfig();
+    c.rampPercent = 100;
+    sim->run(c);
+
+    const LoopbackResult& r = sim->test.result();
+    TEST_ASSERT_EQUAL(LIMIT_SEND, r.limit);
+    TEST_ASSERT_EQUAL(100, r.best.rate);
+    TEST_ASSERT_EQUAL(200, r.last.rate);
+}
+
+void test_micros_wrap() {
+    sim->begin(0xFFFFFFFFu - 1500000);
+    LoopbackConfig c = quickConfig();
+    c.maxRate = 100;
+    sim->run(c);
+
+    const LoopbackResult& r = sim->test.result();
+    TEST_ASSERT_EQUAL(LIMIT_MAX_RATE, r.limit);
+    TEST_ASSERT_EQUAL(100, r.best.rate);
+    TEST_ASSERT_EQUAL(0, r.best.lossPermille);
+    TEST_ASSERT_UINT32_WITHIN(500, 4000, r.best.maxUs);
+}
+
+void test_message_format_and_foreign_messages() {
+    LoopbackTest t;
+    LoopbackConfig c = quickConfig();
+    c.payload = 40;
+    TEST_ASSERT_TRUE(t.start(c, 1000));
+
+    uint8_t out[64];
+    size_t n = t.next(out, sizeof(out), 1000);
+    TEST_ASSERT_EQUAL(40, n);
+    TEST_ASSERT_EQUAL_MEMORY("1 0 1000 ....", out, 13);
+
+    // Nothing due until 1/rate has passed
+    TEST_ASSERT_EQUAL(0, t.next(out, sizeof(out), 1000));
+    TEST_ASSERT_FALSE(t.due(20999));
+    TEST_ASSERT_TRUE(t.due(21000));
+
+    // Cut to the caller's buffer, never below the header
+    TEST_ASSERT_EQUAL(10, t.next(out, 10, 21000));
+
+    TEST_ASSERT_TRUE(t.receive(out, 10, 22000));
+    const char* other[] = {"2 0 1000 ", "1 7 1000 ", "x", "1 0", ""};
+    for (const char* o : other) {
+        TEST_ASSERT_FALSE(t.receive(reinterpret_cast<const uint8_t*>(o), strlen(o), 22000));
+    }
+}
+
+void test_stop_and_restart() {
+    LoopbackTest t;
+    TEST_ASSERT_TRUE(t.start(quickConfig(), 0));
+    uint8_t out[64];
+    size_t n = t.next(out, sizeof(out), 0);
+    t.stop();
+    TEST_ASSERT_FALSE(t.running());
+    TEST_ASSERT_EQUAL(LIMIT_ABORTED, t.result().limit);
+    TEST_ASSERT_EQUAL(0, t.next(out, sizeof(out), 100000));
+
+    // A straggler of the stopped run is late; after a restart it is foreign
+    TEST_ASSERT_TRUE(t.receive(out, n, 1000));
+    TEST_ASSERT_EQUAL(1, t.result().late);
+    TEST_ASSERT_TRUE(t.start(quickConfig(), 2000));
+    TEST_ASSERT_FALSE(t.receive(out, n, 3000));
+    TEST_ASSERT_EQUAL(0, t.result().late);
+}
+
+void test_bad_config_rejected() {
+    LoopbackTest t;
+    LoopbackConfig c = quickConfig();
+    c.startRate = 0;
+    TEST_ASSERT_FALSE(t.start(c, 0));
+    c = quickConfig();
+    c.maxRate = 10;
+    TEST_ASSERT_FALSE(t.start(c, 0));
+    c = quickConfig();
+    c.stepMs = 0;
+    TEST_ASSERT_FALSE(t.start(c, 0));
+    TEST_ASSERT_FALSE(t.running());
+}
+
+void test_result_format() {
+    LoopbackResult r;
+    r.steps = 6;
+    r.limit = LIMIT_LOSS;
+    r.best.rate = 378;
+    r.best.bytesPerSec = 24192;
+    r.best.p50Us = 4100;
+    r.best.p95Us = 5200;
+    r.best.p99Us = 6100;
+    r.best.maxUs = 9000;
+    char out[200];
+    LoopbackTest::formatResult(out, sizeof(out), r);
+    TEST_ASSERT_EQUAL_STRING("max_rate=378 bps=24192 loss_pm=0 p50_us=4100 p95_us=5200 "
+                             "p99_us=6100 max_us=9000 steps=6 late=0 limit=loss", out);
+    TEST_ASSERT_EQUAL(9, LoopbackTest::formatResult(out, 10, r));
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_unlimited_link_reaches_max_rate);
+    RUN_TEST(test_bandwidth_limit_found);
+    RUN_TEST(test_slow_link_fails_on_latency);
+    RUN_TEST(test_slow_sender_fails_on_send_rate);
+    RUN_TEST(test_micros_wrap);
+    RUN_TEST(test_message_format_and_foreign_messages);
+    RUN_TEST(test_stop_and_restart);
+    RUN_TEST(test_bad_config_rejected);
+    RUN_TEST(test_result_format);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttLoopback.h>
+
+espmole::LoopbackTest loopback;
+
+void setup() {
+    Serial.begin(115200);
+    loopback.start(espmole::LoopbackConfig(), micros());
+    uint8_t message[64];
+    size_t len = loopback.next(message, sizeof(message), micros());
+    loopback.receive(message, len, micros());
+    Serial.println("MqttLoopback compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * Tests for CommandMailbox (retained commands for duty-cycled devices)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttMailbox.h>
+
+using espmole::CommandMailbox;
+using espmole::MailboxEntry;
+
+static CommandMailbox::Offer offer(CommandMailbox& m, uint32_t seq, const char* cmd, uint32_t now) {
+    return m.offer(seq, reinterpret_cast<const uint8_t*>(cmd), strlen(cmd), now);
+}
+
+static uint32_t take(CommandMailbox& m) {
+    const MailboxEntry* e = m.peek();
+    if (e == nullptr) return 0;
+    uint32_t seq = e->seq;
+    m.pop();
+    return seq;
+}
+
+void test_waits_for_settle_time() {
+    CommandMailbox m;
+    m.open(1000);
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_QUEUED, offer(m, 1, "led on", 1100));
+    
+    TEST_ASSERT_FALSE(m.ready(1500, 500));
+    TEST_ASSERT_TRUE(m.ready(1600, 500));
+    TEST_ASSERT_FALSE(m.drained(1600, 500));
+}
+
+void test_runs_in_sequence_order() {
+    CommandMailbox m;
+    m.open(0);
+    // Retained messages arrive in arbitrary order
+    offer(m, 30, "c", 0);
+    offer(m, 10, "a", 0);
+    offer(m, 20, "b", 0);
+    
+    const MailboxEntry* e = m.peek();
+    TEST_ASSERT_EQUAL(10, e->seq);
+    TEST_ASSERT_EQUAL(1, e->len);
+    TEST_ASSERT_EQUAL_MEMORY("a", e->command, 1);
+    
+    TEST_ASSERT_EQUAL(10, take(m));
+    TEST_ASSERT_EQUAL(20, take(m));
+    TEST_ASSERT_EQUAL(30, take(m));
+    TEST_ASSERT_NULL(m.peek());
+    TEST_ASSERT_EQUAL(30, m.lastSeq());
+    TEST_ASSERT_TRUE(m.drained(1000, 500));
+}
+
+void test_rejects_duplicates_and_stale() {
+    CommandMailbox m;
+    m.open(0);
+    offer(m, 5, "x", 0);
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_DUPLICATE, offer(m, 5, "x", 0));
+    take(m);
+    
+    // Redelivery of an executed command whose clear has not landed yet
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_STALE, offer(m, 5, "x", 0));
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_STALE, offer(m, 4, "x", 0));
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_QUEUED, offer(m, 6, "y", 0));
+}
+
+void test_rejects_too_long() {
+    CommandMailbox m;
+    m.open(0);
+    uint8_t big[CommandMailbox::COMMAND_MAX + 1];
+    memset(big, 'a', sizeof(big));
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_TOO_LONG, m.offer(1, big, sizeof(big), 0));
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_QUEUED, m.offer(1, big, sizeof(big) - 1, 0));
+}
+
+void test_full_keeps_lowest_sequences() {
+    CommandMailbox m;
+    m.open(0);
+    for (uint32_t i = 0; i < CommandMailbox::MAX_SLOTS; i++) {
+        offer(m, 100 + i, "cmd", 0);
+    }
+    
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_FULL, offer(m, 500, "late", 0));
+    // A lower sequence displaces the highest one
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_QUEUED, offer(m, 1, "early", 0));
+    TEST_ASSERT_EQUAL(CommandMailbox::MAX_SLOTS, m.pending());
+    
+    TEST_ASSERT_FALSE(m.needsRefill());
+    uint32_t last = 0;
+    while (m.pending() > 0) {
+        uint32_t seq = take(m);
+        TEST_ASSERT_TRUE(seq > last);
+        TEST_ASSERT_TRUE(seq != 100 + CommandMailbox::MAX_SLOTS - 1);
+        last = seq;
+    }
+    
+    // The dropped commands are still retained - resubscribe to get them
+    TEST_ASSERT_TRUE(m.needsRefill());
+    TEST_ASSERT_FALSE(m.drained(1000, 500));
+    m.open(1000);
+    TEST_ASSERT_FALSE(m.needsRefill());
+    TEST_ASSERT_EQUAL(CommandMailbox::MAILBOX_QUEUED, offer(m, 107, "cmd", 1000));
+}
+
+void test_parse_seq() {
+    uint32_t seq = 0;
+    TEST_ASSERT_TRUE(CommandMailbox::parseSeq("42", seq));
+    TEST_ASSERT_EQUAL(42, seq);
+    TEST_ASSERT_TRUE(CommandMailbox::parseSeq("0", seq));
+    TEST_ASSERT_EQUAL(0, seq);
+    TEST_ASSERT_TRUE(CommandMailbox::parseSeq("4294967295", seq));
+    TEST_ASSERT_EQUAL_UINT32(4294967295UL, seq);
+    
+    TEST_ASSERT_FALSE(CommandMailbox::parseSeq("", seq));
+    TEST_ASSERT_FALSE(CommandMailbox::parseSeq("007", seq));
+    TEST_ASSERT_FALSE(CommandMailbox::parseSeq("12a", seq));
+    TEST_ASSERT_FALSE(CommandMailbox::parseSeq("4294967296", seq));
+    TEST_ASSERT_FALSE(CommandMailbox::parseSeq("x/1", seq));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_waits_for_settle_time);
+    RUN_TEST(test_runs_in_sequence_order);
+    RUN_TEST(test_rejects_duplicates_and_stale);
+    RUN_TEST(test_rejects_too_long);
+    RUN_TEST(test_full_keeps_lowest_sequences);
+    RUN_TEST(test_parse_seq);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino test - just compile check
+#include <Arduino.h>
+#include <MqttMailbox.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttMailbox compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
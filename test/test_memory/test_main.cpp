@@ -0,0 +1,135 @@
+/**
+ * Tests for MemoryMonitor (memory accounting and heap health)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttMemory.h>
+
+using namespace espmole;
+
+void test_usage_and_peaks() {
+    MemoryMonitor m;
+    m.update(MEM_JOURNAL, 1024, 300);
+    m.update(MEM_JOURNAL, 1024, 800);
+    m.update(MEM_JOURNAL, 1024, 100);
+    m.update(MEM_BATCH, 512, 64);
+
+    const MemoryUsage& j = m.usage(MEM_JOURNAL);
+    TEST_ASSERT_EQUAL(1024, j.reserved);
+    TEST_ASSERT_EQUAL(100, j.used);
+    TEST_ASSERT_EQUAL(800, j.peak);
+
+    MemoryUsage t = m.total();
+    TEST_ASSERT_EQUAL(1536, t.reserved);
+    TEST_ASSERT_EQUAL(164, t.used);
+    TEST_ASSERT_EQUAL(864, t.peak);
+
+    // Out of range areas are ignored
+    m.update(MEM_AREAS, 99, 99);
+    TEST_ASSERT_EQUAL(1536, m.total().reserved);
+}
+
+void test_slot_share() {
+    TEST_ASSERT_EQUAL(0, MemoryMonitor::share(256, 0, 8));
+    TEST_ASSERT_EQUAL(96, MemoryMonitor::share(256, 3, 8));
+    TEST_ASSERT_EQUAL(256, MemoryMonitor::share(256, 12, 8));   // Clamped
+    TEST_ASSERT_EQUAL(0, MemoryMonitor::share(256, 3, 0));
+}
+
+void test_heap_health() {
+    MemoryMonitor m;
+    TEST_ASSERT_EQUAL(0, m.heap().samples);
+
+    // One free block: no fragmentation
+    m.sampleHeap(100000, 100000, 90000);
+    TEST_ASSERT_EQUAL(0, m.heap().fragmentation);
+    TEST_ASSERT_EQUAL(90000, m.heap().minFree);
+
+    // Largest block a quarter of what is free
+    m.sampleHeap(80000, 20000, 75000);
+    TEST_ASSERT_EQUAL(75, m.heap().fragmentation);
+    TEST_ASSERT_EQUAL(75, m.heap().worstFragmentation);
+    TEST_ASSERT_EQUAL(75000, m.heap().minFree);
+
+    // Recovers, the worst case is kept
+    m.sampleHeap(120000, 96000, 75000);
+    TEST_ASSERT_EQUAL(20, m.heap().fragmentation);
+    TEST_ASSERT_EQUAL(75, m.heap().worstFragmentation);
+    TEST_ASSERT_EQUAL(3, m.heap().samples);
+
+    // Platforms without a low-water mark: tracked from the samples
+    MemoryMonitor n;
+    n.sampleHeap(50000, 40000, 0);
+    n.sampleHeap(60000, 40000, 0);
+    n.sampleHeap(45000, 40000, 0);
+    TEST_ASSERT_EQUAL(45000, n.heap().minFree);
+}
+
+void test_format() {
+    MemoryMonitor m;
+    m.update(MEM_TOPICS, 416, 180);
+    m.update(MEM_LOG, 3200, 200);
+    m.update(MEM_LOG, 3200, 100);
+
+    char out[256];
+    size_t len = m.formatSummary(out, sizeof(out), 9000);
+    TEST_ASSERT_EQUAL(strlen(out), len);
+    TEST_ASSERT_EQUAL_STRING("mem obj=9000 reserved=3616 used=280 peak=380", out);
+
+    m.sampleHeap(80000, 20000, 70000);
+    m.formatSummary(out, sizeof(out), 9000);
+    TEST_ASSERT_EQUAL_STRING("mem obj=9000 reserved=3616 used=280 peak=380 "
+                             "heap=80000 heap_blk=20000 heap_min=70000 frag=75 frag_max=75", out);
+
+    // Areas without storage are left out
+    m.formatAreas(out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("topics=180/416/180 log=100/3200/200", out);
+
+    // Truncated, still terminated
+    char small[16];
+    len = m.formatAreas(small, sizeof(small));
+    TEST_ASSERT_EQUAL(15, len);
+    TEST_ASSERT_EQUAL(15, strlen(small));
+
+    TEST_ASSERT_EQUAL_STRING("broker", MemoryMonitor::name(MEM_BROKER));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_usage_and_peaks);
+    RUN_TEST(test_slot_share);
+    RUN_TEST(test_heap_health);
+    RUN_TEST(test_format);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttMemory.h>
+
+espmole::MemoryMonitor memory;
+
+void setup() {
+    Serial.begin(115200);
+    memory.sampleHeap(ESP.getFreeHeap(), ESP.getFreeHeap(), 0);
+    Serial.println("MqttMemory compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,517 @@
+/**
+ * Tests for MicroBroker (embedded MQTT broker)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <MqttMicroBroker.h>
+#include <PosixBrokerServer.h>
+#include <PosixMqttClient.h>
+
+using namespace espmole;
+
+/// Records what the broker sends and closes, per client
+struct Wire {
+    std::vector<uint8_t> out[MicroBroker::MAX_CLIENTS];
+    size_t pos[MicroBroker::MAX_CLIENTS] = {};
+    bool closed[MicroBroker::MAX_CLIENTS] = {};
+    bool full = false;                  // Refuse all sends
+
+    std::vector<std::string> topics;    // Seen by the device
+    std::vector<std::string> payloads;
+
+    /// Next packet the broker sent to `client` (type 0 if none)
+    mqtt::Packet next(int client) {
+        mqtt::Packet p;
+        std::vector<uint8_t>& o = out[client];
+        int n = mqtt::parse(o.data() + pos[client], o.size() - pos[client], p);
+        if (n > 0) pos[client] += static_cast<size_t>(n);
+        else p.type = 0;
+        return p;
+    }
+};
+
+static bool onSend(int client, const uint8_t* data, size_t len, void* ctx) {
+    Wire* w = static_cast<Wire*>(ctx);
+    if (w->full) return false;
+    w->out[client].insert(w->out[client].end(), data, data + len);
+    return true;
+}
+
+static void onClose(int client, void* ctx) {
+    static_cast<Wire*>(ctx)->closed[client] = true;
+}
+
+static void onMessage(const char* topic, const uint8_t* payload, size_t len, void* ctx) {
+    Wire* w = static_cast<Wire*>(ctx);
+    w->topics.push_back(topic);
+    w->payloads.push_back(std::string(reinterpret_cast<const char*>(payload), len));
+}
+
+static void feed(MicroBroker& b, int client, const uint8_t* data, size_t len, uint32_t now = 0) {
+    b.receive(client, data, len, now);
+}
+
+static int connect(MicroBroker& b, Wire& w, const char* id, uint16_t keepAlive = 0,
+                   const char* willTopic = nullptr, const char* will = nullptr) {
+    int c = b.open(0);
+    mqtt::ConnectOptions o;
+    o.clientId = id;
+    o.keepAlive = keepAlive;
+    if (willTopic != nullptr) {
+        o.willTopic = willTopic;
+        o.willPayload = reinterpret_cast<const uint8_t*>(will);
+        o.willLen = strlen(will);
+        o.willQos = 1;
+    }
+    uint8_t buf[128];
+    feed(b, c, buf, mqtt::encodeConnect(buf, sizeof(buf), o));
+    w.next(c);  // CONNACK
+    return c;
+}
+
+static void subscribe(MicroBroker& b, int c, const char* filter, uint8_t qos,
+                      uint16_t packetId = 1) {
+    uint8_t buf[128];
+    feed(b, c, buf, mqtt::encodeSubscribe(buf, sizeof(buf), packetId, filter, qos));
+}
+
+static void publish(MicroBroker& b, int c, const char* topic, const char* payload,
+                    uint8_t qos = 0, bool retain = false, uint16_t packetId = 0) {
+    uint8_t buf[256];
+    feed(b, c, buf, mqtt::encodePublish(buf, sizeof(buf), topic, strlen(topic),
+                                        reinterpret_cast<const uint8_t*>(payload),
+                                        strlen(payload), qos, retain, packetId));
+}
+
+static bool isPublish(Wire& w, int c, const char* topic, const char* payload,
+                      uint8_t qos, bool retain) {
+    mqtt::Packet p = w.next(c);
+    mqtt::PublishView v;
+    if (!mqtt::decodePublish(p, v)) return false;
+    return v.topic.equals(topic) && v.len == strlen(payload)
+        && memcmp(v.payload, payload, v.len) == 0
+        && v.qos == qos && v.retain == retain && (qos == 0) == (v.packetId == 0);
+}
+
+void test_connect_and_refusals() {
+    MicroBroker b;
+    Wire w;
+    TEST_ASSERT_FALSE(b.running());
+    b.begin(onSend, onClose, &w);
+    TEST_ASSERT_TRUE(b.running());
+
+    int c = b.open(0);
+    TEST_ASSERT_EQUAL(0, c);
+    uint8_t buf[128];
+    mqtt::ConnectOptions o;
+    o.clientId = "ctl";
+    feed(b, c, buf, mqtt::encodeConnect(buf, sizeof(buf), o));
+
+    mqtt::Packet p = w.next(c);
+    bool session = true;
+    uint8_t code = 0xFF;
+    TEST_ASSERT_TRUE(mqtt::decodeConnack(p, session, code));
+    TEST_ASSERT_FALSE(session);
+    TEST_ASSERT_EQUAL(mqtt::CONNACK_ACCEPTED, code);
+    TEST_ASSERT_EQUAL(1, b.clients());
+
+    // Wrong protocol level: refused with a CONNACK, then closed
+    int d = b.open(0);
+    size_t n = mqtt::encodeConnect(buf, sizeof(buf), o);
+    buf[8] = 3;  // Protocol level byte after "\0\4MQTT"
+    feed(b, d, buf, n);
+    TEST_ASSERT_TRUE(mqtt::decodeConnack(w.next(d), session, code));
+    TEST_ASSERT_EQUAL(mqtt::CONNACK_BAD_PROTOCOL, code);
+    TEST_ASSERT_TRUE(w.closed[d]);
+
+    // Anything but CONNECT first is a protocol error
+    int e = b.open(0);
+    feed(b, e, buf, mqtt::encodeEmpty(buf, sizeof(buf), mqtt::PINGREQ));
+    TEST_ASSERT_TRUE(w.closed[e]);
+    TEST_ASSERT_EQUAL(1, b.stats().errors);
+
+    // Credentials
+    b.setCredentials("mole", "secret");
+    int f = b.open(0);
+    o.clientId = "other";
+    o.username = "mole";
+    o.password = "wrong";
+    feed(b, f, buf, mqtt::encodeConnect(buf, sizeof(buf), o));
+    TEST_ASSERT_TRUE(mqtt::decodeConnack(w.next(f), session, code));
+    TEST_ASSERT_EQUAL(mqtt::CONNACK_BAD_CREDENTIALS, code);
+
+    int g = b.open(0);
+    o.password = "secret";
+    feed(b, g, buf, mqtt::encodeConnect(buf, sizeof(buf), o));
+    TEST_ASSERT_TRUE(mqtt::decodeConnack(w.next(g), session, code));
+    TEST_ASSERT_EQUAL(mqtt::CONNACK_ACCEPTED, code);
+    TEST_ASSERT_EQUAL(2, b.clients());
+    TEST_ASSERT_EQUAL(2, b.stats().refused);
+}
+
+void test_routing_wildcards_and_qos() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+    b.onMessage(onMessage, &w);
+
+    int a = connect(b, w, "a");
+    int s = connect(b, w, "s");
+    int pub = connect(b, w, "pub");
+
+    subscribe(b, a, "espmole/+/cmd", 1);
+    uint8_t codes[1] = {0xFF};
+    mqtt::Packet p = w.next(a);
+    uint16_t id = 0;
+    TEST_ASSERT_TRUE(mqtt::decodePacketId(p, id));
+    TEST_ASSERT_EQUAL(mqtt::SUBACK, p.type);
+    codes[0] = p.body[2];
+    TEST_ASSERT_EQUAL(1, codes[0]);
+
+    // QoS 2 is granted as QoS 1
+    subscribe(b, s, "espmole/#", 2);
+    p = w.next(s);
+    TEST_ASSERT_EQUAL(1, p.body[2]);
+    subscribe(b, s, "espmole/#", 0);  // Same filter: replaces the QoS
+    p = w.next(s);
+    TEST_ASSERT_EQUAL(0, p.body[2]);
+
+    publish(b, pub, "espmole/kitchen-1/cmd", "status", 1, false, 7);
+    p = w.next(pub);
+    TEST_ASSERT_EQUAL(mqtt::PUBACK, p.type);
+    TEST_ASSERT_TRUE(mqtt::decodePacketId(p, id));
+    TEST_ASSERT_EQUAL(7, id);
+
+    TEST_ASSERT_TRUE(isPublish(w, a, "espmole/kitchen-1/cmd", "status", 1, false));
+    TEST_ASSERT_TRUE(isPublish(w, s, "espmole/kitchen-1/cmd", "status", 0, false));
+    TEST_ASSERT_EQUAL(0, w.next(pub).type);
+
+    // The device sees client publishes, NUL-terminated
+    TEST_ASSERT_EQUAL(1, w.topics.size());
+    TEST_ASSERT_EQUAL_STRING("espmole/kitchen-1/cmd", w.topics[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("status", w.payloads[0].c_str());
+
+    // Device publishes reach subscribers but not onMessage
+    TEST_ASSERT_TRUE(b.publish("espmole/kitchen-1/resp",
+                               reinterpret_cast<const uint8_t*>("ok"), 2, 1));
+    TEST_ASSERT_TRUE(isPublish(w, s, "espmole/kitchen-1/resp", "ok", 0, false));
+    TEST_ASSERT_EQUAL(0, w.next(a).type);
+    TEST_ASSERT_EQUAL(1, w.topics.size());
+
+    // Unsubscribed clients get nothing
+    uint8_t buf[64];
+    feed(b, s, buf, mqtt::encodeUnsubscribe(buf, sizeof(buf), 9, "espmole/#"));
+    TEST_ASSERT_EQUAL(mqtt::UNSUBACK, w.next(s).type);
+    publish(b, pub, "espmole/x/event", "boot");
+    TEST_ASSERT_EQUAL(0, w.next(s).type);
+
+    TEST_ASSERT_EQUAL(2, b.stats().received);
+    TEST_ASSERT_EQUAL(3, b.stats().delivered);
+}
+
+void test_retained_messages() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+
+    // Birth published before anyone is connected
+    TEST_ASSERT_TRUE(b.publish("espmole/dev/status",
+                               reinterpret_cast<const uint8_t*>("online"), 6, 1, true));
+
+    int c = connect(b, w, "late");
+    subscribe(b, c, "espmole/+/status", 1);
+    TEST_ASSERT_EQUAL(mqtt::SUBACK, w.next(c).type);  // SUBACK first
+    TEST_ASSERT_TRUE(isPublish(w, c, "espmole/dev/status", "online", 1, true));
+
+    // Live delivery clears the retain flag; an update replaces the value
+    b.publish("espmole/dev/status", reinterpret_cast<const uint8_t*>("busy"), 4, 0, true);
+    TEST_ASSERT_TRUE(isPublish(w, c, "espmole/dev/status", "busy", 0, false));
+
+    int d = connect(b, w, "later");
+    subscribe(b, d, "espmole/#", 0);
+    w.next(d);
+    TEST_ASSERT_TRUE(isPublish(w, d, "espmole/dev/status", "busy", 0, true));
+    TEST_ASSERT_EQUAL(0, w.next(d).type);
+
+    // Empty payload clears the retained message
+    publish(b, c, "espmole/dev/status", "", 0, true);
+    int e = connect(b, w, "last");
+    subscribe(b, e, "espmole/#", 0);
+    w.next(e);
+    TEST_ASSERT_EQUAL(0, w.next(e).type);
+
+    // Oversized payloads are not retained
+    uint8_t big[MicroBroker::RETAINED_MAX + 1];
+    memset(big, 'x', sizeof(big));
+    TEST_ASSERT_FALSE(b.publish("espmole/dev/big", big, sizeof(big), 0, true));
+}
+
+void test_will_on_loss_only() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+    b.onMessage(onMessage, &w);
+
+    int watcher = connect(b, w, "watcher");
+    subscribe(b, watcher, "ctl/+/status", 1);
+    w.next(watcher);
+
+    int c = connect(b, w, "c1", 0, "ctl/c1/status", "gone");
+    b.closed(c);
+    TEST_ASSERT_TRUE(isPublish(w, watcher, "ctl/c1/status", "gone", 1, false));
+    TEST_ASSERT_FALSE(w.closed[c]);  // The glue reported it, nothing to close
+    TEST_ASSERT_EQUAL(1, w.topics.size());
+    b.closed(c);  // Idempotent
+    TEST_ASSERT_EQUAL(1, w.topics.size());
+
+    // A clean DISCONNECT discards the will
+    int d = connect(b, w, "c2", 0, "ctl/c2/status", "gone");
+    uint8_t buf[4];
+    feed(b, d, buf, mqtt::encodeEmpty(buf, sizeof(buf), mqtt::DISCONNECT));
+    TEST_ASSERT_TRUE(w.closed[d]);
+    TEST_ASSERT_EQUAL(0, w.next(watcher).type);
+    TEST_ASSERT_EQUAL(1, b.clients());
+}
+
+void test_client_id_takeover() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+
+    int watcher = connect(b, w, "watcher");
+    subscribe(b, watcher, "ctl/#", 0);
+    w.next(watcher);
+
+    int old = connect(b, w, "ctl-1", 0, "ctl/1", "lost");
+    int fresh = connect(b, w, "ctl-1");
+    TEST_ASSERT_TRUE(w.closed[old]);
+    TEST_ASSERT_FALSE(w.closed[fresh]);
+    TEST_ASSERT_TRUE(isPublish(w, watcher, "ctl/1", "lost", 0, false));
+    TEST_ASSERT_EQUAL(2, b.clients());
+}
+
+void test_timeouts() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+
+    int silent = b.open(0);                 // Never sends CONNECT
+    int idle = connect(b, w, "idle", 10);   // 10 s keep-alive
+    int busy = connect(b, w, "busy", 10);
+
+    uint8_t ping[2];
+    size_t n = mqtt::encodeEmpty(ping, sizeof(ping), mqtt::PINGREQ);
+    feed(b, busy, ping, n, 9000);
+    TEST_ASSERT_EQUAL(mqtt::PINGRESP, w.next(busy).type);
+
+    b.poll(MicroBroker::CONNECT_TIMEOUT + 1);
+    TEST_ASSERT_TRUE(w.closed[silent]);
+    TEST_ASSERT_FALSE(w.closed[idle]);
+
+    b.poll(15001);                          // 1.5 x keep-alive
+    TEST_ASSERT_TRUE(w.closed[idle]);
+    TEST_ASSERT_FALSE(w.closed[busy]);
+    TEST_ASSERT_EQUAL(2, b.stats().timeouts);
+
+    // Slots are reused
+    TEST_ASSERT_TRUE(b.open(15001) >= 0);
+}
+
+void test_framing_and_protocol_errors() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+    b.onMessage(onMessage, &w);
+
+    // CONNECT + PUBLISH arrive byte by byte, then coalesced
+    int c = b.open(0);
+    uint8_t buf[256];
+    mqtt::ConnectOptions o;
+    o.clientId = "frag";
+    size_t n = mqtt::encodeConnect(buf, sizeof(buf), o);
+    n += mqtt::encodePublish(buf + n, sizeof(buf) - n, "a/b", 3,
+                             reinterpret_cast<const uint8_t*>("1"), 1, 0, false, 0);
+    for (size_t i = 0; i < n; i++) feed(b, c, buf + i, 1);
+    TEST_ASSERT_EQUAL(mqtt::CONNACK, w.next(c).type);
+    size_t m = mqtt::encodePublish(buf, sizeof(buf), "a/b", 3,
+                                   reinterpret_cast<const uint8_t*>("2"), 1, 0, false, 0);
+    memcpy(buf + m, buf, m);
+    feed(b, c, buf, 2 * m);
+    TEST_ASSERT_EQUAL(3, w.topics.size());
+    TEST_ASSERT_EQUAL_STRING("2", w.payloads[2].c_str());
+
+    // Bad filters are refused per filter, the session stays
+    subscribe(b, c, "a/#/b", 0);
+    mqtt::Packet p = w.next(c);
+    TEST_ASSERT_EQUAL(mqtt::SUBACK, p.type);
+    TEST_ASSERT_EQUAL(0x80, p.body[2]);
+    subscribe(b, c, "a+/b", 0);
+    TEST_ASSERT_EQUAL(0x80, w.next(c).body[2]);
+
+    // Subscription table full
+    char filter[16];
+    for (size_t i = 0; i < MicroBroker::MAX_SUBS; i++) {
+        snprintf(filter, sizeof(filter), "f/%u", static_cast<unsigned>(i));
+        subscribe(b, c, filter, 0);
+        TEST_ASSERT_EQUAL(0, w.next(c).body[2]);
+    }
+    subscribe(b, c, "f/extra", 0);
+    TEST_ASSERT_EQUAL(0x80, w.next(c).body[2]);
+    TEST_ASSERT_FALSE(w.closed[c]);
+
+    // Wildcards in a publish topic close the connection
+    publish(b, c, "a/+", "x");
+    TEST_ASSERT_TRUE(w.closed[c]);
+
+    // So does QoS 2
+    int d = connect(b, w, "q2");
+    publish(b, d, "a/b", "x", 2, false, 1);
+    TEST_ASSERT_TRUE(w.closed[d]);
+
+    // And a packet larger than the receive buffer
+    int e = connect(b, w, "big");
+    std::vector<uint8_t> big(MicroBroker::PACKET_MAX + 64);
+    std::vector<uint8_t> payload(MicroBroker::PACKET_MAX, 'x');
+    n = mqtt::encodePublish(big.data(), big.size(), "a/b", 3, payload.data(), payload.size(),
+                            0, false, 0);
+    TEST_ASSERT_TRUE(n > MicroBroker::PACKET_MAX);
+    feed(b, e, big.data(), n);
+    TEST_ASSERT_TRUE(w.closed[e]);
+    TEST_ASSERT_EQUAL(3, b.stats().errors);
+}
+
+void test_slow_connection_drops() {
+    MicroBroker b;
+    Wire w;
+    b.begin(onSend, onClose, &w);
+
+    int c = connect(b, w, "slow");
+    subscribe(b, c, "#", 0);
+    w.next(c);
+
+    w.full = true;
+    TEST_ASSERT_TRUE(b.publish("x", reinterpret_cast<const uint8_t*>("1"), 1));
+    TEST_ASSERT_EQUAL(1, b.stats().dropped);
+    TEST_ASSERT_EQUAL(0, b.stats().delivered);
+    TEST_ASSERT_FALSE(w.closed[c]);
+}
+
+// -----------------------------------------------------------------------------
+// Over sockets, with the host-side client
+// -----------------------------------------------------------------------------
+
+struct Received {
+    std::string topic;
+    std::string payload;
+    bool retain = false;
+};
+
+static void onReceived(const mqtt::PublishView& msg, void* ctx) {
+    Received* r = static_cast<Received*>(ctx);
+    r->topic.assign(msg.topic.data, msg.topic.len);
+    r->payload.assign(reinterpret_cast<const char*>(msg.payload), msg.len);
+    r->retain = msg.retain;
+}
+
+void test_posix_server_end_to_end() {
+    MicroBroker b;
+    PosixBrokerServer server(b);
+    Wire w;
+    b.onMessage(onMessage, &w);
+    b.publish("espmole/dev/status", reinterpret_cast<const uint8_t*>("online"), 6, 1, true);
+
+    int sub[2], pub[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sub));
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pub));
+    TEST_ASSERT_TRUE(server.adopt(sub[0]));
+    TEST_ASSERT_TRUE(server.adopt(pub[0]));
+
+    std::atomic<bool> stop(false);
+    std::thread loop([&] {
+        while (!stop) server.loop(10);
+    });
+
+    PosixMqttClient subscriber, publisher;
+    Received r;
+    subscriber.onMessage(onReceived, &r);
+    mqtt::ConnectOptions o;
+    o.clientId = "sub";
+    TEST_ASSERT_TRUE(subscriber.connectFd(sub[1], o, 2000));
+    TEST_ASSERT_TRUE(subscriber.subscribe("espmole/#", 1, 2000));
+
+    o.clientId = "pub";
+    TEST_ASSERT_TRUE(publisher.connectFd(pub[1], o, 2000));
+
+    // Retained birth first
+    for (int i = 0; i < 100 && r.topic.empty(); i++) subscriber.loop(20);
+    bool birth = r.topic == "espmole/dev/status" && r.payload == "online" && r.retain;
+
+    r.topic.clear();
+    publisher.publish("espmole/dev/cmd", reinterpret_cast<const uint8_t*>("status"), 6, 1);
+    for (int i = 0; i < 100 && r.topic.empty(); i++) subscriber.loop(20);
+    for (int i = 0; i < 100 && publisher.pubacks() == 0; i++) publisher.loop(20);
+    bool live = r.topic == "espmole/dev/cmd" && r.payload == "status" && !r.retain;
+    uint32_t pubacks = publisher.pubacks();
+
+    subscriber.close();
+    publisher.close();
+    for (int i = 0; i < 100 && b.clients() > 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stop = true;
+    loop.join();
+
+    TEST_ASSERT_TRUE(birth);
+    TEST_ASSERT_TRUE(live);
+    TEST_ASSERT_EQUAL(1, pubacks);
+    TEST_ASSERT_EQUAL(1, w.topics.size());
+    TEST_ASSERT_EQUAL(0, b.clients());
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_connect_and_refusals);
+    RUN_TEST(test_routing_wildcards_and_qos);
+    RUN_TEST(test_retained_messages);
+    RUN_TEST(test_will_on_loss_only);
+    RUN_TEST(test_client_id_takeover);
+    RUN_TEST(test_timeouts);
+    RUN_TEST(test_framing_and_protocol_errors);
+    RUN_TEST(test_slow_connection_drops);
+    RUN_TEST(test_posix_server_end_to_end);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttMicroBroker.h>
+
+void setup() {
+    Serial.begin(115200);
+    espmole::MicroBroker* broker = new espmole::MicroBroker();
+    Serial.println(broker->clients() == 0 ? "MqttMicroBroker compile test passed" : "failed");
+    delete broker;
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
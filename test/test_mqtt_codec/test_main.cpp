@@ -0,0 +1,197 @@
+/**
+ * Tests for the MQTT 3.1.1 packet codec
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttCodec.h>
+
+using namespace espmole;
+
+static bool matches(const char* filter, const char* topic) {
+    return mqtt::topicMatches(filter, strlen(filter), topic, strlen(topic));
+}
+
+void test_connect_roundtrip() {
+    mqtt::ConnectOptions o;
+    o.clientId = "dev1";
+    o.username = "user";
+    o.password = "secret";
+    o.willTopic = "espmole/dev1/status";
+    o.willPayload = reinterpret_cast<const uint8_t*>("offline");
+    o.willLen = 7;
+    o.willQos = 1;
+    o.willRetain = true;
+    o.keepAlive = 30;
+    
+    uint8_t buf[128];
+    size_t len = mqtt::encodeConnect(buf, sizeof(buf), o);
+    TEST_ASSERT_TRUE(len > 0);
+    
+    mqtt::Packet p;
+    TEST_ASSERT_EQUAL(static_cast<int>(len), mqtt::parse(buf, len, p));
+    TEST_ASSERT_EQUAL(mqtt::CONNECT, p.type);
+    
+    mqtt::ConnectView v;
+    TEST_ASSERT_TRUE(mqtt::decodeConnect(p, v));
+    TEST_ASSERT_EQUAL(4, v.protocolLevel);
+    TEST_ASSERT_EQUAL(30, v.keepAlive);
+    TEST_ASSERT_TRUE(v.clientId.equals("dev1"));
+    TEST_ASSERT_TRUE(v.username.equals("user"));
+    TEST_ASSERT_TRUE(v.password.equals("secret"));
+    TEST_ASSERT_TRUE(v.hasWill);
+    TEST_ASSERT_TRUE(v.willTopic.equals("espmole/dev1/status"));
+    TEST_ASSERT_TRUE(v.willPayload.equals("offline"));
+    TEST_ASSERT_EQUAL(1, v.willQos);
+    TEST_ASSERT_TRUE(v.willRetain);
+}
+
+void test_publish_roundtrip_qos1() {
+    uint8_t buf[64];
+    const char* topic = "espmole/dev1/cmd";
+    size_t len = mqtt::encodePublish(buf, sizeof(buf), topic, strlen(topic),
+                                     reinterpret_cast<const uint8_t*>("ping"), 4,
+                                     1, true, 0x1234);
+    
+    mqtt::Packet p;
+    TEST_ASSERT_EQUAL(static_cast<int>(len), mqtt::parse(buf, len, p));
+    
+    mqtt::PublishView v;
+    TEST_ASSERT_TRUE(mqtt::decodePublish(p, v));
+    TEST_ASSERT_TRUE(v.topic.equals(topic));
+    TEST_ASSERT_EQUAL(1, v.qos);
+    TEST_ASSERT_TRUE(v.retain);
+    TEST_ASSERT_EQUAL(0x1234, v.packetId);
+    TEST_ASSERT_EQUAL(4, v.len);
+    TEST_ASSERT_EQUAL_MEMORY("ping", v.payload, 4);
+}
+
+void test_parse_needs_complete_packet() {
+    uint8_t buf[64];
+    size_t len = mqtt::encodePublish(buf, sizeof(buf), "a/b", 3,
+                                     reinterpret_cast<const uint8_t*>("x"), 1, 0, false, 0);
+    mqtt::Packet p;
+    for (size_t i = 0; i < len; i++) {
+        TEST_ASSERT_EQUAL(0, mqtt::parse(buf, i, p));
+    }
+    TEST_ASSERT_EQUAL(static_cast<int>(len), mqtt::parse(buf, len, p));
+}
+
+void test_remaining_length_multibyte() {
+    static uint8_t payload[300];
+    static uint8_t buf[400];
+    size_t len = mqtt::encodePublish(buf, sizeof(buf), "t", 1, payload, sizeof(payload), 0, false, 0);
+    TEST_ASSERT_EQUAL(1 + 2 + 2 + 1 + 300, len);
+    
+    mqtt::Packet p;
+    TEST_ASSERT_EQUAL(static_cast<int>(len), mqtt::parse(buf, len, p));
+    TEST_ASSERT_EQUAL(2 + 1 + 300, p.len);
+}
+
+void test_encode_reports_overflow() {
+    uint8_t buf[8];
+    TEST_ASSERT_EQUAL(0, mqtt::encodePublish(buf, sizeof(buf), "espmole/x", 9,
+                                             reinterpret_cast<const uint8_t*>("payload"), 7,
+                                             0, false, 0));
+}
+
+void test_malformed_packets_rejected() {
+    const uint8_t badLength[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    const uint8_t badType[] = {0x00, 0x00};
+    mqtt::Packet p;
+    TEST_ASSERT_EQUAL(-1, mqtt::parse(badLength, sizeof(badLength), p));
+    TEST_ASSERT_EQUAL(-1, mqtt::parse(badType, sizeof(badType), p));
+}
+
+void test_subscribe_roundtrip() {
+    uint8_t buf[64];
+    size_t len = mqtt::encodeSubscribe(buf, sizeof(buf), 7, "espmole/+/status", 1);
+    
+    mqtt::Packet p;
+    TEST_ASSERT_EQUAL(static_cast<int>(len), mqtt::parse(buf, len, p));
+    
+    mqtt::TopicListView v;
+    TEST_ASSERT_TRUE(mqtt::decodeSubscribe(p, v));
+    TEST_ASSERT_EQUAL(7, v.packetId);
+    
+    mqtt::StringView filter;
+    uint8_t qos = 0;
+    TEST_ASSERT_TRUE(v.next(filter, qos));
+    TEST_ASSERT_TRUE(filter.equals("espmole/+/status"));
+    TEST_ASSERT_EQUAL(1, qos);
+    TEST_ASSERT_FALSE(v.next(filter, qos));
+}
+
+void test_acks() {
+    uint8_t buf[8];
+    size_t len = mqtt::encodeAck(buf, sizeof(buf), mqtt::PUBACK, 99);
+    mqtt::Packet p;
+    TEST_ASSERT_EQUAL(4, mqtt::parse(buf, len, p));
+    uint16_t id = 0;
+    TEST_ASSERT_TRUE(mqtt::decodePacketId(p, id));
+    TEST_ASSERT_EQUAL(99, id);
+    
+    len = mqtt::encodeConnack(buf, sizeof(buf), false, mqtt::CONNACK_ACCEPTED);
+    mqtt::parse(buf, len, p);
+    bool session = true;
+    uint8_t code = 0xFF;
+    TEST_ASSERT_TRUE(mqtt::decodeConnack(p, session, code));
+    TEST_ASSERT_FALSE(session);
+    TEST_ASSERT_EQUAL(0, code);
+}
+
+void test_topic_wildcards() {
+    TEST_ASSERT_TRUE(matches("espmole/+/status", "espmole/dev1/status"));
+    TEST_ASSERT_FALSE(matches("espmole/+/status", "espmole/dev1/cmd"));
+    TEST_ASSERT_FALSE(matches("espmole/+/status", "espmole/a/b/status"));
+    TEST_ASSERT_TRUE(matches("espmole/#", "espmole/dev1/cmd"));
+    TEST_ASSERT_TRUE(matches("espmole/#", "espmole"));
+    TEST_ASSERT_TRUE(matches("#", "anything/at/all"));
+    TEST_ASSERT_TRUE(matches("a/+/c", "a//c"));
+    TEST_ASSERT_FALSE(matches("a/b", "a/bc"));
+    TEST_ASSERT_FALSE(matches("a/bc", "a/b"));
+    TEST_ASSERT_FALSE(matches("a/b", "a"));
+    TEST_ASSERT_FALSE(matches("#", "$SYS/broker/uptime"));
+    TEST_ASSERT_TRUE(matches("$SYS/#", "$SYS/broker/uptime"));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_connect_roundtrip);
+    RUN_TEST(test_publish_roundtrip_qos1);
+    RUN_TEST(test_parse_needs_complete_packet);
+    RUN_TEST(test_remaining_length_multibyte);
+    RUN_TEST(test_encode_reports_overflow);
+    RUN_TEST(test_malformed_packets_rejected);
+    RUN_TEST(test_subscribe_roundtrip);
+    RUN_TEST(test_acks);
+    RUN_TEST(test_topic_wildcards);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttCodec.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttCodec compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
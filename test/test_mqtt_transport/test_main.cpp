@@ -10,7 +10,7 @@
 #include <unity.h>
 #include <string.h>
 
-// Note: MqttTransport is disabled for NATIVE_BUILD
+// Note: MqttTransport itself runs natively in test_alloc, against test/stubs
 // These tests are for the logic that can be tested without hardware
 
 void test_topic_structure() {
@@ -0,0 +1,260 @@
+/**
+ * Tests for the $probe reply format and LatencyHistogram
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <MqttProbe.h>
+#include <FleetProbe.h>
+
+using namespace espmole;
+
+static mqtt::PublishView message(const char* topic, const char* payload) {
+    mqtt::PublishView v;
+    v.topic.data = topic;
+    v.topic.len = strlen(topic);
+    v.payload = reinterpret_cast<const uint8_t*>(payload);
+    v.len = strlen(payload);
+    return v;
+}
+
+static std::vector<std::string> sent;
+
+static bool recordSend(const char* topic, const char* payload, void* ctx) {
+    (void)ctx;
+    sent.push_back(std::string(topic) + " " + payload);
+    return true;
+}
+
+void test_reply_round_trip() {
+    ProbeSnapshot s;
+    s.rxUs = 1000;
+    s.txUs = 1180;
+    s.uptimeMs = 60000;
+    s.inflight = 2;
+    s.window = 8;
+    s.batchBytes = 96;
+    s.logLines = 3;
+    s.mailbox = 0;
+    s.heapFree = 180000;
+
+    char out[192];
+    size_t len = formatProbeReply(out, sizeof(out), "a17", 3, s);
+    TEST_ASSERT_EQUAL(strlen(out), len);
+    TEST_ASSERT_EQUAL_STRING("probe a17 rx=1000 tx=1180 up=60000 inflight=2/8 batch=96 "
+                             "log=3 mail=0 heap=180000", out);
+
+    ProbeReply r;
+    TEST_ASSERT_TRUE(parseProbeReply(out, len, r));
+    TEST_ASSERT_EQUAL(3, r.tokenLen);
+    TEST_ASSERT_EQUAL(0, strncmp(r.token, "a17", 3));
+    TEST_ASSERT_EQUAL(180, r.snapshot.deviceUs());
+    TEST_ASSERT_EQUAL(60000, r.snapshot.uptimeMs);
+    TEST_ASSERT_EQUAL(2, r.snapshot.inflight);
+    TEST_ASSERT_EQUAL(8, r.snapshot.window);
+    TEST_ASSERT_EQUAL(96, r.snapshot.batchBytes);
+    TEST_ASSERT_EQUAL(3, r.snapshot.logLines);
+    TEST_ASSERT_EQUAL(0, r.snapshot.mailbox);
+    TEST_ASSERT_EQUAL(180000, r.snapshot.heapFree);
+}
+
+void test_reply_optional_keys() {
+    // A build without log stream, mailbox and heap sampling
+    ProbeSnapshot s;
+    s.rxUs = 4294967000UL;      // micros() wraps between rx and tx
+    s.txUs = 200;
+    char out[192];
+    formatProbeReply(out, sizeof(out), "", 0, s);
+    TEST_ASSERT_EQUAL_STRING("probe  rx=4294967000 tx=200 up=0 inflight=0/0 batch=0", out);
+
+    ProbeReply r;
+    TEST_ASSERT_TRUE(parseProbeReply(out, strlen(out), r));
+    TEST_ASSERT_EQUAL(0, r.tokenLen);
+    TEST_ASSERT_EQUAL(496, r.snapshot.deviceUs());
+    TEST_ASSERT_EQUAL(-1, r.snapshot.logLines);
+    TEST_ASSERT_EQUAL(-1, r.snapshot.mailbox);
+    TEST_ASSERT_EQUAL(-1, r.snapshot.heapFree);
+
+    // Long tokens are cut
+    char token[64];
+    memset(token, 'x', sizeof(token));
+    formatProbeReply(out, sizeof(out), token, sizeof(token), s);
+    TEST_ASSERT_TRUE(parseProbeReply(out, strlen(out), r));
+    TEST_ASSERT_EQUAL(PROBE_TOKEN_MAX, r.tokenLen);
+}
+
+void test_reply_rejects_and_skips() {
+    ProbeReply r;
+    const char* other = "ok temp=21.5";
+    TEST_ASSERT_FALSE(parseProbeReply(other, strlen(other), r));
+
+    const char* noTimes = "probe 7 up=5";
+    TEST_ASSERT_FALSE(parseProbeReply(noTimes, strlen(noTimes), r));
+
+    // Keys from a newer device are skipped
+    const char* newer = "probe 7 rx=10 cpu=42/80 tx=25 q=x";
+    TEST_ASSERT_TRUE(parseProbeReply(newer, strlen(newer), r));
+    TEST_ASSERT_EQUAL(15, r.snapshot.deviceUs());
+
+    // Only len bytes are read
+    const char* longer = "probe 7 rx=10 tx=25999";
+    TEST_ASSERT_TRUE(parseProbeReply(longer, strlen(longer) - 3, r));
+    TEST_ASSERT_EQUAL(15, r.snapshot.deviceUs());
+}
+
+void test_histogram_buckets() {
+    TEST_ASSERT_EQUAL(0, LatencyHistogram::bucketOf(0));
+    TEST_ASSERT_EQUAL(3, LatencyHistogram::bucketOf(3));
+    TEST_ASSERT_EQUAL(4, LatencyHistogram::bucketOf(4));
+    TEST_ASSERT_EQUAL(LatencyHistogram::BUCKETS - 1, LatencyHistogram::bucketOf(UINT32_MAX));
+
+    // Every value lands in the bucket whose range holds it
+    const uint32_t values[] = {1, 5, 7, 8, 100, 1000, 1023, 1024, 65535, 1000000, 3000000000UL};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        size_t b = LatencyHistogram::bucketOf(values[i]);
+        TEST_ASSERT_TRUE(LatencyHistogram::bucketLow(b) <= values[i]);
+        TEST_ASSERT_TRUE(values[i] < LatencyHistogram::bucketLow(b + 1));
+    }
+}
+
+void test_histogram_percentiles() {
+    LatencyHistogram h;
+    TEST_ASSERT_EQUAL(0, h.percentile(50));
+
+    for (uint32_t us = 1; us <= 1000; us++) {
+        h.add(us * 10);
+    }
+    TEST_ASSERT_EQUAL(1000, h.count());
+    TEST_ASSERT_EQUAL(10, h.min());
+    TEST_ASSERT_EQUAL(10000, h.max());
+    TEST_ASSERT_EQUAL(5005, h.mean());
+
+    // Within 12.5% of the exact value
+    uint32_t p50 = h.percentile(50);
+    uint32_t p99 = h.percentile(99);
+    TEST_ASSERT_TRUE(p50 >= 5000 * 7 / 8 && p50 <= 5000 * 9 / 8);
+    TEST_ASSERT_TRUE(p99 >= 9900 * 7 / 8 && p99 <= 9900 * 9 / 8);
+    TEST_ASSERT_EQUAL(10, h.percentile(0));
+    TEST_ASSERT_EQUAL(10000, h.percentile(100));
+
+    // Fleet view
+    LatencyHistogram slow;
+    for (int i = 0; i < 1000; i++) {
+        slow.add(200000);
+    }
+    LatencyHistogram fleet;
+    fleet.merge(h);
+    fleet.merge(slow);
+    TEST_ASSERT_EQUAL(2000, fleet.count());
+    TEST_ASSERT_EQUAL(10, fleet.min());
+    TEST_ASSERT_EQUAL(200000, fleet.max());
+    TEST_ASSERT_EQUAL(200000, fleet.percentile(90));
+
+    fleet.reset();
+    TEST_ASSERT_EQUAL(0, fleet.count());
+    TEST_ASSERT_EQUAL(0, fleet.bucket(LatencyHistogram::bucketOf(200000)));
+}
+
+void test_fleet_discovery() {
+    FleetProbe probe("home");
+    TEST_ASSERT_EQUAL_STRING("home/+/resp", probe.replyFilter());
+    TEST_ASSERT_EQUAL_STRING("home/+/status", probe.statusFilter());
+
+    TEST_ASSERT_TRUE(probe.onStatus(message("home/a/status", "online caps=qos1,probe,mem")));
+    TEST_ASSERT_TRUE(probe.onStatus(message("home/b/status", "online")));      // No caps announced
+    TEST_ASSERT_FALSE(probe.onStatus(message("home/c/status", "online caps=qos1,probes")));
+    TEST_ASSERT_FALSE(probe.onStatus(message("home/d/status", "offline")));
+    TEST_ASSERT_FALSE(probe.onStatus(message("home/e/x/status", "online")));
+    TEST_ASSERT_FALSE(probe.onStatus(message("espmole/f/status", "online")));
+    TEST_ASSERT_FALSE(probe.onStatus(message("home/a/status", "online caps=probe")));   // Known
+    TEST_ASSERT_EQUAL(2, probe.devices());
+}
+
+void test_fleet_rounds() {
+    FleetProbe probe;
+    probe.add("a");
+    probe.add("b");
+
+    sent.clear();
+    TEST_ASSERT_EQUAL(2, probe.startRound(1000, recordSend, nullptr));
+    TEST_ASSERT_EQUAL_STRING("espmole/a/cmd $probe 1", sent[0].c_str());
+
+    // a answers after 5 ms, 2 ms of which on the device
+    TEST_ASSERT_TRUE(probe.onReply(message("espmole/a/resp", "probe 1 rx=100 tx=2100 inflight=3/8 batch=40"),
+                                   6000));
+    TEST_ASSERT_FALSE(probe.onReply(message("espmole/a/resp", "ok"), 6000));
+    TEST_ASSERT_EQUAL(1, probe.expire(7000, 10000));
+
+    // b does not answer in time
+    TEST_ASSERT_EQUAL(0, probe.expire(11000, 10000));
+    TEST_ASSERT_EQUAL(2, probe.startRound(20000, recordSend, nullptr));
+
+    // b's answer to round 1 arrives during round 2: late, not a fast round 2
+    probe.onReply(message("espmole/b/resp", "probe 1 rx=0 tx=10"), 21000);
+    TEST_ASSERT_EQUAL(2, probe.expire(21000, 10000));
+
+    const DeviceProbeStats& a = probe.stats().at("a");
+    TEST_ASSERT_EQUAL(1, a.received);
+    TEST_ASSERT_EQUAL(5000, a.rtt.max());
+    TEST_ASSERT_EQUAL(2000, a.device.max());
+    TEST_ASSERT_EQUAL(3000, a.network.max());
+    TEST_ASSERT_EQUAL(3, a.maxInflight);
+    TEST_ASSERT_EQUAL(40, a.maxBatch);
+    TEST_ASSERT_EQUAL(-1, a.minHeap);
+
+    DeviceProbeStats f = probe.fleet();
+    TEST_ASSERT_EQUAL(4, f.sent);
+    TEST_ASSERT_EQUAL(1, f.received);
+    TEST_ASSERT_EQUAL(1, f.lost);
+    TEST_ASSERT_EQUAL(1, f.late);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reply_round_trip);
+    RUN_TEST(test_reply_optional_keys);
+    RUN_TEST(test_reply_rejects_and_skips);
+    RUN_TEST(test_histogram_buckets);
+    RUN_TEST(test_histogram_percentiles);
+    RUN_TEST(test_fleet_discovery);
+    RUN_TEST(test_fleet_rounds);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttProbe.h>
+
+espmole::LatencyHistogram histogram;
+
+void setup() {
+    Serial.begin(115200);
+    espmole::ProbeSnapshot s;
+    s.rxUs = micros();
+    s.txUs = micros();
+    char out[128];
+    espmole::formatProbeReply(out, sizeof(out), "1", 1, s);
+    histogram.add(s.deviceUs());
+    Serial.println(out);
+    Serial.println("MqttProbe compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,283 @@
+/**
+ * Tests for TimerWheel and QueryScheduler ($sched queries)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttSchedule.h>
+
+using espmole::TimerWheel;
+using espmole::QueryScheduler;
+using espmole::ScheduledQuery;
+
+static uint8_t addQuery(QueryScheduler& s, bool watch, uint32_t interval,
+                        const char* cmd, uint32_t lease, uint32_t now) {
+    return s.add(watch, interval, cmd, strlen(cmd), lease, now);
+}
+
+void test_wheel_fires_after_delay() {
+    TimerWheel w;
+    w.arm(0, 200, 1000);
+    
+    TEST_ASSERT_EQUAL(0, w.advance(1150));
+    TEST_ASSERT_EQUAL(1, w.advance(1200));
+    TEST_ASSERT_FALSE(w.armed(0));
+}
+
+void test_wheel_handles_multiple_rounds() {
+    TimerWheel w;
+    uint32_t revolution = TimerWheel::SLOTS * TimerWheel::TICK_MS;
+    w.arm(1, revolution * 3 + 100, 0);
+    
+    uint32_t fired = 0;
+    uint32_t now = 0;
+    while (fired == 0 && now < revolution * 5) {
+        now += TimerWheel::TICK_MS;
+        fired = w.advance(now);
+    }
+    TEST_ASSERT_EQUAL(1u << 1, fired);
+    TEST_ASSERT_EQUAL(revolution * 3 + 100, now);
+}
+
+void test_wheel_long_delay_does_not_wrap() {
+    // 40 h is more revolutions than a 16-bit round counter holds
+    TimerWheel w;
+    const uint32_t delay = 40UL * 3600 * 1000;
+    w.arm(0, delay, 0);
+    
+    uint32_t fired = 0;
+    uint32_t now = 0;
+    while (fired == 0 && now < delay + 1000) {
+        now += TimerWheel::TICK_MS;
+        fired = w.advance(now);
+    }
+    TEST_ASSERT_EQUAL(1, fired);
+    TEST_ASSERT_EQUAL_UINT32(delay, now);
+}
+
+void test_wheel_disarm() {
+    TimerWheel w;
+    w.arm(0, 100, 0);
+    w.arm(1, 100, 0);
+    w.disarm(0);
+    TEST_ASSERT_EQUAL(1u << 1, w.advance(100));
+}
+
+void test_wheel_stall_does_not_burst() {
+    TimerWheel w;
+    w.arm(0, 100, 0);
+    // A long stall fires the timer once instead of replaying every tick
+    TEST_ASSERT_EQUAL(1, w.advance(60000));
+    TEST_ASSERT_EQUAL(0, w.advance(60050));
+}
+
+void test_scheduler_runs_every_interval() {
+    QueryScheduler s;
+    uint8_t id = addQuery(s, false, 500, "ping", 60000, 0);
+    TEST_ASSERT_EQUAL(1, id);
+    
+    QueryScheduler::Due due;
+    TEST_ASSERT_FALSE(s.poll(450, due));
+    TEST_ASSERT_TRUE(s.poll(500, due));
+    TEST_ASSERT_EQUAL(id, due.id);
+    TEST_ASSERT_FALSE(due.expired);
+    TEST_ASSERT_FALSE(s.poll(600, due));
+    TEST_ASSERT_TRUE(s.poll(1000, due));
+}
+
+void test_scheduler_lease_expires() {
+    QueryScheduler s;
+    uint8_t id = addQuery(s, false, 1000, "ping", 2500, 0);
+    
+    QueryScheduler::Due due;
+    TEST_ASSERT_TRUE(s.poll(1000, due));
+    TEST_ASSERT_TRUE(s.poll(2000, due));
+    TEST_ASSERT_FALSE(due.expired);
+    TEST_ASSERT_TRUE(s.poll(3000, due));
+    TEST_ASSERT_TRUE(due.expired);
+    TEST_ASSERT_EQUAL(id, due.id);
+    TEST_ASSERT_NULL(s.get(id));
+}
+
+void test_scheduler_renew_extends_lease() {
+    QueryScheduler s;
+    uint8_t id = addQuery(s, false, 1000, "ping", 2500, 0);
+    
+    QueryScheduler::Due due;
+    s.poll(1000, due);
+    s.poll(2000, due);
+    TEST_ASSERT_TRUE(s.renew(id, 2000));
+    TEST_ASSERT_TRUE(s.poll(3000, due));
+    TEST_ASSERT_FALSE(due.expired);
+}
+
+void test_scheduler_watch_publishes_on_change_only() {
+    QueryScheduler s;
+    uint8_t id = addQuery(s, true, 1000, "temp", 60000, 0);
+    const uint8_t a[] = "21.5";
+    const uint8_t b[] = "22.0";
+    
+    TEST_ASSERT_TRUE(s.noteResult(id, a, 4));
+    TEST_ASSERT_FALSE(s.noteResult(id, a, 4));
+    TEST_ASSERT_TRUE(s.noteResult(id, b, 4));
+}
+
+void test_scheduler_every_always_publishes() {
+    QueryScheduler s;
+    uint8_t id = addQuery(s, false, 1000, "ping", 60000, 0);
+    const uint8_t a[] = "pong";
+    
+    TEST_ASSERT_TRUE(s.noteResult(id, a, 4));
+    TEST_ASSERT_TRUE(s.noteResult(id, a, 4));
+}
+
+void test_scheduler_table_full_and_cancel() {
+    QueryScheduler s;
+    for (size_t i = 0; i < QueryScheduler::MAX_QUERIES; i++) {
+        TEST_ASSERT_TRUE(addQuery(s, false, 1000, "ping", 60000, 0) != 0);
+    }
+    TEST_ASSERT_EQUAL(0, addQuery(s, false, 1000, "ping", 60000, 0));
+    
+    TEST_ASSERT_TRUE(s.cancel(2));
+    TEST_ASSERT_FALSE(s.cancel(2));
+    TEST_ASSERT_EQUAL(2, addQuery(s, false, 1000, "ping", 60000, 0));
+}
+
+void test_scheduler_rejects_long_command() {
+    QueryScheduler s;
+    char cmd[QueryScheduler::COMMAND_MAX + 1];
+    memset(cmd, 'x', sizeof(cmd) - 1);
+    cmd[sizeof(cmd) - 1] = '\0';
+    TEST_ASSERT_EQUAL(0, addQuery(s, false, 1000, cmd, 60000, 0));
+}
+
+void test_scheduler_clamps_interval() {
+    QueryScheduler s;
+    uint8_t id = addQuery(s, false, 1, "ping", 60000, 0);
+    TEST_ASSERT_EQUAL(QueryScheduler::MIN_INTERVAL, s.get(id)->interval);
+}
+
+void test_state_query_runs_soon_and_never_expires() {
+    QueryScheduler s;
+    const char* cmd = "config get";
+    uint8_t id = s.add(true, 60000, cmd, strlen(cmd), 0, 0, true);
+    TEST_ASSERT_TRUE(s.get(id)->state);
+    
+    // First value shortly after registration, not after a whole interval
+    QueryScheduler::Due due;
+    TEST_ASSERT_TRUE(s.poll(QueryScheduler::MIN_INTERVAL, due));
+    TEST_ASSERT_FALSE(due.expired);
+    
+    // No lease: still there long after any lease would have run out
+    int runs = 0;
+    for (uint32_t t = 150; t <= 600200; t += TimerWheel::TICK_MS) {
+        while (s.poll(t, due)) {
+            TEST_ASSERT_FALSE(due.expired);
+            runs++;
+        }
+    }
+    TEST_ASSERT_EQUAL(10, runs);
+    TEST_ASSERT_NOT_NULL(s.get(id));
+}
+
+void test_state_query_expiry_keeps_command() {
+    QueryScheduler s;
+    const char* cmd = "sensors";
+    uint8_t id = s.add(true, 1000, cmd, strlen(cmd), 1500, 0, true);
+    
+    QueryScheduler::Due due;
+    TEST_ASSERT_TRUE(s.poll(QueryScheduler::MIN_INTERVAL, due));
+    TEST_ASSERT_TRUE(s.poll(1100, due));
+    TEST_ASSERT_FALSE(due.expired);
+    TEST_ASSERT_TRUE(s.poll(2100, due));
+    TEST_ASSERT_TRUE(due.expired);
+    TEST_ASSERT_TRUE(due.state);
+    TEST_ASSERT_EQUAL_STRING("sensors", due.command);     // To clear state/sensors
+    TEST_ASSERT_NULL(s.get(id));
+}
+
+void test_state_forget_republishes() {
+    QueryScheduler s;
+    uint8_t a = addQuery(s, true, 1000, "version", 60000, 0);
+    uint8_t b = addQuery(s, true, 1000, "sensors", 60000, 0);
+    const uint8_t v[] = "1.2.0";
+    
+    TEST_ASSERT_TRUE(s.noteResult(a, v, 5));
+    TEST_ASSERT_TRUE(s.noteResult(b, v, 5));
+    TEST_ASSERT_FALSE(s.noteResult(a, v, 5));
+    
+    s.forget(a);
+    TEST_ASSERT_TRUE(s.noteResult(a, v, 5));
+    TEST_ASSERT_FALSE(s.noteResult(b, v, 5));
+    
+    // After a reconnect every value is published again
+    s.forget(0);
+    TEST_ASSERT_TRUE(s.noteResult(a, v, 5));
+    TEST_ASSERT_TRUE(s.noteResult(b, v, 5));
+}
+
+void test_state_leaf() {
+    char out[32];
+    TEST_ASSERT_EQUAL(7, QueryScheduler::stateLeaf(out, sizeof(out), "version"));
+    TEST_ASSERT_EQUAL_STRING("version", out);
+    
+    QueryScheduler::stateLeaf(out, sizeof(out), "  config   get wifi ");
+    TEST_ASSERT_EQUAL_STRING("config/get/wifi", out);
+    
+    // No wildcards or empty levels in a topic
+    QueryScheduler::stateLeaf(out, sizeof(out), "gpio +1 a/b #");
+    TEST_ASSERT_EQUAL_STRING("gpio/_1/a_b/_", out);
+    
+    TEST_ASSERT_EQUAL(0, QueryScheduler::stateLeaf(out, sizeof(out), "   "));
+    TEST_ASSERT_EQUAL(0, QueryScheduler::stateLeaf(out, 8, "config get"));
+    TEST_ASSERT_EQUAL(6, QueryScheduler::stateLeaf(out, 7, "config"));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_wheel_fires_after_delay);
+    RUN_TEST(test_wheel_handles_multiple_rounds);
+    RUN_TEST(test_wheel_long_delay_does_not_wrap);
+    RUN_TEST(test_wheel_disarm);
+    RUN_TEST(test_wheel_stall_does_not_burst);
+    RUN_TEST(test_scheduler_runs_every_interval);
+    RUN_TEST(test_scheduler_lease_expires);
+    RUN_TEST(test_scheduler_renew_extends_lease);
+    RUN_TEST(test_scheduler_watch_publishes_on_change_only);
+    RUN_TEST(test_scheduler_every_always_publishes);
+    RUN_TEST(test_scheduler_table_full_and_cancel);
+    RUN_TEST(test_scheduler_rejects_long_command);
+    RUN_TEST(test_scheduler_clamps_interval);
+    RUN_TEST(test_state_query_runs_soon_and_never_expires);
+    RUN_TEST(test_state_query_expiry_keeps_command);
+    RUN_TEST(test_state_forget_republishes);
+    RUN_TEST(test_state_leaf);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttSchedule.h>
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttSchedule compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
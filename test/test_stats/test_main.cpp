@@ -0,0 +1,148 @@
+/**
+ * Tests for the stats record format
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <MqttStats.h>
+
+using namespace espmole;
+
+static const uint32_t U32 = 4294967295UL;
+
+void test_minimal_record() {
+    // Build without batching, TLS, memory accounting or time sync
+    InflightStats q;
+    q.acked = 12;
+    q.minLatency = 8;
+    q.avgLatency = 15;
+    q.maxLatency = 40;
+    WorkStats w;
+    w.lastCallUs = 120;
+    w.maxCallUs = 900;
+
+    StatsSnapshot s;
+    s.inflight = 1;
+    s.window = 8;
+    s.qos = &q;
+    s.work = &w;
+
+    char out[STATS_RECORD_MAX];
+    size_t len = formatStats(out, sizeof(out), s);
+    TEST_ASSERT_EQUAL(strlen(out), len);
+    TEST_ASSERT_EQUAL_STRING("inflight=1/8 acked=12 timeout=0 aborted=0 rejected=0 "
+                             "puback_ms=8/15/40 filtered=0 "
+                             "poll_us=120/900 poll_over=0 poll_left=0", out);
+}
+
+void test_full_record_fits() {
+    // Every group, every value at its widest
+    InflightStats q;
+    q.acked = q.timedOut = q.aborted = q.rejected = U32;
+    q.minLatency = q.avgLatency = q.maxLatency = U32;
+    BatchStats b;
+    b.bursts = b.dropped = b.connectedMs = U32;
+    LinkStats l;
+    l.srtt = l.rttvar = l.lost = U32;
+    l.keepAlive = 65535;
+    TlsStats t;
+    t.full = t.resumed = t.failed = t.avgFullMs = t.avgResumedMs = U32;
+    MemoryUsage m;
+    m.used = m.reserved = U32;
+    HeapHealth h;
+    h.freeBytes = h.largestBlock = U32;
+    h.fragmentation = 100;
+    WorkStats w;
+    w.lastCallUs = w.maxCallUs = w.overBudget = w.deferred = U32;
+    TimeSyncStats ts;
+    ts.errorMs = U32;
+    ts.driftPpm = -2147483647 - 1;
+
+    StatsSnapshot s;
+    s.inflight = 65535;
+    s.window = 65535;
+    s.qos = &q;
+    s.filtered = U32;
+    s.batch = &b;
+    s.burstsPerHour = U32;
+    s.link = &l;
+    s.tls = &t;
+    s.mem = &m;
+    s.heap = &h;
+    s.work = &w;
+    s.time = &ts;
+
+    const char* expected =
+        "inflight=65535/65535 acked=4294967295 timeout=4294967295 aborted=4294967295 "
+        "rejected=4294967295 puback_ms=4294967295/4294967295/4294967295 filtered=4294967295"
+        " bursts=4294967295 bursts_h=4294967295 connected_s=4294967 batch_dropped=4294967295"
+        " srtt=4294967295 rttvar=4294967295 ka=65535 rtt_lost=4294967295"
+        " tls_full=4294967295 tls_resumed=4294967295 tls_failed=4294967295"
+        " tls_ms=4294967295/4294967295"
+        " mem=4294967295/4294967295 heap=4294967295 heap_blk=4294967295 frag=100"
+        " poll_us=4294967295/4294967295 poll_over=4294967295 poll_left=4294967295"
+        " time_err=4294967295 drift_ppm=-2147483648";
+
+    // The buffer publishStats() uses holds the complete record
+    char out[STATS_RECORD_MAX];
+    size_t len = formatStats(out, sizeof(out), s);
+    TEST_ASSERT_EQUAL_STRING(expected, out);
+    TEST_ASSERT_EQUAL(strlen(expected), len);
+    TEST_ASSERT_TRUE(len < STATS_RECORD_MAX);
+}
+
+void test_truncates_to_cap() {
+    InflightStats q;
+    WorkStats w;
+    StatsSnapshot s;
+    s.qos = &q;
+    s.work = &w;
+
+    char out[16];
+    memset(out, 'x', sizeof(out));
+    size_t len = formatStats(out, sizeof(out), s);
+    TEST_ASSERT_EQUAL(sizeof(out) - 1, len);
+    TEST_ASSERT_EQUAL_STRING("inflight=0/0 ac", out);
+    TEST_ASSERT_EQUAL(0, formatStats(out, 0, s));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_minimal_record);
+    RUN_TEST(test_full_record_fits);
+    RUN_TEST(test_truncates_to_cap);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttStats.h>
+
+void setup() {
+    Serial.begin(115200);
+    espmole::WorkStats w;
+    espmole::StatsSnapshot s;
+    s.work = &w;
+    char out[espmole::STATS_RECORD_MAX];
+    espmole::formatStats(out, sizeof(out), s);
+    Serial.println(out);
+    Serial.println("MqttStats compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * Tests for the host-side fleet status index and aggregator
+ * (tools/common, built with the native environment only)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <MqttCodec.h>
+#include <PosixMqttClient.h>
+#include <StatusAggregator.h>
+#include <StatusIndex.h>
+
+using namespace espmole;
+
+static char indexPath[64];
+
+static bool update(StatusIndex& idx, const char* id, DeviceState state, uint64_t now = 1000) {
+    return idx.update(id, strlen(id), state, 0, now);
+}
+
+static const DeviceRecord* find(const StatusIndex& idx, const char* id) {
+    return idx.find(id, strlen(id));
+}
+
+static mqtt::PublishView statusMessage(const char* topic, const char* payload, bool retain = false) {
+    mqtt::PublishView msg;
+    msg.topic.data = topic;
+    msg.topic.len = strlen(topic);
+    msg.payload = reinterpret_cast<const uint8_t*>(payload);
+    msg.len = strlen(payload);
+    msg.retain = retain;
+    return msg;
+}
+
+void test_index_insert_and_update() {
+    StatusIndex idx;
+    TEST_ASSERT_TRUE(idx.openInMemory(16));
+    
+    TEST_ASSERT_TRUE(update(idx, "dev1", DeviceState::Online, 1000));
+    TEST_ASSERT_TRUE(update(idx, "dev2", DeviceState::Offline, 1000));
+    TEST_ASSERT_EQUAL(2, idx.size());
+    TEST_ASSERT_EQUAL(1, idx.online());
+    
+    TEST_ASSERT_TRUE(update(idx, "dev1", DeviceState::Offline, 2000));
+    TEST_ASSERT_EQUAL(2, idx.size());
+    TEST_ASSERT_EQUAL(0, idx.online());
+    
+    const DeviceRecord* rec = find(idx, "dev1");
+    TEST_ASSERT_NOT_NULL(rec);
+    TEST_ASSERT_EQUAL(2000, rec->changed);
+    TEST_ASSERT_NULL(find(idx, "dev3"));
+    TEST_ASSERT_NULL(find(idx, "dev"));
+}
+
+void test_index_rejects_long_ids() {
+    StatusIndex idx;
+    idx.openInMemory();
+    char id[DeviceRecord::ID_MAX + 1];
+    memset(id, 'x', sizeof(id) - 1);
+    id[sizeof(id) - 1] = '\0';
+    TEST_ASSERT_FALSE(update(idx, id, DeviceState::Online));
+}
+
+void test_index_grows_and_keeps_records() {
+    StatusIndex idx;
+    idx.openInMemory(16);
+    
+    char id[16];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(id, sizeof(id), "dev%d", i);
+        TEST_ASSERT_TRUE(update(idx, id, i % 3 ? DeviceState::Online : DeviceState::Offline));
+    }
+    TEST_ASSERT_EQUAL(1000, idx.size());
+    TEST_ASSERT_TRUE(idx.capacity() * 7 >= idx.size() * 10);
+    TEST_ASSERT_EQUAL(666, idx.online());
+    
+    for (int i = 0; i < 1000; i++) {
+        snprintf(id, sizeof(id), "dev%d", i);
+        TEST_ASSERT_NOT_NULL(find(idx, id));
+    }
+}
+
+void test_index_remove_keeps_probe_chains() {
+    StatusIndex idx;
+    idx.openInMemory(64);
+    
+    char id[16];
+    for (int i = 0; i < 40; i++) {
+        snprintf(id, sizeof(id), "d%d", i);
+        update(idx, id, DeviceState::Online);
+    }
+    for (int i = 0; i < 40; i += 2) {
+        snprintf(id, sizeof(id), "d%d", i);
+        TEST_ASSERT_TRUE(idx.remove(id, strlen(id)));
+    }
+    TEST_ASSERT_EQUAL(20, idx.size());
+    TEST_ASSERT_EQUAL(20, idx.online());
+    for (int i = 0; i < 40; i++) {
+        snprintf(id, sizeof(id), "d%d", i);
+        if (i % 2) TEST_ASSERT_NOT_NULL(find(idx, id));
+        else TEST_ASSERT_NULL(find(idx, id));
+    }
+}
+
+void test_index_snapshot_survives_reopen() {
+    {
+        StatusIndex idx;
+        TEST_ASSERT_TRUE(idx.open(indexPath, 16));
+        char id[16];
+        for (int i = 0; i < 100; i++) {
+            snprintf(id, sizeof(id), "dev%d", i);
+            idx.update(id, strlen(id), DeviceState::Online, StatusIndex::capabilityBit("sched", 5), 42);
+        }
+    }
+    
+    StatusIndex idx;
+    TEST_ASSERT_TRUE(idx.open(indexPath));
+    TEST_ASSERT_EQUAL(100, idx.size());
+    TEST_ASSERT_EQUAL(100, idx.online());
+    const DeviceRecord* rec = find(idx, "dev57");
+    TEST_ASSERT_NOT_NULL(rec);
+    TEST_ASSERT_EQUAL(42, rec->lastSeen);
+    TEST_ASSERT_EQUAL_STRING("sched", StatusIndex::capabilityNames(rec->capabilities).c_str());
+}
+
+void test_index_corrupt_snapshot_starts_empty() {
+    FILE* f = fopen(indexPath, "wb");
+    fputs("definitely not an index file, but longer than a header..........", f);
+    fclose(f);
+    
+    StatusIndex idx;
+    TEST_ASSERT_TRUE(idx.open(indexPath));
+    TEST_ASSERT_EQUAL(0, idx.size());
+    TEST_ASSERT_TRUE(update(idx, "dev1", DeviceState::Online));
+}
+
+void test_aggregator_parses_status_and_caps() {
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    
+    TEST_ASSERT_TRUE(agg.onMessage(statusMessage("espmole/dev1/status", "online caps=qos1,sched,future"), 5000));
+    const DeviceRecord* rec = find(idx, "dev1");
+    TEST_ASSERT_NOT_NULL(rec);
+    TEST_ASSERT_EQUAL(static_cast<uint8_t>(DeviceState::Online), rec->state);
+    TEST_ASSERT_EQUAL_STRING("qos1,sched", StatusIndex::capabilityNames(rec->capabilities).c_str());
+    
+    TEST_ASSERT_TRUE(agg.onMessage(statusMessage("espmole/dev1/status", "offline"), 6000));
+    TEST_ASSERT_EQUAL(static_cast<uint8_t>(DeviceState::Offline), find(idx, "dev1")->state);
+}
+
+void test_aggregator_knows_every_capability() {
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    
+    // Everything MqttTransport::formatCapabilities() can announce
+    const char* all = "qos1,journal,filter,sched,mailbox,log,mem,probe,term,time,selftest";
+    char birth[128];
+    snprintf(birth, sizeof(birth), "online caps=%s", all);
+    TEST_ASSERT_TRUE(agg.onMessage(statusMessage("espmole/dev1/status", birth), 5000));
+    TEST_ASSERT_EQUAL_STRING(all, StatusIndex::capabilityNames(find(idx, "dev1")->capabilities).c_str());
+    
+    TEST_ASSERT_TRUE(agg.onMessage(statusMessage("espmole/dev2/status", "online caps=probe,selftest"), 5000));
+    TEST_ASSERT_EQUAL_STRING("probe,selftest",
+                             StatusIndex::capabilityNames(find(idx, "dev2")->capabilities).c_str());
+    TEST_ASSERT_EQUAL_STRING("dev2 online seen=0s changed=0s caps=probe,selftest\n",
+                             agg.query("get dev2\n", 5000).c_str());
+}
+
+void test_aggregator_ignores_other_topics() {
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    
+    TEST_ASSERT_FALSE(agg.onMessage(statusMessage("espmole/dev1/resp", "online"), 0));
+    TEST_ASSERT_FALSE(agg.onMessage(statusMessage("other/dev1/status", "online"), 0));
+    TEST_ASSERT_FALSE(agg.onMessage(statusMessage("espmole/a/b/status", "online"), 0));
+    TEST_ASSERT_FALSE(agg.onMessage(statusMessage("espmole//status", "online"), 0));
+    TEST_ASSERT_EQUAL(0, idx.size());
+}
+
+void test_aggregator_retained_replay_keeps_last_seen() {
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    
+    agg.onMessage(statusMessage("espmole/dev1/status", "online"), 1000);
+    agg.onMessage(statusMessage("espmole/dev1/status", "online", true), 9000);
+    TEST_ASSERT_EQUAL(1000, find(idx, "dev1")->lastSeen);
+    TEST_ASSERT_EQUAL(1, agg.stats().retainedSkipped);
+    
+    // A retained message that changes state is applied
+    agg.onMessage(statusMessage("espmole/dev1/status", "offline", true), 9500);
+    TEST_ASSERT_EQUAL(9500, find(idx, "dev1")->changed);
+}
+
+void test_aggregator_empty_payload_removes() {
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    
+    agg.onMessage(statusMessage("espmole/dev1/status", "online"), 1000);
+    agg.onMessage(statusMessage("espmole/dev1/status", ""), 2000);
+    TEST_ASSERT_EQUAL(0, idx.size());
+}
+
+void test_aggregator_queries() {
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    agg.onMessage(statusMessage("espmole/dev1/status", "online"), 1000);
+    agg.onMessage(statusMessage("espmole/dev2/status", "offline"), 1000);
+    
+    TEST_ASSERT_EQUAL_STRING("total=2 online=1 other=1\n", agg.query("count", 5000).c_str());
+    TEST_ASSERT_EQUAL_STRING("dev1 online seen=4s changed=4s caps=\n", agg.query("get dev1\n", 5000).c_str());
+    TEST_ASSERT_EQUAL_STRING("dev2 offline seen=4s changed=4s caps=\n", agg.query("list offline", 5000).c_str());
+    TEST_ASSERT_EQUAL_STRING("error: unknown device\n", agg.query("get nope", 5000).c_str());
+}
+
+static void feedAggregator(const mqtt::PublishView& msg, void* ctx) {
+    static_cast<StatusAggregator*>(ctx)->onMessage(msg, 1234);
+}
+
+static void standInSend(int fd, const uint8_t* data, size_t len) {
+    TEST_ASSERT_EQUAL(static_cast<ssize_t>(len), send(fd, data, len, 0));
+}
+
+void test_client_against_broker_stand_in() {
+    // Broker stand-in: the other end of a socketpair, scripted with the codec
+    int sv[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    int broker = sv[1];
+    
+    uint8_t buf[128];
+    size_t len = mqtt::encodeConnack(buf, sizeof(buf), false, mqtt::CONNACK_ACCEPTED);
+    standInSend(broker, buf, len);
+    
+    StatusIndex idx;
+    idx.openInMemory();
+    StatusAggregator agg(idx);
+    
+    PosixMqttClient client;
+    client.onMessage(feedAggregator, &agg);
+    mqtt::ConnectOptions options;
+    options.clientId = "test";
+    TEST_ASSERT_TRUE(client.connectFd(sv[0], options, 1000));
+    
+    // The client's first packet ID is 1; queue the SUBACK ahead of the request
+    uint8_t granted = 0;
+    len = mqtt::encodeSuback(buf, sizeof(buf), 1, &granted, 1);
+    standInSend(broker, buf, len);
+    TEST_ASSERT_TRUE(client.subscribe(agg.filter(), 0, 1000));
+    
+    // Check what the client sent: CONNECT then SUBSCRIBE
+    uint8_t rx[256];
+    ssize_t n = recv(broker, rx, sizeof(rx), 0);
+    mqtt::Packet p;
+    int used = mqtt::parse(rx, static_cast<size_t>(n), p);
+    TEST_ASSERT_TRUE(used > 0);
+    TEST_ASSERT_EQUAL(mqtt::CONNECT, p.type);
+    
+    const char* topics[] = {"espmole/a/status", "espmole/b/status", "espmole/c/status"};
+    for (const char* t : topics) {
+        len = mqtt::encodePublish(buf, sizeof(buf), t, strlen(t),
+                                  reinterpret_cast<const uint8_t*>("online caps=journal"), 19,
+                                  0, true, 0);
+        standInSend(broker, buf, len);
+    }
+    
+    int received = 0;
+    for (int i = 0; i < 10 && received < 3; i++) {
+        int r = client.loop(100);
+        TEST_ASSERT_TRUE(r >= 0);
+        received += r;
+    }
+    TEST_ASSERT_EQUAL(3, received);
+    TEST_ASSERT_EQUAL(3, idx.online());
+    TEST_ASSERT_EQUAL_STRING("journal",
+        StatusIndex::capabilityNames(find(idx, "b")->capabilities).c_str());
+    
+    // Broker goes away
+    close(broker);
+    int r = 0;
+    for (int i = 0; i < 10 && r >= 0; i++) r = client.loop(100);
+    TEST_ASSERT_EQUAL(-1, r);
+    TEST_ASSERT_FALSE(client.connected());
+}
+
+void setUp(void) {}
+void tearDown(void) {
+    unlink(indexPath);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    
+    snprintf(indexPath, sizeof(indexPath), "/tmp/espmole-status-test-%d.idx", static_cast<int>(getpid()));
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_index_insert_and_update);
+    RUN_TEST(test_index_rejects_long_ids);
+    RUN_TEST(test_index_grows_and_keeps_records);
+    RUN_TEST(test_index_remove_keeps_probe_chains);
+    RUN_TEST(test_index_snapshot_survives_reopen);
+    RUN_TEST(test_index_corrupt_snapshot_starts_empty);
+    RUN_TEST(test_aggregator_parses_status_and_caps);
+    RUN_TEST(test_aggregator_knows_every_capability);
+    RUN_TEST(test_aggregator_ignores_other_topics);
+    RUN_TEST(test_aggregator_retained_replay_keeps_last_seen);
+    RUN_TEST(test_aggregator_empty_payload_removes);
+    RUN_TEST(test_aggregator_queries);
+    RUN_TEST(test_client_against_broker_stand_in);
+    
+    return UNITY_END();
+}
+
+#else
+
+// Host-only tool code - nothing to test on the device
+#include <Arduino.h>
+
+void setup() {}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,295 @@
+/**
+ * Tests for TerminalSession (line assembly and output coalescing)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <MqttTerminal.h>
+
+using namespace espmole;
+
+static std::vector<std::string> lines;
+
+static void collect(TerminalSession& session, const char* line, size_t len, void* ctx) {
+    (void)session;
+    (void)ctx;
+    TEST_ASSERT_EQUAL(strlen(line), len);
+    lines.push_back(line);
+}
+
+static void feed(TerminalSession& t, const char* text, uint32_t now = 0) {
+    t.input(reinterpret_cast<const uint8_t*>(text), strlen(text), now, collect, nullptr);
+}
+
+/// Everything buffered, as published segment by segment
+static std::string drain(TerminalSession& t) {
+    std::string out;
+    const uint8_t* data = nullptr;
+    while (size_t n = t.peek(data)) {
+        out.append(reinterpret_cast<const char*>(data), n);
+        t.consume(n);
+    }
+    return out;
+}
+
+/// Run a command whose result is `result`
+static void command(TerminalSession& t, const char* result, uint32_t now = 0) {
+    size_t cap = 0;
+    uint8_t* out = t.beginCommand(cap);
+    size_t len = strlen(result) < cap ? strlen(result) : cap;
+    memcpy(out, result, len);
+    t.endCommand(len, now);
+}
+
+static TerminalSession* session;
+
+void setUp() {
+    lines.clear();
+    session = new TerminalSession();
+    TEST_ASSERT_TRUE(session->open("ops", 3, 0));
+}
+
+void tearDown() {
+    delete session;
+}
+
+void test_open_and_match() {
+    TerminalSession t;
+    TEST_ASSERT_FALSE(t.isOpen());
+    TEST_ASSERT_FALSE(t.open("", 0, 0));
+    TEST_ASSERT_FALSE(t.open("a/b", 3, 0));
+    TEST_ASSERT_FALSE(t.open("0123456789abcdef", 16, 0));
+
+    TEST_ASSERT_TRUE(t.open("alice/in", 5, 100));
+    TEST_ASSERT_EQUAL_STRING("alice", t.name());
+    TEST_ASSERT_TRUE(t.matches("alice", 5));
+    TEST_ASSERT_FALSE(t.matches("alic", 4));
+    TEST_ASSERT_FALSE(t.matches("alicex", 6));
+    TEST_ASSERT_EQUAL(400, t.idleMs(500));
+
+    t.close();
+    TEST_ASSERT_FALSE(t.isOpen());
+    TEST_ASSERT_FALSE(t.matches("alice", 5));
+}
+
+void test_lines_across_messages() {
+    TerminalSession& t = *session;
+    feed(t, "sta");
+    TEST_ASSERT_EQUAL(0, lines.size());
+    feed(t, "tus\r\nhelp\nuptime\r");
+    feed(t, "\nver");
+    TEST_ASSERT_EQUAL(3, lines.size());
+    TEST_ASSERT_EQUAL_STRING("status", lines[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("help", lines[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("uptime", lines[2].c_str());
+
+    // Empty lines are reported too (they prompt again)
+    feed(t, "\n");
+    TEST_ASSERT_EQUAL(4, lines.size());
+    TEST_ASSERT_EQUAL_STRING("ver", lines[3].c_str());
+    feed(t, "\n");
+    TEST_ASSERT_EQUAL_STRING("", lines[4].c_str());
+
+    // Nothing echoed in line mode
+    TEST_ASSERT_EQUAL(0, t.pending());
+    TEST_ASSERT_EQUAL(5, t.stats().lines);
+}
+
+void test_keystrokes_edit_and_echo() {
+    TerminalSession& t = *session;
+    t.setPrompt("> ");
+    t.setMode(TERM_KEYS, true);
+
+    feed(t, "s");
+    feed(t, "tx");
+    feed(t, "\x7f");
+    feed(t, "at\x08t\r");
+    TEST_ASSERT_EQUAL(1, lines.size());
+    TEST_ASSERT_EQUAL_STRING("stat", lines[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("stx\b \bat\b \bt\r\n", drain(t).c_str());
+
+    // Ctrl-C discards, Ctrl-U too, both prompt again
+    feed(t, "reboot\x03");
+    TEST_ASSERT_EQUAL(1, lines.size());
+    TEST_ASSERT_EQUAL_STRING("reboot^C\r\n> ", drain(t).c_str());
+    feed(t, "x\x15");
+    TEST_ASSERT_EQUAL_STRING("x^U\r\n> ", drain(t).c_str());
+
+    // Other control characters are ignored
+    feed(t, "a\x1b" "b\n");
+    TEST_ASSERT_EQUAL_STRING("ab", lines[1].c_str());
+
+    // Without echo the client shows what it typed
+    drain(t);
+    t.setMode(TERM_KEYS, false);
+    feed(t, "ok\r");
+    TEST_ASSERT_EQUAL(0, t.pending());
+    TEST_ASSERT_EQUAL_STRING("ok", lines[2].c_str());
+}
+
+void test_long_line_rejected() {
+    TerminalSession& t = *session;
+    std::string longLine(TerminalSession::LINE_MAX + 10, 'x');
+    feed(t, longLine.c_str());
+    feed(t, "\nshort\n");
+    TEST_ASSERT_EQUAL(1, lines.size());
+    TEST_ASSERT_EQUAL_STRING("short", lines[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("line too long\n", drain(t).c_str());
+}
+
+void test_coalescing_by_time_and_size() {
+    TerminalSession& t = *session;
+    t.setCoalescing(20, 8);
+
+    // Small writes wait for company
+    t.print("a", 100);
+    t.print("b", 105);
+    TEST_ASSERT_FALSE(t.flushDue(110));
+    TEST_ASSERT_TRUE(t.flushDue(120));
+
+    const uint8_t* data = nullptr;
+    TEST_ASSERT_EQUAL(2, t.peek(data));
+    t.consume(2);
+    TEST_ASSERT_FALSE(t.flushDue(1000));
+
+    // A full segment goes at once, in segment-sized pieces
+    t.print("0123456789", 200);
+    TEST_ASSERT_TRUE(t.flushDue(200));
+    TEST_ASSERT_EQUAL(8, t.peek(data));
+    TEST_ASSERT_EQUAL_MEMORY("01234567", data, 8);
+    t.consume(8);
+    TEST_ASSERT_FALSE(t.flushDue(201));
+    TEST_ASSERT_TRUE(t.flushDue(220));
+
+    TEST_ASSERT_EQUAL(2, t.stats().chunks);
+    TEST_ASSERT_EQUAL(10, t.stats().bytesOut);
+}
+
+void test_command_result_pushes() {
+    TerminalSession& t = *session;
+    t.setCoalescing(1000, 512);
+    t.setPrompt("> ");
+
+    command(t, "uptime 42s", 10);
+    TEST_ASSERT_TRUE(t.flushDue(10));
+    TEST_ASSERT_EQUAL_STRING("uptime 42s\n> ", drain(t).c_str());
+
+    // Results that end their own line get no second line end
+    command(t, "a\nb\n", 20);
+    TEST_ASSERT_EQUAL_STRING("a\nb\n> ", drain(t).c_str());
+
+    // After the push, small writes wait again
+    t.print("x", 30);
+    TEST_ASSERT_FALSE(t.flushDue(40));
+}
+
+void test_output_during_command_precedes_result() {
+    TerminalSession& t = *session;
+    t.setMode(TERM_KEYS, false);
+    t.print("old ", 0);
+
+    size_t cap = 0;
+    uint8_t* out = t.beginCommand(cap);
+    TEST_ASSERT_EQUAL((TerminalSession::BUFFER - 4) / 2 + (TerminalSession::BUFFER - 4) % 2, cap);
+
+    // Streamed while running; nothing goes out until the command ends
+    t.print("progress 50%\r\n", 1);
+    TEST_ASSERT_FALSE(t.flushDue(5000));
+    memcpy(out, "done", 4);
+    t.endCommand(4, 2);
+
+    TEST_ASSERT_EQUAL_STRING("old progress 50%\r\ndone\r\n", drain(t).c_str());
+}
+
+void test_result_larger_than_response_buffer() {
+    TerminalSession& t = *session;
+    std::string big(600, 'r');
+    size_t cap = 0;
+    uint8_t* out = t.beginCommand(cap);
+    TEST_ASSERT_TRUE(cap >= 512);
+    memcpy(out, big.data(), big.size() < cap ? big.size() : cap);
+    t.endCommand(big.size() < cap ? big.size() : cap, 0);
+    TEST_ASSERT_TRUE(t.pending() > 256);
+}
+
+void test_full_buffer_drops() {
+    TerminalSession& t = *session;
+    std::string fill(TerminalSession::BUFFER - 2, 'f');
+    TEST_ASSERT_EQUAL(fill.size(), t.print(fill.c_str(), 0));
+    TEST_ASSERT_EQUAL(2, t.print("abcd", 0));
+    TEST_ASSERT_EQUAL(2, t.stats().dropped);
+
+    // The prompt still comes after a result with no room
+    t.setPrompt("> ");
+    drain(t);
+    command(t, "ok", 0);
+    TEST_ASSERT_EQUAL_STRING("ok\n> ", drain(t).c_str());
+}
+
+void test_close_when_flushed() {
+    TerminalSession& t = *session;
+    t.setCoalescing(1000, 512);
+    t.print("bye\n", 0);
+    t.closeWhenFlushed();
+    TEST_ASSERT_TRUE(t.closing());
+    TEST_ASSERT_TRUE(t.flushDue(0));
+
+    // Input after the end is ignored
+    feed(t, "status\n");
+    TEST_ASSERT_EQUAL(0, lines.size());
+
+    t.close();
+    TEST_ASSERT_FALSE(t.closing());
+    TEST_ASSERT_EQUAL(0, t.pending());
+    TEST_ASSERT_EQUAL(0, t.print("x", 0));
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_open_and_match);
+    RUN_TEST(test_lines_across_messages);
+    RUN_TEST(test_keystrokes_edit_and_echo);
+    RUN_TEST(test_long_line_rejected);
+    RUN_TEST(test_coalescing_by_time_and_size);
+    RUN_TEST(test_command_result_pushes);
+    RUN_TEST(test_output_during_command_precedes_result);
+    RUN_TEST(test_result_larger_than_response_buffer);
+    RUN_TEST(test_full_buffer_drops);
+    RUN_TEST(test_close_when_flushed);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttTerminal.h>
+
+espmole::TerminalSession terminal;
+
+static void onLine(espmole::TerminalSession& session, const char* line, size_t len, void* ctx) {
+    (void)ctx;
+    session.write(reinterpret_cast<const uint8_t*>(line), len, millis());
+}
+
+void setup() {
+    Serial.begin(115200);
+    terminal.open("serial", 6, millis());
+    terminal.input(reinterpret_cast<const uint8_t*>("hello\n"), 6, millis(), onLine, nullptr);
+    Serial.println("MqttTerminal compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
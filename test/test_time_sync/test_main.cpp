@@ -0,0 +1,336 @@
+/**
+ * Tests for TimeSync (offset and drift estimation) and TimeStamper
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <MqttTimeSync.h>
+
+using namespace espmole;
+
+/// Reference time at the start of each simulation (Unix ms)
+static const uint64_t EPOCH = 1760000000000ULL;
+
+/**
+ * A device whose millisecond clock started at `localStart` and runs
+ * `ppm` slow, talking to a controller over a link with the given delays.
+ */
+struct Sim {
+    TimeSync sync;
+    uint64_t ref = EPOCH;           // True (controller) time
+    uint32_t localStart = 0;
+    int32_t ppm = 0;
+
+    uint32_t local() const {
+        int64_t elapsed = static_cast<int64_t>(ref - EPOCH);
+        return localStart + static_cast<uint32_t>(elapsed - elapsed * ppm / 1000000);
+    }
+
+    void advance(uint64_t ms) { ref += ms; }
+
+    /// One exchange; returns what onReply() said
+    bool exchange(uint32_t up, uint32_t down, uint32_t server = 1) {
+        char req[TimeSync::REQUEST_MAX];
+        uint32_t t1 = 0;
+        if (sync.startRequest(req, sizeof(req), local()) == 0 ||
+            !TimeSync::parseRequest(req, strlen(req), t1)) {
+            return false;
+        }
+
+        advance(up);
+        uint64_t T2 = ref;
+        advance(server);
+        uint64_t T3 = ref;
+        advance(down);
+        return sync.onReply(t1, T2, T3, local());
+    }
+
+    /// Device estimate minus true time
+    int32_t error() const {
+        return static_cast<int32_t>(static_cast<int64_t>(sync.epochMillis(local())) -
+                                    static_cast<int64_t>(ref));
+    }
+};
+
+static Sim* sim;
+
+void setUp() {
+    sim = new Sim();
+    sim->sync.begin(60000);
+}
+
+void tearDown() {
+    delete sim;
+}
+
+void test_symmetric_exchange_is_exact() {
+    sim->localStart = 12345;
+    TEST_ASSERT_FALSE(sim->sync.synced());
+    TEST_ASSERT_TRUE(sim->sync.epochMillis(sim->local()) == 0);
+
+    TEST_ASSERT_TRUE(sim->exchange(20, 20));
+    TEST_ASSERT_TRUE(sim->sync.synced());
+    TEST_ASSERT_EQUAL_INT32(0, sim->error());
+
+    TimeSyncStats s = sim->sync.stats(sim->local());
+    TEST_ASSERT_EQUAL(40, s.delayMs);
+    TEST_ASSERT_EQUAL(21, s.errorMs);
+    TEST_ASSERT_EQUAL(1, s.samples);
+    TEST_ASSERT_TRUE(s.offsetMs == static_cast<int64_t>(EPOCH) - 12345);
+}
+
+void test_asymmetry_bounded_by_half_delay() {
+    TEST_ASSERT_TRUE(sim->exchange(90, 10));
+    TimeSyncStats s = sim->sync.stats(sim->local());
+    int32_t err = sim->error();
+    TEST_ASSERT_EQUAL_INT32(40, err);
+    TEST_ASSERT_TRUE(err <= static_cast<int32_t>(s.errorMs));
+}
+
+void test_least_delayed_sample_wins() {
+    TEST_ASSERT_TRUE(sim->exchange(5, 5));
+    sim->advance(2000);
+
+    // Queueing on one leg: worse samples do not displace the good one
+    TEST_ASSERT_TRUE(sim->exchange(800, 10));
+    TEST_ASSERT_EQUAL_INT32(0, sim->error());
+    TEST_ASSERT_EQUAL(10, sim->sync.stats(sim->local()).delayMs);
+
+    // ...until it falls out of the window
+    for (size_t i = 0; i < TimeSync::SAMPLES; i++) {
+        sim->advance(2000);
+        TEST_ASSERT_TRUE(sim->exchange(30, 10));
+    }
+    TEST_ASSERT_EQUAL(40, sim->sync.stats(sim->local()).delayMs);
+    TEST_ASSERT_EQUAL_INT32(10, sim->error());
+}
+
+void test_drift_estimated_and_carried_forward() {
+    sim->ppm = 80;
+    for (int i = 0; i < 30; i++) {
+        TEST_ASSERT_TRUE(sim->exchange(10, 10));
+        sim->advance(60000);
+    }
+    TimeSyncStats s = sim->sync.stats(sim->local());
+    TEST_ASSERT_INT_WITHIN(10, 80, s.driftPpm);
+
+    // Ten minutes without a sample: 48 ms of drift, mostly corrected
+    sim->advance(600000);
+    s = sim->sync.stats(sim->local());
+    int32_t err = sim->error();
+    TEST_ASSERT_TRUE(err >= -8 && err <= 8);
+    TEST_ASSERT_TRUE(err <= static_cast<int32_t>(s.errorMs) && -err <= static_cast<int32_t>(s.errorMs));
+}
+
+void test_error_grows_with_age_without_drift_estimate() {
+    TEST_ASSERT_TRUE(sim->exchange(10, 10));
+    uint32_t fresh = sim->sync.stats(sim->local()).errorMs;
+    sim->advance(100000);
+    TEST_ASSERT_EQUAL(fresh + 10, sim->sync.stats(sim->local()).errorMs);
+}
+
+void test_request_schedule() {
+    TimeSync& sync = sim->sync;
+    char req[TimeSync::REQUEST_MAX];
+    TEST_ASSERT_TRUE(sync.requestDue(0));
+
+    // Not while a request is out
+    sync.startRequest(req, sizeof(req), 0);
+    TEST_ASSERT_FALSE(sync.requestDue(3000));
+    TEST_ASSERT_TRUE(sync.onReply(0, EPOCH, EPOCH, 20));
+
+    // Bursts until the window is full
+    TEST_ASSERT_FALSE(sync.requestDue(1999));
+    TEST_ASSERT_TRUE(sync.requestDue(2000));
+
+    // A lost request times out and frees the slot
+    sync.startRequest(req, sizeof(req), 2000);
+    sync.expire(2000 + TimeSync::TIMEOUT_MS - 1);
+    TEST_ASSERT_EQUAL(0, sync.stats(7000).lost);
+    sync.expire(2000 + TimeSync::TIMEOUT_MS);
+    TEST_ASSERT_EQUAL(1, sync.stats(7000).lost);
+    TEST_ASSERT_TRUE(sync.requestDue(7000));
+
+    // Interval 0 never asks
+    TimeSync off;
+    off.begin(0);
+    TEST_ASSERT_FALSE(off.requestDue(100000));
+}
+
+void test_interval_after_burst() {
+    for (size_t i = 0; i < TimeSync::SAMPLES; i++) {
+        TEST_ASSERT_TRUE(sim->exchange(10, 10));
+        sim->advance(TimeSync::BURST_INTERVAL_MS);
+    }
+    uint32_t last = sim->local() - TimeSync::BURST_INTERVAL_MS - 21;
+    TEST_ASSERT_FALSE(sim->sync.requestDue(last + 59999));
+    TEST_ASSERT_TRUE(sim->sync.requestDue(last + 60000));
+}
+
+void test_bad_replies_rejected() {
+    TimeSync& sync = sim->sync;
+    char req[TimeSync::REQUEST_MAX];
+
+    // Nothing outstanding
+    TEST_ASSERT_FALSE(sync.onReply(0, EPOCH, EPOCH, 10));
+
+    sync.startRequest(req, sizeof(req), 100);
+    // Wrong t1, send before receive, more server time than round trip, too slow
+    TEST_ASSERT_FALSE(sync.onReply(99, EPOCH, EPOCH, 120));
+    TEST_ASSERT_FALSE(sync.onReply(100, EPOCH + 5, EPOCH, 120));
+    TEST_ASSERT_FALSE(sync.onReply(100, EPOCH, EPOCH + 50, 120));
+    TEST_ASSERT_EQUAL(4, sync.stats(120).rejected);
+    TEST_ASSERT_FALSE(sync.synced());
+
+    // Stale reply after the timeout
+    sync.startRequest(req, sizeof(req), 200);
+    sync.expire(200 + TimeSync::TIMEOUT_MS);
+    TEST_ASSERT_FALSE(sync.onReply(200, EPOCH, EPOCH, 200 + TimeSync::TIMEOUT_MS));
+
+    sync.startRequest(req, sizeof(req), 10000);
+    TEST_ASSERT_FALSE(sync.onReply(10000, EPOCH, EPOCH, 10000 + TimeSync::MAX_DELAY_MS + 1));
+    TEST_ASSERT_FALSE(sync.synced());
+}
+
+void test_local_clock_wrap() {
+    sim->localStart = 0xFFFFFFFFu - 5000;
+    TEST_ASSERT_TRUE(sim->exchange(10, 10));
+    sim->advance(3000);
+    TEST_ASSERT_TRUE(sim->exchange(10, 10));
+    TEST_ASSERT_EQUAL_INT32(0, sim->error());
+
+    // Across the wrap
+    sim->advance(10000);
+    TEST_ASSERT_TRUE(sim->local() < 10000);
+    TEST_ASSERT_EQUAL_INT32(0, sim->error());
+    TEST_ASSERT_TRUE(sim->exchange(10, 10));
+    TEST_ASSERT_EQUAL_INT32(0, sim->error());
+}
+
+void test_wire_format() {
+    uint32_t t1 = 0;
+    TEST_ASSERT_TRUE(TimeSync::parseRequest("time? 4294967295", 16, t1));
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, t1);
+    TEST_ASSERT_FALSE(TimeSync::parseRequest("time? 4294967296", 16, t1));
+    TEST_ASSERT_FALSE(TimeSync::parseRequest("time? ", 6, t1));
+    TEST_ASSERT_FALSE(TimeSync::parseRequest("time? 12x", 9, t1));
+    TEST_ASSERT_FALSE(TimeSync::parseRequest("uptime 12", 9, t1));
+
+    char out[64];
+    size_t n = TimeSync::formatReply(out, sizeof(out), 77, EPOCH, EPOCH + 2);
+    TEST_ASSERT_EQUAL_STRING("$time 77 1760000000000 1760000000002", out);
+    TEST_ASSERT_EQUAL(strlen(out), n);
+
+    uint64_t T2 = 0, T3 = 0;
+    TEST_ASSERT_TRUE(TimeSync::parseReply(out + 6, t1, T2, T3));
+    TEST_ASSERT_EQUAL_UINT32(77, t1);
+    TEST_ASSERT_TRUE(T2 == EPOCH);
+    TEST_ASSERT_TRUE(T3 == EPOCH + 2);
+    TEST_ASSERT_FALSE(TimeSync::parseReply("77 1", t1, T2, T3));
+    TEST_ASSERT_FALSE(TimeSync::parseReply("77 1 2 3", t1, T2, T3));
+    TEST_ASSERT_FALSE(TimeSync::parseReply("", t1, T2, T3));
+    TEST_ASSERT_EQUAL(0, TimeSync::formatReply(out, 10, 77, EPOCH, EPOCH));
+}
+
+void test_stamps_round_trip() {
+    TimeStamper stamper;
+    char out[TimeStamper::STAMP_MAX];
+    uint64_t prev = 0, at = 0;
+    size_t used = 0;
+
+    uint64_t times[] = {EPOCH, EPOCH + 15, EPOCH + 15, EPOCH + 1000};
+    std::string all;
+    for (uint64_t t : times) {
+        stamper.stamp(out, sizeof(out), t);
+        all += out;
+    }
+    TEST_ASSERT_EQUAL_STRING("@1760000000000 +15 +0 +985 ", all.c_str());
+
+    const char* p = all.c_str();
+    for (uint64_t t : times) {
+        TEST_ASSERT_TRUE(TimeStamper::parse(p, strlen(p), prev, at, used));
+        TEST_ASSERT_TRUE(at == t);
+        p += used;
+    }
+
+    // A delta needs a previous time
+    uint64_t none = 0;
+    TEST_ASSERT_FALSE(TimeStamper::parse("+15 x", 5, none, at, used));
+    TEST_ASSERT_FALSE(TimeStamper::parse("hello", 5, prev, at, used));
+    TEST_ASSERT_FALSE(TimeStamper::parse("@12", 3, prev, at, used));
+}
+
+void test_stamps_go_absolute() {
+    TimeStamper stamper;
+    char out[TimeStamper::STAMP_MAX];
+    uint64_t t = EPOCH;
+    stamper.stamp(out, sizeof(out), t);
+
+    // Periodically
+    for (uint8_t i = 1; i < TimeStamper::ABSOLUTE_EVERY; i++) {
+        stamper.stamp(out, sizeof(out), ++t);
+        TEST_ASSERT_EQUAL('+', out[0]);
+    }
+    stamper.stamp(out, sizeof(out), ++t);
+    TEST_ASSERT_EQUAL('@', out[0]);
+
+    // After a step back, a long gap, or a reset
+    stamper.stamp(out, sizeof(out), t - 5);
+    TEST_ASSERT_EQUAL('@', out[0]);
+    stamper.stamp(out, sizeof(out), t + TimeStamper::DELTA_MAX_MS + 1);
+    TEST_ASSERT_EQUAL('@', out[0]);
+    stamper.reset();
+    stamper.stamp(out, sizeof(out), t + TimeStamper::DELTA_MAX_MS + 2);
+    TEST_ASSERT_EQUAL('@', out[0]);
+
+    // Too little room
+    TEST_ASSERT_EQUAL(0, stamper.stamp(out, 5, t));
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_symmetric_exchange_is_exact);
+    RUN_TEST(test_asymmetry_bounded_by_half_delay);
+    RUN_TEST(test_least_delayed_sample_wins);
+    RUN_TEST(test_drift_estimated_and_carried_forward);
+    RUN_TEST(test_error_grows_with_age_without_drift_estimate);
+    RUN_TEST(test_request_schedule);
+    RUN_TEST(test_interval_after_burst);
+    RUN_TEST(test_bad_replies_rejected);
+    RUN_TEST(test_local_clock_wrap);
+    RUN_TEST(test_wire_format);
+    RUN_TEST(test_stamps_round_trip);
+    RUN_TEST(test_stamps_go_absolute);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttTimeSync.h>
+
+espmole::TimeSync timeSync;
+
+void setup() {
+    Serial.begin(115200);
+    timeSync.begin(60000);
+    char request[espmole::TimeSync::REQUEST_MAX];
+    timeSync.startRequest(request, sizeof(request), millis());
+    Serial.println(request);
+    Serial.println("MqttTimeSync compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * Tests for the TLS session cache and handshake statistics, and for TLS
+ * session resumption against an in-process OpenSSL broker stand-in
+ * (tools/common, built with the native environment only)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <MqttCodec.h>
+#include <MqttTlsSession.h>
+#include <PosixMqttClient.h>
+#include <PosixTls.h>
+
+using namespace espmole;
+
+// Self-signed certificate for "localhost", shared by all tests
+static EVP_PKEY* serverKey = nullptr;
+static X509* serverCert = nullptr;
+static std::string serverCertPem;
+
+static X509* makeCert(EVP_PKEY* key, const char* cn) {
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char*>(cn), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    X509V3_CTX v3;
+    X509V3_set_ctx_nodb(&v3);
+    X509V3_set_ctx(&v3, cert, cert, nullptr, nullptr, 0);
+    const char* exts[][2] = {
+        {"subjectAltName", "DNS:localhost"},
+        {"basicConstraints", "critical,CA:TRUE"},
+    };
+    for (auto& e : exts) {
+        X509_EXTENSION* ext = X509V3_EXT_conf(nullptr, &v3, e[0], e[1]);
+        X509_add_ext(cert, ext, -1);
+        X509_EXTENSION_free(ext);
+    }
+
+    X509_sign(cert, key, EVP_sha256());
+    return cert;
+}
+
+static std::string toPem(X509* cert) {
+    BIO* bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(bio, cert);
+    char* data = nullptr;
+    long len = BIO_get_mem_data(bio, &data);
+    std::string pem(data, static_cast<size_t>(len));
+    BIO_free(bio);
+    return pem;
+}
+
+/// TLS versions and resumption mechanisms the stand-in can offer
+enum ServerMode {
+    TLS13_TICKETS,
+    TLS12_TICKETS,
+    TLS12_SESSION_ID
+};
+
+static SSL_CTX* makeServerCtx(ServerMode mode) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx, serverCert);
+    SSL_CTX_use_PrivateKey(ctx, serverKey);
+
+    static const unsigned char SID_CTX[] = "espmole-test";
+    SSL_CTX_set_session_id_context(ctx, SID_CTX, sizeof(SID_CTX) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+
+    if (mode != TLS13_TICKETS) {
+        SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    }
+    if (mode == TLS12_SESSION_ID) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+    return ctx;
+}
+
+/**
+ * Broker stand-in for one connection: TLS handshake, CONNACK for the
+ * CONNECT, then wait until the client goes away.
+ */
+static void serveOne(SSL_CTX* ctx, int fd) {
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+
+    if (SSL_accept(ssl) == 1) {
+        uint8_t buf[512];
+        size_t len = 0;
+        mqtt::Packet packet;
+        while (len < sizeof(buf)) {
+            size_t got = 0;
+            if (SSL_read_ex(ssl, buf + len, sizeof(buf) - len, &got) != 1) break;
+            len += got;
+            if (mqtt::parse(buf, len, packet) > 0) {
+                uint8_t ack[4];
+                size_t n = mqtt::encodeConnack(ack, sizeof(ack), false, mqtt::CONNACK_ACCEPTED);
+                size_t written = 0;
+                SSL_write_ex(ssl, ack, n, &written);
+                break;
+            }
+        }
+
+        // Drain until DISCONNECT / close_notify
+        size_t got = 0;
+        while (SSL_read_ex(ssl, buf, sizeof(buf), &got) == 1) {}
+        SSL_shutdown(ssl);
+    }
+
+    SSL_free(ssl);
+    close(fd);
+}
+
+/// Connect a client over TLS to a fresh stand-in connection
+static bool connectOnce(SSL_CTX* serverCtx, PosixTls& tls) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return false;
+    std::thread server(serveOne, serverCtx, sv[1]);
+
+    PosixMqttClient client;
+    client.useTls(&tls, "localhost");
+    mqtt::ConnectOptions options;
+    options.clientId = "tls-test";
+    bool ok = client.connectFd(sv[0], options, 2000);
+
+    // TLS 1.3 tickets are read along with the first records after the handshake
+    if (ok) client.loop(50);
+    client.close();
+    if (!ok) close(sv[0]);
+
+    server.join();
+    return ok;
+}
+
+static PosixTls::Options verifyingOptions() {
+    PosixTls::Options options;
+    options.caPem = serverCertPem.c_str();
+    return options;
+}
+
+// =============================================================================
+// TlsSessionCache
+// =============================================================================
+
+void test_cache_store_and_load() {
+    TlsSessionCache cache = {};
+    size_t len = 0;
+    TEST_ASSERT_FALSE(cache.valid());
+    TEST_ASSERT_NULL(cache.load("broker", 8883, len));
+
+    const uint8_t blob[] = {1, 2, 3, 4, 5};
+    TEST_ASSERT_TRUE(cache.store("broker", 8883, blob, sizeof(blob)));
+    TEST_ASSERT_TRUE(cache.valid());
+
+    const uint8_t* got = cache.load("broker", 8883, len);
+    TEST_ASSERT_NOT_NULL(got);
+    TEST_ASSERT_EQUAL(sizeof(blob), len);
+    TEST_ASSERT_EQUAL_MEMORY(blob, got, sizeof(blob));
+
+    // Sessions are bound to the server they came from
+    TEST_ASSERT_NULL(cache.load("broker", 1883, len));
+    TEST_ASSERT_NULL(cache.load("other", 8883, len));
+
+    cache.clear();
+    TEST_ASSERT_NULL(cache.load("broker", 8883, len));
+}
+
+void test_cache_rejects_garbage() {
+    // Uninitialized retained memory after a cold boot
+    TlsSessionCache cache;
+    memset(&cache, 0xA5, sizeof(cache));
+    TEST_ASSERT_FALSE(cache.valid());
+
+    const uint8_t blob[] = {9, 8, 7};
+    TEST_ASSERT_TRUE(cache.store("broker", 8883, blob, sizeof(blob)));
+
+    // A flipped bit invalidates the session
+    cache.blob[1] ^= 0x10;
+    size_t len = 0;
+    TEST_ASSERT_FALSE(cache.valid());
+    TEST_ASSERT_NULL(cache.load("broker", 8883, len));
+}
+
+void test_cache_rejects_oversized() {
+    TlsSessionCache cache = {};
+    const uint8_t blob[] = {1};
+    TEST_ASSERT_TRUE(cache.store("broker", 8883, blob, sizeof(blob)));
+
+    static uint8_t big[TlsSessionCache::SESSION_MAX + 1];
+    TEST_ASSERT_FALSE(cache.store("broker", 8883, big, sizeof(big)));
+    TEST_ASSERT_FALSE(cache.valid());
+    TEST_ASSERT_FALSE(cache.store("broker", 8883, blob, 0));
+}
+
+void test_handshake_stats() {
+    TlsHandshakeStats stats;
+    stats.noteHandshake(false, 800);
+    stats.noteHandshake(true, 80);
+    stats.noteHandshake(true, 160);
+    stats.noteFailure();
+
+    const TlsStats& s = stats.stats();
+    TEST_ASSERT_EQUAL(1, s.full);
+    TEST_ASSERT_EQUAL(2, s.resumed);
+    TEST_ASSERT_EQUAL(1, s.failed);
+    TEST_ASSERT_EQUAL(160, s.lastMs);
+    TEST_ASSERT_EQUAL(800, s.avgFullMs);
+    TEST_ASSERT_EQUAL(90, s.avgResumedMs);
+
+    // Falling times move the average down as well
+    stats.noteHandshake(true, 10);
+    TEST_ASSERT_EQUAL(80, stats.stats().avgResumedMs);
+}
+
+// =============================================================================
+// Resumption against the broker stand-in
+// =============================================================================
+
+static void checkResumption(ServerMode mode) {
+    SSL_CTX* serverCtx = makeServerCtx(mode);
+    TlsSessionCache cache = {};
+    PosixTls tls(&cache);
+    TEST_ASSERT_TRUE(tls.begin(verifyingOptions()));
+
+    TEST_ASSERT_TRUE(connectOnce(serverCtx, tls));
+    TEST_ASSERT_FALSE(tls.resumed());
+    TEST_ASSERT_TRUE(cache.valid());
+
+    TEST_ASSERT_TRUE(connectOnce(serverCtx, tls));
+    TEST_ASSERT_TRUE(tls.resumed());
+
+    TEST_ASSERT_TRUE(connectOnce(serverCtx, tls));
+    TEST_ASSERT_TRUE(tls.resumed());
+
+    const TlsStats& s = tls.handshakeStats().stats();
+    TEST_ASSERT_EQUAL(1, s.full);
+    TEST_ASSERT_EQUAL(2, s.resumed);
+    TEST_ASSERT_EQUAL(0, s.failed);
+
+    SSL_CTX_free(serverCtx);
+}
+
+void test_resume_tls13_ticket() {
+    checkResumption(TLS13_TICKETS);
+}
+
+void test_resume_tls12_ticket() {
+    checkResumption(TLS12_TICKETS);
+}
+
+void test_resume_tls12_session_id() {
+    checkResumption(TLS12_SESSION_ID);
+}
+
+void test_resume_across_restart() {
+    SSL_CTX* serverCtx = makeServerCtx(TLS13_TICKETS);
+    TlsSessionCache retained = {};
+
+    {
+        PosixTls tls(&retained);
+        TEST_ASSERT_TRUE(tls.begin(verifyingOptions()));
+        TEST_ASSERT_TRUE(connectOnce(serverCtx, tls));
+        TEST_ASSERT_FALSE(tls.resumed());
+    }
+
+    // Deep sleep: only the retained bytes survive
+    TlsSessionCache afterWake;
+    memcpy(&afterWake, &retained, sizeof(afterWake));
+
+    PosixTls tls(&afterWake);
+    TEST_ASSERT_TRUE(tls.begin(verifyingOptions()));
+    TEST_ASSERT_TRUE(connectOnce(serverCtx, tls));
+    TEST_ASSERT_TRUE(tls.resumed());
+
+    SSL_CTX_free(serverCtx);
+}
+
+void test_unknown_session_falls_back_to_full() {
+    SSL_CTX* firstServer = makeServerCtx(TLS12_SESSION_ID);
+    TlsSessionCache cache = {};
+    PosixTls tls(&cache);
+    TEST_ASSERT_TRUE(tls.begin(verifyingOptions()));
+    TEST_ASSERT_TRUE(connectOnce(firstServer, tls));
+
+    // Restarted broker: the session is offered but no longer known
+    SSL_CTX* restartedServer = makeServerCtx(TLS12_SESSION_ID);
+    TEST_ASSERT_TRUE(connectOnce(restartedServer, tls));
+    TEST_ASSERT_FALSE(tls.resumed());
+    TEST_ASSERT_EQUAL(2, tls.handshakeStats().stats().full);
+
+    // ...and the new session is resumable
+    TEST_ASSERT_TRUE(connectOnce(restartedServer, tls));
+    TEST_ASSERT_TRUE(tls.resumed());
+
+    SSL_CTX_free(firstServer);
+    SSL_CTX_free(restartedServer);
+}
+
+void test_corrupt_session_is_dropped() {
+    SSL_CTX* serverCtx = makeServerCtx(TLS13_TICKETS);
+    TlsSessionCache cache = {};
+
+    // Valid checksum, but not a session the TLS library can parse
+    const uint8_t junk[] = {0x30, 0x03, 0x01, 0x02, 0x03};
+    TEST_ASSERT_TRUE(cache.store("localhost", 0, junk, sizeof(junk)));
+
+    PosixTls tls(&cache);
+    TEST_ASSERT_TRUE(tls.begin(verifyingOptions()));
+    TEST_ASSERT_TRUE(connectOnce(serverCtx, tls));
+    TEST_ASSERT_FALSE(tls.resumed());
+
+    size_t len = 0;
+    const uint8_t* blob = cache.load("localhost", 0, len);
+    TEST_ASSERT_NOT_NULL(blob);
+    TEST_ASSERT_TRUE(len > sizeof(junk));
+
+    SSL_CTX_free(serverCtx);
+}
+
+void test_untrusted_server_fails() {
+    SSL_CTX* serverCtx = makeServerCtx(TLS13_TICKETS);
+
+    // Trust a different certificate than the one the server presents
+    EVP_PKEY* otherKey = EVP_EC_gen("P-256");
+    X509* otherCert = makeCert(otherKey, "localhost");
+    std::string otherPem = toPem(otherCert);
+
+    TlsSessionCache cache = {};
+    PosixTls tls(&cache);
+    PosixTls::Options options;
+    options.caPem = otherPem.c_str();
+    TEST_ASSERT_TRUE(tls.begin(options));
+
+    TEST_ASSERT_FALSE(connectOnce(serverCtx, tls));
+    TEST_ASSERT_EQUAL(1, tls.handshakeStats().stats().failed);
+    TEST_ASSERT_FALSE(cache.valid());
+
+    X509_free(otherCert);
+    EVP_PKEY_free(otherKey);
+    SSL_CTX_free(serverCtx);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    // The stand-in writes close_notify to clients that may already be gone
+    signal(SIGPIPE, SIG_IGN);
+
+    serverKey = EVP_EC_gen("P-256");
+    serverCert = makeCert(serverKey, "localhost");
+    serverCertPem = toPem(serverCert);
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_cache_store_and_load);
+    RUN_TEST(test_cache_rejects_garbage);
+    RUN_TEST(test_cache_rejects_oversized);
+    RUN_TEST(test_handshake_stats);
+    RUN_TEST(test_resume_tls13_ticket);
+    RUN_TEST(test_resume_tls12_ticket);
+    RUN_TEST(test_resume_tls12_session_id);
+    RUN_TEST(test_resume_across_restart);
+    RUN_TEST(test_unknown_session_falls_back_to_full);
+    RUN_TEST(test_corrupt_session_is_dropped);
+    RUN_TEST(test_untrusted_server_fails);
+
+    int failures = UNITY_END();
+
+    X509_free(serverCert);
+    EVP_PKEY_free(serverKey);
+    return failures;
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttTlsClient.h>
+
+RTC_NOINIT_ATTR espmole::TlsSessionCache session;
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("MqttTlsClient compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * Tests for TraceWriter / TraceReader and the trace tools' analysis
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <MqttTrace.h>
+#include <TraceAnalysis.h>
+#include <TraceFile.h>
+
+using namespace espmole;
+
+static uint32_t fakeMicros = 0;
+
+static uint32_t fakeClock(void* ctx) {
+    (void)ctx;
+    return fakeMicros;
+}
+
+static bool bufferSink(const uint8_t* data, size_t len, void* ctx) {
+    auto* buf = static_cast<std::vector<uint8_t>*>(ctx);
+    buf->insert(buf->end(), data, data + len);
+    return true;
+}
+
+struct LimitedSink {
+    std::vector<uint8_t> buf;
+    size_t limit;
+};
+
+static bool limitedSink(const uint8_t* data, size_t len, void* ctx) {
+    auto* s = static_cast<LimitedSink*>(ctx);
+    size_t room = s->limit - s->buf.size();
+    size_t n = len < room ? len : room;
+    s->buf.insert(s->buf.end(), data, data + n);
+    return n == len;
+}
+
+static void record(TraceWriter& w, uint32_t us, TraceDirection dir, const char* topic,
+                   const char* payload) {
+    fakeMicros = us;
+    w.record(dir, topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), 0, false);
+}
+
+void test_round_trip_in_place() {
+    std::vector<uint8_t> buf;
+    TraceWriter w;
+    fakeMicros = 5000;
+    TEST_ASSERT_TRUE(w.begin(bufferSink, &buf, fakeClock));
+
+    fakeMicros = 5100;
+    const uint8_t payload[] = {'s', 't', 'a', 't', 'u', 's'};
+    TEST_ASSERT_TRUE(w.record(TRACE_IN, "espmole/dev/cmd", payload, sizeof(payload), 1, false));
+    fakeMicros = 7000;
+    TEST_ASSERT_TRUE(w.record(TRACE_OUT, "espmole/dev/status", nullptr, 0, 1, true));
+    TEST_ASSERT_EQUAL(2, w.stats().records);
+    TEST_ASSERT_EQUAL(buf.size(), w.stats().bytes);
+    TEST_ASSERT_EQUAL(sizeof(TraceFileHeader) + TraceWriter::recordSize(15, 6) +
+                      TraceWriter::recordSize(18, 0), buf.size());
+
+    TraceReader r(buf.data(), buf.size());
+    TEST_ASSERT_TRUE(r.valid());
+    TraceEvent e;
+    TEST_ASSERT_TRUE(r.next(e));
+    TEST_ASSERT_EQUAL(100, e.timeUs);
+    TEST_ASSERT_EQUAL(TRACE_IN, e.direction);
+    TEST_ASSERT_EQUAL(1, e.qos);
+    TEST_ASSERT_FALSE(e.retain);
+    TEST_ASSERT_EQUAL_STRING("espmole/dev/cmd", e.topic);
+    TEST_ASSERT_EQUAL_MEMORY(payload, e.payload, sizeof(payload));
+    // Views point into the buffer
+    TEST_ASSERT_TRUE(e.payload > buf.data() && e.payload < buf.data() + buf.size());
+
+    TEST_ASSERT_TRUE(r.next(e));
+    TEST_ASSERT_EQUAL(2000, e.timeUs);
+    TEST_ASSERT_EQUAL(TRACE_OUT, e.direction);
+    TEST_ASSERT_TRUE(e.retain);
+    TEST_ASSERT_EQUAL_STRING("espmole/dev/status", e.topic);
+    TEST_ASSERT_EQUAL(0, e.len);
+
+    TEST_ASSERT_FALSE(r.next(e));
+    TEST_ASSERT_FALSE(r.truncated());
+
+    r.rewind();
+    TEST_ASSERT_TRUE(r.next(e));
+    TEST_ASSERT_EQUAL_STRING("espmole/dev/cmd", e.topic);
+}
+
+void test_records_are_aligned() {
+    std::vector<uint8_t> buf;
+    TraceWriter w;
+    w.begin(bufferSink, &buf, fakeClock);
+    record(w, 0, TRACE_IN, "a", "x");
+    record(w, 0, TRACE_IN, "bb", "yyyyyyyyy");
+    TEST_ASSERT_EQUAL(0, buf.size() % 8);
+
+    size_t offset = sizeof(TraceFileHeader);
+    TraceReader r(buf.data(), buf.size());
+    TraceEvent e;
+    while (r.next(e)) {
+        const uint8_t* header = reinterpret_cast<const uint8_t*>(e.topic) - sizeof(TraceRecordHeader);
+        TEST_ASSERT_EQUAL(offset, static_cast<size_t>(header - buf.data()));
+        TEST_ASSERT_EQUAL(0, offset % 8);
+        offset += TraceWriter::recordSize(e.topicLen, e.len);
+    }
+}
+
+void test_clock_wrap() {
+    std::vector<uint8_t> buf;
+    TraceWriter w;
+    fakeMicros = 0xffffff00u;
+    w.begin(bufferSink, &buf, fakeClock);
+    record(w, 0xffffff80u, TRACE_IN, "t", "");
+    record(w, 0x00000100u, TRACE_IN, "t", "");    // Wrapped
+
+    TraceReader r(buf.data(), buf.size());
+    TraceEvent e;
+    TEST_ASSERT_TRUE(r.next(e));
+    TEST_ASSERT_EQUAL(0x80, e.timeUs);
+    TEST_ASSERT_TRUE(r.next(e));
+    TEST_ASSERT_EQUAL(0x200, e.timeUs);
+}
+
+void test_full_sink_leaves_readable_trace() {
+    LimitedSink sink;
+    sink.limit = sizeof(TraceFileHeader) + TraceWriter::recordSize(1, 1) + 20;
+    TraceWriter w;
+    w.begin(limitedSink, &sink, fakeClock);
+    record(w, 0, TRACE_IN, "a", "1");
+    record(w, 0, TRACE_IN, "b", "22222222222222222222");
+    TEST_ASSERT_FALSE(w.active());
+    record(w, 0, TRACE_IN, "c", "3");               // Ignored once stopped
+    TEST_ASSERT_EQUAL(1, w.stats().records);
+    TEST_ASSERT_EQUAL(1, w.stats().failed);
+
+    TraceReader r(sink.buf.data(), sink.buf.size());
+    TraceEvent e;
+    TEST_ASSERT_TRUE(r.next(e));
+    TEST_ASSERT_EQUAL_STRING("a", e.topic);
+    TEST_ASSERT_FALSE(r.next(e));
+    TEST_ASSERT_TRUE(r.truncated());
+}
+
+void test_reader_rejects_garbage() {
+    const uint8_t junk[32] = {'n', 'o', 'p', 'e'};
+    TraceReader r(junk, sizeof(junk));
+    TraceEvent e;
+    TEST_ASSERT_FALSE(r.valid());
+    TEST_ASSERT_FALSE(r.next(e));
+
+    TraceReader empty(nullptr, 0);
+    TEST_ASSERT_FALSE(empty.valid());
+
+    // A topic length pointing past the end
+    std::vector<uint8_t> buf;
+    TraceWriter w;
+    w.begin(bufferSink, &buf, fakeClock);
+    record(w, 0, TRACE_IN, "topic", "payload");
+    TraceRecordHeader h;
+    memcpy(&h, buf.data() + sizeof(TraceFileHeader), sizeof(h));
+    h.topicLen = 5000;
+    memcpy(buf.data() + sizeof(TraceFileHeader), &h, sizeof(h));
+    TraceReader bad(buf.data(), buf.size());
+    TEST_ASSERT_TRUE(bad.valid());
+    TEST_ASSERT_FALSE(bad.next(e));
+    TEST_ASSERT_TRUE(bad.truncated());
+}
+
+void test_summary_pairs_commands_per_device() {
+    std::vector<uint8_t> buf;
+    TraceWriter w;
+    fakeMicros = 0;
+    w.begin(bufferSink, &buf, fakeClock);
+    record(w, 0, TRACE_IN, "espmole/a/cmd", "status");
+    record(w, 100, TRACE_IN, "espmole/b/cmd", "status");
+    record(w, 150, TRACE_IN, "home/light", "on");            // User topic
+    record(w, 200, TRACE_OUT, "espmole/b/event", "x");       // Not a response
+    record(w, 1100, TRACE_OUT, "espmole/b/resp", "ok");      // b: 1000 us
+    record(w, 3000, TRACE_OUT, "espmole/a/resp", "ok");      // a: 3000 us
+    record(w, 4000, TRACE_IN, "espmole/a/cmd", "ping");      // Never answered
+
+    TraceReader r(buf.data(), buf.size());
+    TraceSummary s = summarizeTrace(r);
+    TEST_ASSERT_EQUAL(4, s.inbound);
+    TEST_ASSERT_EQUAL(3, s.outbound);
+    TEST_ASSERT_EQUAL(3, s.commands);
+    TEST_ASSERT_EQUAL(2, s.answered);
+    TEST_ASSERT_EQUAL(4000, s.durationUs);
+    TEST_ASSERT_EQUAL(1000, s.latencyMin);
+    TEST_ASSERT_EQUAL(3000, s.latencyMax);
+    TEST_ASSERT_EQUAL(2000, s.latencyAvg);
+    TEST_ASSERT_EQUAL(1000, s.latencyP50);
+    TEST_ASSERT_EQUAL(3000, s.latencyP99);
+    TEST_ASSERT_TRUE(s.rate(s.inbound) == 1000.0);
+}
+
+void test_mapped_file() {
+    char path[] = "/tmp/espmole-trace-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    FILE* f = fopen(path, "wb");
+    TraceWriter w;
+    w.begin(fileTraceSink, f, hostTraceClock);
+    for (int i = 0; i < 100; i++) {
+        record(w, 0, i % 2 ? TRACE_OUT : TRACE_IN, i % 2 ? "d/x/resp" : "d/x/cmd", "payload");
+    }
+    fclose(f);
+
+    MappedTrace trace;
+    TEST_ASSERT_TRUE(trace.open(path));
+    unlink(path);
+    TraceReader r = trace.reader();
+    TraceSummary s = summarizeTrace(r);
+    TEST_ASSERT_EQUAL(50, s.commands);
+    TEST_ASSERT_EQUAL(50, s.answered);
+    TEST_ASSERT_FALSE(s.truncated);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_round_trip_in_place);
+    RUN_TEST(test_records_are_aligned);
+    RUN_TEST(test_clock_wrap);
+    RUN_TEST(test_full_sink_leaves_readable_trace);
+    RUN_TEST(test_reader_rejects_garbage);
+    RUN_TEST(test_summary_pairs_commands_per_device);
+    RUN_TEST(test_mapped_file);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttTrace.h>
+
+static uint8_t traceBuf[1024];
+static size_t traceLen = 0;
+
+static bool ramSink(const uint8_t* data, size_t len, void* ctx) {
+    (void)ctx;
+    if (len > sizeof(traceBuf) - traceLen) return false;
+    memcpy(traceBuf + traceLen, data, len);
+    traceLen += len;
+    return true;
+}
+
+static uint32_t microsClock(void* ctx) {
+    (void)ctx;
+    return micros();
+}
+
+espmole::TraceWriter trace;
+
+void setup() {
+    Serial.begin(115200);
+    trace.begin(ramSink, nullptr, microsClock);
+    trace.record(espmole::TRACE_IN, "espmole/dev/cmd", reinterpret_cast<const uint8_t*>("status"), 6, 0, false);
+    Serial.println("MqttTrace compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * Tests for WorkScheduler (time-budgeted poll)
+ */
+
+#ifdef NATIVE_BUILD
+
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <MqttWork.h>
+
+using namespace espmole;
+
+/// Fake clock and tasks: each step costs `cost[task]` us and works off one unit
+struct Rig {
+    uint32_t clock = 0;
+    uint32_t backlog[4] = {};
+    uint32_t cost[4] = {10, 10, 10, 10};
+    uint32_t lastNow = 0;
+    std::string order;
+};
+
+static Rig rig;
+
+static uint32_t fakeMicros(void* ctx) {
+    return static_cast<Rig*>(ctx)->clock;
+}
+
+static bool step(uint8_t task, uint32_t now, void* ctx) {
+    Rig* r = static_cast<Rig*>(ctx);
+    r->lastNow = now;
+    r->clock += r->cost[task];
+    r->order += static_cast<char>('a' + task);
+    if (r->backlog[task] > 0) r->backlog[task]--;
+    return r->backlog[task] > 0;
+}
+
+static WorkScheduler make(uint8_t tasks) {
+    WorkScheduler w;
+    w.begin(tasks, step, &rig, fakeMicros);
+    return w;
+}
+
+void setUp() {
+    rig = Rig();
+}
+
+void tearDown() {}
+
+void test_single_pass_without_budget() {
+    WorkScheduler w = make(4);
+    rig.backlog[1] = 3;
+
+    // Budget 0: every task once, the backlog is reported
+    TEST_ASSERT_EQUAL(1, w.run(42, 0));
+    TEST_ASSERT_EQUAL_STRING("abcd", rig.order.c_str());
+    TEST_ASSERT_EQUAL(42, rig.lastNow);
+    TEST_ASSERT_TRUE(w.pending(1));
+    TEST_ASSERT_FALSE(w.pending(0));
+
+    TEST_ASSERT_EQUAL(1, w.run(43, 0));
+    TEST_ASSERT_EQUAL(0, w.run(44, 0));
+    TEST_ASSERT_EQUAL(0u, w.pending());
+    TEST_ASSERT_EQUAL(3, w.stats().calls);
+    TEST_ASSERT_EQUAL(12, w.stats().steps);
+    TEST_ASSERT_EQUAL(2, w.stats().deferred);
+}
+
+void test_budget_drains_backlog() {
+    WorkScheduler w = make(4);
+    rig.backlog[2] = 5;
+
+    // One pass (40 us), then the backlog alone
+    TEST_ASSERT_EQUAL(0, w.run(0, 1000));
+    TEST_ASSERT_EQUAL_STRING("abcdcccc", rig.order.c_str());
+    TEST_ASSERT_EQUAL(80, w.stats().lastCallUs);
+    TEST_ASSERT_EQUAL(0, w.stats().overBudget);
+}
+
+void test_budget_stops_and_resumes() {
+    WorkScheduler w = make(4);
+    rig.backlog[0] = 10;
+    rig.backlog[3] = 10;
+
+    // 35 us: four steps of 10 us, the last one overruns
+    TEST_ASSERT_EQUAL(2, w.run(0, 35));
+    TEST_ASSERT_EQUAL_STRING("abcd", rig.order.c_str());
+    TEST_ASSERT_EQUAL(1, w.stats().overBudget);
+
+    // Backlogged tasks alternate with the pass of the next call
+    rig.order.clear();
+    w.run(0, 55);
+    TEST_ASSERT_EQUAL_STRING("abcdad", rig.order.c_str());
+}
+
+void test_tight_budget_is_fair() {
+    WorkScheduler w = make(4);
+    rig.backlog[0] = 100;
+
+    // Budget smaller than one step: one step per call, round-robin
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_TRUE(w.run(0, 1) > 0);
+    }
+    TEST_ASSERT_EQUAL_STRING("abcdabcd", rig.order.c_str());
+    TEST_ASSERT_EQUAL(8, w.stats().overBudget);
+
+    // Tasks not reached are pending until they had their look
+    TEST_ASSERT_TRUE(w.pending(0));
+}
+
+void test_slow_step_is_recorded() {
+    WorkScheduler w = make(3);
+    rig.cost[1] = 700;
+
+    w.run(0, 500);
+    TEST_ASSERT_EQUAL(700, w.maxStepUs(1));
+    TEST_ASSERT_EQUAL(10, w.maxStepUs(0));
+    TEST_ASSERT_EQUAL(710, w.stats().maxCallUs);
+    TEST_ASSERT_EQUAL(1, w.stats().overBudget);
+
+    // The call after the overrun still starts where it left off
+    rig.order.clear();
+    rig.cost[1] = 10;
+    w.run(0, 500);
+    TEST_ASSERT_EQUAL_STRING("cab", rig.order.c_str());
+}
+
+void test_no_clock_or_tasks() {
+    WorkScheduler w;
+    TEST_ASSERT_EQUAL(0, w.run(0, 100));
+
+    // Without a clock a budget cannot be measured: single pass
+    w.begin(2, step, &rig, nullptr);
+    rig.backlog[0] = 3;
+    TEST_ASSERT_EQUAL(1, w.run(0, 100));
+    TEST_ASSERT_EQUAL_STRING("ab", rig.order.c_str());
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_single_pass_without_budget);
+    RUN_TEST(test_budget_drains_backlog);
+    RUN_TEST(test_budget_stops_and_resumes);
+    RUN_TEST(test_tight_budget_is_fair);
+    RUN_TEST(test_slow_step_is_recorded);
+    RUN_TEST(test_no_clock_or_tasks);
+
+    return UNITY_END();
+}
+
+#else
+
+// Arduino environment - basic compile test
+#include <Arduino.h>
+#include <MqttWork.h>
+
+espmole::WorkScheduler work;
+
+static bool step(uint8_t task, uint32_t now, void* ctx) {
+    (void)task;
+    (void)now;
+    (void)ctx;
+    return false;
+}
+
+static uint32_t microsClock(void* ctx) {
+    (void)ctx;
+    return micros();
+}
+
+void setup() {
+    Serial.begin(115200);
+    work.begin(2, step, nullptr, microsClock);
+    work.run(millis(), 1000);
+    Serial.println("MqttWork compile test passed");
+}
+
+void loop() {
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,254 @@
+#include "FleetProbe.h"
+
+#include <string.h>
+
+namespace espmole {
+
+namespace {
+
+/// "12.34" - microseconds as milliseconds
+std::string ms(uint32_t us) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%.2f", us / 1000.0);
+    return buf;
+}
+
+/// Does the comma-separated list contain `item`
+bool listHas(const std::string& list, const char* item) {
+    size_t n = strlen(item);
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        if (end - pos == n && list.compare(pos, n, item) == 0) return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+void printPercentiles(FILE* out, const char* name, const LatencyHistogram& h) {
+    fprintf(out, "  %-8s %9s %9s %9s %9s %9s\n", name,
+            ms(h.percentile(50)).c_str(), ms(h.percentile(90)).c_str(),
+            ms(h.percentile(99)).c_str(), ms(h.max()).c_str(), ms(h.mean()).c_str());
+}
+
+/// One row per power of two between the fastest and slowest sample
+void printHistogram(FILE* out, const LatencyHistogram& h) {
+    const size_t step = LatencyHistogram::SUB_BUCKETS;
+    const size_t rows = LatencyHistogram::BUCKETS / step;
+    uint32_t counts[LatencyHistogram::BUCKETS / LatencyHistogram::SUB_BUCKETS] = {};
+    uint32_t peak = 0;
+    size_t first = rows;
+    size_t last = 0;
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t i = 0; i < step; i++) {
+            counts[r] += h.bucket(r * step + i);
+        }
+        if (counts[r] == 0) continue;
+        if (r < first) first = r;
+        last = r;
+        if (counts[r] > peak) peak = counts[r];
+    }
+    if (first == rows) return;
+
+    for (size_t r = first; r <= last; r++) {
+        size_t bar = counts[r] * 40 / peak;
+        if (counts[r] > 0 && bar == 0) bar = 1;
+        uint32_t high = r + 1 < rows ? LatencyHistogram::bucketLow((r + 1) * step) : UINT32_MAX;
+        fprintf(out, bar ? "  %9s - %-9s %6lu  %s\n" : "  %9s - %-9s %6lu\n",
+                ms(LatencyHistogram::bucketLow(r * step)).c_str(), ms(high).c_str(),
+                static_cast<unsigned long>(counts[r]), std::string(bar, '#').c_str());
+    }
+}
+
+} // namespace
+
+FleetProbe::FleetProbe(const char* baseTopic)
+    : base_(baseTopic)
+    , replyFilter_(base_ + "/+/resp")
+    , statusFilter_(base_ + "/+/status") {
+}
+
+void FleetProbe::add(const char* deviceId) {
+    devices_[deviceId];
+}
+
+std::string FleetProbe::deviceOf(const char* topic, size_t len, const char* leaf) const {
+    size_t leafLen = strlen(leaf);
+    size_t min = base_.size() + 1 + 1 + 1 + leafLen;
+    if (len < min || base_.compare(0, base_.size(), topic, base_.size()) != 0 ||
+        topic[base_.size()] != '/' || topic[len - leafLen - 1] != '/' ||
+        memcmp(topic + len - leafLen, leaf, leafLen) != 0) {
+        return std::string();
+    }
+    std::string id(topic + base_.size() + 1, len - base_.size() - leafLen - 2);
+    return id.find('/') == std::string::npos ? id : std::string();
+}
+
+bool FleetProbe::onStatus(const mqtt::PublishView& msg) {
+    std::string id = deviceOf(msg.topic.data, msg.topic.len, "status");
+    if (id.empty() || msg.len == 0) return false;
+
+    std::string payload(reinterpret_cast<const char*>(msg.payload), msg.len);
+    if (payload.compare(0, 6, "online") != 0 || (payload.size() > 6 && payload[6] != ' ')) {
+        return false;
+    }
+
+    // Devices announcing capabilities must announce "probe"
+    size_t caps = payload.find(" caps=");
+    if (caps != std::string::npos) {
+        size_t start = caps + 6;
+        size_t end = payload.find(' ', start);
+        std::string list = payload.substr(start, end == std::string::npos ? end : end - start);
+        if (!listHas(list, "probe")) return false;
+    }
+
+    if (devices_.count(id)) return false;
+    devices_[id];
+    return true;
+}
+
+size_t FleetProbe::startRound(uint64_t nowUs, SendFn send, void* ctx) {
+    round_++;
+    char payload[32];
+    snprintf(payload, sizeof(payload), "$probe %lu", static_cast<unsigned long>(round_));
+
+    size_t sent = 0;
+    for (auto& entry : devices_) {
+        DeviceProbeStats& d = entry.second;
+        if (d.waiting) continue;
+        std::string topic = base_ + "/" + entry.first + "/cmd";
+        if (!send(topic.c_str(), payload, ctx)) continue;
+        d.waiting = true;
+        d.token = round_;
+        d.sentUs = nowUs;
+        d.sent++;
+        sent++;
+    }
+    return sent;
+}
+
+bool FleetProbe::onReply(const mqtt::PublishView& msg, uint64_t nowUs) {
+    std::string id = deviceOf(msg.topic.data, msg.topic.len, "resp");
+    auto it = id.empty() ? devices_.end() : devices_.find(id);
+    if (it == devices_.end()) return false;
+
+    ProbeReply reply;
+    if (!parseProbeReply(reinterpret_cast<const char*>(msg.payload), msg.len, reply)) {
+        return false;
+    }
+
+    DeviceProbeStats& d = it->second;
+    std::string token(reply.token, reply.tokenLen);
+    if (!d.waiting || token != std::to_string(d.token)) {
+        d.late++;
+        return true;
+    }
+
+    d.waiting = false;
+    d.received++;
+    uint32_t rtt = static_cast<uint32_t>(nowUs - d.sentUs);
+    uint32_t device = reply.snapshot.deviceUs();
+    if (device > rtt) device = rtt;     // Clock drift on very short round trips
+    d.rtt.add(rtt);
+    d.device.add(device);
+    d.network.add(rtt - device);
+
+    const ProbeSnapshot& s = reply.snapshot;
+    if (s.inflight > d.maxInflight) d.maxInflight = s.inflight;
+    if (s.batchBytes > d.maxBatch) d.maxBatch = s.batchBytes;
+    if (s.logLines > d.maxLog) d.maxLog = s.logLines;
+    if (s.mailbox > d.maxMailbox) d.maxMailbox = s.mailbox;
+    if (s.heapFree >= 0 && (d.minHeap < 0 || s.heapFree < d.minHeap)) d.minHeap = s.heapFree;
+    return true;
+}
+
+size_t FleetProbe::expire(uint64_t nowUs, uint64_t timeoutUs) {
+    size_t waiting = 0;
+    for (auto& entry : devices_) {
+        DeviceProbeStats& d = entry.second;
+        if (!d.waiting) continue;
+        if (nowUs - d.sentUs >= timeoutUs) {
+            d.waiting = false;
+            d.lost++;
+        } else {
+            waiting++;
+        }
+    }
+    return waiting;
+}
+
+DeviceProbeStats FleetProbe::fleet() const {
+    DeviceProbeStats f;
+    for (const auto& entry : devices_) {
+        const DeviceProbeStats& d = entry.second;
+        f.sent += d.sent;
+        f.received += d.received;
+        f.lost += d.lost;
+        f.late += d.late;
+        f.rtt.merge(d.rtt);
+        f.network.merge(d.network);
+        f.device.merge(d.device);
+    }
+    return f;
+}
+
+void FleetProbe::printReport(FILE* out) const {
+    fprintf(out, "%-20s %5s %5s %5s %9s %9s %9s %9s %9s %9s  %s\n",
+            "device", "sent", "recv", "lost", "rtt p50", "p99", "net p50", "p99",
+            "dev p50", "p99", "queues (worst)");
+    for (const auto& entry : devices_) {
+        const DeviceProbeStats& d = entry.second;
+        if (d.received == 0) {
+            fprintf(out, "%-20s %5lu %5lu %5lu %9s %9s %9s %9s %9s %9s  -\n",
+                    entry.first.c_str(),
+                    static_cast<unsigned long>(d.sent), 0UL,
+                    static_cast<unsigned long>(d.lost),
+                    "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+
+        char queues[96];
+        int n = snprintf(queues, sizeof(queues), "inflight=%u batch=%lu",
+                         static_cast<unsigned>(d.maxInflight),
+                         static_cast<unsigned long>(d.maxBatch));
+        if (d.maxLog >= 0) {
+            n += snprintf(queues + n, sizeof(queues) - n, " log=%ld", static_cast<long>(d.maxLog));
+        }
+        if (d.maxMailbox >= 0) {
+            n += snprintf(queues + n, sizeof(queues) - n, " mail=%ld",
+                          static_cast<long>(d.maxMailbox));
+        }
+        if (d.minHeap >= 0) {
+            snprintf(queues + n, sizeof(queues) - n, " heap>=%ld", static_cast<long>(d.minHeap));
+        }
+        fprintf(out, "%-20s %5lu %5lu %5lu %9s %9s %9s %9s %9s %9s  %s\n",
+                entry.first.c_str(),
+                static_cast<unsigned long>(d.sent),
+                static_cast<unsigned long>(d.received),
+                static_cast<unsigned long>(d.lost),
+                ms(d.rtt.percentile(50)).c_str(), ms(d.rtt.percentile(99)).c_str(),
+                ms(d.network.percentile(50)).c_str(), ms(d.network.percentile(99)).c_str(),
+                ms(d.device.percentile(50)).c_str(), ms(d.device.percentile(99)).c_str(),
+                queues);
+    }
+
+    DeviceProbeStats f = fleet();
+    fprintf(out, "\nfleet: %zu devices, %lu sent, %lu received, %lu lost, %lu late\n",
+            devices_.size(),
+            static_cast<unsigned long>(f.sent),
+            static_cast<unsigned long>(f.received),
+            static_cast<unsigned long>(f.lost),
+            static_cast<unsigned long>(f.late));
+    if (f.rtt.count() == 0) return;
+
+    fprintf(out, "  %-8s %9s %9s %9s %9s %9s   (ms)\n", "", "p50", "p90", "p99", "max", "mean");
+    printPercentiles(out, "rtt", f.rtt);
+    printPercentiles(out, "network", f.network);
+    printPercentiles(out, "device", f.device);
+
+    fprintf(out, "\nrtt histogram (ms)\n");
+    printHistogram(out, f.rtt);
+}
+
+} // namespace espmole
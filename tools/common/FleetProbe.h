@@ -0,0 +1,104 @@
+#ifndef ESPMOLE_FLEET_PROBE_H
+#define ESPMOLE_FLEET_PROBE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+
+#include <MqttCodec.h>
+#include <MqttProbe.h>
+
+namespace espmole {
+
+/**
+ * Round-trip figures of one device.
+ *
+ * rtt is measured on the host, device is tx - rx from the reply, and
+ * network is the difference: broker, Wi-Fi and TCP in both directions.
+ */
+struct DeviceProbeStats {
+    uint32_t sent = 0;
+    uint32_t received = 0;      ///< Answered within the timeout
+    uint32_t lost = 0;          ///< Not answered within the timeout
+    uint32_t late = 0;          ///< Answers to probes already counted lost
+    LatencyHistogram rtt;
+    LatencyHistogram network;
+    LatencyHistogram device;
+
+    // Queue depths, worst seen in replies
+    uint16_t maxInflight = 0;
+    uint32_t maxBatch = 0;
+    int32_t maxLog = -1;
+    int32_t maxMailbox = -1;
+    int32_t minHeap = -1;
+
+    // Probe in flight
+    bool waiting = false;
+    uint32_t token = 0;
+    uint64_t sentUs = 0;
+};
+
+/**
+ * Probes a set of devices in rounds and keeps per-device statistics.
+ *
+ * Each round sends "$probe <round>" to every device's command topic at
+ * once; a reply is matched to the round by its token, so a reply that
+ * arrives after its timeout is counted late rather than as a fast answer
+ * to the next round. Networking is the caller's; times are host micros.
+ */
+class FleetProbe {
+public:
+    /// Publishes one message; false if it could not be sent
+    using SendFn = bool (*)(const char* topic, const char* payload, void* ctx);
+
+    explicit FleetProbe(const char* baseTopic = "espmole");
+
+    /// Filters for the replies ("<base>/+/resp") and status ("<base>/+/status")
+    const char* replyFilter() const { return replyFilter_.c_str(); }
+    const char* statusFilter() const { return statusFilter_.c_str(); }
+
+    /// Probe this device
+    void add(const char* deviceId);
+
+    /**
+     * Add the device of a status message if it is online and announces the
+     * "probe" capability (or announces none).
+     *
+     * @return true if a device was added
+     */
+    bool onStatus(const mqtt::PublishView& msg);
+
+    /// Send the next round to every device not still waiting; returns probes sent
+    size_t startRound(uint64_t nowUs, SendFn send, void* ctx);
+
+    /// Apply a message from replyFilter(); false if it was not a probe reply
+    bool onReply(const mqtt::PublishView& msg, uint64_t nowUs);
+
+    /// Count probes older than timeoutUs as lost; returns probes still waiting
+    size_t expire(uint64_t nowUs, uint64_t timeoutUs);
+
+    size_t devices() const { return devices_.size(); }
+    const std::map<std::string, DeviceProbeStats>& stats() const { return devices_; }
+
+    /// All devices together
+    DeviceProbeStats fleet() const;
+
+    /// Per-device table, fleet percentiles and the fleet RTT histogram
+    void printReport(FILE* out) const;
+
+private:
+    std::string base_;
+    std::string replyFilter_;
+    std::string statusFilter_;
+    std::map<std::string, DeviceProbeStats> devices_;
+    uint32_t round_ = 0;
+
+    /// Device ID of "<base>/<id>/<leaf>", empty if the topic does not match
+    std::string deviceOf(const char* topic, size_t len, const char* leaf) const;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_FLEET_PROBE_H
@@ -0,0 +1,172 @@
+#include "PosixBrokerServer.h"
+#include "PosixMqttClient.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace espmole {
+
+namespace {
+
+uint32_t now32() {
+    return static_cast<uint32_t>(hostMillis());
+}
+
+} // namespace
+
+PosixBrokerServer::PosixBrokerServer(MicroBroker& broker)
+    : broker_(broker)
+{
+    for (size_t i = 0; i < MicroBroker::MAX_CLIENTS; i++) fds_[i] = -1;
+    broker_.begin(onSend, onClose, this);
+}
+
+PosixBrokerServer::~PosixBrokerServer() {
+    close();
+}
+
+bool PosixBrokerServer::listen(uint16_t port, const char* address) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (address != nullptr && inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        ::close(fd);
+        return false;
+    }
+
+    socklen_t addrLen = sizeof(addr);
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(fd, 8) != 0
+        || getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addrLen) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    listenFd_ = fd;
+    port_ = ntohs(addr.sin_port);
+    return true;
+}
+
+bool PosixBrokerServer::adopt(int fd) {
+    int handle = broker_.open(now32());
+    if (handle < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // Fails harmlessly on socketpairs
+    fds_[handle] = fd;
+    return true;
+}
+
+void PosixBrokerServer::loop(int timeoutMs) {
+    struct pollfd fds[MicroBroker::MAX_CLIENTS + 1];
+    int handles[MicroBroker::MAX_CLIENTS + 1];
+    nfds_t count = 0;
+
+    if (listenFd_ >= 0) {
+        fds[count] = {listenFd_, POLLIN, 0};
+        handles[count++] = -1;
+    }
+    for (size_t i = 0; i < MicroBroker::MAX_CLIENTS; i++) {
+        if (fds_[i] < 0) continue;
+        fds[count] = {fds_[i], POLLIN, 0};
+        handles[count++] = static_cast<int>(i);
+    }
+
+    if (poll(fds, count, timeoutMs) < 0 && errno != EINTR) {
+        return;
+    }
+
+    for (nfds_t i = 0; i < count; i++) {
+        if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+
+        int handle = handles[i];
+        if (handle < 0) {
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if (fd >= 0) adopt(fd);
+            continue;
+        }
+
+        // An earlier packet in this round may have closed it (takeover)
+        if (fds_[handle] != fds[i].fd) continue;
+
+        uint8_t buf[4096];
+        ssize_t n = recv(fds[i].fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            fds_[handle] = -1;
+            ::close(fds[i].fd);
+            broker_.closed(handle);
+            continue;
+        }
+        broker_.receive(handle, buf, static_cast<size_t>(n), now32());
+    }
+
+    broker_.poll(now32());
+}
+
+void PosixBrokerServer::close() {
+    for (size_t i = 0; i < MicroBroker::MAX_CLIENTS; i++) {
+        int fd = fds_[i];
+        if (fd < 0) continue;
+        fds_[i] = -1;
+        ::close(fd);
+        broker_.closed(static_cast<int>(i));
+    }
+    if (listenFd_ >= 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+    }
+}
+
+bool PosixBrokerServer::onSend(int client, const uint8_t* data, size_t len, void* ctx) {
+    PosixBrokerServer* self = static_cast<PosixBrokerServer*>(ctx);
+    int fd = self->fds_[client];
+    if (fd < 0) return false;
+
+    // Packets are small; wait briefly for buffer space rather than tearing one
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            data += n;
+            len -= static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && poll(&pfd, 1, 100) > 0) {
+            continue;
+        }
+
+        // Broken or stuck - the next loop() sees the hangup and reports it
+        shutdown(fd, SHUT_RDWR);
+        return false;
+    }
+    return true;
+}
+
+void PosixBrokerServer::onClose(int client, void* ctx) {
+    PosixBrokerServer* self = static_cast<PosixBrokerServer*>(ctx);
+    int fd = self->fds_[client];
+    if (fd < 0) return;
+    self->fds_[client] = -1;
+    ::close(fd);
+}
+
+} // namespace espmole
@@ -0,0 +1,68 @@
+#ifndef ESPMOLE_POSIX_BROKER_SERVER_H
+#define ESPMOLE_POSIX_BROKER_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <MqttMicroBroker.h>
+
+namespace espmole {
+
+/**
+ * poll()-based TCP front end for MicroBroker on Linux.
+ *
+ * Runs the same broker core as the device, so it can stand in for a
+ * broker-less ESP32 on the bench and drive the broker in tests.
+ * Single-threaded: call loop() repeatedly.
+ */
+class PosixBrokerServer {
+public:
+    explicit PosixBrokerServer(MicroBroker& broker);
+    ~PosixBrokerServer();
+
+    PosixBrokerServer(const PosixBrokerServer&) = delete;
+    PosixBrokerServer& operator=(const PosixBrokerServer&) = delete;
+
+    /**
+     * Listen for connections.
+     *
+     * @param port     TCP port, 0 picks a free one (see port())
+     * @param address  Local address to bind, nullptr = all
+     */
+    bool listen(uint16_t port, const char* address = nullptr);
+
+    /// Port actually bound
+    uint16_t port() const { return port_; }
+
+    /**
+     * Serve an already connected socket (e.g. one end of a socketpair).
+     * Takes ownership of `fd`.
+     *
+     * @return  false if the broker has no free slot (fd is closed)
+     */
+    bool adopt(int fd);
+
+    /**
+     * Accept, read and dispatch whatever is ready, then run the broker's
+     * keep-alive checks.
+     *
+     * @param timeoutMs  How long to wait for activity
+     */
+    void loop(int timeoutMs);
+
+    /// Close every connection and the listening socket
+    void close();
+
+private:
+    MicroBroker& broker_;
+    int listenFd_ = -1;
+    uint16_t port_ = 0;
+    int fds_[MicroBroker::MAX_CLIENTS];
+
+    static bool onSend(int client, const uint8_t* data, size_t len, void* ctx);
+    static void onClose(int client, void* ctx);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_POSIX_BROKER_SERVER_H
@@ -0,0 +1,304 @@
+#include "PosixMqttClient.h"
+#include "PosixTls.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace espmole {
+
+uint64_t hostMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+uint64_t hostMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+uint64_t hostEpochMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+PosixMqttClient::PosixMqttClient()
+    : rx_(mqtt::MAX_REMAINING_LENGTH + 8)
+{
+}
+
+PosixMqttClient::~PosixMqttClient() {
+    close();
+}
+
+bool PosixMqttClient::connect(const char* host, uint16_t port,
+                              const mqtt::ConnectOptions& options, int timeoutMs) {
+    close();
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", static_cast<unsigned>(port));
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        return false;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return start(fd, options, timeoutMs, serverName_ ? serverName_ : host, port);
+}
+
+bool PosixMqttClient::connectFd(int fd, const mqtt::ConnectOptions& options, int timeoutMs) {
+    return start(fd, options, timeoutMs, serverName_ ? serverName_ : "localhost", 0);
+}
+
+bool PosixMqttClient::start(int fd, const mqtt::ConnectOptions& options, int timeoutMs,
+                            const char* host, uint16_t port) {
+    close();
+    fd_ = fd;
+    rxLen_ = 0;
+    keepAlive_ = options.keepAlive;
+
+    if (tls_ && !tls_->handshake(fd, host, port, timeoutMs)) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    uint8_t buf[512];
+    size_t len = mqtt::encodeConnect(buf, sizeof(buf), options);
+    if (len == 0 || !sendAll(buf, len) || !waitFor(mqtt::CONNACK, 0, timeoutMs)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PosixMqttClient::close() {
+    if (fd_ < 0) return;
+
+    uint8_t buf[2];
+    size_t len = mqtt::encodeEmpty(buf, sizeof(buf), mqtt::DISCONNECT);
+    if (tls_) {
+        tls_->send(buf, len);
+        tls_->shutdown();
+    } else {
+        ::send(fd_, buf, len, MSG_NOSIGNAL);
+    }
+    ::close(fd_);
+    fd_ = -1;
+    rxLen_ = 0;
+}
+
+bool PosixMqttClient::subscribe(const char* filter, uint8_t qos, int timeoutMs) {
+    if (fd_ < 0) return false;
+
+    uint8_t buf[512];
+    uint16_t id = nextId();
+    size_t len = mqtt::encodeSubscribe(buf, sizeof(buf), id, filter, qos);
+    return len > 0 && sendAll(buf, len) && waitFor(mqtt::SUBACK, id, timeoutMs);
+}
+
+bool PosixMqttClient::publish(const char* topic, const uint8_t* payload, size_t len,
+                              uint8_t qos, bool retain) {
+    if (fd_ < 0 || qos > 1) return false;
+
+    std::vector<uint8_t> buf(len + strlen(topic) + 16);
+    size_t n = mqtt::encodePublish(buf.data(), buf.size(), topic, strlen(topic),
+                                   payload, len, qos, retain, qos > 0 ? nextId() : 0);
+    return n > 0 && sendAll(buf.data(), n);
+}
+
+int PosixMqttClient::loop(int timeoutMs) {
+    if (fd_ < 0) return -1;
+
+    if (keepAlive_ > 0 && hostMillis() - lastSend_ >= keepAlive_ * 1000ULL / 2) {
+        uint8_t ping[2];
+        size_t n = mqtt::encodeEmpty(ping, sizeof(ping), mqtt::PINGREQ);
+        if (!sendAll(ping, n)) return -1;
+    }
+
+    if (!readSome(timeoutMs)) {
+        return fd_ < 0 ? -1 : 0;
+    }
+    return dispatch(0, 0, nullptr);
+}
+
+bool PosixMqttClient::sendAll(const uint8_t* data, size_t len) {
+    if (tls_) {
+        if (!tls_->send(data, len)) {
+            close();
+            return false;
+        }
+        lastSend_ = hostMillis();
+        return true;
+    }
+
+    while (len > 0) {
+        ssize_t n = ::send(fd_, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close();
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    lastSend_ = hostMillis();
+    return true;
+}
+
+bool PosixMqttClient::readSome(int timeoutMs) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    // Data already decrypted by TLS does not show up on the socket
+    bool buffered = tls_ && tls_->pending() > 0;
+    if (!buffered && ::poll(&pfd, 1, timeoutMs) <= 0) return false;
+
+    if (rxLen_ == rx_.size()) {
+        // A packet larger than we accept - drop the connection
+        close();
+        return false;
+    }
+
+    if (tls_) {
+        int n = tls_->recv(rx_.data() + rxLen_, rx_.size() - rxLen_);
+        if (n < 0) {
+            close();
+            return false;
+        }
+        rxLen_ += static_cast<size_t>(n);
+        return n > 0;
+    }
+
+    ssize_t n = ::recv(fd_, rx_.data() + rxLen_, rx_.size() - rxLen_, 0);
+    if (n <= 0) {
+        if (n < 0 && errno == EINTR) return false;
+        close();
+        return false;
+    }
+    rxLen_ += static_cast<size_t>(n);
+    return true;
+}
+
+bool PosixMqttClient::waitFor(uint8_t type, uint16_t packetId, int timeoutMs) {
+    uint64_t deadline = hostMillis() + static_cast<uint64_t>(timeoutMs);
+    bool matched = false;
+
+    // Packets may already be buffered from an earlier read
+    if (dispatch(type, packetId, &matched) < 0) return false;
+
+    while (!matched) {
+        uint64_t now = hostMillis();
+        if (now >= deadline) return false;
+        if (!readSome(static_cast<int>(deadline - now)) && fd_ < 0) return false;
+        if (dispatch(type, packetId, &matched) < 0) return false;
+    }
+    return true;
+}
+
+int PosixMqttClient::dispatch(uint8_t waitType, uint16_t waitId, bool* matched) {
+    int messages = 0;
+    size_t offset = 0;
+
+    while (offset < rxLen_) {
+        mqtt::Packet packet;
+        int used = mqtt::parse(rx_.data() + offset, rxLen_ - offset, packet);
+        if (used < 0) {
+            close();
+            return -1;
+        }
+        if (used == 0) break;
+        offset += static_cast<size_t>(used);
+
+        switch (packet.type) {
+            case mqtt::PUBLISH: {
+                mqtt::PublishView msg;
+                if (!mqtt::decodePublish(packet, msg)) break;
+                if (msg.qos == 1) {
+                    uint8_t ack[4];
+                    size_t n = mqtt::encodeAck(ack, sizeof(ack), mqtt::PUBACK, msg.packetId);
+                    if (!sendAll(ack, n)) return -1;
+                }
+                if (handler_) handler_(msg, handlerCtx_);
+                messages++;
+                break;
+            }
+            case mqtt::CONNACK: {
+                bool sessionPresent = false;
+                uint8_t code = 0;
+                if (!mqtt::decodeConnack(packet, sessionPresent, code)
+                    || code != mqtt::CONNACK_ACCEPTED) {
+                    close();
+                    return -1;
+                }
+                if (matched && waitType == mqtt::CONNACK) *matched = true;
+                break;
+            }
+            case mqtt::PUBACK:
+                pubacks_++;
+                break;
+            case mqtt::SUBACK: {
+                uint16_t id = 0;
+                if (matched && waitType == mqtt::SUBACK
+                    && mqtt::decodePacketId(packet, id) && id == waitId) {
+                    // 0x80 in the return code means the broker refused it
+                    if (packet.body[2] == 0x80) {
+                        close();
+                        return -1;
+                    }
+                    *matched = true;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (fd_ >= 0 && offset > 0) {
+        memmove(rx_.data(), rx_.data() + offset, rxLen_ - offset);
+        rxLen_ -= offset;
+    }
+    return messages;
+}
+
+uint16_t PosixMqttClient::nextId() {
+    uint16_t id = nextPacketId_++;
+    if (nextPacketId_ == 0) nextPacketId_ = 1;
+    return id;
+}
+
+} // namespace espmole
@@ -0,0 +1,121 @@
+#ifndef ESPMOLE_POSIX_MQTT_CLIENT_H
+#define ESPMOLE_POSIX_MQTT_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include <MqttCodec.h>
+
+namespace espmole {
+
+class PosixTls;
+
+/**
+ * Small blocking MQTT 3.1.1 client for the host-side tools.
+ *
+ * Single-threaded: call loop() regularly (or when fd() is readable) to
+ * receive messages and keep the connection alive. QoS 1 publishes are
+ * acknowledged, QoS 2 is not supported. With useTls() the connection
+ * runs over TLS.
+ */
+class PosixMqttClient {
+public:
+    /// Called for every PUBLISH received - views are valid during the call only
+    using MessageHandler = void (*)(const mqtt::PublishView& msg, void* ctx);
+
+    PosixMqttClient();
+    ~PosixMqttClient();
+
+    PosixMqttClient(const PosixMqttClient&) = delete;
+    PosixMqttClient& operator=(const PosixMqttClient&) = delete;
+
+    /**
+     * Open a TCP connection and perform the MQTT handshake.
+     *
+     * @return  true once CONNACK accepted the connection
+     */
+    bool connect(const char* host, uint16_t port, const mqtt::ConnectOptions& options,
+                 int timeoutMs = 5000);
+
+    /**
+     * Perform the MQTT handshake over an already connected socket
+     * (e.g. one end of a socketpair in tests). Takes ownership of `fd`.
+     */
+    bool connectFd(int fd, const mqtt::ConnectOptions& options, int timeoutMs = 5000);
+
+    /// Send DISCONNECT (if connected) and close the socket
+    void close();
+
+    /**
+     * Run TLS over connections opened from now on (nullptr = plain TCP).
+     *
+     * @param tls         TLS session, owned by the caller
+     * @param serverName  Name to verify and resume sessions for; connect()
+     *                    uses its host argument when this is nullptr
+     */
+    void useTls(PosixTls* tls, const char* serverName = nullptr) {
+        tls_ = tls;
+        serverName_ = serverName;
+    }
+
+    bool connected() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+
+    void onMessage(MessageHandler handler, void* ctx) {
+        handler_ = handler;
+        handlerCtx_ = ctx;
+    }
+
+    /// Subscribe and wait for SUBACK
+    bool subscribe(const char* filter, uint8_t qos = 0, int timeoutMs = 5000);
+
+    /// Publish at QoS 0 or 1 (QoS 1 does not wait for PUBACK)
+    bool publish(const char* topic, const uint8_t* payload, size_t len,
+                 uint8_t qos = 0, bool retain = false);
+
+    /**
+     * Receive and dispatch pending packets, send PINGREQ when due.
+     *
+     * @param timeoutMs  How long to wait for data (0 = don't block)
+     * @return           Messages dispatched, or -1 if the connection was lost
+     */
+    int loop(int timeoutMs);
+
+    /// PUBACKs received for QoS 1 publishes
+    uint32_t pubacks() const { return pubacks_; }
+
+private:
+    int fd_ = -1;
+    PosixTls* tls_ = nullptr;
+    const char* serverName_ = nullptr;
+    std::vector<uint8_t> rx_;
+    size_t rxLen_ = 0;
+    uint16_t nextPacketId_ = 1;
+    uint16_t keepAlive_ = 0;
+    uint64_t lastSend_ = 0;
+    uint32_t pubacks_ = 0;
+    MessageHandler handler_ = nullptr;
+    void* handlerCtx_ = nullptr;
+
+    bool start(int fd, const mqtt::ConnectOptions& options, int timeoutMs,
+               const char* host, uint16_t port);
+    bool sendAll(const uint8_t* data, size_t len);
+    bool readSome(int timeoutMs);
+    bool waitFor(uint8_t type, uint16_t packetId, int timeoutMs);
+    int dispatch(uint8_t waitType, uint16_t waitId, bool* matched);
+    uint16_t nextId();
+};
+
+/// Monotonic milliseconds for the host tools
+uint64_t hostMillis();
+
+/// Monotonic microseconds, for latency measurements
+uint64_t hostMicros();
+
+/// Wall-clock milliseconds since the Unix epoch
+uint64_t hostEpochMillis();
+
+} // namespace espmole
+
+#endif // ESPMOLE_POSIX_MQTT_CLIENT_H
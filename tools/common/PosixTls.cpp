@@ -0,0 +1,233 @@
+#include "PosixTls.h"
+
+#include <errno.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "PosixMqttClient.h"
+
+namespace espmole {
+
+namespace {
+
+void setTimeout(int fd, int timeoutMs) {
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Socket BIO that writes with MSG_NOSIGNAL like the plain TCP path, so a
+// closed peer is an error instead of SIGPIPE
+int bioWrite(BIO* bio, const char* data, int len) {
+    BIO_clear_retry_flags(bio);
+    ssize_t n = ::send(static_cast<int>(BIO_get_fd(bio, nullptr)), data,
+                       static_cast<size_t>(len), MSG_NOSIGNAL);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        BIO_set_retry_write(bio);
+    }
+    return static_cast<int>(n);
+}
+
+BIO_METHOD* noSigpipeMethod() {
+    static BIO_METHOD* method = [] {
+        const BIO_METHOD* base = BIO_s_socket();
+        BIO_METHOD* m = BIO_meth_new(BIO_TYPE_SOCKET, "espmole socket");
+        BIO_meth_set_write(m, bioWrite);
+        BIO_meth_set_read(m, BIO_meth_get_read(base));
+        BIO_meth_set_puts(m, BIO_meth_get_puts(base));
+        BIO_meth_set_ctrl(m, BIO_meth_get_ctrl(base));
+        BIO_meth_set_create(m, BIO_meth_get_create(base));
+        BIO_meth_set_destroy(m, BIO_meth_get_destroy(base));
+        return m;
+    }();
+    return method;
+}
+
+bool loadCaPem(SSL_CTX* ctx, const char* pem) {
+    BIO* bio = BIO_new_mem_buf(pem, -1);
+    if (!bio) return false;
+
+    X509_STORE* store = SSL_CTX_get_cert_store(ctx);
+    int loaded = 0;
+    while (X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+        if (X509_STORE_add_cert(store, cert) == 1) loaded++;
+        X509_free(cert);
+    }
+    ERR_clear_error();
+    BIO_free(bio);
+    return loaded > 0;
+}
+
+} // namespace
+
+PosixTls::PosixTls(TlsSessionCache* cache)
+    : ownCache_(cache ? nullptr : new TlsSessionCache())
+    , cache_(cache ? cache : ownCache_)
+{
+}
+
+PosixTls::~PosixTls() {
+    shutdown();
+    if (ctx_) SSL_CTX_free(ctx_);
+    delete ownCache_;
+}
+
+bool PosixTls::begin(const Options& options) {
+    if (ctx_) SSL_CTX_free(ctx_);
+    ctx_ = SSL_CTX_new(TLS_client_method());
+    if (!ctx_) return false;
+
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+
+    // Return to the caller's poll() when a record carried no application data
+    SSL_CTX_clear_mode(ctx_, SSL_MODE_AUTO_RETRY);
+
+    // Sessions go to the cache through the callback only
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx_, onNewSession);
+
+    if (!options.verify) {
+        SSL_CTX_set_verify(ctx_, SSL_VERIFY_NONE, nullptr);
+        return true;
+    }
+
+    SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+    bool ok;
+    if (options.caPem) {
+        ok = loadCaPem(ctx_, options.caPem);
+    } else if (options.caFile) {
+        ok = SSL_CTX_load_verify_locations(ctx_, options.caFile, nullptr) == 1;
+    } else {
+        ok = SSL_CTX_set_default_verify_paths(ctx_) == 1;
+    }
+    return ok;
+}
+
+// =============================================================================
+// Connection
+// =============================================================================
+
+bool PosixTls::handshake(int fd, const char* host, uint16_t port, int timeoutMs) {
+    shutdown();
+    resumed_ = false;
+    if (!ctx_) return false;
+
+    ssl_ = SSL_new(ctx_);
+    if (!ssl_) return false;
+    host_ = host;
+    port_ = port;
+    SSL_set_app_data(ssl_, this);
+    BIO* bio = BIO_new(noSigpipeMethod());
+    if (!bio) {
+        SSL_free(ssl_);
+        ssl_ = nullptr;
+        return false;
+    }
+    BIO_set_fd(bio, fd, BIO_NOCLOSE);
+    SSL_set_bio(ssl_, bio, bio);
+    SSL_set_tlsext_host_name(ssl_, host);
+    if (SSL_CTX_get_verify_mode(ctx_) & SSL_VERIFY_PEER) {
+        SSL_set1_host(ssl_, host);
+    }
+
+    // Offer the cached session - the server decides whether to resume
+    bool offered = false;
+    size_t len = 0;
+    const uint8_t* blob = cache_->load(host, port, len);
+    if (blob) {
+        const unsigned char* p = blob;
+        SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &p, static_cast<long>(len));
+        offered = session != nullptr && SSL_set_session(ssl_, session) == 1;
+        if (session) SSL_SESSION_free(session);
+        if (!offered) cache_->clear();
+    }
+
+    setTimeout(fd, timeoutMs);
+    uint64_t start = hostMillis();
+    int ret = SSL_connect(ssl_);
+    uint32_t elapsed = static_cast<uint32_t>(hostMillis() - start);
+    setTimeout(fd, 0);
+
+    if (ret != 1) {
+        // A session the server chokes on must not be offered again
+        if (offered) cache_->clear();
+        ERR_clear_error();
+        stats_.noteFailure();
+        SSL_free(ssl_);
+        ssl_ = nullptr;
+        return false;
+    }
+
+    resumed_ = SSL_session_reused(ssl_) == 1;
+    stats_.noteHandshake(resumed_, elapsed);
+    return true;
+}
+
+int PosixTls::onNewSession(SSL* ssl, SSL_SESSION* session) {
+    PosixTls* self = static_cast<PosixTls*>(SSL_get_app_data(ssl));
+    if (!self) return 0;
+
+    int len = i2d_SSL_SESSION(session, nullptr);
+    if (len <= 0 || static_cast<size_t>(len) > TlsSessionCache::SESSION_MAX) {
+        return 0;
+    }
+    unsigned char* p = self->cache_->buffer();
+    i2d_SSL_SESSION(session, &p);
+    self->cache_->commit(self->host_.c_str(), self->port_, static_cast<size_t>(len));
+
+    // The serialized copy is all we keep
+    return 0;
+}
+
+void PosixTls::shutdown() {
+    if (!ssl_) return;
+    SSL_shutdown(ssl_);
+    ERR_clear_error();
+    SSL_free(ssl_);
+    ssl_ = nullptr;
+}
+
+// =============================================================================
+// Data
+// =============================================================================
+
+bool PosixTls::send(const uint8_t* data, size_t len) {
+    if (!ssl_) return false;
+
+    while (len > 0) {
+        size_t written = 0;
+        if (SSL_write_ex(ssl_, data, len, &written) != 1) {
+            ERR_clear_error();
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+int PosixTls::recv(uint8_t* buf, size_t len) {
+    if (!ssl_) return -1;
+
+    size_t got = 0;
+    if (SSL_read_ex(ssl_, buf, len, &got) == 1) {
+        return static_cast<int>(got);
+    }
+    int err = SSL_get_error(ssl_, 0);
+    ERR_clear_error();
+    // Post-handshake messages (TLS 1.3 tickets) carry no application data
+    return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? 0 : -1;
+}
+
+size_t PosixTls::pending() const {
+    return ssl_ ? static_cast<size_t>(SSL_pending(ssl_)) : 0;
+}
+
+} // namespace espmole
@@ -0,0 +1,87 @@
+#ifndef ESPMOLE_POSIX_TLS_H
+#define ESPMOLE_POSIX_TLS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include <MqttTlsSession.h>
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+typedef struct ssl_session_st SSL_SESSION;
+
+namespace espmole {
+
+/**
+ * OpenSSL client side of PosixMqttClient, with session resumption.
+ *
+ * Uses the same TlsSessionCache and TlsHandshakeStats as the device
+ * client, so resumption (TLS 1.3 tickets, TLS 1.2 tickets or session IDs)
+ * and its handshake times can be measured on Linux. TLS 1.3 tickets arrive
+ * after the handshake and are cached once the first record is read.
+ */
+class PosixTls {
+public:
+    struct Options {
+        const char* caFile = nullptr;   ///< PEM file with trusted roots
+        const char* caPem = nullptr;    ///< PEM string with trusted roots
+        bool verify = true;             ///< Verify the certificate chain and host name
+    };
+
+    /**
+     * @param cache  Session cache (nullptr = keep one in this object)
+     */
+    explicit PosixTls(TlsSessionCache* cache = nullptr);
+    ~PosixTls();
+
+    PosixTls(const PosixTls&) = delete;
+    PosixTls& operator=(const PosixTls&) = delete;
+
+    /// Create the TLS context; false if the CA could not be loaded
+    bool begin(const Options& options);
+
+    /**
+     * Handshake over a connected blocking socket, offering the cached
+     * session for host:port.
+     */
+    bool handshake(int fd, const char* host, uint16_t port, int timeoutMs);
+
+    /// Send all of `len` bytes; false on error
+    bool send(const uint8_t* data, size_t len);
+
+    /**
+     * Read decrypted data.
+     *
+     * @return  Bytes read, 0 if only handshake records arrived, -1 on close/error
+     */
+    int recv(uint8_t* buf, size_t len);
+
+    /// Decrypted bytes buffered inside OpenSSL
+    size_t pending() const;
+
+    /// Send close_notify and free the connection (the socket stays open)
+    void shutdown();
+
+    /// true if the last handshake resumed a cached session
+    bool resumed() const { return resumed_; }
+
+    const TlsHandshakeStats& handshakeStats() const { return stats_; }
+    TlsSessionCache& sessionCache() { return *cache_; }
+
+private:
+    TlsSessionCache* ownCache_;
+    TlsSessionCache* cache_;
+    TlsHandshakeStats stats_;
+    SSL_CTX* ctx_ = nullptr;
+    SSL* ssl_ = nullptr;
+    std::string host_;
+    uint16_t port_ = 0;
+    bool resumed_ = false;
+
+    static int onNewSession(SSL* ssl, SSL_SESSION* session);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_POSIX_TLS_H
@@ -0,0 +1,147 @@
+#include "StatusAggregator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace espmole {
+
+StatusAggregator::StatusAggregator(StatusIndex& index, const char* baseTopic)
+    : index_(index)
+    , base_(baseTopic)
+    , filter_(std::string(baseTopic) + "/+/status")
+{
+}
+
+bool StatusAggregator::onMessage(const mqtt::PublishView& msg, uint64_t now) {
+    // Topic must be exactly "<base>/<id>/status"
+    const char* topic = msg.topic.data;
+    size_t len = msg.topic.len;
+    static const char SUFFIX[] = "/status";
+    const size_t suffixLen = sizeof(SUFFIX) - 1;
+
+    if (len <= base_.size() + 1 + suffixLen
+        || strncmp(topic, base_.data(), base_.size()) != 0
+        || topic[base_.size()] != '/'
+        || strncmp(topic + len - suffixLen, SUFFIX, suffixLen) != 0) {
+        return false;
+    }
+
+    const char* id = topic + base_.size() + 1;
+    size_t idLen = len - base_.size() - 1 - suffixLen;
+    if (memchr(id, '/', idLen) != nullptr) {
+        return false;
+    }
+
+    stats_.messages++;
+
+    if (msg.len == 0) {
+        // Retained status cleared - device decommissioned
+        if (index_.remove(id, idLen)) stats_.removed++;
+        return true;
+    }
+
+    // "<state> [caps=a,b,c] ..."
+    const char* p = reinterpret_cast<const char*>(msg.payload);
+    const char* end = p + msg.len;
+    const char* word = p;
+    while (p < end && *p != ' ') p++;
+    size_t wordLen = static_cast<size_t>(p - word);
+
+    DeviceState state = DeviceState::Unknown;
+    if (wordLen == 6 && strncmp(word, "online", 6) == 0) {
+        state = DeviceState::Online;
+    } else if (wordLen == 7 && strncmp(word, "offline", 7) == 0) {
+        state = DeviceState::Offline;
+    }
+
+    uint32_t caps = 0;
+    while (p < end) {
+        while (p < end && *p == ' ') p++;
+        word = p;
+        while (p < end && *p != ' ') p++;
+        if (p - word > 5 && strncmp(word, "caps=", 5) == 0) {
+            const char* c = word + 5;
+            while (c < p) {
+                const char* name = c;
+                while (c < p && *c != ',') c++;
+                caps |= StatusIndex::capabilityBit(name, static_cast<size_t>(c - name));
+                if (c < p) c++;
+            }
+        }
+    }
+
+    // Retained replays after a restart carry no new information if the
+    // snapshot already has the same state - keep the original lastSeen
+    const DeviceRecord* rec = index_.find(id, idLen);
+    if (msg.retain && rec && rec->state == static_cast<uint8_t>(state)
+        && rec->capabilities == caps) {
+        stats_.retainedSkipped++;
+        return true;
+    }
+
+    if (!index_.update(id, idLen, state, caps, now)) {
+        stats_.rejected++;
+    }
+    return true;
+}
+
+std::string StatusAggregator::describe(const DeviceRecord& rec, uint64_t now) const {
+    char line[160];
+    snprintf(line, sizeof(line), "%s %s seen=%llus changed=%llus caps=%s\n",
+             rec.id,
+             StatusIndex::stateName(static_cast<DeviceState>(rec.state)),
+             static_cast<unsigned long long>(now > rec.lastSeen ? (now - rec.lastSeen) / 1000 : 0),
+             static_cast<unsigned long long>(now > rec.changed ? (now - rec.changed) / 1000 : 0),
+             StatusIndex::capabilityNames(rec.capabilities).c_str());
+    return line;
+}
+
+std::string StatusAggregator::query(const char* line, uint64_t now) const {
+    char cmd[16] = {0};
+    char arg[64] = {0};
+    unsigned long limit = 0;
+    int n = sscanf(line, "%15s %63s %lu", cmd, arg, &limit);
+    if (n < 1) {
+        return "error: empty query\n";
+    }
+
+    if (strcmp(cmd, "get") == 0) {
+        if (n < 2) return "error: usage get <device-id>\n";
+        const DeviceRecord* rec = index_.find(arg, strlen(arg));
+        return rec ? describe(*rec, now) : std::string("error: unknown device\n");
+    }
+
+    if (strcmp(cmd, "count") == 0) {
+        char out[96];
+        size_t total = index_.size();
+        size_t online = index_.online();
+        snprintf(out, sizeof(out), "total=%zu online=%zu other=%zu\n",
+                 total, online, total - online);
+        return out;
+    }
+
+    if (strcmp(cmd, "list") == 0) {
+        DeviceState want = DeviceState::Online;
+        bool all = false;
+        if (n >= 2) {
+            if (strcmp(arg, "offline") == 0) want = DeviceState::Offline;
+            else if (strcmp(arg, "all") == 0) all = true;
+            else if (strcmp(arg, "online") != 0) return "error: usage list [online|offline|all] [limit]\n";
+        }
+
+        std::string out;
+        size_t listed = 0;
+        index_.forEach([&](const DeviceRecord& rec) {
+            if (!all && rec.state != static_cast<uint8_t>(want)) return true;
+            out += describe(rec, now);
+            listed++;
+            return limit == 0 || listed < limit;
+        });
+        return out.empty() ? std::string("none\n") : out;
+    }
+
+    return "error: unknown query\n";
+}
+
+} // namespace espmole
@@ -0,0 +1,66 @@
+#ifndef ESPMOLE_STATUS_AGGREGATOR_H
+#define ESPMOLE_STATUS_AGGREGATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include <MqttCodec.h>
+#include "StatusIndex.h"
+
+namespace espmole {
+
+/**
+ * Feeds `<base>/+/status` messages into a StatusIndex and answers
+ * line-based queries about it.
+ *
+ * Status payloads are the birth/LWT messages published by MqttTransport:
+ * the first word is the state (`online` / `offline`), an optional
+ * `caps=a,b,c` word lists capabilities. An empty retained payload removes
+ * the device.
+ *
+ * Queries (one per line):
+ * - `get <device-id>`                    - one device
+ * - `list [online|offline|all] [limit]`  - devices, one per line
+ * - `count`                              - total / online / offline
+ */
+class StatusAggregator {
+public:
+    struct Stats {
+        uint64_t messages = 0;          ///< Status messages received
+        uint64_t retainedSkipped = 0;   ///< Retained replays that changed nothing
+        uint64_t removed = 0;
+        uint64_t rejected = 0;          ///< Bad topic or device ID
+    };
+
+    StatusAggregator(StatusIndex& index, const char* baseTopic = "espmole");
+
+    /// Subscription filter for the status topics ("<base>/+/status")
+    const char* filter() const { return filter_.c_str(); }
+
+    /**
+     * Apply one message. Messages on other topics are ignored.
+     *
+     * @param msg  Received PUBLISH
+     * @param now  Epoch ms
+     * @return     true if the message was a status message
+     */
+    bool onMessage(const mqtt::PublishView& msg, uint64_t now);
+
+    /// Answer a query line; the result ends with a newline
+    std::string query(const char* line, uint64_t now) const;
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    StatusIndex& index_;
+    std::string base_;
+    std::string filter_;
+    Stats stats_;
+
+    std::string describe(const DeviceRecord& rec, uint64_t now) const;
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_STATUS_AGGREGATOR_H
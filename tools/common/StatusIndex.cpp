@@ -0,0 +1,334 @@
+#include "StatusIndex.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace espmole {
+
+namespace {
+
+const char MAGIC[8] = {'E', 'S', 'P', 'M', 'I', 'D', 'X', '1'};
+constexpr uint32_t VERSION = 1;
+constexpr size_t MIN_CAPACITY = 16;     // Keeps the tag array a multiple of 64 bytes
+
+/// Capability names as announced by MqttTransport (bit = position)
+const char* const CAPABILITIES[] = {
+    "qos1",
+    "journal",
+    "filter",
+    "sched",
+    "mailbox",
+    "log",
+    "mem",
+    "probe",
+    "term",
+    "time",
+    "selftest",
+};
+constexpr size_t CAPABILITY_COUNT = sizeof(CAPABILITIES) / sizeof(CAPABILITIES[0]);
+static_assert(CAPABILITY_COUNT <= 32, "capabilities are a 32-bit mask");
+
+size_t roundCapacity(size_t capacity) {
+    size_t c = MIN_CAPACITY;
+    while (c < capacity) c <<= 1;
+    return c;
+}
+
+} // namespace
+
+StatusIndex::~StatusIndex() {
+    close();
+}
+
+// =============================================================================
+// Mapping
+// =============================================================================
+
+size_t StatusIndex::bytesFor(size_t capacity) {
+    return sizeof(Header) + capacity * sizeof(uint32_t) + capacity * sizeof(DeviceRecord);
+}
+
+bool StatusIndex::open(const char* path, size_t capacity) {
+    close();
+
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    path_ = path;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+        Header hdr;
+        if (pread(fd, &hdr, sizeof(hdr), 0) == static_cast<ssize_t>(sizeof(hdr))
+            && memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) == 0
+            && hdr.version == VERSION
+            && hdr.recordSize == sizeof(DeviceRecord)
+            && hdr.capacity >= MIN_CAPACITY
+            && (hdr.capacity & (hdr.capacity - 1)) == 0
+            && static_cast<size_t>(st.st_size) == bytesFor(hdr.capacity)) {
+            return map(fd, static_cast<size_t>(hdr.capacity), false);
+        }
+    }
+
+    // New or unusable file - start empty
+    capacity = roundCapacity(capacity);
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, static_cast<off_t>(bytesFor(capacity))) != 0) {
+        ::close(fd);
+        return false;
+    }
+    return map(fd, capacity, true);
+}
+
+bool StatusIndex::openInMemory(size_t capacity) {
+    close();
+    path_.clear();
+    return map(-1, roundCapacity(capacity), true);
+}
+
+bool StatusIndex::map(int fd, size_t capacity, bool fresh) {
+    size_t len = bytesFor(capacity);
+    void* p = fd >= 0
+        ? mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    base_ = static_cast<uint8_t*>(p);
+    mapLen_ = len;
+    fd_ = fd;
+    bind();
+
+    if (fresh) {
+        memset(hdr_, 0, sizeof(Header));
+        memcpy(hdr_->magic, MAGIC, sizeof(MAGIC));
+        hdr_->version = VERSION;
+        hdr_->recordSize = sizeof(DeviceRecord);
+        hdr_->capacity = capacity;
+    }
+    return true;
+}
+
+void StatusIndex::bind() {
+    hdr_ = reinterpret_cast<Header*>(base_);
+    size_t capacity = static_cast<size_t>(hdr_->capacity);
+    if (capacity == 0) {
+        // Fresh mapping - header not written yet
+        capacity = (mapLen_ - sizeof(Header)) / (sizeof(uint32_t) + sizeof(DeviceRecord));
+    }
+    tags_ = reinterpret_cast<uint32_t*>(base_ + sizeof(Header));
+    recs_ = reinterpret_cast<DeviceRecord*>(base_ + sizeof(Header) + capacity * sizeof(uint32_t));
+}
+
+void StatusIndex::close() {
+    if (base_) {
+        if (fd_ >= 0) msync(base_, mapLen_, MS_SYNC);
+        munmap(base_, mapLen_);
+    }
+    if (fd_ >= 0) ::close(fd_);
+
+    base_ = nullptr;
+    mapLen_ = 0;
+    fd_ = -1;
+    hdr_ = nullptr;
+    tags_ = nullptr;
+    recs_ = nullptr;
+}
+
+bool StatusIndex::sync() {
+    if (!base_ || fd_ < 0) return true;
+    return msync(base_, mapLen_, MS_SYNC) == 0;
+}
+
+bool StatusIndex::grow() {
+    size_t newCapacity = capacity() * 2;
+
+    // Keep the old table until the new one is fully built
+    uint8_t* oldBase = base_;
+    size_t oldLen = mapLen_;
+    int oldFd = fd_;
+    uint32_t* oldTags = tags_;
+    DeviceRecord* oldRecs = recs_;
+    size_t oldCapacity = capacity();
+
+    std::string tmp;
+    int fd = -1;
+    if (oldFd >= 0) {
+        tmp = path_ + ".tmp";
+        fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(bytesFor(newCapacity))) != 0) {
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+    }
+
+    if (!map(fd, newCapacity, true)) {
+        base_ = oldBase;
+        mapLen_ = oldLen;
+        fd_ = oldFd;
+        bind();
+        return false;
+    }
+
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (oldTags[i] != 0) insertRecord(oldRecs[i], oldTags[i]);
+    }
+
+    if (oldFd >= 0) {
+        // Atomically replace the snapshot with the grown table
+        msync(base_, mapLen_, MS_SYNC);
+        if (rename(tmp.c_str(), path_.c_str()) != 0) {
+            path_ = tmp;  // Keep snapshotting to the file we are mapped on
+        }
+        ::close(oldFd);
+    }
+    munmap(oldBase, oldLen);
+    return true;
+}
+
+// =============================================================================
+// Table Operations
+// =============================================================================
+
+uint32_t StatusIndex::tagOf(const char* id, size_t len) {
+    // FNV-1a with a final mix; 0 marks an empty slot
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= static_cast<uint8_t>(id[i]);
+        h *= 16777619UL;
+    }
+    h ^= h >> 15;
+    h *= 0x2C1B3C6DUL;
+    h ^= h >> 12;
+    return h == 0 ? 1 : h;
+}
+
+size_t StatusIndex::slotOf(const char* id, size_t len, uint32_t tag) const {
+    size_t mask = capacity() - 1;
+    for (size_t i = tag & mask; tags_[i] != 0; i = (i + 1) & mask) {
+        if (tags_[i] == tag && strncmp(recs_[i].id, id, len) == 0 && recs_[i].id[len] == '\0') {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+void StatusIndex::insertRecord(const DeviceRecord& rec, uint32_t tag) {
+    size_t mask = capacity() - 1;
+    size_t i = tag & mask;
+    while (tags_[i] != 0) i = (i + 1) & mask;
+
+    tags_[i] = tag;
+    recs_[i] = rec;
+    hdr_->count++;
+    if (rec.state == static_cast<uint8_t>(DeviceState::Online)) hdr_->online++;
+}
+
+bool StatusIndex::update(const char* id, size_t idLen, DeviceState state,
+                         uint32_t capabilities, uint64_t now) {
+    if (!hdr_ || idLen == 0 || idLen >= DeviceRecord::ID_MAX) return false;
+
+    uint32_t tag = tagOf(id, idLen);
+    size_t slot = slotOf(id, idLen, tag);
+    uint8_t s = static_cast<uint8_t>(state);
+
+    if (slot != SIZE_MAX) {
+        DeviceRecord& rec = recs_[slot];
+        if (rec.state != s) {
+            if (rec.state == static_cast<uint8_t>(DeviceState::Online)) hdr_->online--;
+            if (state == DeviceState::Online) hdr_->online++;
+            rec.state = s;
+            rec.changed = now;
+        }
+        rec.lastSeen = now;
+        rec.capabilities = capabilities;
+        return true;
+    }
+
+    // Keep the load factor at or below 0.7
+    if ((size() + 1) * 10 > capacity() * 7 && !grow()) {
+        return false;
+    }
+
+    DeviceRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.id, id, idLen);
+    rec.lastSeen = now;
+    rec.changed = now;
+    rec.capabilities = capabilities;
+    rec.state = s;
+    insertRecord(rec, tag);
+    return true;
+}
+
+const DeviceRecord* StatusIndex::find(const char* id, size_t idLen) const {
+    if (!hdr_ || idLen == 0 || idLen >= DeviceRecord::ID_MAX) return nullptr;
+    size_t slot = slotOf(id, idLen, tagOf(id, idLen));
+    return slot == SIZE_MAX ? nullptr : &recs_[slot];
+}
+
+bool StatusIndex::remove(const char* id, size_t idLen) {
+    if (!hdr_ || idLen == 0 || idLen >= DeviceRecord::ID_MAX) return false;
+
+    size_t i = slotOf(id, idLen, tagOf(id, idLen));
+    if (i == SIZE_MAX) return false;
+
+    if (recs_[i].state == static_cast<uint8_t>(DeviceState::Online)) hdr_->online--;
+    hdr_->count--;
+
+    // Backward-shift deletion: pull later entries of the probe run into the hole
+    size_t mask = capacity() - 1;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (tags_[j] == 0) break;
+        size_t home = tags_[j] & mask;
+        bool between = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!between) {
+            tags_[i] = tags_[j];
+            recs_[i] = recs_[j];
+            i = j;
+        }
+    }
+    tags_[i] = 0;
+    memset(&recs_[i], 0, sizeof(DeviceRecord));
+    return true;
+}
+
+// =============================================================================
+// Names
+// =============================================================================
+
+uint32_t StatusIndex::capabilityBit(const char* name, size_t len) {
+    for (size_t i = 0; i < CAPABILITY_COUNT; i++) {
+        if (strlen(CAPABILITIES[i]) == len && strncmp(CAPABILITIES[i], name, len) == 0) {
+            return 1UL << i;
+        }
+    }
+    return 0;
+}
+
+std::string StatusIndex::capabilityNames(uint32_t capabilities) {
+    std::string names;
+    for (size_t i = 0; i < CAPABILITY_COUNT; i++) {
+        if (capabilities & (1UL << i)) {
+            if (!names.empty()) names += ',';
+            names += CAPABILITIES[i];
+        }
+    }
+    return names;
+}
+
+const char* StatusIndex::stateName(DeviceState state) {
+    switch (state) {
+        case DeviceState::Online: return "online";
+        case DeviceState::Offline: return "offline";
+        default: return "unknown";
+    }
+}
+
+} // namespace espmole
@@ -0,0 +1,143 @@
+#ifndef ESPMOLE_STATUS_INDEX_H
+#define ESPMOLE_STATUS_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace espmole {
+
+enum class DeviceState : uint8_t {
+    Unknown = 0,
+    Online = 1,
+    Offline = 2
+};
+
+/**
+ * One device in the index. Exactly one cache line.
+ */
+struct DeviceRecord {
+    static constexpr size_t ID_MAX = 40;
+
+    char id[ID_MAX];            ///< NUL-terminated device ID
+    uint64_t lastSeen;          ///< Epoch ms of the last status message
+    uint64_t changed;           ///< Epoch ms of the last state change
+    uint32_t capabilities;      ///< Bitmask, see capabilityBit()
+    uint8_t state;              ///< DeviceState
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(DeviceRecord) == 64, "DeviceRecord should fill one cache line");
+
+/**
+ * Open-addressing index of device status, keyed by device ID.
+ *
+ * Probing runs over a dense array of 32-bit hash tags (16 per cache line);
+ * the 64-byte records are only touched on a tag match. Deletion uses
+ * backward shifting, so there are no tombstones.
+ *
+ * The table can live in a memory-mapped file. Reopening the same file
+ * after a restart makes the whole fleet state available immediately,
+ * without waiting for the broker to replay retained status messages.
+ */
+class StatusIndex {
+public:
+    StatusIndex() = default;
+    ~StatusIndex();
+
+    StatusIndex(const StatusIndex&) = delete;
+    StatusIndex& operator=(const StatusIndex&) = delete;
+
+    /**
+     * Map the index from `path`, creating the file if it does not exist
+     * or does not hold a valid index.
+     *
+     * @param path      Snapshot file
+     * @param capacity  Initial slot count for a new file (rounded up to a power of two)
+     */
+    bool open(const char* path, size_t capacity = 1024);
+
+    /// Keep the index in anonymous memory only
+    bool openInMemory(size_t capacity = 1024);
+
+    /// Flush and unmap
+    void close();
+
+    /// Flush dirty pages of a file-backed index to disk
+    bool sync();
+
+    /**
+     * Record a status message for a device.
+     *
+     * @param id            Device ID
+     * @param idLen         Length of the ID
+     * @param state         Reported state
+     * @param capabilities  Capability bitmask
+     * @param now           Epoch ms
+     * @return              false if the ID is too long or the index cannot grow
+     */
+    bool update(const char* id, size_t idLen, DeviceState state,
+                uint32_t capabilities, uint64_t now);
+
+    /// Look up a device (nullptr if unknown)
+    const DeviceRecord* find(const char* id, size_t idLen) const;
+
+    /// Remove a device
+    bool remove(const char* id, size_t idLen);
+
+    size_t size() const { return hdr_ ? static_cast<size_t>(hdr_->count) : 0; }
+    size_t capacity() const { return hdr_ ? static_cast<size_t>(hdr_->capacity) : 0; }
+
+    /// Number of devices currently online
+    size_t online() const { return hdr_ ? static_cast<size_t>(hdr_->online) : 0; }
+
+    /// Visit every record; stop early if `fn` returns false
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (size_t i = 0; i < capacity(); i++) {
+            if (tags_[i] != 0 && !fn(recs_[i])) return;
+        }
+    }
+
+    /// Bit for a capability name announced in the birth message (0 if unknown)
+    static uint32_t capabilityBit(const char* name, size_t len);
+
+    /// Comma separated names for a capability bitmask
+    static std::string capabilityNames(uint32_t capabilities);
+
+    static const char* stateName(DeviceState state);
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t capacity;
+        uint64_t count;
+        uint64_t online;
+        uint8_t reserved[24];
+    };
+    static_assert(sizeof(Header) == 64, "Header keeps records cache-line aligned");
+
+    uint8_t* base_ = nullptr;
+    size_t mapLen_ = 0;
+    int fd_ = -1;
+    std::string path_;
+
+    Header* hdr_ = nullptr;
+    uint32_t* tags_ = nullptr;
+    DeviceRecord* recs_ = nullptr;
+
+    static size_t bytesFor(size_t capacity);
+    static uint32_t tagOf(const char* id, size_t len);
+
+    bool map(int fd, size_t capacity, bool fresh);
+    void bind();
+    bool grow();
+    size_t slotOf(const char* id, size_t len, uint32_t tag) const;
+    void insertRecord(const DeviceRecord& rec, uint32_t tag);
+};
+
+} // namespace espmole
+
+#endif // ESPMOLE_STATUS_INDEX_H
@@ -0,0 +1,133 @@
+#include "TraceAnalysis.h"
+
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace espmole {
+
+namespace {
+
+/// Device prefix of ".../cmd" or ".../resp", empty if the topic is neither
+std::string devicePrefix(const TraceEvent& e, const char* suffix) {
+    size_t n = strlen(suffix);
+    if (e.topicLen <= n || memcmp(e.topic + e.topicLen - n, suffix, n) != 0) {
+        return std::string();
+    }
+    return std::string(e.topic, e.topicLen - n);
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, unsigned pct) {
+    if (sorted.empty()) return 0;
+    size_t i = (sorted.size() * pct + 99) / 100;
+    return sorted[i > 0 ? i - 1 : 0];
+}
+
+struct Row {
+    const char* name;
+    double a;
+    double b;
+    bool lowerIsBetter;
+};
+
+} // namespace
+
+TraceSummary summarizeTrace(TraceReader& reader) {
+    TraceSummary s;
+    std::map<std::string, std::deque<uint64_t>> waiting;
+    std::vector<uint64_t> latencies;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    bool any = false;
+
+    reader.rewind();
+    TraceEvent e;
+    while (reader.next(e)) {
+        if (!any) first = e.timeUs;
+        any = true;
+        last = e.timeUs;
+
+        if (e.direction == TRACE_IN) {
+            s.inbound++;
+            s.inBytes += e.len;
+            std::string prefix = devicePrefix(e, "/cmd");
+            if (!prefix.empty()) {
+                s.commands++;
+                waiting[prefix].push_back(e.timeUs);
+            }
+        } else {
+            s.outbound++;
+            s.outBytes += e.len;
+            std::string prefix = devicePrefix(e, "/resp");
+            auto it = prefix.empty() ? waiting.end() : waiting.find(prefix);
+            if (it != waiting.end() && !it->second.empty()) {
+                latencies.push_back(e.timeUs - it->second.front());
+                it->second.pop_front();
+            }
+        }
+    }
+    s.truncated = reader.truncated();
+    s.durationUs = last - first;
+    s.answered = static_cast<uint32_t>(latencies.size());
+
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        uint64_t sum = 0;
+        for (uint64_t l : latencies) sum += l;
+        s.latencyMin = latencies.front();
+        s.latencyMax = latencies.back();
+        s.latencyAvg = sum / latencies.size();
+        s.latencyP50 = percentile(latencies, 50);
+        s.latencyP95 = percentile(latencies, 95);
+        s.latencyP99 = percentile(latencies, 99);
+    }
+    return s;
+}
+
+void printTraceSummary(FILE* out, const TraceSummary& s) {
+    fprintf(out, "inbound      %u msgs, %llu bytes, %.1f msg/s\n",
+            s.inbound, static_cast<unsigned long long>(s.inBytes), s.rate(s.inbound));
+    fprintf(out, "outbound     %u msgs, %llu bytes, %.1f msg/s\n",
+            s.outbound, static_cast<unsigned long long>(s.outBytes), s.rate(s.outbound));
+    fprintf(out, "duration     %.3f s\n", s.durationUs / 1e6);
+    fprintf(out, "commands     %u (%u answered)\n", s.commands, s.answered);
+    if (s.answered > 0) {
+        fprintf(out, "latency ms   min %.2f avg %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f\n",
+                s.latencyMin / 1e3, s.latencyAvg / 1e3, s.latencyP50 / 1e3,
+                s.latencyP95 / 1e3, s.latencyP99 / 1e3, s.latencyMax / 1e3);
+    }
+    if (s.truncated) {
+        fprintf(out, "warning      trace ends in a partial record\n");
+    }
+}
+
+void printTraceComparison(FILE* out, const char* nameA, const TraceSummary& a,
+                          const char* nameB, const TraceSummary& b) {
+    const Row rows[] = {
+        {"inbound msg/s", a.rate(a.inbound), b.rate(b.inbound), false},
+        {"outbound msg/s", a.rate(a.outbound), b.rate(b.outbound), false},
+        {"answered", static_cast<double>(a.answered), static_cast<double>(b.answered), false},
+        {"latency avg ms", a.latencyAvg / 1e3, b.latencyAvg / 1e3, true},
+        {"latency p50 ms", a.latencyP50 / 1e3, b.latencyP50 / 1e3, true},
+        {"latency p95 ms", a.latencyP95 / 1e3, b.latencyP95 / 1e3, true},
+        {"latency p99 ms", a.latencyP99 / 1e3, b.latencyP99 / 1e3, true},
+        {"latency max ms", a.latencyMax / 1e3, b.latencyMax / 1e3, true},
+    };
+
+    fprintf(out, "%-16s %12s %12s %9s\n", "", nameA, nameB, "change");
+    for (const Row& r : rows) {
+        fprintf(out, "%-16s %12.2f %12.2f", r.name, r.a, r.b);
+        if (r.a > 0) {
+            double change = (r.b - r.a) * 100.0 / r.a;
+            bool worse = r.lowerIsBetter ? change > 0 : change < 0;
+            fprintf(out, " %+8.1f%%%s\n", change, worse && (change > 5 || change < -5) ? " !" : "");
+        } else {
+            fprintf(out, " %9s\n", "-");
+        }
+    }
+}
+
+} // namespace espmole
@@ -0,0 +1,56 @@
+#ifndef ESPMOLE_TRACE_ANALYSIS_H
+#define ESPMOLE_TRACE_ANALYSIS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <MqttTrace.h>
+
+namespace espmole {
+
+/**
+ * Traffic and latency figures of one trace.
+ *
+ * Directions are the device's: commands are inbound, responses outbound.
+ * Each command on ".../cmd" is paired with the next response on the same
+ * device's ".../resp" - the transport answers commands in order.
+ */
+struct TraceSummary {
+    uint32_t inbound = 0;       ///< Messages received by the device
+    uint32_t outbound = 0;      ///< Messages published by the device
+    uint64_t inBytes = 0;       ///< Payload bytes
+    uint64_t outBytes = 0;
+    uint32_t commands = 0;      ///< Inbound on .../cmd
+    uint32_t answered = 0;      ///< Commands paired with a response
+    uint64_t durationUs = 0;    ///< First to last record
+
+    // Command -> response latency, microseconds
+    uint64_t latencyMin = 0;
+    uint64_t latencyAvg = 0;
+    uint64_t latencyP50 = 0;
+    uint64_t latencyP95 = 0;
+    uint64_t latencyP99 = 0;
+    uint64_t latencyMax = 0;
+
+    bool truncated = false;     ///< The trace ended in a partial record
+
+    /// Messages per second in one direction over the trace duration
+    double rate(uint32_t count) const {
+        return durationUs > 0 ? count * 1e6 / static_cast<double>(durationUs) : 0.0;
+    }
+};
+
+/// Walk the whole trace (from the start) and compute its summary
+TraceSummary summarizeTrace(TraceReader& reader);
+
+/// Print one summary as "name value" lines
+void printTraceSummary(FILE* out, const TraceSummary& s);
+
+/// Print two summaries side by side with the relative change
+void printTraceComparison(FILE* out, const char* nameA, const TraceSummary& a,
+                          const char* nameB, const TraceSummary& b);
+
+} // namespace espmole
+
+#endif // ESPMOLE_TRACE_ANALYSIS_H
@@ -0,0 +1,50 @@
+#ifndef ESPMOLE_TRACE_FILE_H
+#define ESPMOLE_TRACE_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <MqttTrace.h>
+
+namespace espmole {
+
+/**
+ * A trace file mapped read-only, for walking with TraceReader.
+ */
+class MappedTrace {
+public:
+    MappedTrace() = default;
+    ~MappedTrace();
+
+    MappedTrace(const MappedTrace&) = delete;
+    MappedTrace& operator=(const MappedTrace&) = delete;
+
+    /// Map `path`; false if it cannot be opened (an empty file maps to nothing)
+    bool open(const char* path);
+    void close();
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    TraceReader reader() const { return TraceReader(data_, size_); }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * TraceWriter sink writing to a stdio stream.
+ *
+ *   FILE* f = fopen("run.trace", "wb");
+ *   writer.begin(fileTraceSink, f, hostTraceClock);
+ */
+bool fileTraceSink(const uint8_t* data, size_t len, void* ctx);
+
+/// TraceWriter clock for the host tools (monotonic microseconds)
+uint32_t hostTraceClock(void* ctx);
+
+} // namespace espmole
+
+#endif // ESPMOLE_TRACE_FILE_H
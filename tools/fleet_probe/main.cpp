@@ -0,0 +1,176 @@
+/**
+ * ESPMole fleet RTT probe
+ *
+ * Sends "$probe" to many devices at once, in rounds, and reports round-trip
+ * time histograms per device and for the whole fleet:
+ *
+ *   fleet_probe -h broker.local                  # every online device
+ *   fleet_probe -h broker.local -n 100 -i 200 kitchen-1 garage-2
+ *
+ * Devices answer $probe in the transport itself, before the dispatcher,
+ * with their receive and reply timestamps, so each round trip is split
+ * into device time (reply minus receipt, on the device's clock) and
+ * network time (the rest: broker, Wi-Fi and TCP both ways). Replies also
+ * carry queue depths; the worst seen per device is reported.
+ *
+ * Without device IDs, devices are found through their retained status
+ * messages: online and announcing the "probe" capability.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <FleetProbe.h>
+#include <PosixMqttClient.h>
+
+using namespace espmole;
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct Options {
+    const char* host = "localhost";
+    uint16_t port = 1883;
+    const char* baseTopic = "espmole";
+    const char* clientId = "espmole-fleet-probe";
+    unsigned rounds = 20;               // Probes per device
+    unsigned intervalMs = 1000;         // Between rounds
+    unsigned timeoutMs = 2000;          // A probe not answered by then is lost
+    unsigned discoverMs = 2000;         // Collecting retained status messages
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-b base-topic] [-c client-id] [-n rounds]\n"
+            "          [-i interval-ms] [-t timeout-ms] [-d discover-ms] [device-id ...]\n",
+            argv0);
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:b:c:n:i:t:d:")) != -1) {
+        switch (opt) {
+            case 'h': o.host = optarg; break;
+            case 'p': o.port = static_cast<uint16_t>(atoi(optarg)); break;
+            case 'b': o.baseTopic = optarg; break;
+            case 'c': o.clientId = optarg; break;
+            case 'n': o.rounds = static_cast<unsigned>(atoi(optarg)); break;
+            case 'i': o.intervalMs = static_cast<unsigned>(atoi(optarg)); break;
+            case 't': o.timeoutMs = static_cast<unsigned>(atoi(optarg)); break;
+            case 'd': o.discoverMs = static_cast<unsigned>(atoi(optarg)); break;
+            default: return false;
+        }
+    }
+    return o.rounds > 0 && o.timeoutMs > 0;
+}
+
+struct Session {
+    FleetProbe* probe;
+    bool discovering;
+};
+
+void onMessage(const mqtt::PublishView& msg, void* ctx) {
+    Session* s = static_cast<Session*>(ctx);
+    // Timestamp first: everything after this is host time, not round trip
+    uint64_t now = hostMicros();
+    if (s->discovering && s->probe->onStatus(msg)) {
+        return;
+    }
+    s->probe->onReply(msg, now);
+}
+
+bool sendProbe(const char* topic, const char* payload, void* ctx) {
+    PosixMqttClient* client = static_cast<PosixMqttClient*>(ctx);
+    return client->publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), 0, false);
+}
+
+/// Dispatch incoming messages until `deadline` (host ms)
+bool pumpUntil(PosixMqttClient& client, uint64_t deadline) {
+    for (;;) {
+        uint64_t now = hostMillis();
+        if (stopRequested) return false;
+        if (now >= deadline) return true;
+        uint64_t left = deadline - now;
+        if (client.loop(static_cast<int>(left > 50 ? 50 : left)) < 0) {
+            fprintf(stderr, "connection lost\n");
+            return false;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    FleetProbe probe(options.baseTopic);
+    for (int i = optind; i < argc; i++) {
+        probe.add(argv[i]);
+    }
+
+    Session session = {&probe, optind == argc};
+    PosixMqttClient client;
+    client.onMessage(onMessage, &session);
+
+    mqtt::ConnectOptions connect;
+    connect.clientId = options.clientId;
+    connect.keepAlive = 30;
+    if (!client.connect(options.host, options.port, connect)) {
+        fprintf(stderr, "cannot connect to %s:%u\n", options.host, options.port);
+        return 1;
+    }
+    if (!client.subscribe(probe.replyFilter(), 0)) {
+        fprintf(stderr, "cannot subscribe to %s\n", probe.replyFilter());
+        return 1;
+    }
+
+    if (session.discovering) {
+        if (!client.subscribe(probe.statusFilter(), 0)) {
+            fprintf(stderr, "cannot subscribe to %s\n", probe.statusFilter());
+            return 1;
+        }
+        pumpUntil(client, hostMillis() + options.discoverMs);
+        session.discovering = false;
+        if (probe.devices() == 0) {
+            fprintf(stderr, "no online devices with the probe capability under %s/\n",
+                    options.baseTopic);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "probing %zu device(s), %u round(s) every %u ms\n",
+            probe.devices(), options.rounds, options.intervalMs);
+
+    for (unsigned round = 0; round < options.rounds && !stopRequested; round++) {
+        uint64_t start = hostMillis();
+        probe.startRound(hostMicros(), sendProbe, &client);
+
+        // Until every device answered or timed out, then wait out the interval
+        uint64_t timeoutUs = static_cast<uint64_t>(options.timeoutMs) * 1000;
+        while (!stopRequested && probe.expire(hostMicros(), timeoutUs) > 0) {
+            if (!pumpUntil(client, hostMillis() + 5)) break;
+        }
+        if (round + 1 < options.rounds && !pumpUntil(client, start + options.intervalMs)) {
+            break;
+        }
+    }
+    client.close();
+
+    probe.printReport(stdout);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * ESPMole MQTT static footprint
+ *
+ * Prints the size of every fixed buffer MqttTransport embeds under the
+ * feature switches and size macros it was compiled with. `make footprint`
+ * builds and runs it for a few configurations side by side:
+ *
+ *   make -C tools footprint
+ *   make -C tools footprint FOOTPRINT_FLAGS=-m32     # 32-bit, needs gcc-multilib
+ *
+ * Sizes are the host compiler's; with -m32 they match ESP32/ESP8266
+ * except for alignment details. The AsyncMqttClient created by begin()
+ * is on the heap and not included.
+ */
+
+#include <stdio.h>
+
+#include <MqttBuildConfig.h>
+#include <MqttInflight.h>
+#include <MqttLinkMonitor.h>
+#include <MqttMemory.h>
+#include <MqttStats.h>
+#include <MqttWork.h>
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+#include <MqttEventJournal.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+#include <MqttSchedule.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+#include <MqttEventFilter.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+#include <MqttMailbox.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_BATCH
+#include <MqttBatch.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_BUS
+#include <MqttEventBus.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+#include <MqttLogStream.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_BROKER
+#include <MqttMicroBroker.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+#include <MqttTerminal.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+#include <MqttTimeSync.h>
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+#include <MqttLoopback.h>
+#endif
+
+#ifndef FOOTPRINT_CONFIG
+#define FOOTPRINT_CONFIG "custom"
+#endif
+
+using namespace espmole;
+
+namespace {
+
+size_t total = 0;
+
+void row(const char* name, size_t bytes, const char* note = "") {
+    printf(*note ? "  %-22s %7zu  %s\n" : "  %-22s %7zu\n", name, bytes, note);
+    total += bytes;
+}
+
+} // namespace
+
+int main() {
+    printf("%s (%zu-bit pointers)\n", FOOTPRINT_CONFIG, sizeof(void*) * 8);
+
+#if ESPMOLE_MQTT_STATIC_TOPICS
+    row("topics", 0, "in flash (ESPMOLE_MQTT_DEVICE_ID)");
+#else
+    size_t topics = 6 + ESPMOLE_MQTT_FEATURE_JOURNAL + ESPMOLE_MQTT_FEATURE_FILTER +
+                    ESPMOLE_MQTT_FEATURE_MAILBOX + ESPMOLE_MQTT_FEATURE_LOG +
+                    ESPMOLE_MQTT_FEATURE_TERM + ESPMOLE_MQTT_FEATURE_SELFTEST;
+    row("topics", topics * ESPMOLE_MQTT_TOPIC_MAX + ESPMOLE_MQTT_DEVICE_ID_MAX,
+        "ESPMOLE_MQTT_TOPIC_MAX, _DEVICE_ID_MAX");
+#endif
+    row("inflight", sizeof(InflightWindow), "ESPMOLE_MQTT_MAX_INFLIGHT");
+    row("link", sizeof(LinkMonitor));
+    row("work", sizeof(WorkScheduler));
+#if ESPMOLE_MQTT_FEATURE_JOURNAL
+    row("journal", sizeof(EventJournal), "ESPMOLE_MQTT_JOURNAL_BYTES");
+#endif
+#if ESPMOLE_MQTT_FEATURE_SCHED
+    row("sched", sizeof(QueryScheduler), "ESPMOLE_MQTT_MAX_SCHEDULES");
+#endif
+#if ESPMOLE_MQTT_FEATURE_FILTER
+    row("filter", 2 * sizeof(EventFilter), "active + spare for recompiling");
+#endif
+#if ESPMOLE_MQTT_FEATURE_MAILBOX
+    row("mailbox", sizeof(CommandMailbox), "ESPMOLE_MQTT_MAILBOX_SLOTS");
+#endif
+#if ESPMOLE_MQTT_FEATURE_BATCH
+    row("batch", sizeof(OutboundBatch), "ESPMOLE_MQTT_BATCH_BYTES");
+#endif
+#if ESPMOLE_MQTT_FEATURE_BUS
+    row("bus", sizeof(LocalEventBus), "ESPMOLE_MQTT_BUS_SUBSCRIBERS");
+#endif
+#if ESPMOLE_MQTT_FEATURE_LOG
+    row("log", sizeof(LogStream), "ESPMOLE_MQTT_LOG_SLOTS, _LOG_LINE");
+#endif
+#if ESPMOLE_MQTT_FEATURE_MEM
+    row("mem", sizeof(MemoryMonitor));
+#endif
+#if ESPMOLE_MQTT_FEATURE_TERM
+    row("term", ESPMOLE_MQTT_TERM_SESSIONS * sizeof(TerminalSession),
+        "ESPMOLE_MQTT_TERM_SESSIONS, _TERM_BUFFER");
+#endif
+#if ESPMOLE_MQTT_FEATURE_TIME
+    row("time", sizeof(TimeSync) + 2 * sizeof(TimeStamper));
+#endif
+#if ESPMOLE_MQTT_FEATURE_SELFTEST
+    row("selftest", sizeof(LoopbackTest));
+#endif
+    printf("  %-22s %7zu\n", "transport buffers", total);
+
+    // Stack buffers of poll() and command handling, not part of the object
+    printf("  %-22s %7zu  ESPMOLE_MQTT_RESPONSE_BUFFER\n", "stack: response",
+           static_cast<size_t>(ESPMOLE_MQTT_RESPONSE_BUFFER));
+    printf("  %-22s %7zu  STATS_RECORD_MAX\n", "stack: stats", STATS_RECORD_MAX);
+
+#if ESPMOLE_MQTT_FEATURE_BROKER
+    // A separate object, only if serveLocal() is used
+    printf("  %-22s %7zu  ESPMOLE_MQTT_BROKER_*\n", "MicroBroker (optional)", sizeof(MicroBroker));
+#endif
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * ESPMole loopback throughput test
+ *
+ * Ramps the message rate through a broker until loss or latency gives out
+ * (MqttLoopback.h), either from this host or on a device:
+ *
+ *   loopback_test -h broker.local -r 5000             # host <-> broker
+ *   loopback_test -h broker.local -d kitchen-1 -r 500 # device <-> broker
+ *
+ * Without -d the test runs here, publishing to and subscribing to its own
+ * topic - a baseline for the broker and network. With -d it sends
+ * "$selftest start <max-rate> <bytes>" to the device and prints the
+ * "selftest" lines the device reports on its stats topic until the result.
+ * Run against micro_broker to measure the device's own broker stand-in.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <MqttLoopback.h>
+#include <PosixMqttClient.h>
+
+using namespace espmole;
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct Options {
+    const char* host = "localhost";
+    uint16_t port = 1883;
+    const char* baseTopic = "espmole";
+    const char* clientId = "espmole-loopback-test";
+    const char* device = nullptr;       // Run on this device instead of here
+    LoopbackConfig test;
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-b base-topic] [-c client-id] [-d device]\n"
+            "          [-r max-rate] [-s bytes] [-t step-ms] [-q qos]\n"
+            "       -d runs the test on the device ($selftest) and prints its report\n",
+            argv0);
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:b:c:d:r:s:t:q:")) != -1) {
+        switch (opt) {
+            case 'h': o.host = optarg; break;
+            case 'p': o.port = static_cast<uint16_t>(atoi(optarg)); break;
+            case 'b': o.baseTopic = optarg; break;
+            case 'c': o.clientId = optarg; break;
+            case 'd': o.device = optarg; break;
+            case 'r': o.test.maxRate = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+            case 's': o.test.payload = static_cast<uint16_t>(atoi(optarg)); break;
+            case 't': o.test.stepMs = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+            case 'q': o.test.qos = static_cast<uint8_t>(atoi(optarg)); break;
+            default: return false;
+        }
+    }
+    if (o.test.maxRate < o.test.startRate) {
+        o.test.startRate = o.test.maxRate;
+    }
+    return optind == argc;
+}
+
+void printStep(uint8_t index, const LoopbackStep& step, void*) {
+    char line[160];
+    LoopbackTest::formatStep(line, sizeof(line), step);
+    printf("step=%u %s\n", static_cast<unsigned>(index), line);
+    fflush(stdout);
+}
+
+void onLoopback(const mqtt::PublishView& msg, void* ctx) {
+    // Receive time first, like the device
+    uint32_t now = static_cast<uint32_t>(hostMicros());
+    static_cast<LoopbackTest*>(ctx)->receive(msg.payload, msg.len, now);
+}
+
+int runHere(PosixMqttClient& client, const Options& options) {
+    std::string topic = std::string(options.baseTopic) + "/" + options.clientId + "/selftest";
+    LoopbackTest test;
+    test.onStep(printStep, nullptr);
+    client.onMessage(onLoopback, &test);
+    if (!client.subscribe(topic.c_str(), options.test.qos)) {
+        fprintf(stderr, "cannot subscribe to %s\n", topic.c_str());
+        return 1;
+    }
+    if (!test.start(options.test, static_cast<uint32_t>(hostMicros()))) {
+        fprintf(stderr, "invalid test parameters\n");
+        return 2;
+    }
+
+    uint8_t buf[4096];
+    while (!test.update(static_cast<uint32_t>(hostMicros()))) {
+        if (stopRequested) {
+            test.stop();
+            break;
+        }
+        uint32_t now = static_cast<uint32_t>(hostMicros());
+        size_t n;
+        while ((n = test.next(buf, sizeof(buf), now)) > 0) {
+            if (!client.publish(topic.c_str(), buf, n, options.test.qos, false)) {
+                test.sendFailed();
+            }
+            now = static_cast<uint32_t>(hostMicros());
+        }
+        if (client.loop(1) < 0) {
+            fprintf(stderr, "connection lost\n");
+            return 1;
+        }
+    }
+
+    char line[160];
+    LoopbackTest::formatResult(line, sizeof(line), test.result());
+    printf("%s\n", line);
+    return test.result().best.rate > 0 ? 0 : 1;
+}
+
+struct DeviceRun {
+    bool done;
+    bool passed;
+};
+
+void onDeviceStats(const mqtt::PublishView& msg, void* ctx) {
+    DeviceRun* run = static_cast<DeviceRun*>(ctx);
+    const char* text = reinterpret_cast<const char*>(msg.payload);
+    if (msg.retain || msg.len < 9 || strncmp(text, "selftest ", 9) != 0) {
+        return;
+    }
+    printf("%.*s\n", static_cast<int>(msg.len - 9), text + 9);
+    fflush(stdout);
+    if (msg.len >= 18 && strncmp(text + 9, "max_rate=", 9) == 0) {
+        run->done = true;
+        run->passed = strncmp(text + 18, "0 ", 2) != 0;
+    }
+}
+
+int runOnDevice(PosixMqttClient& client, const Options& options) {
+    std::string prefix = std::string(options.baseTopic) + "/" + options.device + "/";
+    DeviceRun run = {false, false};
+    client.onMessage(onDeviceStats, &run);
+    if (!client.subscribe((prefix + "stats").c_str(), 0)) {
+        fprintf(stderr, "cannot subscribe to %sstats\n", prefix.c_str());
+        return 1;
+    }
+
+    char cmd[64];
+    int n = snprintf(cmd, sizeof(cmd), "$selftest start %lu %u",
+                     static_cast<unsigned long>(options.test.maxRate),
+                     static_cast<unsigned>(options.test.payload));
+    if (!client.publish((prefix + "cmd").c_str(), reinterpret_cast<const uint8_t*>(cmd),
+                        static_cast<size_t>(n), 1, false)) {
+        fprintf(stderr, "cannot send to %scmd\n", prefix.c_str());
+        return 1;
+    }
+
+    bool stopSent = false;
+    while (!run.done) {
+        if (stopRequested && !stopSent) {
+            const char stop[] = "$selftest stop";
+            client.publish((prefix + "cmd").c_str(), reinterpret_cast<const uint8_t*>(stop),
+                           sizeof(stop) - 1, 1, false);
+            stopSent = true;
+        }
+        if (client.loop(200) < 0) {
+            fprintf(stderr, "connection lost\n");
+            return 1;
+        }
+    }
+    return run.passed ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    PosixMqttClient client;
+    mqtt::ConnectOptions connect;
+    connect.clientId = options.clientId;
+    connect.keepAlive = 30;
+    if (!client.connect(options.host, options.port, connect)) {
+        fprintf(stderr, "cannot connect to %s:%u\n", options.host, options.port);
+        return 1;
+    }
+
+    int status = options.device ? runOnDevice(client, options) : runHere(client, options);
+    client.close();
+    return status;
+}
@@ -0,0 +1,110 @@
+/**
+ * ESPMole micro-broker
+ *
+ * Runs the embedded MicroBroker as a standalone Linux process - the same
+ * code a broker-less ESP32 serves its LAN clients with. Useful for bench
+ * tests of controllers and for trying the broker with stock MQTT tools:
+ *
+ *   micro_broker -p 1883 -v
+ *   mosquitto_sub -h localhost -t 'espmole/#' -v
+ *   mosquitto_pub -h localhost -t espmole/kitchen-1/cmd -m status -q 1
+ *
+ * Limits are the device's compile-time limits (ESPMOLE_MQTT_BROKER_*):
+ * a handful of clients, QoS 0/1, clean sessions only.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <MqttMicroBroker.h>
+#include <PosixBrokerServer.h>
+
+using namespace espmole;
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct Options {
+    uint16_t port = 1883;
+    const char* address = nullptr;      // nullptr = all interfaces
+    const char* username = nullptr;
+    const char* password = nullptr;
+    bool verbose = false;               // Print every client publish
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [-p port] [-a bind-address] [-u username [-P password]] [-v]\n"
+            "       -v prints every message clients publish\n",
+            argv0);
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:a:u:P:v")) != -1) {
+        switch (opt) {
+            case 'p': o.port = static_cast<uint16_t>(atoi(optarg)); break;
+            case 'a': o.address = optarg; break;
+            case 'u': o.username = optarg; break;
+            case 'P': o.password = optarg; break;
+            case 'v': o.verbose = true; break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+void onMessage(const char* topic, const uint8_t* payload, size_t len, void* ctx) {
+    (void)ctx;
+    printf("%s %.*s\n", topic, static_cast<int>(len), reinterpret_cast<const char*>(payload));
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // About 10 KB with the default limits - keep it off the stack anyway
+    static MicroBroker broker;
+    broker.setCredentials(options.username, options.password);
+    if (options.verbose) {
+        broker.onMessage(onMessage, nullptr);
+    }
+
+    PosixBrokerServer server(broker);
+    if (!server.listen(options.port, options.address)) {
+        fprintf(stderr, "cannot listen on %s:%u\n",
+                options.address ? options.address : "*", options.port);
+        return 1;
+    }
+    fprintf(stderr, "listening on %s:%u (%zu clients, %zu subscriptions each)\n",
+            options.address ? options.address : "*", server.port(),
+            MicroBroker::MAX_CLIENTS, MicroBroker::MAX_SUBS);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    while (!stopRequested) {
+        server.loop(1000);
+    }
+
+    const BrokerStats& s = broker.stats();
+    fprintf(stderr, "stopping: %u connects, %u refused, %u received, %u delivered, "
+                    "%u dropped, %u timeouts, %u errors\n",
+            s.connects, s.refused, s.received, s.delivered, s.dropped, s.timeouts, s.errors);
+
+    server.close();
+    return 0;
+}
@@ -0,0 +1,248 @@
+/**
+ * ESPMole fleet status aggregator
+ *
+ * Subscribes to espmole/+/status, keeps every device's state, last-seen
+ * time and capabilities in a memory-mapped index, and answers queries on a
+ * local Unix socket:
+ *
+ *   status_aggregator -h broker.local -f /var/lib/espmole/status.idx
+ *   echo "count" | nc -U /tmp/espmole-status.sock
+ *   echo "list offline" | nc -U /tmp/espmole-status.sock
+ *   echo "get my-esp32" | nc -U /tmp/espmole-status.sock
+ *
+ * The index file survives restarts, so queries are answered immediately
+ * while the broker is still replaying retained status messages.
+ *
+ * With -t the broker connection uses TLS; reconnects resume the TLS
+ * session, and the handshake counters are printed on exit.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <PosixMqttClient.h>
+#include <PosixTls.h>
+#include <StatusAggregator.h>
+#include <StatusIndex.h>
+
+using namespace espmole;
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct Options {
+    const char* host = "localhost";
+    uint16_t port = 1883;
+    const char* baseTopic = "espmole";
+    const char* indexPath = "espmole-status.idx";
+    const char* socketPath = "/tmp/espmole-status.sock";
+    const char* clientId = "espmole-status-aggregator";
+    unsigned syncInterval = 10;         // Seconds between msync() of the index
+    bool tls = false;
+    const char* caFile = nullptr;       // nullptr = system trust store
+    bool insecure = false;              // Skip certificate verification
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-b base-topic] [-f index-file]\n"
+            "          [-s socket] [-c client-id] [-i sync-seconds]\n"
+            "          [-t [-C ca-file] [-k]]\n"
+            "       -f :memory: keeps the index in RAM only\n"
+            "       -t connects over TLS (default port 8883), -k skips verification\n",
+            argv0);
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    int opt;
+    bool portSet = false;
+    while ((opt = getopt(argc, argv, "h:p:b:f:s:c:i:tC:k")) != -1) {
+        switch (opt) {
+            case 'h': o.host = optarg; break;
+            case 'p': o.port = static_cast<uint16_t>(atoi(optarg)); portSet = true; break;
+            case 'b': o.baseTopic = optarg; break;
+            case 'f': o.indexPath = optarg; break;
+            case 's': o.socketPath = optarg; break;
+            case 'c': o.clientId = optarg; break;
+            case 'i': o.syncInterval = static_cast<unsigned>(atoi(optarg)); break;
+            case 't': o.tls = true; break;
+            case 'C': o.caFile = optarg; break;
+            case 'k': o.insecure = true; break;
+            default: return false;
+        }
+    }
+    if (o.tls && !portSet) o.port = 8883;
+    return true;
+}
+
+int listenUnix(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// Read one query line from a local client, answer it, close the connection
+void serveQuery(int fd, const StatusAggregator& aggregator) {
+    char line[256];
+    size_t len = 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while (len < sizeof(line) - 1 && poll(&pfd, 1, 1000) > 0) {
+        ssize_t n = recv(fd, line + len, sizeof(line) - 1 - len, 0);
+        if (n <= 0) break;
+        len += static_cast<size_t>(n);
+        if (memchr(line, '\n', len)) break;
+    }
+    line[len] = '\0';
+
+    std::string answer = aggregator.query(line, hostEpochMillis());
+    const char* p = answer.data();
+    size_t left = answer.size();
+    while (left > 0) {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    close(fd);
+}
+
+void onMessage(const mqtt::PublishView& msg, void* ctx) {
+    static_cast<StatusAggregator*>(ctx)->onMessage(msg, hostEpochMillis());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    StatusIndex index;
+    bool opened = strcmp(options.indexPath, ":memory:") == 0
+        ? index.openInMemory()
+        : index.open(options.indexPath);
+    if (!opened) {
+        fprintf(stderr, "cannot open index %s: %s\n", options.indexPath, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "index: %zu devices (%zu online) loaded\n", index.size(), index.online());
+
+    StatusAggregator aggregator(index, options.baseTopic);
+
+    int listenFd = listenUnix(options.socketPath);
+    if (listenFd < 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", options.socketPath, strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    PosixMqttClient client;
+    client.onMessage(onMessage, &aggregator);
+
+    PosixTls tls;
+    if (options.tls) {
+        PosixTls::Options tlsOptions;
+        tlsOptions.caFile = options.caFile;
+        tlsOptions.verify = !options.insecure;
+        if (!tls.begin(tlsOptions)) {
+            fprintf(stderr, "cannot load CA certificates%s%s\n",
+                    options.caFile ? " from " : "", options.caFile ? options.caFile : "");
+            return 1;
+        }
+        client.useTls(&tls);
+    }
+
+    mqtt::ConnectOptions connect;
+    connect.clientId = options.clientId;
+    connect.keepAlive = 30;
+
+    uint64_t lastSync = hostMillis();
+    uint64_t lastAttempt = 0;
+
+    while (!stopRequested) {
+        uint64_t now = hostMillis();
+
+        if (!client.connected() && now - lastAttempt >= 5000) {
+            lastAttempt = now;
+            if (client.connect(options.host, options.port, connect)
+                && client.subscribe(aggregator.filter(), 0)) {
+                fprintf(stderr, "subscribed to %s on %s:%u%s\n",
+                        aggregator.filter(), options.host, options.port,
+                        !options.tls ? "" : tls.resumed() ? " (TLS, resumed)" : " (TLS)");
+            } else {
+                fprintf(stderr, "connect to %s:%u failed, retrying\n", options.host, options.port);
+                client.close();
+            }
+        }
+
+        struct pollfd fds[2];
+        nfds_t count = 0;
+        fds[count++] = {listenFd, POLLIN, 0};
+        if (client.connected()) fds[count++] = {client.fd(), POLLIN, 0};
+
+        if (poll(fds, count, 1000) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) serveQuery(fd, aggregator);
+        }
+
+        if (client.connected()) {
+            // Drain everything that is buffered without blocking
+            while (client.loop(0) > 0) {}
+        }
+
+        if (options.syncInterval > 0 && now - lastSync >= options.syncInterval * 1000ULL) {
+            lastSync = now;
+            index.sync();
+        }
+    }
+
+    const StatusAggregator::Stats& s = aggregator.stats();
+    fprintf(stderr, "stopping: %llu messages, %llu retained replays skipped, %zu devices\n",
+            static_cast<unsigned long long>(s.messages),
+            static_cast<unsigned long long>(s.retainedSkipped),
+            index.size());
+    if (options.tls) {
+        const TlsStats& t = tls.handshakeStats().stats();
+        fprintf(stderr, "tls: %u full (avg %u ms), %u resumed (avg %u ms), %u failed\n",
+                t.full, t.avgFullMs, t.resumed, t.avgResumedMs, t.failed);
+    }
+
+    client.close();
+    index.close();
+    close(listenFd);
+    unlink(options.socketPath);
+    return 0;
+}
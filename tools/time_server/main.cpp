@@ -0,0 +1,148 @@
+/**
+ * ESPMole time server
+ *
+ * Answers the time requests of devices with config.timeSyncInterval set,
+ * with this host's wall clock as the reference:
+ *
+ *   time_server -h broker.local -v
+ *
+ * A device publishes "time? <t1>" on its response topic; the answer
+ * "$time <t1> <T2> <T3>" goes to its command topic, T2 being the time the
+ * request arrived here and T3 the time the answer left (Unix ms). The
+ * device estimates its offset and drift from that (MqttTimeSync.h), so the
+ * host clock should itself be NTP-disciplined.
+ *
+ * Run one time server per fleet: answers from two would both be accepted.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <MqttTimeSync.h>
+#include <PosixMqttClient.h>
+
+using namespace espmole;
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct Options {
+    const char* host = "localhost";
+    uint16_t port = 1883;
+    const char* baseTopic = "espmole";
+    const char* clientId = "espmole-time-server";
+    bool verbose = false;               // Print every exchange
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-b base-topic] [-c client-id] [-v]\n"
+            "       -v prints every request answered\n",
+            argv0);
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:b:c:v")) != -1) {
+        switch (opt) {
+            case 'h': o.host = optarg; break;
+            case 'p': o.port = static_cast<uint16_t>(atoi(optarg)); break;
+            case 'b': o.baseTopic = optarg; break;
+            case 'c': o.clientId = optarg; break;
+            case 'v': o.verbose = true; break;
+            default: return false;
+        }
+    }
+    return optind == argc;
+}
+
+struct Server {
+    PosixMqttClient* client;
+    std::string base;                   // "<base-topic>/"
+    bool verbose;
+    unsigned long answered;
+};
+
+void onMessage(const mqtt::PublishView& msg, void* ctx) {
+    // Receive time first: everything after it counts as server time
+    uint64_t received = hostEpochMillis();
+    Server* s = static_cast<Server*>(ctx);
+
+    uint32_t t1 = 0;
+    if (msg.retain || !TimeSync::parseRequest(reinterpret_cast<const char*>(msg.payload),
+                                              msg.len, t1)) {
+        return;
+    }
+
+    // "<base>/<id>/resp" -> "<base>/<id>/cmd"
+    std::string topic(msg.topic.data, msg.topic.len);
+    if (topic.compare(0, s->base.size(), s->base) != 0 || topic.size() < s->base.size() + 6) {
+        return;
+    }
+    topic.replace(topic.size() - 4, 4, "cmd");
+
+    char reply[64];
+    size_t n = TimeSync::formatReply(reply, sizeof(reply), t1, received, hostEpochMillis());
+    if (n == 0 || !s->client->publish(topic.c_str(), reinterpret_cast<const uint8_t*>(reply), n,
+                                      0, false)) {
+        return;
+    }
+    s->answered++;
+    if (s->verbose) {
+        printf("%.*s -> %s\n", static_cast<int>(topic.size() - s->base.size() - 4),
+               topic.c_str() + s->base.size(), reply);
+        fflush(stdout);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    PosixMqttClient client;
+    Server server = {&client, std::string(options.baseTopic) + "/", options.verbose, 0};
+    client.onMessage(onMessage, &server);
+
+    mqtt::ConnectOptions connect;
+    connect.clientId = options.clientId;
+    connect.keepAlive = 30;
+    if (!client.connect(options.host, options.port, connect)) {
+        fprintf(stderr, "cannot connect to %s:%u\n", options.host, options.port);
+        return 1;
+    }
+    std::string filter = server.base + "+/resp";
+    if (!client.subscribe(filter.c_str(), 0)) {
+        fprintf(stderr, "cannot subscribe to %s\n", filter.c_str());
+        return 1;
+    }
+    fprintf(stderr, "answering time requests on %s\n", filter.c_str());
+
+    while (!stopRequested) {
+        if (client.loop(200) < 0) {
+            fprintf(stderr, "connection lost\n");
+            return 1;
+        }
+    }
+    client.close();
+
+    fprintf(stderr, "%lu request(s) answered\n", server.answered);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/**
+ * ESPMole trace replay
+ *
+ * Plays the inbound side of a captured trace (MqttTransport::setTrace)
+ * into a device through a broker, records what the device publishes back,
+ * and compares throughput and command latency with the original capture:
+ *
+ *   trace_replay -h broker.local -s 4 -o run.trace field.trace
+ *   trace_replay -C before.trace after.trace
+ *   trace_replay -i field.trace
+ *
+ * Replays keep the original spacing divided by -s (0 = back to back), so
+ * the same bursts hit each firmware build. Comparing the -o traces of two
+ * builds shows the regression; changes over 5% in the wrong direction are
+ * marked with "!". The replay is timed on the host, so broker round trips
+ * are included in its latencies - compare replays with replays.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <PosixMqttClient.h>
+#include <TraceAnalysis.h>
+#include <TraceFile.h>
+
+using namespace espmole;
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+    stopRequested = 1;
+}
+
+struct Options {
+    const char* host = "localhost";
+    uint16_t port = 1883;
+    const char* clientId = "espmole-trace-replay";
+    double speed = 1.0;                 // 0 = no delays
+    int qos = 1;                        // QoS for replayed messages
+    unsigned settleMs = 2000;           // Wait for late responses
+    const char* outPath = nullptr;
+    bool compare = false;
+    bool info = false;
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-c client-id] [-s speed] [-q qos]\n"
+            "          [-w settle-ms] [-o out.trace] in.trace\n"
+            "       %s -C a.trace b.trace     compare two traces\n"
+            "       %s -i in.trace            summarize a trace\n",
+            argv0, argv0, argv0);
+}
+
+bool parseArgs(int argc, char** argv, Options& o) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:s:q:w:o:Ci")) != -1) {
+        switch (opt) {
+            case 'h': o.host = optarg; break;
+            case 'p': o.port = static_cast<uint16_t>(atoi(optarg)); break;
+            case 'c': o.clientId = optarg; break;
+            case 's': o.speed = atof(optarg); break;
+            case 'q': o.qos = atoi(optarg); break;
+            case 'w': o.settleMs = static_cast<unsigned>(atoi(optarg)); break;
+            case 'o': o.outPath = optarg; break;
+            case 'C': o.compare = true; break;
+            case 'i': o.info = true; break;
+            default: return false;
+        }
+    }
+    return o.qos >= 0 && o.qos <= 1 && o.speed >= 0;
+}
+
+bool openTrace(const char* path, MappedTrace& trace) {
+    if (!trace.open(path)) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    if (!trace.reader().valid()) {
+        fprintf(stderr, "%s: not an ESPMole trace\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool vectorSink(const uint8_t* data, size_t len, void* ctx) {
+    auto* buf = static_cast<std::vector<uint8_t>*>(ctx);
+    buf->insert(buf->end(), data, data + len);
+    return true;
+}
+
+bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+struct Replay {
+    TraceWriter writer;
+    uint32_t pendingCommands = 0;
+};
+
+/// Device publishes, recorded as outbound (the device's direction)
+void onMessage(const mqtt::PublishView& msg, void* ctx) {
+    Replay* r = static_cast<Replay*>(ctx);
+    std::string topic(msg.topic.data, msg.topic.len);
+
+    // Our own replayed messages echoed back by the wildcard subscription
+    if (endsWith(topic, "/cmd") || endsWith(topic, "/filter")) {
+        return;
+    }
+    if (endsWith(topic, "/resp") && r->pendingCommands > 0) {
+        r->pendingCommands--;
+    }
+    r->writer.record(TRACE_OUT, topic.c_str(), msg.payload, msg.len, msg.qos, msg.retain);
+}
+
+/// Wait until `deadline` (host ms) while dispatching responses
+bool waitUntil(PosixMqttClient& client, uint64_t deadline) {
+    for (;;) {
+        uint64_t now = hostMillis();
+        if (stopRequested) return false;
+        int timeout = now >= deadline ? 0 : static_cast<int>(deadline - now);
+        if (client.loop(timeout > 100 ? 100 : timeout) < 0) {
+            fprintf(stderr, "connection lost\n");
+            return false;
+        }
+        if (now >= deadline) return true;
+    }
+}
+
+int replay(const Options& options, const char* inPath) {
+    MappedTrace input;
+    if (!openTrace(inPath, input)) return 1;
+
+    // Subscribe to every device the trace sends commands to
+    std::set<std::string> devices;
+    uint32_t messages = 0;
+    TraceReader reader = input.reader();
+    TraceEvent e;
+    while (reader.next(e)) {
+        if (e.direction != TRACE_IN) continue;
+        messages++;
+        std::string topic(e.topic, e.topicLen);
+        if (endsWith(topic, "/cmd")) devices.insert(topic.substr(0, topic.size() - 4));
+    }
+    if (messages == 0) {
+        fprintf(stderr, "%s: no inbound messages to replay\n", inPath);
+        return 1;
+    }
+
+    PosixMqttClient client;
+    mqtt::ConnectOptions connect;
+    connect.clientId = options.clientId;
+    connect.keepAlive = 30;
+    if (!client.connect(options.host, options.port, connect)) {
+        fprintf(stderr, "cannot connect to %s:%u\n", options.host, options.port);
+        return 1;
+    }
+    for (const std::string& device : devices) {
+        std::string filter = device + "/+";
+        if (!client.subscribe(filter.c_str(), 1)) {
+            fprintf(stderr, "cannot subscribe to %s\n", filter.c_str());
+            return 1;
+        }
+    }
+
+    static Replay r;
+    std::vector<uint8_t> out;
+    r.writer.begin(vectorSink, &out, hostTraceClock);
+    client.onMessage(onMessage, &r);
+
+    if (options.speed > 0) {
+        fprintf(stderr, "replaying %u messages to %zu device(s) at x%.2f speed\n",
+                messages, devices.size(), options.speed);
+    } else {
+        fprintf(stderr, "replaying %u messages to %zu device(s) back to back\n",
+                messages, devices.size());
+    }
+
+    uint64_t start = hostMillis();
+    uint64_t first = 0;
+    bool started = false;
+    reader.rewind();
+    while (!stopRequested && reader.next(e)) {
+        if (e.direction != TRACE_IN) continue;
+        if (!started) {
+            first = e.timeUs;
+            started = true;
+        }
+        if (options.speed > 0) {
+            uint64_t offsetMs = static_cast<uint64_t>((e.timeUs - first) / 1000 / options.speed);
+            if (!waitUntil(client, start + offsetMs)) break;
+        } else if (client.loop(0) < 0) {
+            fprintf(stderr, "connection lost\n");
+            break;
+        }
+
+        if (endsWith(std::string(e.topic, e.topicLen), "/cmd")) r.pendingCommands++;
+        r.writer.record(TRACE_IN, e.topic, e.payload, e.len, static_cast<uint8_t>(options.qos),
+                        e.retain);
+        if (!client.publish(e.topic, e.payload, e.len, static_cast<uint8_t>(options.qos), e.retain)) {
+            fprintf(stderr, "publish failed\n");
+            break;
+        }
+    }
+
+    // Late responses, until all commands are answered or the settle time passes
+    uint64_t settleEnd = hostMillis() + options.settleMs;
+    while (!stopRequested && r.pendingCommands > 0 && hostMillis() < settleEnd) {
+        if (!waitUntil(client, hostMillis() + 10)) break;
+    }
+    client.close();
+    r.writer.end();
+
+    if (options.outPath) {
+        FILE* f = fopen(options.outPath, "wb");
+        if (!f || fwrite(out.data(), 1, out.size(), f) != out.size()) {
+            fprintf(stderr, "%s: cannot write\n", options.outPath);
+            if (f) fclose(f);
+            return 1;
+        }
+        fclose(f);
+    }
+
+    TraceReader original = input.reader();
+    TraceReader replayed(out.data(), out.size());
+    printTraceComparison(stdout, "capture", summarizeTrace(original),
+                         "replay", summarizeTrace(replayed));
+    return 0;
+}
+
+int compare(const char* pathA, const char* pathB) {
+    MappedTrace a;
+    MappedTrace b;
+    if (!openTrace(pathA, a) || !openTrace(pathB, b)) return 1;
+
+    TraceReader ra = a.reader();
+    TraceReader rb = b.reader();
+    printTraceComparison(stdout, "a", summarizeTrace(ra), "b", summarizeTrace(rb));
+    return 0;
+}
+
+int info(const char* path) {
+    MappedTrace trace;
+    if (!openTrace(path, trace)) return 1;
+
+    TraceReader reader = trace.reader();
+    printTraceSummary(stdout, summarizeTrace(reader));
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    int files = argc - optind;
+
+    if (options.compare) {
+        if (files != 2) {
+            usage(argv[0]);
+            return 2;
+        }
+        return compare(argv[optind], argv[optind + 1]);
+    }
+    if (files != 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (options.info) {
+        return info(argv[optind]);
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    return replay(options, argv[optind]);
+}